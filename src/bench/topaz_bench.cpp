@@ -0,0 +1,573 @@
+/**
+ * Topaz Benchmark - Codec
+ *
+ * Measures time and heap allocations of atom / datum size, encode, decode,
+ * compare and print over representative workloads: UID-heavy method calls,
+ * Properties responses, a full Locking table dump and large MEDIUM / LONG
+ * byte atoms. Results are printed one JSON object per line (or CSV), so
+ * runs can be compared as the codec changes. Built with TOPAZ_ALLOC, JSON
+ * results also break allocations down by library call site.
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <new>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include <topaz/alloc.h>
+#include <topaz/alloc_new.h>
+#include <topaz/arena.h>
+#include <topaz/datum.h>
+#include <topaz/exceptions.h>
+#include <topaz/uid.h>
+using namespace std;
+using namespace topaz;
+
+////
+// Heap accounting (counted global operator new / delete, from the library
+// itself when built with TOPAZ_ALLOC)
+//
+
+namespace
+{
+  uint64_t allocs_so_far()
+  {
+    return alloc_totals().allocs;
+  }
+
+  uint64_t bytes_so_far()
+  {
+    return alloc_totals().bytes;
+  }
+};
+
+////
+// Workloads
+//
+
+typedef chrono::steady_clock bench_clock;
+
+// Named set of datums, encoded back to back as one stream
+typedef struct
+{
+  string       name;
+  datum_vector items;
+  byte_vector  stream;
+} workload;
+
+// One measured operation over a workload
+typedef struct
+{
+  string   workload;
+  string   op;
+  uint64_t iters;
+  size_t   bytes;        // Encoded size of workload
+  double   ns_per_op;
+  double   mb_per_s;
+  double   allocs_per_op;
+  double   alloc_bytes_per_op;
+  alloc_stats sites[ALLOC_SITES];  // Per call site (TOPAZ_ALLOC builds)
+} bench_result;
+
+// Get[] of a column range on an object
+datum get_call(uint64_t obj_uid, uint64_t first, uint64_t last)
+{
+  datum call;
+  call.object_uid() = obj_uid;
+  call.method_uid() = GET;
+  call[0][0].name()        = atom::new_uint(3);
+  call[0][0].named_value() = atom::new_uint(first);
+  call[0][1].name()        = atom::new_uint(4);
+  call[0][1].named_value() = atom::new_uint(last);
+  return call;
+}
+
+// Set[] of read / write lock on an object
+datum set_call(uint64_t obj_uid, uint64_t lock)
+{
+  datum call;
+  call.object_uid() = obj_uid;
+  call.method_uid() = SET;
+  call[0].name() = atom::new_uint(1);
+  call[0].named_value()[0].name()        = atom::new_uint(7);
+  call[0].named_value()[0].named_value() = atom::new_uint(lock);
+  call[0].named_value()[1].name()        = atom::new_uint(8);
+  call[0].named_value()[1].named_value() = atom::new_uint(lock);
+  return call;
+}
+
+// Named value with string name
+datum named(char const *name, uint64_t val)
+{
+  datum item;
+  item.name() = atom::new_bin(name);
+  item.named_value() = atom::new_uint(val);
+  return item;
+}
+
+// Batched unlock: Gets of every range, then Sets, plus StartSession
+workload uid_calls()
+{
+  workload load;
+  load.name = "uid_calls";
+  for (unsigned i = 0; i <= 8; i++)
+  {
+    load.items.push_back(get_call(i ? LBA_RANGE_BASE + i : LBA_RANGE_GLOBAL, 3, 10));
+  }
+  for (unsigned i = 0; i <= 8; i++)
+  {
+    load.items.push_back(set_call(i ? LBA_RANGE_BASE + i : LBA_RANGE_GLOBAL, 0));
+  }
+
+  datum start;
+  start.object_uid() = SESSION_MGR;
+  start.method_uid() = START_SESSION;
+  start[0] = atom::new_uint(1);
+  start[1] = atom::new_uid(LOCKING_SP);
+  start[2] = atom::new_uint(1);
+  start[3].name()        = atom::new_uint(0);
+  start[3].named_value() = atom::new_bin("0123456789abcdef0123456789abcdef");
+  start[4].name()        = atom::new_uint(3);
+  start[4].named_value() = atom::new_uid(ADMIN_BASE + 1);
+  load.items.push_back(start);
+  return load;
+}
+
+// Bare UID atoms
+workload uid_atoms()
+{
+  workload load;
+  load.name = "uid_atoms";
+  for (unsigned i = 0; i < 64; i++)
+  {
+    load.items.push_back(datum(atom::new_uid(LBA_RANGE_BASE + i)));
+  }
+  return load;
+}
+
+// Properties response, TPer then echoed host properties
+workload properties()
+{
+  static char const *props[] = {
+    "MaxComPacketSize", "MaxResponseComPacketSize", "MaxPacketSize",
+    "MaxIndTokenSize", "MaxPackets", "MaxSubpackets", "MaxMethods",
+    "MaxSessions", "MaxReadSessions", "MaxAuthentications",
+    "MaxTransactionLimit", "DefSessionTimeout", "MaxSessionTimeout",
+    "MinSessionTimeout", "DefTransTimeout", "MaxTransTimeout",
+    "MinTransTimeout", "MaxComIDTime", "ContinuedTokens", "SequenceNumbers",
+    "AckNak", "Asynchronous"
+  };
+  size_t count = sizeof(props) / sizeof(props[0]);
+
+  workload load;
+  load.name = "properties";
+  datum resp;
+  for (size_t i = 0; i < count; i++)
+  {
+    resp[0][i] = named(props[i], 65536 >> (i % 16));
+  }
+  resp[1].name() = atom::new_uint(0);
+  for (size_t i = 0; i < 8; i++)
+  {
+    resp[1].named_value()[i] = named(props[i], 65536 >> i);
+  }
+  load.items.push_back(resp);
+  return load;
+}
+
+// Whole rows of the Locking table, as returned by table_get
+workload locking_table()
+{
+  workload load;
+  load.name = "locking_table";
+  for (unsigned i = 0; i <= 8; i++)
+  {
+    uint64_t uid = (i ? LBA_RANGE_BASE + i : LBA_RANGE_GLOBAL);
+    string name = (i ? "Locking_Range" + to_string(i) : "Locking_GlobalRange");
+    datum row;
+    datum &cols = row[0];
+    unsigned c = 0;
+
+    cols[c].name() = atom::new_uint(0);
+    cols[c++].named_value() = atom::new_uid(uid);
+    cols[c].name() = atom::new_uint(1);
+    cols[c++].named_value() = atom::new_bin(name.c_str());
+    cols[c].name() = atom::new_uint(2);
+    cols[c++].named_value() = atom::new_bin("");
+    for (uint64_t col = 3; col <= 8; col++)
+    {
+      cols[c].name() = atom::new_uint(col);
+      cols[c++].named_value() = atom::new_uint(col < 5 ? i * 0x100000 : 1);
+    }
+    cols[c].name() = atom::new_uint(9);
+    cols[c++].named_value()[0] = atom::new_uint(0);
+    cols[c].name() = atom::new_uint(10);
+    cols[c++].named_value() = atom::new_uid(_UID_MAKE(0x806, 0x30000 + i));
+    for (uint64_t col = 11; col <= 18; col++)
+    {
+      cols[c].name() = atom::new_uint(col);
+      cols[c++].named_value() = atom::new_uint(0);
+    }
+    load.items.push_back(row);
+  }
+  return load;
+}
+
+// Byte atoms of given size, owned or borrowed
+workload bin_atom(char const *name, size_t len, bool borrowed)
+{
+  static vector<topaz::byte> data;
+  workload load;
+  load.name = name;
+  data.resize(max(data.size(), len));
+  for (size_t i = 0; i < len; i++)
+  {
+    data[i] = (topaz::byte)(i * 7);
+  }
+  load.items.push_back(datum(borrowed ? atom::new_bin_ref(&(data[0]), len) :
+			     atom::new_bin(&(data[0]), len)));
+  return load;
+}
+
+// MBR shadow write, Set[] with large Values
+workload mbr_write()
+{
+  static vector<topaz::byte> data(32768, 0x5a);
+  workload load;
+  load.name = "mbr_write";
+  datum call;
+  call.object_uid() = MBR;
+  call.method_uid() = SET;
+  call[0].name() = atom::new_uint(0);
+  call[0].named_value() = atom::new_uint(0);
+  call[1].name() = atom::new_uint(1);
+  call[1].named_value() = atom::new_bin_ref(&(data[0]), data.size());
+  load.items.push_back(call);
+  return load;
+}
+
+////
+// Measurement
+//
+
+// Time fn until min_ms has passed, doubling iterations per batch
+bench_result measure(workload &load, char const *op, double min_ms,
+		     function<void()> const &fn)
+{
+  bench_result res;
+  uint64_t iters = 1, count, bytes;
+  double ns;
+
+  fn(); // warm up
+  while (true)
+  {
+    alloc_reset();
+    count = allocs_so_far();
+    bytes = bytes_so_far();
+    bench_clock::time_point start = bench_clock::now();
+    for (uint64_t i = 0; i < iters; i++)
+    {
+      fn();
+    }
+    ns = chrono::duration<double, nano>(bench_clock::now() - start).count();
+    if ((ns >= min_ms * 1e6) || (iters >= (1ULL << 40)))
+    {
+      break;
+    }
+    iters *= 2;
+  }
+
+  res.workload = load.name;
+  res.op = op;
+  res.iters = iters;
+  res.bytes = load.stream.size();
+  res.ns_per_op = ns / iters;
+  res.mb_per_s = (res.bytes * 1e3) / res.ns_per_op;
+  res.allocs_per_op = (double)(allocs_so_far() - count) / iters;
+  res.alloc_bytes_per_op = (double)(bytes_so_far() - bytes) / iters;
+  for (unsigned i = 0; i < ALLOC_SITES; i++)
+  {
+    res.sites[i] = alloc_site_stats((alloc_site)i);
+  }
+  return res;
+}
+
+// Run selected operations on one workload
+void bench(workload &load, string const &only_op, double min_ms,
+	   vector<bench_result> &results)
+{
+  datum_vector &items = load.items;
+  datum_vector copies(items);
+  byte_vector &stream = load.stream;
+  size_t len = stream.size();
+  arena pool(1 << 20);
+  volatile size_t sink = 0;
+
+  // (name, body) for each operation
+  vector<pair<char const *, function<void()> > > ops;
+  ops.push_back(make_pair("size", [&]()
+  {
+    size_t total = 0;
+    for (size_t i = 0; i < items.size(); i++)
+    {
+      total += items[i].size();
+    }
+    sink = total;
+  }));
+  ops.push_back(make_pair("encode", [&]()
+  {
+    size_t off = 0;
+    for (size_t i = 0; i < items.size(); i++)
+    {
+      off += items[i].encode_bytes(&(stream[off]));
+    }
+    sink = off;
+  }));
+  ops.push_back(make_pair("encode_vector", [&]()
+  {
+    for (size_t i = 0; i < items.size(); i++)
+    {
+      sink = items[i].encode_vector().size();
+    }
+  }));
+  ops.push_back(make_pair("decode", [&]()
+  {
+    size_t off = 0;
+    while (off < len)
+    {
+      datum item;
+      off += item.decode_bytes(&(stream[off]), len - off);
+    }
+    sink = off;
+  }));
+  ops.push_back(make_pair("decode_arena", [&]()
+  {
+    size_t off = 0;
+    while (off < len)
+    {
+      datum item{mem_allocator(&pool)};
+      off += item.decode_bytes(&(stream[off]), len - off);
+    }
+    pool.reset();
+    sink = off;
+  }));
+  ops.push_back(make_pair("compare", [&]()
+  {
+    size_t same = 0;
+    for (size_t i = 0; i < items.size(); i++)
+    {
+      same += (items[i] == copies[i]) ? 1 : 0;
+    }
+    sink = same;
+  }));
+  ops.push_back(make_pair("print", [&]()
+  {
+    for (size_t i = 0; i < items.size(); i++)
+    {
+      items[i].print();
+    }
+  }));
+
+  for (size_t i = 0; i < ops.size(); i++)
+  {
+    if (!only_op.empty() && (only_op != ops[i].first))
+    {
+      continue;
+    }
+
+    // Printing goes to the bit bucket
+    int saved = -1;
+    if (!strcmp(ops[i].first, "print"))
+    {
+      fflush(stdout);
+      saved = dup(STDOUT_FILENO);
+      int null_fd = open("/dev/null", O_WRONLY);
+      dup2(null_fd, STDOUT_FILENO);
+      close(null_fd);
+    }
+
+    bench_result res = measure(load, ops[i].first, min_ms, ops[i].second);
+
+    if (saved != -1)
+    {
+      fflush(stdout);
+      dup2(saved, STDOUT_FILENO);
+      close(saved);
+    }
+    results.push_back(res);
+  }
+}
+
+// Output one result
+void report(bench_result const &res, bool csv)
+{
+  if (csv)
+  {
+    printf("%s,%s,%llu,%zu,%.1f,%.2f,%.2f,%.1f\n",
+	   res.workload.c_str(), res.op.c_str(), (unsigned long long)res.iters,
+	   res.bytes, res.ns_per_op, res.mb_per_s, res.allocs_per_op,
+	   res.alloc_bytes_per_op);
+  }
+  else
+  {
+    printf("{\"workload\":\"%s\",\"op\":\"%s\",\"iters\":%llu,\"bytes\":%zu,"
+	   "\"ns_per_op\":%.1f,\"mb_per_s\":%.2f,\"allocs_per_op\":%.2f,"
+	   "\"alloc_bytes_per_op\":%.1f",
+	   res.workload.c_str(), res.op.c_str(), (unsigned long long)res.iters,
+	   res.bytes, res.ns_per_op, res.mb_per_s, res.allocs_per_op,
+	   res.alloc_bytes_per_op);
+
+    // Call sites the operation went through, per call
+    if (alloc_available())
+    {
+      char const *sep = "";
+      printf(",\"sites\":{");
+      for (unsigned i = 0; i < ALLOC_SITES; i++)
+      {
+	alloc_stats const &site = res.sites[i];
+	if (site.calls)
+	{
+	  printf("%s\"%s\":{\"calls_per_op\":%.2f,\"allocs_per_call\":%.2f,"
+		 "\"bytes_per_call\":%.1f,\"peak\":%llu}", sep, alloc_site_name(i),
+		 (double)site.calls / res.iters, (double)site.allocs / site.calls,
+		 (double)site.bytes / site.calls, (unsigned long long)site.peak);
+	  sep = ",";
+	}
+      }
+      printf("}");
+    }
+    printf("}\n");
+  }
+  fflush(stdout);
+}
+
+void usage()
+{
+  fprintf(stderr,
+	  "\nUsage:\n"
+	  "  topaz_bench [opts] - Codec microbenchmarks\n"
+	  "\n"
+	  "Options:\n"
+	  "  -w <name> - Only this workload (uid_calls, uid_atoms, properties,\n"
+	  "              locking_table, bin_medium, bin_long, bin_long_ref, mbr_write)\n"
+	  "  -o <op>   - Only this operation (size, encode, encode_vector, decode,\n"
+	  "              decode_arena, compare, print)\n"
+	  "  -t <ms>   - Minimum time per measurement (default 200)\n"
+	  "  -c        - CSV output (default one JSON object per line)\n");
+}
+
+int main(int argc, char **argv)
+{
+  string only_load, only_op;
+  double min_ms = 200;
+  bool csv = false;
+  int c;
+
+  opterr = 0;
+  while ((c = getopt(argc, argv, "w:o:t:c")) != -1)
+  {
+    switch (c)
+    {
+      case 'w':
+	only_load = optarg;
+	break;
+
+      case 'o':
+	only_op = optarg;
+	break;
+
+      case 't':
+	min_ms = atof(optarg);
+	break;
+
+      case 'c':
+	csv = true;
+	break;
+
+      default:
+	fprintf(stderr, "Invalid command line option %c\n", (char)optopt);
+	usage();
+	return -1;
+    }
+  }
+
+  try
+  {
+    vector<workload> loads;
+    loads.push_back(uid_calls());
+    loads.push_back(uid_atoms());
+    loads.push_back(properties());
+    loads.push_back(locking_table());
+    loads.push_back(bin_atom("bin_medium", 1536, false));
+    loads.push_back(bin_atom("bin_long", 65536, false));
+    loads.push_back(bin_atom("bin_long_ref", 65536, true));
+    loads.push_back(mbr_write());
+
+    if (csv)
+    {
+      printf("workload,op,iters,bytes,ns_per_op,mb_per_s,allocs_per_op,alloc_bytes_per_op\n");
+    }
+    for (size_t i = 0; i < loads.size(); i++)
+    {
+      workload &load = loads[i];
+      if (!only_load.empty() && (only_load != load.name))
+      {
+	continue;
+      }
+
+      // Reference encoding, also the decode input
+      size_t len = 0;
+      for (size_t j = 0; j < load.items.size(); j++)
+      {
+	len += load.items[j].size();
+      }
+      load.stream.assign(len, 0);
+      for (size_t j = 0, off = 0; j < load.items.size(); j++)
+      {
+	off += load.items[j].encode_bytes(&(load.stream[off]));
+      }
+
+      vector<bench_result> results;
+      bench(load, only_op, min_ms, results);
+      for (size_t j = 0; j < results.size(); j++)
+      {
+	report(results[j], csv);
+      }
+    }
+  }
+  catch (topaz_exception &e)
+  {
+    fprintf(stderr, "Exception raised: %s\n", e.what());
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,161 @@
+/**
+ * Topaz Test - Heap Allocation Accounting
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <topaz/alloc.h>
+#include <topaz/drive.h>
+#include <topaz/exceptions.h>
+#include <topaz/simdrive.h>
+#include <topaz/trace.h>
+#include <topaz/uid.h>
+using namespace std;
+using namespace topaz;
+
+// Global, eh ....
+int test_count = 0;
+
+// Bail out
+void fail(char const *why)
+{
+  printf("*** Failed (%s) ***\n", why);
+  exit(1);
+}
+
+// Nested and re-entered sites
+void check_scopes()
+{
+  printf("Testing scopes ...\n");
+
+  alloc_reset();
+  {
+    alloc_scope outer(ALLOC_INVOKE);
+    {
+      alloc_scope inner(ALLOC_ENCODE);
+      alloc_scope again(ALLOC_ENCODE);
+      char *volatile buf = new char[1000];
+      buf[0] = 0;
+      delete[] buf;
+    }
+    char *volatile buf = new char[10];
+    delete[] buf;
+  }
+
+  alloc_stats invoke = alloc_site_stats(ALLOC_INVOKE);
+  alloc_stats encode = alloc_site_stats(ALLOC_ENCODE);
+  if ((invoke.calls != 1) || (encode.calls != 1))
+  {
+    fail("unexpected call counts");
+  }
+  if (alloc_available() &&
+      ((encode.allocs != 1) || (encode.bytes != 1000) || (encode.frees != 1) ||
+       (encode.peak < 1000) || (invoke.allocs != 2) || (invoke.bytes != 1010) ||
+       (alloc_totals().allocs < 2)))
+  {
+    fail("allocations not attributed");
+  }
+  test_count++;
+}
+
+// Method calls against simulated drive
+void check_drive()
+{
+  printf("Testing drive ...\n");
+
+  simdrive sim;
+  drive target(sim);
+  target.login_anon(ADMIN_SP);
+
+  alloc_reset();
+  for (int i = 0; i < 10; i++)
+  {
+    target.table_get(ADMIN_SP, 6);
+  }
+
+  alloc_stats invoke = alloc_site_stats(ALLOC_INVOKE);
+  alloc_stats sim_tper = alloc_site_stats(ALLOC_SIMULATED);
+  printf("  %s\n", alloc_available() ? "library instrumented" : "library not instrumented");
+  for (unsigned i = 0; i < ALLOC_SITES; i++)
+  {
+    alloc_stats site = alloc_site_stats((alloc_site)i);
+    printf("  %-16s %4lu calls, %5lu allocs, %7lu bytes, peak %lu\n",
+	   alloc_site_name(i), (unsigned long)site.calls, (unsigned long)site.allocs,
+	   (unsigned long)site.bytes, (unsigned long)site.peak);
+  }
+  if (alloc_available() &&
+      ((invoke.calls != 10) || (alloc_site_stats(ALLOC_SEND).calls != 10) ||
+       (alloc_site_stats(ALLOC_DECODE).calls != 10) || !invoke.allocs ||
+       !sim_tper.calls || (invoke.allocs + sim_tper.allocs > alloc_totals().allocs)))
+  {
+    fail("invoke not accounted");
+  }
+  test_count++;
+}
+
+// Each site's counts land in the trace
+void check_trace()
+{
+  vector<trace_event> events;
+  printf("Testing trace ...\n");
+
+  trace_clear();
+  trace_enable(true);
+  {
+    alloc_scope scope(ALLOC_DECODE);
+    vector<int> values(100);
+  }
+  trace_enable(false);
+  trace_snapshot(events);
+
+  if ((events.size() != 1) || (events[0].type != TRACE_ALLOC) ||
+      ((events[0].a >> 32) != ALLOC_DECODE) ||
+      (alloc_available() && (((events[0].a & 0xffffffff) != 1) || (events[0].b != 400))))
+  {
+    fail("unexpected trace event");
+  }
+  test_count++;
+}
+
+int main()
+{
+  try
+  {
+    check_scopes();
+    check_drive();
+    check_trace();
+
+    printf("\n******** %d Tests Passed ********\n\n", test_count);
+  }
+  catch (topaz_exception &e)
+  {
+    printf("Exception raised: %s\n", e.what());
+    return 1;
+  }
+
+  return 0;
+}
@@ -28,6 +28,7 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 #include <inttypes.h>
 #include <topaz/atom.h>
 #include <topaz/exceptions.h>
@@ -80,6 +81,9 @@ char const *atom_enc_to_string(atom::enc_t enc)
     case atom::LONG:
       return "LONG";
       break;
+    case atom::CONTINUED:
+      return "Continued";
+      break;
     default:
       return "Unknown";
       break;
@@ -160,6 +164,14 @@ void test_unsigned(atom::type_t type, atom::enc_t enc, size_t size, uint64_t val
   // Debug
   printf("\nUnsigned Integer: %" PRIu64 " (0x%" PRIx64 ")\n", val, val);
   
+  // Non-throwing accessors
+  atom test = atom::new_uint(val);
+  if ((test.try_get_uint() != val) || test.try_get_int() || test.try_get_uid())
+  {
+    printf("*** Failed (try accessors disagree) ***\n");
+    exit(1);
+  }
+  
   // Check
   check(atom::new_uint(val), type, enc, size);
 }
@@ -191,6 +203,91 @@ void test_binary(atom::enc_t enc, size_t size)
   check(atom::new_bin(raw), atom::BYTES, enc, size);
 }
 
+void test_borrowed(atom::enc_t enc, size_t size)
+{
+  byte_vector raw;
+  
+  // Initialize
+  raw.reserve(size);
+  for (size_t i = 0; i < size; i++)
+  {
+    raw.push_back(0xff & i);
+  }
+  
+  // Debug
+  printf("\nBorrowed Binary Data: %u bytes\n", (unsigned int)size);
+  
+  // Must encode identically to an owned copy
+  atom borrowed = atom::new_bin_ref(raw.data(), raw.size());
+  if ((!borrowed.is_borrowed()) ||
+      (borrowed.encode_vector() != atom::new_bin(raw).encode_vector()))
+  {
+    printf("*** Failed (borrowed encoding differs) ***\n");
+    exit(1);
+  }
+  
+  // Check
+  check(borrowed, atom::BYTES, enc, size);
+}
+
+void test_continued(size_t size)
+{
+  byte_vector raw;
+  size_t segs = 0, seg_bytes = 0;
+  
+  // Initialize
+  raw.reserve(size);
+  for (size_t i = 0; i < size; i++)
+  {
+    raw.push_back(0xff & i);
+  }
+  
+  // Debug
+  printf("\nContinued Binary Data: %u bytes\n", (unsigned int)size);
+  
+  // Too big for a single atom
+  atom test = atom::new_bin_ref(raw.data(), raw.size());
+  byte_vector test_bytes = test.encode_vector();
+  dump(test_bytes);
+  if ((test.get_enc() != atom::CONTINUED) || (test.size() != test_bytes.size()) ||
+      (test_bytes[0] != (atom::LONG_TOK | atom::LONG_BIN | atom::LONG_CONT)))
+  {
+    printf("*** Failed (expected continued long atoms) ***\n");
+    exit(1);
+  }
+  
+  // Stream segments back out without gathering them
+  size_t used = atom::decode_segments(test_bytes.data(), test_bytes.size(),
+				      [&](topaz::byte const *seg, size_t len)
+				      {
+					if (memcmp(seg, raw.data() + seg_bytes, len) != 0)
+					{
+					  printf("*** Failed (segment data differs) ***\n");
+					  exit(1);
+					}
+					segs++;
+					seg_bytes += len;
+				      });
+  printf("Segments: %u\n", (unsigned int)segs);
+  if ((used != test_bytes.size()) || (seg_bytes != size) ||
+      (segs != (size + atom::MAX_SEGMENT - 1) / atom::MAX_SEGMENT))
+  {
+    printf("*** Failed (segment stream differs) ***\n");
+    exit(1);
+  }
+  
+  // Reconstruct atom
+  printf("Testing reconstructed copy ...\n");
+  atom copy;
+  if ((copy.decode_vector(test_bytes) != test_bytes.size()) || (copy != test))
+  {
+    printf("*** Failed (decoded object differs) ***\n");
+    exit(1);
+  }
+  
+  // Bump the counter
+  test_count++;
+}
 
 void test_uid(uint64_t val)
 {
@@ -216,6 +313,68 @@ void test_uid(uint64_t val)
     printf("Decode mismatch!\n");
     exit(1);
   }
+  
+  // Only the UID accessor should answer
+  if ((second.try_get_uid() != val) || second.try_get_uint() || second.try_get_int())
+  {
+    printf("*** Failed (try accessors disagree) ***\n");
+    exit(1);
+  }
+}
+
+// Decode hand built (possibly non-minimal) encodings
+void test_raw(byte_vector raw, atom expect)
+{
+  atom found;
+  
+  // Debug
+  printf("\nRaw Encoding:\n");
+  dump(raw);
+  
+  // Decode
+  found.decode_vector(raw);
+  printf("Atom: ");
+  found.print();
+  printf("\n");
+  
+  // Compare values, not encodings (raw input may be non-minimal)
+  if ((found.get_type() != expect.get_type()) ||
+      ((found.get_type() == atom::BYTES) ?
+       (found.get_string() != expect.get_string()) : (found != expect)))
+  {
+    printf("*** Failed (expected ");
+    expect.print();
+    printf(") ***\n");
+    exit(1);
+  }
+  
+  // Bump the counter
+  test_count++;
+}
+
+// Reserved header bytes must be rejected
+void test_bad_header(uint8_t head)
+{
+  byte_vector raw(4, 0);
+  atom found;
+  
+  // Debug
+  printf("\nBad Header: %02X\n", head);
+  
+  raw[0] = head;
+  try
+  {
+    found.decode_vector(raw);
+  }
+  catch (topaz_exception &e)
+  {
+    printf("Rejected: %s\n", e.what());
+    test_count++;
+    return;
+  }
+  
+  printf("*** Failed (header accepted) ***\n");
+  exit(1);
 }
 
 int main()
@@ -292,7 +451,44 @@ int main()
   
     // Max Long
     test_binary(atom::LONG, 0xffffff);
+    
+    // Continued atoms (split across several long atoms)
+    test_continued(0x1000000);
+    test_continued(2 * atom::MAX_SEGMENT);
+    
+    // Borrowed (non-owning) binary data
+    test_borrowed(atom::SHORT, 0x8);
+    test_borrowed(atom::MEDIUM, 0x7ff);
+    test_borrowed(atom::LONG, 0x10000);
   
+    //////////////////////////////////////////////////////////////////////////////
+    // Raw Header Decoding
+    //
+    
+    // Tiny signed values sign extend
+    test_raw(byte_vector{0x41}, atom::new_int(1));
+    test_raw(byte_vector{0x7f}, atom::new_int(-1));
+    test_raw(byte_vector{0x60}, atom::new_int(-0x20));
+    
+    // Non-minimal widths decode to the same value
+    test_raw(byte_vector{0x84, 0x00, 0x00, 0x01, 0x2a}, atom::new_uint(0x12a));
+    test_raw(byte_vector{0x92, 0xff, 0x7f}, atom::new_int(-129));
+    test_raw(byte_vector{0x98, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xfe, 0xfe},
+	     atom::new_int(-0x102));
+    
+    // Medium and long headers carry their length across header bytes
+    test_raw(byte_vector{0xd0, 0x01, 0xaa}, atom::new_bin(byte_vector{0xaa}));
+    test_raw(byte_vector{0xe2, 0x00, 0x00, 0x01, 0xaa}, atom::new_bin(byte_vector{0xaa}));
+    
+    // Continued byte sequences (sign flag on binary atoms)
+    test_raw(byte_vector{0xb1, 'a', 0xd8, 0x01, 'b', 0xa1, 'c'}, atom::new_bin("abc"));
+    test_raw(byte_vector{0xe3, 0x00, 0x00, 0x01, 'a', 0xa0}, atom::new_bin("a"));
+    
+    // Continued sequences must end in binary data, and non-atom tokens
+    test_bad_header(0xb0);
+    test_bad_header(0xe4);
+    test_bad_header(0xf0);
+    
     //////////////////////////////////////////////////////////////////////////////
     // Misc Types
     //
@@ -0,0 +1,320 @@
+/**
+ * Topaz Test - Freestanding Unlock Core
+ *
+ * Runs the unlock core against a scripted TPer, decoding everything it sends
+ * with the full codec to check both agree on the wire format.
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <endian.h>
+#include <topaz/core.h>
+#include <topaz/datum.h>
+#include <topaz/defs.h>
+#include <topaz/exceptions.h>
+#include <topaz/uid.h>
+using namespace topaz;
+
+// Global, eh ....
+int test_count = 0;
+
+// Scripted TPer state
+struct fake_tper
+{
+  uint16_t com_id;       // Base ComID reported in discovery
+  bool     reset;        // STACK_RESET seen
+  unsigned status;       // Method status for next response
+  unsigned not_ready;    // Polls to answer "no data yet" before responding
+  bool     truncated;    // Discovery ends in a descriptor cut off by the block
+  datum    last;         // Last payload sent to the TPer
+  uint8_t  resp[ATA_BLOCK_SIZE];
+};
+
+// Fill ComPkt headers around a response payload
+void fake_respond(fake_tper *tper, byte_vector const &payload)
+{
+  opal_header_t *header = (opal_header_t*)tper->resp;
+  
+  memset(tper->resp, 0, sizeof(tper->resp));
+  header->com_hdr.com_id = htobe16(tper->com_id);
+  header->com_hdr.length = htobe32(sizeof(opal_packet_header_t) +
+				   sizeof(opal_sub_packet_header_t) + payload.size());
+  header->sub_hdr.length = htobe32(payload.size());
+  memcpy(tper->resp + sizeof(opal_header_t), payload.data(), payload.size());
+}
+
+int fake_if_send(void *ctx, uint8_t proto, uint16_t comid,
+		 void const *data, size_t bcount)
+{
+  fake_tper *tper = (fake_tper*)ctx;
+  opal_header_t const *header = (opal_header_t const*)data;
+  byte const *payload = (byte const*)data + sizeof(opal_header_t);
+  
+  // ComID management
+  if (proto == 2)
+  {
+    tper->reset = true;
+    return 0;
+  }
+  
+  // Decode whatever came in
+  tper->last.decode_bytes(payload, be32toh(header->sub_hdr.length));
+  
+  // Cook up a response
+  byte_vector rsp;
+  if (tper->last.get_type() == datum::END_SESSION)
+  {
+    rsp = tper->last.encode_vector();
+  }
+  else
+  {
+    datum rc;
+    if (tper->last.method_uid() == START_SESSION)
+    {
+      // SyncSession[HostSessionID, SPSessionID]
+      rc.object_uid() = SESSION_MGR;
+      rc.method_uid() = SYNC_SESSION;
+      rc[0].value() = tper->last[0].value();
+      rc[1].value() = atom::new_uint(0x1234);
+    }
+    else if (tper->last.method_uid() == GET)
+    {
+      // [[ReadLockEnabled(5) = "x", ReadLocked(7) = 1, WriteLocked(8) = 0x1234]]
+      rc[0][0].name() = atom::new_uint(5);
+      rc[0][0].named_value() = atom::new_bin("x");
+      rc[0][1].name() = atom::new_uint(7);
+      rc[0][1].named_value() = atom::new_uint(1);
+      rc[0][2].name() = atom::new_uint(8);
+      rc[0][2].named_value() = atom::new_uint(0x1234);
+    }
+    else
+    {
+      rc = datum(datum::LIST);
+    }
+    rsp = rc.encode_vector();
+    
+    // Method status
+    byte tail[] = {datum::TOK_END_OF_DATA, datum::TOK_START_LIST,
+		   (byte)tper->status, 0, 0, datum::TOK_END_LIST};
+    rsp.insert(rsp.end(), tail, tail + sizeof(tail));
+  }
+  fake_respond(tper, rsp);
+  tper->not_ready = 1;
+  
+  return 0;
+}
+
+int fake_if_recv(void *ctx, uint8_t proto, uint16_t comid,
+		 void *data, size_t bcount)
+{
+  fake_tper *tper = (fake_tper*)ctx;
+  uint8_t *block = (uint8_t*)data;
+  
+  memset(block, 0, ATA_BLOCK_SIZE);
+  if ((proto == 1) && (comid == 1) && tper->truncated)
+  {
+    // Level 0 Discovery - vendor padding, then an Opal 2.0 header in the
+    // last 5 bytes of the block (its ComID would lie past the end)
+    level0_header_t *header = (level0_header_t*)block;
+    header->length = htobe32(1024);
+    header->minor_ver = htobe16(1);
+    uint8_t *feat = block + sizeof(level0_header_t);
+    feat[0] = 0xc0;
+    feat[3] = 255;
+    feat += 4 + 255;
+    feat[0] = 0xc0;
+    feat[3] = ATA_BLOCK_SIZE - 5 - (feat - block) - 4;
+    feat += 4 + feat[3];
+    ((level0_feat_t*)feat)->code = htobe16(FEAT_OPAL2);
+    ((level0_feat_t*)feat)->length = 16;
+  }
+  else if ((proto == 1) && (comid == 1))
+  {
+    // Level 0 Discovery - Locking (locked), Opal 2.0
+    level0_header_t *header = (level0_header_t*)block;
+    level0_feat_t *feat = (level0_feat_t*)(block + sizeof(level0_header_t));
+    header->length = htobe32(sizeof(level0_header_t) - 4 +
+			     2 * sizeof(level0_feat_t) + 12 + 16);
+    header->minor_ver = htobe16(1);
+    feat->code = htobe16(FEAT_LOCK);
+    feat->length = 12;
+    ((uint8_t*)(feat + 1))[0] = 0x07;
+    feat = (level0_feat_t*)((uint8_t*)(feat + 1) + 12);
+    feat->code = htobe16(FEAT_OPAL2);
+    feat->length = 16;
+    ((feat_opal2_t*)(feat + 1))->comid_base = htobe16(tper->com_id);
+  }
+  else if (proto == 2)
+  {
+    // STACK_RESET completed
+    opal_comid_resp_t *resp = (opal_comid_resp_t*)block;
+    resp->com_id = htobe16(comid);
+    resp->avail_data = htobe32(4);
+  }
+  else if (tper->not_ready)
+  {
+    // No data yet
+    tper->not_ready--;
+    ((opal_header_t*)block)->com_hdr.com_id = htobe16(tper->com_id);
+  }
+  else
+  {
+    memcpy(block, tper->resp, ATA_BLOCK_SIZE);
+  }
+  
+  return 0;
+}
+
+// Verify a core result
+void check(char const *desc, int rc, int expect)
+{
+  printf("%s: %d\n", desc, rc);
+  if (rc != expect)
+  {
+    printf("*** Failed (expected %d) ***\n", expect);
+    exit(1);
+  }
+  
+  // Bump the counter
+  test_count++;
+}
+
+// Verify the last call seen by the TPer
+void check_sent(fake_tper &tper, datum &expect)
+{
+  printf("Sent: ");
+  tper.last.print();
+  printf("\n");
+  if (tper.last != expect)
+  {
+    printf("*** Failed (expected ");
+    expect.print();
+    printf(") ***\n");
+    exit(1);
+  }
+  
+  // Bump the counter
+  test_count++;
+}
+
+int main()
+{
+  
+  try
+  {
+    fake_tper tper;
+    tper.com_id = 0x7fe;
+    tper.reset = false;
+    tper.status = 0;
+    tper.not_ready = 0;
+    tper.truncated = false;
+    
+    core_io_t io = {&tper, fake_if_send, fake_if_recv, NULL};
+    core unlock(io);
+    core::column_t cols[] = {{7, 0}, {8, 0}};
+    
+    // No session manager calls before discovery
+    check("Early Session", unlock.start_session(LOCKING_SP, 0, NULL, 0), core::ERR_STATE);
+    
+    // Discovery
+    check("Discovery", unlock.discover(), core::OK);
+    if ((unlock.get_com_id() != tper.com_id) || (!unlock.is_locked()) || (!tper.reset))
+    {
+      printf("*** Failed (discovery state) ***\n");
+      exit(1);
+    }
+    
+    // Authenticated session, same call the full library makes
+    check("Start Session", unlock.start_session(LOCKING_SP, USER_BASE + 1, "pass", 4),
+	  core::OK);
+    datum start;
+    start.object_uid() = SESSION_MGR;
+    start.method_uid() = START_SESSION;
+    start[0].value() = atom::new_uint(1);
+    start[1].value() = atom::new_uid(LOCKING_SP);
+    start[2].value() = atom::new_uint(1);
+    start[3].name() = atom::new_uint(0);
+    start[3].named_value() = atom::new_bin("pass");
+    start[4].name() = atom::new_uint(3);
+    start[4].named_value() = atom::new_uid(USER_BASE + 1);
+    check_sent(tper, start);
+    
+    // Unlock global range, both columns in one Set[]
+    check("Set", unlock.set(LBA_RANGE_GLOBAL, cols, 2), core::OK);
+    datum set;
+    set.object_uid() = LBA_RANGE_GLOBAL;
+    set.method_uid() = SET;
+    set[0].name() = atom::new_uint(1);
+    set[0].named_value()[0].name() = atom::new_uint(7);
+    set[0].named_value()[0].named_value() = atom::new_uint(0);
+    set[0].named_value()[1].name() = atom::new_uint(8);
+    set[0].named_value()[1].named_value() = atom::new_uint(0);
+    check_sent(tper, set);
+    
+    // Lock state of a range, other columns stepped over
+    core::column_t state[] = {{8, 0}, {7, 0}};
+    check("Get", unlock.get(LBA_RANGE_BASE + 1, state, 2), core::OK);
+    datum get;
+    get.object_uid() = LBA_RANGE_BASE + 1;
+    get.method_uid() = GET;
+    get[0][0].name() = atom::new_uint(3);
+    get[0][0].named_value() = atom::new_uint(7);
+    get[0][1].name() = atom::new_uint(4);
+    get[0][1].named_value() = atom::new_uint(8);
+    check_sent(tper, get);
+    if ((state[0].val != 0x1234) || (state[1].val != 1))
+    {
+      printf("*** Failed (Get values) ***\n");
+      exit(1);
+    }
+    core::column_t missing[] = {{9, 0}};
+    check("Get (Missing Column)", unlock.get(LBA_RANGE_BASE + 1, missing, 1), core::ERR_PROTO);
+    
+    // Method status passed back as-is
+    tper.status = datum::STA_NOT_AUTHORIZED;
+    check("Set (Denied)", unlock.set(LBA_RANGE_GLOBAL, cols, 2), datum::STA_NOT_AUTHORIZED);
+    
+    // Done
+    check("End Session", unlock.end_session(), core::OK);
+    datum end(datum::END_SESSION);
+    check_sent(tper, end);
+    check("Set (No Session)", unlock.set(LBA_RANGE_GLOBAL, cols, 2), core::ERR_STATE);
+    
+    // Descriptor running past the block is not read
+    tper.truncated = true;
+    core cut(io);
+    check("Discovery (Truncated)", cut.discover(), core::ERR_NO_OPAL);
+    
+    printf("\n******** %d Tests Passed ********\n\n", test_count);
+  }
+  catch (topaz_exception &e)
+  {
+    printf("Exception raised: %s\n", e.what());
+  }
+  
+  return 0;
+}
@@ -28,6 +28,7 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <topaz/arena.h>
 #include <topaz/atom.h>
 #include <topaz/datum.h>
 #include <topaz/exceptions.h>
@@ -125,6 +126,96 @@ void check(datum &test, datum::type_t type, size_t size)
   test_count++;
 }
 
+// Verify decode draws every node from a single arena
+void check_arena(datum &test)
+{
+  byte_vector test_bytes = test.encode_vector();
+  
+  printf("\n");
+  printf("Datum: ");
+  test.print();
+  printf("\nDecoding into arena (no heap fallback) ...\n");
+  
+  // Any allocation past the arena's region would throw
+  arena mem(4096, std::pmr::null_memory_resource());
+  for (int pass = 0; pass < 2; pass++)
+  {
+    {
+      datum copy(&mem);
+      copy.decode_vector(test_bytes);
+      if (test != copy)
+      {
+	printf("*** Failed (decoded object differs) ***\n");
+	exit(1);
+      }
+      
+      // Re-encode from arena
+      if (copy.encode_vector(&mem) != test_bytes)
+      {
+	printf("*** Failed (re-encoded bytes differ) ***\n");
+	exit(1);
+      }
+    }
+    
+    // Second pass reuses the same region
+    mem.reset();
+  }
+  
+  // Bump the counter
+  test_count++;
+}
+
+// Verify moves hand over nested storage rather than copying it
+void check_move(datum &test)
+{
+  topaz::byte const *orig = test[0].named_value()[1].named_value().value().get_bin_data();
+  
+  printf("\n");
+  printf("Datum: ");
+  test.print();
+  printf("\nTesting moved copy ...\n");
+  
+  datum moved(std::move(test));
+  if (moved[0].named_value()[1].named_value().value().get_bin_data() != orig)
+  {
+    printf("*** Failed (move copied nested data) ***\n");
+    exit(1);
+  }
+  
+  // Bump the counter
+  test_count++;
+}
+
+// Verify non-throwing lookup over mixed name types
+void check_find(datum &test)
+{
+  printf("\n");
+  printf("Datum: ");
+  test.print();
+  printf("\nTesting name lookup ...\n");
+  
+  // String names must be skipped, not thrown on
+  datum const *found = test.try_find_by_name(2);
+  if ((found == NULL) || (found->value().try_get_uint() != 5u))
+  {
+    printf("*** Failed (named value not found) ***\n");
+    exit(1);
+  }
+  if ((test.try_find_by_name(9) != NULL) || (test[0].try_find_by_name(2) != NULL))
+  {
+    printf("*** Failed (found missing value) ***\n");
+    exit(1);
+  }
+  if (&test.find_by_name(2) != found)
+  {
+    printf("*** Failed (throwing lookup differs) ***\n");
+    exit(1);
+  }
+  
+  // Bump the counter
+  test_count++;
+}
+
 int main()
 {
   
@@ -154,6 +245,26 @@ int main()
     test.method_uid() = PROPERTIES;
     check(test, datum::METHOD, 21);
     
+    // Nested method call, decoded into arena
+    test = datum();
+    test.object_uid() = LOCKING;
+    test.method_uid() = SET;
+    test[0].name() = atom::new_uint(1);
+    test[0].named_value()[0].name() = atom::new_uint(7);
+    test[0].named_value()[0].named_value() = atom::new_uint(0);
+    test[0].named_value()[1].name() = atom::new_uint(3);
+    test[0].named_value()[1].named_value() = atom::new_bin("Some LBA Range");
+    check_arena(test);
+    check_move(test);
+    
+    // Named values, not all named by uint
+    test = datum();
+    test[0].name() = atom::new_bin("Name");
+    test[0].named_value() = atom::new_bin("Value");
+    test[1].name() = atom::new_uint(2);
+    test[1].named_value() = atom::new_uint(5);
+    check_find(test);
+    
     printf("\n******** %d Tests Passed ********\n\n", test_count);
   }
   catch (topaz_exception &e)
@@ -0,0 +1,299 @@
+/**
+ * Topaz Test - Desired State
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sstream>
+#include <string>
+#include <topaz/desired.h>
+#include <topaz/drive.h>
+#include <topaz/exceptions.h>
+#include <topaz/simdrive.h>
+#include <topaz/uid.h>
+using namespace std;
+using namespace topaz;
+
+// Global, eh ....
+int test_count = 0;
+
+// Policy used throughout (4 objects, 9 cells)
+char const *policy =
+  "# Data partition, locked at power on\n"
+  "range 1 start=2048 length=4096 read_lock_enabled=1 write_lock_enabled=1\n"
+  "range 2 start=8192 length=4096   # not locked\n"
+  "mbr enable=1 done=0\n"
+  "user1 enabled=1\n";
+
+// Bail out
+void fail(char const *why)
+{
+  printf("*** Failed (%s) ***\n", why);
+  exit(1);
+}
+
+// Take ownership and activate Locking SP (Admin1 PIN "owner")
+void take_ownership(simdrive &sim)
+{
+  drive target(sim);
+  target.login(ADMIN_SP, SID, "SIMULATED-MSID");
+  target.table_set(C_PIN_SID, 3, atom::new_bin("owner"));
+  target.invoke(LOCKING_SP, ACTIVATE);
+  target.logout();
+}
+
+// Desired state from text
+desired_state from_text(char const *text)
+{
+  desired_state state;
+  istringstream in(text);
+  state.parse(in, "policy");
+  return state;
+}
+
+// Does document fail to parse, naming the line?
+void expect_bad(char const *text, char const *where)
+{
+  try
+  {
+    from_text(text);
+  }
+  catch (topaz_exception &e)
+  {
+    if (strncmp(e.what(), where, strlen(where)) != 0)
+    {
+      printf("  '%s'\n", e.what());
+      fail("error does not name line");
+    }
+    return;
+  }
+  fail("bad document accepted");
+}
+
+// Documents parse into cells, mistakes are reported by line
+void check_parse()
+{
+  printf("Testing desired state documents ...\n");
+
+  desired_state state = from_text(policy);
+  if (state.size() != 9)
+  {
+    fail("wrong cell count");
+  }
+
+  // Later value of a cell replaces earlier
+  state = from_text("range global read_locked=1\nrange 0 read_locked=0 write_locked=1\n");
+  if (state.size() != 2)
+  {
+    fail("repeated cell not replaced");
+  }
+
+  expect_bad("mbr enable=1\nrange x start=0\n", "policy:2:");
+  expect_bad("lba 1 start=0\n", "policy:1:");
+  expect_bad("range 1 begin=0\n", "policy:1:");
+  expect_bad("user1 enabled=2\n", "policy:1:");
+  expect_bad("\n\nmbr enable\n", "policy:3:");
+  expect_bad("range 1 start=0\nrange global start=0\n", "policy:2:");
+  expect_bad("range 0 length=8\n", "policy:1:");
+  test_count++;
+}
+
+// Out of line drive is brought in line, with one batched read and write
+void check_apply(drive &target)
+{
+  printf("Testing desired state apply ...\n");
+
+  desired_state state = from_text(policy);
+  vector<state_change> changes;
+  io_counters used;
+  {
+    io_scope scope(target, &used);
+    changes = state.apply(target);
+  }
+
+  // Factory ranges are 0, MBR disabled, users disabled - all but done=0
+  if (changes.size() != 8)
+  {
+    fail("wrong change count");
+  }
+  if ((changes[0].label != "policy:2 start") || (changes[0].current.get_uint() != 0) ||
+      (changes[0].desired.get_uint() != 2048))
+  {
+    fail("change not described");
+  }
+
+  // 4 Gets, then a Set per object (each batch fits one ComPkt)
+  if ((used.if_sends != 2) || (used.methods != 8))
+  {
+    printf("  %lu IF-SEND, %lu methods\n", (unsigned long)used.if_sends,
+	   (unsigned long)used.methods);
+    fail("not batched");
+  }
+  if ((target.table_get(LBA_RANGE_BASE + 1, 3).get_uint() != 2048) ||
+      (target.table_get(LBA_RANGE_BASE + 2, 4).get_uint() != 4096) ||
+      (target.table_get(LBA_RANGE_BASE + 1, 6).get_uint() != 1) ||
+      (target.table_get(MBR_CONTROL, 1).get_uint() != 1) ||
+      (target.table_get(USER_BASE + 1, 5).get_uint() != 1))
+  {
+    fail("drive not in desired state");
+  }
+  test_count++;
+}
+
+// Compliant drive costs one read and no writes
+void check_compliant(drive &target)
+{
+  printf("Testing compliant drive ...\n");
+
+  desired_state state = from_text(policy);
+  vector<state_change> changes;
+  io_counters used;
+  {
+    io_scope scope(target, &used);
+    changes = state.apply(target);
+  }
+  if (!changes.empty())
+  {
+    fail("compliant drive changed");
+  }
+  if ((used.if_sends != 1) || (used.methods != 4))
+  {
+    printf("  %lu IF-SEND, %lu methods\n", (unsigned long)used.if_sends,
+	   (unsigned long)used.methods);
+    fail("more than one read");
+  }
+  test_count++;
+}
+
+// Dry run reports drift without fixing it, apply fixes only the drift
+void check_dry_run(drive &target)
+{
+  printf("Testing dry run ...\n");
+
+  desired_state state = from_text(policy);
+  target.table_set(LBA_RANGE_BASE + 2, 4, 1024);
+  target.table_set(USER_BASE + 1, 5, 0);
+
+  vector<state_change> changes = state.apply(target, true);
+  if ((changes.size() != 2) || (changes[0].label != "policy:3 length") ||
+      (changes[0].current.get_uint() != 1024) || (changes[1].label != "policy:5 enabled"))
+  {
+    fail("wrong plan");
+  }
+  if (target.table_get(LBA_RANGE_BASE + 2, 4).get_uint() != 1024)
+  {
+    fail("dry run wrote");
+  }
+
+  // Read, then one Set for each drifted object
+  io_counters used;
+  {
+    io_scope scope(target, &used);
+    changes = state.apply(target);
+  }
+  if ((changes.size() != 2) || (used.methods != 4 + 2))
+  {
+    fail("more than drift written");
+  }
+  if (!state.diff(target).empty())
+  {
+    fail("drift not fixed");
+  }
+  test_count++;
+}
+
+// Same value in a longer encoding is still compliant
+void check_encoding(drive &target)
+{
+  printf("Testing non-minimal encoding ...\n");
+
+  // 0x81 0x00 - zero as a Short atom, kept as sent by the simulated TPer
+  topaz::byte short_zero[] = { 0x81, 0x00 };
+  atom zero;
+  zero.decode_bytes(short_zero, sizeof(short_zero));
+  target.table_set(LBA_RANGE_BASE + 3, 3, zero);
+  target.table_set(MBR_CONTROL, 2, zero);
+
+  desired_state state = from_text("range 3 start=0\nmbr done=0\n");
+  if (!state.diff(target).empty())
+  {
+    fail("same value seen as a change");
+  }
+  test_count++;
+}
+
+// Cells the drive refuses to read name the policy line
+void check_unreadable(drive &target)
+{
+  printf("Testing unreadable object ...\n");
+
+  // Simulated drive has 8 ranges
+  desired_state state = from_text("mbr done=0\nrange 9 start=0\n");
+  try
+  {
+    state.apply(target);
+  }
+  catch (topaz_exception &e)
+  {
+    if (strncmp(e.what(), "policy:2 start: cannot read", 27) != 0)
+    {
+      printf("  '%s'\n", e.what());
+      fail("error does not name cell");
+    }
+    test_count++;
+    return;
+  }
+  fail("unreadable object ignored");
+}
+
+int main()
+{
+  try
+  {
+    simdrive sim;
+    take_ownership(sim);
+
+    drive target(sim);
+    target.login(LOCKING_SP, ADMIN_BASE + 1, "owner");
+
+    check_parse();
+    check_apply(target);
+    check_compliant(target);
+    check_dry_run(target);
+    check_encoding(target);
+    check_unreadable(target);
+
+    printf("\n******** %d Tests Passed ********\n\n", test_count);
+  }
+  catch (topaz_exception &e)
+  {
+    printf("Exception raised: %s\n", e.what());
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,141 @@
+/**
+ * Topaz Test - Fleet Executor
+ *
+ * Runs timed dummy tasks across several fake controllers, checking that the
+ * per-controller cap holds, every device runs once, failures stay with their
+ * device, and controllers proceed in parallel.
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <topaz/exceptions.h>
+#include <topaz/fleet.h>
+using namespace std;
+using namespace topaz;
+
+// Global, eh ....
+int test_count = 0;
+
+// Per controller load seen by tasks
+mutex load_lock;
+map<string, unsigned> load, worst;
+
+// Pretend to do some work on a device
+void busy_task(fleet_result &result)
+{
+  {
+    lock_guard<mutex> guard(load_lock);
+    unsigned now = ++load[result.controller];
+    if (now > worst[result.controller])
+    {
+      worst[result.controller] = now;
+    }
+  }
+  
+  this_thread::sleep_for(chrono::milliseconds(20));
+  
+  {
+    lock_guard<mutex> guard(load_lock);
+    load[result.controller]--;
+  }
+  
+  // One bad apple
+  if (result.path == "/dev/fake7")
+  {
+    throw topaz_exception("Simulated drive failure");
+  }
+  result.note = "done";
+}
+
+int main()
+{
+  // 12 devices over 3 controllers, 2 at a time per controller
+  fleet pool(6, 2);
+  for (int i = 0; i < 12; i++)
+  {
+    char path[32], ctrl[32];
+    snprintf(path, sizeof(path), "/dev/fake%d", i);
+    snprintf(ctrl, sizeof(ctrl), "host%d", i % 3);
+    pool.add(path, ctrl);
+  }
+  
+  vector<fleet_result> results = pool.run_tasks(busy_task);
+  fleet_summary const &sum = pool.summary();
+  
+  // Results
+  for (size_t i = 0; i < results.size(); i++)
+  {
+    printf("%s on %s: %s (worker %u%s, queued %.1f ms)\n", results[i].path.c_str(),
+	   results[i].controller.c_str(),
+	   (results[i].ok ? results[i].note.c_str() : results[i].error.c_str()),
+	   results[i].worker, (results[i].stolen ? ", stolen" : ""), results[i].queue_ms);
+  }
+  printf("Wall %.1f ms, %u ok, %u failed\n", sum.wall_ms, (unsigned)sum.ok,
+	 (unsigned)sum.failed);
+  
+  // Everything ran, failure kept to its device
+  printf("\nTesting results ...\n");
+  if ((results.size() != 12) || (sum.ok != 11) || (sum.failed != 1) ||
+      results[7].ok || (results[7].error != "Simulated drive failure") ||
+      (results[3].note != "done"))
+  {
+    printf("*** Failed (unexpected results) ***\n");
+    exit(1);
+  }
+  test_count++;
+  
+  // Cap held, as seen by both the tasks and the executor
+  printf("Testing controller cap ...\n");
+  for (map<string, unsigned>::iterator it = worst.begin(); it != worst.end(); it++)
+  {
+    if ((it->second > 2) || (sum.peak.at(it->first) != it->second))
+    {
+      printf("*** Failed (%u in flight on %s) ***\n", it->second, it->first.c_str());
+      exit(1);
+    }
+  }
+  test_count++;
+  
+  // Controllers overlap: 4 devices per controller, 2 at a time is two
+  // rounds of 20 ms, versus 240 ms one at a time
+  printf("Testing parallelism ...\n");
+  if (sum.wall_ms > 150)
+  {
+    printf("*** Failed (took %.1f ms) ***\n", sum.wall_ms);
+    exit(1);
+  }
+  test_count++;
+  
+  printf("\n******** %d Tests Passed ********\n\n", test_count);
+  
+  return 0;
+}
@@ -0,0 +1,175 @@
+/**
+ * Topaz Test - Latency Histograms
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+#include <topaz/drive.h>
+#include <topaz/exceptions.h>
+#include <topaz/latency.h>
+#include <topaz/simdrive.h>
+#include <topaz/uid.h>
+using namespace std;
+using namespace topaz;
+
+// Global, eh ....
+int test_count = 0;
+
+// Bail out
+void fail(char const *why)
+{
+  printf("*** Failed (%s) ***\n", why);
+  exit(1);
+}
+
+// Within a bucket's width of expected
+bool near(uint64_t val, uint64_t expect)
+{
+  return (val >= expect) && (val <= expect + expect / 16 + 1);
+}
+
+// Buckets are contiguous, and values land in the right one
+void check_buckets()
+{
+  printf("Testing buckets ...\n");
+
+  uint64_t next = 0;
+  for (unsigned i = 0; i < latency_histogram::BUCKETS; i++)
+  {
+    uint64_t limit = latency_histogram::bucket_limit(i);
+    if ((latency_histogram::bucket_of(next) != i) ||
+	(latency_histogram::bucket_of(limit) != i))
+    {
+      fail("bucket bounds disagree");
+    }
+    next = limit + 1;
+  }
+  if (latency_histogram::bucket_of(UINT64_MAX) != latency_histogram::BUCKETS - 1)
+  {
+    fail("large values not clamped");
+  }
+  test_count++;
+}
+
+// Percentiles from many threads at once
+void check_percentiles()
+{
+  latency_histogram hist;
+  vector<thread> pool;
+  printf("Testing percentiles ...\n");
+
+  // 1 .. 100000, four threads
+  for (unsigned t = 0; t < 4; t++)
+  {
+    pool.push_back(thread([t, &hist]()
+			  {
+			    for (uint64_t v = t + 1; v <= 100000; v += 4)
+			    {
+			      hist.record(v);
+			    }
+			  }));
+  }
+  for (size_t t = 0; t < pool.size(); t++)
+  {
+    pool[t].join();
+  }
+
+  printf("  p50 %lu, p99 %lu, max %lu\n", (unsigned long)hist.percentile(50),
+	 (unsigned long)hist.percentile(99), (unsigned long)hist.max());
+  if ((hist.count() != 100000) || (hist.sum() != 5000050000ull) ||
+      (hist.min() != 1) || (hist.max() != 100000) ||
+      !near(hist.percentile(50), 50000) || !near(hist.percentile(99), 99000) ||
+      (hist.percentile(100) != 100000))
+  {
+    fail("unexpected summary");
+  }
+
+  latency_histogram copy(hist);
+  hist.reset();
+  if (hist.count() || hist.percentile(50) || (copy.count() != 100000))
+  {
+    fail("snapshot / reset");
+  }
+  test_count++;
+}
+
+// Drive splits each call into phases
+void check_drive()
+{
+  printf("Testing drive ...\n");
+
+  simdrive sim;
+  sim.latency().set("Get", 20000);
+  drive target(sim);
+  target.login_anon(ADMIN_SP);
+  target.reset_latency();
+  for (int i = 0; i < 5; i++)
+  {
+    target.table_get(ADMIN_SP, 6);
+  }
+
+  method_latency const *get = target.method_latency().find(GET);
+  if (!get || (get->total.count() != 5) || target.method_latency().find(GENKEY) ||
+      target.command_latency())
+  {
+    fail("calls not counted");
+  }
+  printf("  Get total p50 %.1f ms, think %.1f ms, %.1f polls\n",
+	 get->total.percentile(50) / 1e6, get->think.percentile(50) / 1e6,
+	 target.poll_count().mean());
+
+  // Drive took 20ms, each phase accounts for part of the whole
+  uint64_t parts = (get->encode.sum() + get->transfer.sum() +
+		    get->think.sum() + get->decode.sum());
+  if ((get->think.min() < 20000000) || (target.poll_count().min() < 1) ||
+      (target.poll_latency().count() != 5) || (parts > get->total.sum()) ||
+      (parts + 5 * 1000 < get->total.sum()))
+  {
+    fail("phases don't add up");
+  }
+  test_count++;
+}
+
+int main()
+{
+  try
+  {
+    check_buckets();
+    check_percentiles();
+    check_drive();
+
+    printf("\n******** %d Tests Passed ********\n\n", test_count);
+  }
+  catch (topaz_exception &e)
+  {
+    printf("Exception raised: %s\n", e.what());
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,244 @@
+/**
+ * Topaz Test - Device Lease
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <topaz/drive.h>
+#include <topaz/exceptions.h>
+#include <topaz/lease.h>
+#include <topaz/simdrive.h>
+#include <topaz/uid.h>
+using namespace std;
+using namespace topaz;
+
+// Global, eh ....
+int test_count = 0;
+string lease_dir;
+
+// Bail out
+void fail(char const *why)
+{
+  printf("*** Failed (%s) ***\n", why);
+  exit(1);
+}
+
+// Lease settings for a test
+lease_policy make_policy(lease_mode mode, unsigned wait_ms)
+{
+  lease_policy policy;
+  policy.mode = mode;
+  policy.wait_ms = wait_ms;
+  return policy;
+}
+
+// Can drive still read through its session?
+bool session_alive(drive &target)
+{
+  atom val;
+  try
+  {
+    return target.try_table_get(LBA_RANGE_GLOBAL, 3, val) == datum::STA_SUCCESS;
+  }
+  catch (topaz_exception &e)
+  {
+    return false;
+  }
+}
+
+// PID recorded in lease file
+string lease_file(char const *serial)
+{
+  ifstream in(lease_dir + "/sim-" + serial + ".lock");
+  string pid;
+  in >> pid;
+  return pid;
+}
+
+// Second opener waits, and gives up with the holder named
+void check_wait(simdrive &sim)
+{
+  printf("Testing wait ...\n");
+
+  drive first(sim);
+  if ((first.lease().held() != device_lease::EXCLUSIVE) ||
+      (lease_file("LEASE") != to_string(getpid())))
+  {
+    fail("lease not taken");
+  }
+  first.login(LOCKING_SP, ADMIN_BASE + 1, "owner");
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  try
+  {
+    drive second(sim, make_policy(LEASE_WAIT, 100));
+    fail("lease not waited for");
+  }
+  catch (topaz_exception &e)
+  {
+    if (!strstr(e.what(), to_string(getpid()).c_str()))
+    {
+      fail("holder not named");
+    }
+  }
+  if (chrono::steady_clock::now() - start < chrono::milliseconds(100))
+  {
+    fail("gave up early");
+  }
+  if (!session_alive(first))
+  {
+    fail("waiting clobbered session");
+  }
+  test_count++;
+}
+
+// Waiter gets the lease once the holder is gone
+void check_release(simdrive &sim)
+{
+  printf("Testing release ...\n");
+
+  unique_ptr<drive> first(new drive(sim));
+  thread closer([&first] {
+    this_thread::sleep_for(chrono::milliseconds(150));
+    first.reset();
+  });
+  drive second(sim, make_policy(LEASE_WAIT, 5000));
+  closer.join();
+  if (second.lease().held() != device_lease::EXCLUSIVE)
+  {
+    fail("lease not handed over");
+  }
+  test_count++;
+}
+
+// Sharers leave the holder's session alone, takeover ends it
+void check_share(simdrive &sim)
+{
+  printf("Testing share and takeover ...\n");
+
+  drive first(sim);
+  first.login(LOCKING_SP, ADMIN_BASE + 1, "owner");
+  {
+    drive shared(sim, make_policy(LEASE_SHARE, 0));
+    if (shared.lease().may_reset() || (shared.lease().previous_holder() != getpid()))
+    {
+      fail("share not noticed");
+    }
+  }
+  if (!session_alive(first))
+  {
+    fail("sharer clobbered session");
+  }
+
+  drive taker(sim, make_policy(LEASE_TAKEOVER, 0));
+  if (!taker.lease().may_reset() || (taker.lease().held() != device_lease::NONE))
+  {
+    fail("takeover not noticed");
+  }
+  if (session_alive(first))
+  {
+    fail("session survived takeover");
+  }
+  test_count++;
+}
+
+// Lease cleared on close, drives without identity aren't leased
+void check_misc()
+{
+  printf("Testing lease file and settings ...\n");
+
+  if (lease_file("LEASE") != "")
+  {
+    fail("holder left behind");
+  }
+
+  simdrive anon;
+  drive one(anon), two(anon);
+  if ((one.lease().held() != device_lease::NONE) || !two.lease().may_reset())
+  {
+    fail("anonymous drive leased");
+  }
+
+  setenv("TOPAZ_LEASE", "share", 1);
+  setenv("TOPAZ_LEASE_WAIT_MS", "1234", 1);
+  lease_policy policy;
+  if ((policy.mode != LEASE_SHARE) || (policy.wait_ms != 1234))
+  {
+    fail("settings not taken from environment");
+  }
+  unsetenv("TOPAZ_LEASE");
+  unsetenv("TOPAZ_LEASE_WAIT_MS");
+  test_count++;
+}
+
+int main()
+{
+  char dir[] = "/tmp/test-lease-XXXXXX";
+  if (!mkdtemp(dir))
+  {
+    fail("no lease directory");
+  }
+  lease_dir = dir;
+  setenv("TOPAZ_LEASE_DIR", dir, 1);
+
+  try
+  {
+    sim_config cfg;
+    cfg.serial = "LEASE";
+    simdrive sim(cfg);
+
+    // Take ownership, so sessions can be held
+    {
+      drive target(sim);
+      target.login(ADMIN_SP, SID, "SIMULATED-MSID");
+      target.table_set(C_PIN_SID, 3, atom::new_bin("owner"));
+      target.invoke(LOCKING_SP, ACTIVATE);
+    }
+
+    check_wait(sim);
+    check_release(sim);
+    check_share(sim);
+    check_misc();
+
+    printf("\n******** %d Tests Passed ********\n\n", test_count);
+  }
+  catch (topaz_exception &e)
+  {
+    printf("Exception raised: %s\n", e.what());
+    return 1;
+  }
+
+  string cleanup = lease_dir + "/sim-LEASE.lock";
+  unlink(cleanup.c_str());
+  rmdir(dir);
+  return 0;
+}
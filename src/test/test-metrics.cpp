@@ -0,0 +1,217 @@
+/**
+ * Topaz Test - Metrics Exporter
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <topaz/drive.h>
+#include <topaz/exceptions.h>
+#include <topaz/metrics.h>
+#include <topaz/simdrive.h>
+#include <topaz/uid.h>
+using namespace std;
+using namespace topaz;
+
+// Global, eh ....
+int test_count = 0;
+
+// Bail out
+void fail(char const *why)
+{
+  printf("*** Failed (%s) ***\n", why);
+  exit(1);
+}
+
+// Does text hold line?
+bool has_line(string const &text, string const &line)
+{
+  return text.find(line + "\n") != string::npos;
+}
+
+// Metrics follow drive activity, reading them costs no round trips
+void check_render(simdrive &sim, drive &target, metrics_exporter &metrics)
+{
+  printf("Testing render ...\n");
+
+  // Properties (discovery), StartSession, 3 Gets ok, 1 fails
+  target.login_anon(ADMIN_SP);
+  for (int i = 0; i < 3; i++)
+  {
+    target.table_get(ADMIN_SP, 6);
+  }
+  atom val;
+  if (target.try_table_get(_UID_MAKE(0x205, 0x7777), 6, val) != datum::STA_INVALID_PARAMETER)
+  {
+    fail("expected method failure");
+  }
+
+  sim_stats before = sim.stats();
+  io_counters traffic = target.counters();
+  string text = metrics.render();
+  if ((sim.stats().sends != before.sends) || (sim.stats().recvs != before.recvs) ||
+      (target.counters().if_sends != traffic.if_sends))
+  {
+    fail("render talked to drive");
+  }
+
+  if (!has_line(text, "# TYPE topaz_method_status_total counter") ||
+      !has_line(text, "topaz_locking_supported{device=\"sim0\"} 1") ||
+      !has_line(text, "topaz_locked{device=\"sim0\"} 0") ||
+      !has_line(text, "topaz_session_open{device=\"sim0\"} 1") ||
+      !has_line(text, "topaz_sessions_started_total{device=\"sim0\"} 1") ||
+      !has_line(text, "topaz_method_status_total{device=\"sim0\",status=\"success\"} 5") ||
+      !has_line(text, "topaz_method_status_total{device=\"sim0\",status=\"invalid_parameter\"} 1") ||
+      !has_line(text, "topaz_timeouts_total{device=\"sim0\"} 0") ||
+      !has_line(text, "topaz_invoke_duration_seconds_count{device=\"sim0\",method=\"Get\"} 4") ||
+      !has_line(text, "topaz_invoke_duration_seconds_bucket{device=\"sim0\",method=\"Get\",le=\"+Inf\"} 4") ||
+      (text.find("topaz_max_com_packet_size_bytes{device=\"sim0\"} ") == string::npos))
+  {
+    printf("%s", text.c_str());
+    fail("unexpected metrics");
+  }
+
+  target.logout();
+  if (!has_line(metrics.render(), "topaz_session_open{device=\"sim0\"} 0"))
+  {
+    fail("session still open");
+  }
+  test_count++;
+}
+
+// Textfile collector output
+void check_textfile(metrics_exporter &metrics)
+{
+  printf("Testing textfile ...\n");
+
+  char path[] = "/tmp/topaz-metrics-XXXXXX";
+  close(mkstemp(path));
+  metrics.write_textfile(path);
+
+  ifstream in(path);
+  stringstream text;
+  text << in.rdbuf();
+  unlink(path);
+  if (text.str() != metrics.render())
+  {
+    fail("textfile differs from render");
+  }
+  test_count++;
+}
+
+// Plain HTTP GET, whole response
+string http_get(uint16_t port, char const *target)
+{
+  sockaddr_in sin;
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_port = htons(port);
+  sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (connect(fd, (sockaddr*)&sin, sizeof(sin)) == -1)
+  {
+    fail("cannot connect to metrics server");
+  }
+  string req = string("GET ") + target + " HTTP/1.0\r\nHost: localhost\r\n\r\n";
+  if (write(fd, req.data(), req.size()) != (ssize_t)req.size())
+  {
+    fail("cannot send request");
+  }
+
+  string resp;
+  char buf[4096];
+  ssize_t got;
+  while ((got = read(fd, buf, sizeof(buf))) > 0)
+  {
+    resp.append(buf, got);
+  }
+  close(fd);
+  return resp;
+}
+
+// Scrapes over HTTP on loopback
+void check_server(metrics_exporter &metrics)
+{
+  printf("Testing server ...\n");
+
+  metrics_server server(metrics, 0);
+  thread runner(&metrics_server::run, &server);
+
+  string ok = http_get(server.port(), "/metrics");
+  string missing = http_get(server.port(), "/");
+  server.stop();
+  runner.join();
+
+  size_t body = ok.find("\r\n\r\n");
+  printf("  port %u, %zu bytes\n", server.port(), ok.size());
+  if ((ok.compare(0, 15, "HTTP/1.0 200 OK") != 0) ||
+      (ok.find("Content-Type: text/plain; version=0.0.4") == string::npos) ||
+      (body == string::npos) || (ok.substr(body + 4) != metrics.render()) ||
+      (missing.compare(0, 12, "HTTP/1.0 404") != 0))
+  {
+    fail("unexpected response");
+  }
+  test_count++;
+}
+
+int main()
+{
+  try
+  {
+    simdrive sim;
+    drive target(sim);
+    metrics_exporter metrics;
+    metrics.add("sim0", target);
+
+    check_render(sim, target, metrics);
+    check_textfile(metrics);
+    check_server(metrics);
+
+    metrics.remove("sim0");
+    if (metrics.render().find("sim0") != string::npos)
+    {
+      fail("drive not removed");
+    }
+
+    printf("\n******** %d Tests Passed ********\n\n", test_count);
+  }
+  catch (topaz_exception &e)
+  {
+    printf("Exception raised: %s\n", e.what());
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,342 @@
+/**
+ * Topaz Test - Management Server
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <topaz/drive.h>
+#include <topaz/exceptions.h>
+#include <topaz/mgmt.h>
+#include <topaz/simdrive.h>
+#include <topaz/uid.h>
+using namespace std;
+using namespace topaz;
+
+// Global, eh ....
+int test_count = 0;
+
+// Bail out
+void fail(char const *why)
+{
+  printf("*** Failed (%s) ***\n", why);
+  exit(1);
+}
+
+// Take ownership and activate Locking SP (Admin1 PIN "owner")
+void take_ownership(simdrive &sim)
+{
+  drive target(sim);
+  target.login(ADMIN_SP, SID, "SIMULATED-MSID");
+  target.table_set(C_PIN_SID, 3, atom::new_bin("owner"));
+  target.invoke(LOCKING_SP, ACTIVATE);
+  target.logout();
+}
+
+// Sessions started on drive, as published in metrics
+uint64_t sessions(mgmt_server &server, char const *name)
+{
+  string text = server.metrics().render();
+  string key = string("topaz_sessions_started_total{device=\"") + name + "\"} ";
+  size_t pos = text.find(key);
+  if (pos == string::npos)
+  {
+    fail("no session count");
+  }
+  return strtoull(text.c_str() + pos + key.size(), NULL, 10);
+}
+
+// Answer starts with expected text?
+void expect(mgmt_server &server, string const &request, char const *answer)
+{
+  string got = server.handle(request);
+  if (got.compare(0, strlen(answer), answer) != 0)
+  {
+    printf("  '%s' -> '%s'\n", request.c_str(), got.c_str());
+    fail("unexpected answer");
+  }
+}
+
+// Requests with the same credentials share one session
+void check_warm(mgmt_server &server)
+{
+  printf("Testing warm sessions ...\n");
+
+  uint64_t before = sessions(server, "sim0");
+  expect(server, "lock sim0 admin1 owner 0,1,2", "ok");
+  expect(server, "range sim0 admin1 owner 1", "ok start=0 length=0 read_lock_enabled=0 "
+	 "write_lock_enabled=0 read_locked=1 write_locked=1");
+  expect(server, "unlock sim0 admin1 owner 0,1,2", "ok");
+  expect(server, "setrange sim0 admin1 owner 1 2048 4096", "ok");
+  expect(server, "range sim0 admin1 owner 1", "ok start=2048 length=4096 ");
+  expect(server, "query sim0", "ok locking=1 ");
+  if (server.handle("query sim0").find("session=1") == string::npos)
+  {
+    fail("session not kept");
+  }
+  if (sessions(server, "sim0") != before + 1)
+  {
+    fail("session not reused");
+  }
+
+  // Other credentials, other session (refused StartSession counts too)
+  expect(server, "range sim0 sid owner 0", "err ");
+  expect(server, "range sim0 admin1 owner 0", "ok ");
+  if (sessions(server, "sim0") != before + 3)
+  {
+    fail("unexpected sessions");
+  }
+  test_count++;
+}
+
+// Bad requests are answered, not fatal, and drop the session
+void check_errors(mgmt_server &server)
+{
+  printf("Testing errors ...\n");
+
+  expect(server, "", "err Empty request");
+  expect(server, "frob sim0", "err Unknown request");
+  expect(server, "query nosuch", "err No such drive");
+  expect(server, "lock sim0 admin1 owner", "err Wrong number of arguments");
+  expect(server, "lock sim0 bogus owner 1", "err Unknown authority");
+  expect(server, "lock sim0 admin1 owner x", "err Bad range");
+  expect(server, "lock sim0 admin1 own%zz 1", "err Bad escape");
+  expect(server, "lock sim0 admin1 wrong 1", "err ");
+  if (server.handle("query sim0").find("session=0") == string::npos)
+  {
+    fail("session kept after failure");
+  }
+  expect(server, "lock sim0 admin1 owner 99", "err Range 99");
+  expect(server, "unlock sim0 admin1 owner 1", "ok");
+  test_count++;
+}
+
+// PIN change keeps session, escaped PINs work
+void check_setpin(mgmt_server &server)
+{
+  printf("Testing PIN change ...\n");
+
+  string pin = mgmt_client::escape("new pin%");
+  if (pin != "new%20pin%25")
+  {
+    fail("bad escape");
+  }
+  uint64_t before = sessions(server, "sim0");
+  expect(server, "setpin sim0 admin1 owner admin1 " + pin, "ok");
+  expect(server, "range sim0 admin1 " + pin + " 1", "ok ");
+  if (sessions(server, "sim0") != before)
+  {
+    fail("session not kept over PIN change");
+  }
+  expect(server, "setpin sim0 admin1 " + pin + " sid x", "err ");
+  expect(server, "setpin sim0 admin1 " + pin + " admin1 owner", "ok");
+  expect(server, "logout sim0 admin1 owner", "ok");
+  expect(server, "range sim0 admin1 owner 1", "ok ");
+  test_count++;
+}
+
+// Only the session's authority logs it out
+void check_logout(mgmt_server &server)
+{
+  printf("Testing logout ...\n");
+
+  expect(server, "range sim0 admin1 owner 1", "ok ");
+  expect(server, "logout sim0", "err Wrong number of arguments");
+  expect(server, "logout sim0 admin1 wrong", "err Not the session's");
+  expect(server, "logout sim0 admin2 owner", "err Not the session's");
+  if (server.handle("query sim0").find("session=1") == string::npos)
+  {
+    fail("session ended by other authority");
+  }
+  expect(server, "logout sim0 admin1 owner", "ok");
+  if (server.handle("query sim0").find("session=0") == string::npos)
+  {
+    fail("session kept after logout");
+  }
+  expect(server, "logout sim0 admin1 owner", "ok");
+  test_count++;
+}
+
+// Warm session lost under the server is replaced, once
+void check_retry(mgmt_server &server, simdrive &sim)
+{
+  printf("Testing lost warm session ...\n");
+
+  expect(server, "unlock sim0 admin1 owner 1", "ok");
+  uint64_t before = sessions(server, "sim0");
+  sim.power_cycle();
+  expect(server, "range sim0 admin1 owner 1", "ok ");
+  if (sessions(server, "sim0") != before + 1)
+  {
+    fail("session not started again");
+  }
+
+  // Request errors on a new session aren't retried
+  sim.power_cycle();
+  before = sessions(server, "sim0");
+  expect(server, "lock sim0 admin1 owner 99", "err Range 99");
+  if (sessions(server, "sim0") != before + 1)
+  {
+    fail("failed request retried more than once");
+  }
+  test_count++;
+}
+
+// Idle sessions are closed, or never kept
+void check_idle(simdrive &sim)
+{
+  printf("Testing idle logout ...\n");
+
+  string path = "/tmp/test-mgmt-idle-" + to_string(getpid()) + ".sock";
+  mgmt_policy policy;
+  policy.idle_ms = 0;
+  {
+    mgmt_server server(path, policy);
+    server.add("sim1", sim);
+    expect(server, "unlock sim1 admin1 owner 1", "ok");
+    expect(server, "query sim1", "ok ");
+    if (server.handle("query sim1").find("session=0") == string::npos)
+    {
+      fail("session kept without idle time");
+    }
+  }
+
+  policy.idle_ms = 50;
+  mgmt_server server(path, policy);
+  server.add("sim1", sim);
+  expect(server, "unlock sim1 admin1 owner 1", "ok");
+  server.expire();
+  if (server.handle("query sim1").find("session=1") == string::npos)
+  {
+    fail("session closed early");
+  }
+  this_thread::sleep_for(chrono::milliseconds(100));
+  server.expire();
+  if (server.handle("query sim1").find("session=0") == string::npos)
+  {
+    fail("idle session not closed");
+  }
+  test_count++;
+}
+
+// Clients over the socket, requests to one drive never interleave
+void check_socket(mgmt_server &server, char const *path)
+{
+  printf("Testing socket clients ...\n");
+
+  // PINs cross the socket, owner only
+  struct stat st;
+  if ((stat(path, &st) != 0) || ((st.st_mode & 0777) != 0600))
+  {
+    fail("socket not owner only");
+  }
+
+  thread runner(&mgmt_server::run, &server);
+  int failures = 0;
+  vector<thread> clients;
+  for (int i = 0; i < 4; i++)
+  {
+    clients.push_back(thread([&failures, path, i] {
+      try
+      {
+	mgmt_client client(path);
+	for (int j = 0; j < 10; j++)
+	{
+	  client.call(string(j % 2 ? "unlock" : "lock") + " sim0 admin1 owner " +
+		      to_string(i + 1));
+	}
+	if (client.call("list") != "sim0")
+	{
+	  failures++;
+	}
+      }
+      catch (topaz_exception &e)
+      {
+	printf("  client %d: %s\n", i, e.what());
+	failures++;
+      }
+    }));
+  }
+  for (size_t i = 0; i < clients.size(); i++)
+  {
+    clients[i].join();
+  }
+
+  // Errors come back as exceptions
+  mgmt_client client(path);
+  try
+  {
+    client.call("query nosuch");
+    failures++;
+  }
+  catch (topaz_exception &e)
+  {
+  }
+
+  server.stop();
+  runner.join();
+  if (failures)
+  {
+    fail("client requests failed");
+  }
+  test_count++;
+}
+
+int main()
+{
+  try
+  {
+    simdrive sim0, sim1;
+    take_ownership(sim0);
+    take_ownership(sim1);
+
+    string path = "/tmp/test-mgmt-" + to_string(getpid()) + ".sock";
+    mgmt_server server(path);
+    server.add("sim0", sim0);
+
+    check_warm(server);
+    check_errors(server);
+    check_setpin(server);
+    check_logout(server);
+    check_retry(server, sim0);
+    check_idle(sim1);
+    check_socket(server, path.c_str());
+
+    printf("\n******** %d Tests Passed ********\n\n", test_count);
+  }
+  catch (topaz_exception &e)
+  {
+    printf("Exception raised: %s\n", e.what());
+    return 1;
+  }
+
+  return 0;
+}
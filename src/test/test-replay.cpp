@@ -0,0 +1,218 @@
+/**
+ * Topaz Test - Transport Record and Replay
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <string>
+#include <topaz/drive.h>
+#include <topaz/exceptions.h>
+#include <topaz/record.h>
+#include <topaz/simdrive.h>
+#include <topaz/uid.h>
+using namespace std;
+using namespace topaz;
+
+typedef chrono::steady_clock test_clock;
+
+// Global, eh ....
+int test_count = 0;
+
+// Bail out
+void fail(char const *why)
+{
+  printf("*** Failed (%s) ***\n", why);
+  exit(1);
+}
+
+// Milliseconds since start
+double since_ms(test_clock::time_point start)
+{
+  return chrono::duration<double, milli>(test_clock::now() - start).count();
+}
+
+// Take ownership, activate, erase a range, summarize what the drive said
+string workflow(drive &target)
+{
+  string summary;
+
+  target.login_anon(ADMIN_SP);
+  string msid = target.default_pin();
+  target.login(ADMIN_SP, SID, msid);
+  target.table_set(C_PIN_SID, 3, atom::new_bin("owner"));
+  target.invoke(LOCKING_SP, ACTIVATE);
+  summary += to_string(target.table_get(LOCKING_SP, 6).get_uint()) + " ";
+
+  target.login(LOCKING_SP, ADMIN_BASE + 1, "owner");
+  vector<unsigned> status = target.erase_ranges(vector<uint64_t>(1, LBA_RANGE_BASE + 1));
+  summary += to_string(status[0]) + " ";
+  summary += to_string(target.table_get(LBA_RANGE_BASE + 1, 10).get_uid());
+  return summary;
+}
+
+// Record workflow against simulated drive
+string record(char const *path, double &ms)
+{
+  simdrive sim;
+  sim.latency().set("GenKey", 40000);
+
+  recorder rec(sim, path);
+  test_clock::time_point start = test_clock::now();
+  drive target(rec);
+  string summary = workflow(target);
+  ms = since_ms(start);
+  return summary;
+}
+
+// Recorded trace holds the exchanges, including polls
+void check_record(char const *path, string &expect)
+{
+  double ms;
+  printf("Testing record ...\n");
+
+  expect = record(path, ms);
+  vector<trace_record> trace = load_trace(path);
+  size_t sends = 0, empties = 0;
+  for (size_t i = 0; i < trace.size(); i++)
+  {
+    sends += (trace[i].hdr.flags & TRACE_SEND) ? 1 : 0;
+    empties += (trace[i].hdr.flags & TRACE_EMPTY) ? 1 : 0;
+  }
+  printf("  %zu exchanges, %zu IF-SEND, %zu polls without data, %.1f ms\n",
+	 trace.size(), sends, empties, ms);
+  if (!sends || !empties || (trace[0].hdr.flags & TRACE_SEND))
+  {
+    fail("unexpected trace contents");
+  }
+  test_count++;
+}
+
+// As fast as possible, no drive attached
+void check_replay(char const *path, string const &expect)
+{
+  printf("Testing replay ...\n");
+
+  test_clock::time_point start = test_clock::now();
+  replayer rep(path);
+  {
+    drive target(rep);
+    if (workflow(target) != expect)
+    {
+      fail("replayed results differ");
+    }
+  }
+  double ms = since_ms(start);
+  printf("  %.1f ms\n", ms);
+  if (rep.remaining() || rep.mismatches() || (ms > 30))
+  {
+    fail("replay not exact or not fast");
+  }
+
+  // Same through a device path
+  drive target(("replay:" + string(path)).c_str());
+  if (workflow(target) != expect)
+  {
+    fail("replay by path differs");
+  }
+  test_count++;
+}
+
+// At recorded timing
+void check_timed(char const *path, string const &expect)
+{
+  printf("Testing timed replay ...\n");
+
+  test_clock::time_point start = test_clock::now();
+  replayer rep(path, true);
+  drive target(rep);
+  if (workflow(target) != expect)
+  {
+    fail("replayed results differ");
+  }
+  double ms = since_ms(start);
+  printf("  %.1f ms\n", ms);
+  if (ms < 40)
+  {
+    fail("recorded drive time not honored");
+  }
+  test_count++;
+}
+
+// Host doing something else is caught
+void check_diverge(char const *path)
+{
+  printf("Testing divergence ...\n");
+
+  replayer rep(path);
+  drive target(rep);
+  target.login_anon(ADMIN_SP);
+  try
+  {
+    target.login(LOCKING_SP, ADMIN_BASE + 1, "owner");
+    target.table_get(LBA_RANGE_GLOBAL, 3);
+    target.table_get(LBA_RANGE_GLOBAL, 4);
+  }
+  catch (topaz_exception &e)
+  {
+    if (rep.mismatches() == 0)
+    {
+      fail("changed payloads not counted");
+    }
+    test_count++;
+    return;
+  }
+  fail("divergence not caught");
+}
+
+int main()
+{
+  char path[] = "/tmp/topaz-trace-XXXXXX";
+  int fd = mkstemp(path);
+  close(fd);
+
+  try
+  {
+    string expect;
+    check_record(path, expect);
+    check_replay(path, expect);
+    check_timed(path, expect);
+    check_diverge(path);
+    unlink(path);
+
+    printf("\n******** %d Tests Passed ********\n\n", test_count);
+  }
+  catch (topaz_exception &e)
+  {
+    unlink(path);
+    printf("Exception raised: %s\n", e.what());
+    return 1;
+  }
+
+  return 0;
+}
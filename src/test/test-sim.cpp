@@ -0,0 +1,517 @@
+/**
+ * Topaz Test - Simulated Drive
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <topaz/batch.h>
+#include <topaz/core.h>
+#include <topaz/drive.h>
+#include <topaz/exceptions.h>
+#include <topaz/simdrive.h>
+#include <topaz/uid.h>
+using namespace std;
+using namespace topaz;
+
+// Global, eh ....
+int test_count = 0;
+
+// Bail out
+void fail(char const *why)
+{
+  printf("*** Failed (%s) ***\n", why);
+  exit(1);
+}
+
+// Does login succeed?
+bool try_login(drive &target, uint64_t sp_uid, uint64_t auth_uid, char const *pin)
+{
+  try
+  {
+    target.login(sp_uid, auth_uid, pin);
+  }
+  catch (topaz_exception &e)
+  {
+    return false;
+  }
+  return true;
+}
+
+// Get[] call for one column of an object
+datum get_call(uint64_t obj_uid, uint64_t col)
+{
+  datum call;
+  call.object_uid() = obj_uid;
+  call.method_uid() = GET;
+  call[0][0].name()        = atom::new_uint(3);
+  call[0][0].named_value() = atom::new_uint(col);
+  call[0][1].name()        = atom::new_uint(4);
+  call[0][1].named_value() = atom::new_uint(col);
+  return call;
+}
+
+// Take ownership and activate Locking SP, leaving Admin1 logged in
+void check_ownership(simdrive &sim, drive &target)
+{
+  printf("\nTesting ownership ...\n");
+
+  // MSID readable anonymously, and is the initial SID PIN
+  target.login_anon(ADMIN_SP);
+  if (target.default_pin() != "SIMULATED-MSID")
+  {
+    fail("unexpected MSID");
+  }
+  if (try_login(target, ADMIN_SP, SID, "wrong"))
+  {
+    fail("login with bad PIN");
+  }
+  if (!try_login(target, ADMIN_SP, SID, "SIMULATED-MSID"))
+  {
+    fail("login with MSID");
+  }
+  target.table_set(C_PIN_SID, 3, atom::new_bin("owner"));
+  if (!try_login(target, ADMIN_SP, SID, "owner"))
+  {
+    fail("login with new SID PIN");
+  }
+
+  // Activate, Admin1 inherits SID PIN
+  if (target.table_get(LOCKING_SP, 6).get_uint() != 8)
+  {
+    fail("Locking SP not inactive");
+  }
+  target.invoke(LOCKING_SP, ACTIVATE);
+  if (target.table_get(LOCKING_SP, 6).get_uint() != 9)
+  {
+    fail("Locking SP not active");
+  }
+  if (!try_login(target, LOCKING_SP, ADMIN_BASE + 1, "owner"))
+  {
+    fail("login as Admin1");
+  }
+  test_count++;
+}
+
+// Lock on reset, then unlock
+void check_locking(simdrive &sim, drive &target)
+{
+  printf("Testing locking ranges ...\n");
+
+  target.table_set(LBA_RANGE_BASE + 1, 3, 2048);
+  target.table_set(LBA_RANGE_BASE + 1, 4, 4096);
+  target.table_set(LBA_RANGE_BASE + 1, 5, 1);
+  target.table_set(LBA_RANGE_BASE + 1, 6, 1);
+
+  // Power cycle locks it, and drops the session
+  sim.power_cycle();
+
+  // Pre-boot unlock core reads range count and lock state
+  core unlock(sim.get_core_io());
+  core::column_t max_ranges[] = {{4, 0}};
+  core::column_t state[] = {{7, 0}, {8, 0}};
+  if ((unlock.discover() != core::OK) || !unlock.is_locked() ||
+      (unlock.start_session(LOCKING_SP, ADMIN_BASE + 1, "owner", 5) != core::OK) ||
+      (unlock.get(LOCKINGINFO, max_ranges, 1) != core::OK) || (max_ranges[0].val != 8) ||
+      (unlock.get(LBA_RANGE_BASE + 1, state, 2) != core::OK) ||
+      (state[0].val != 1) || (state[1].val != 1))
+  {
+    fail("core does not see locked range");
+  }
+  unlock.end_session();
+
+  target.login(LOCKING_SP, ADMIN_BASE + 1, "owner");
+  if ((target.table_get(LBA_RANGE_BASE + 1, 7).get_uint() != 1) ||
+      (target.table_get(LBA_RANGE_BASE + 1, 8).get_uint() != 1) ||
+      (target.table_get(LBA_RANGE_BASE + 1, 4).get_uint() != 4096))
+  {
+    fail("range not locked after power cycle");
+  }
+  target.table_set(LBA_RANGE_BASE + 1, 7, 0);
+  target.table_set(LBA_RANGE_BASE + 1, 8, 0);
+  if (target.table_get(LBA_RANGE_BASE + 1, 7).get_uint() != 0)
+  {
+    fail("range not unlocked");
+  }
+
+  // PINs never read back
+  atom pin;
+  if (target.try_table_get(C_PIN_ADMIN_BASE + 1, 3, pin) ||
+      (pin.get_type() != atom::EMPTY))
+  {
+    fail("PIN readable");
+  }
+  test_count++;
+}
+
+// Several calls per ComPkt, TPer stops at first failure
+void check_batch(simdrive &sim, drive &target)
+{
+  printf("Testing batched calls ...\n");
+
+  datum_vector calls, results;
+  for (unsigned i = 1; i <= 4; i++)
+  {
+    calls.push_back(get_call(LBA_RANGE_BASE + i, 10));
+  }
+  sim.reset_stats();
+  vector<unsigned> status = target.invoke_batch(std::move(calls), results);
+  if ((sim.stats().packets != 1) || (sim.stats().methods != 4) || (status.size() != 4))
+  {
+    fail("calls not batched");
+  }
+  for (unsigned i = 0; i < 4; i++)
+  {
+    if (status[i] || (results[i][0].find_by_name(10).value().get_uid() !=
+		      _UID_MAKE(0x806, 0x30001 + i)))
+    {
+      fail("unexpected batch result");
+    }
+  }
+
+  // Middle call fails, last one never runs
+  calls.clear();
+  calls.push_back(get_call(LBA_RANGE_GLOBAL, 3));
+  calls.push_back(get_call(_UID_MAKE(0x802, 0x7777), 3));
+  calls.push_back(get_call(LBA_RANGE_GLOBAL, 4));
+  status = target.invoke_batch(std::move(calls), results);
+  if ((status[0] != datum::STA_SUCCESS) || (status[1] != datum::STA_INVALID_PARAMETER) ||
+      (status[2] != drive::STA_INCOMPLETE))
+  {
+    fail("unexpected status after failed call");
+  }
+  test_count++;
+}
+
+// Unlocking every range fits a round trip budget
+void check_budget(simdrive &sim, drive &target)
+{
+  printf("Testing round trip budget ...\n");
+
+  // Locking.Set[] ReadLocked / WriteLocked, global range and eight more
+  datum_vector calls, results;
+  for (unsigned i = 0; i <= 8; i++)
+  {
+    datum call;
+    call.object_uid() = (i ? LBA_RANGE_BASE + i : LBA_RANGE_GLOBAL);
+    call.method_uid() = SET;
+    call[0].name() = atom::new_uint(1);
+    call[0].named_value()[0].name()        = atom::new_uint(7);
+    call[0].named_value()[0].named_value() = atom::new_uint(0);
+    call[0].named_value()[1].name()        = atom::new_uint(8);
+    call[0].named_value()[1].named_value() = atom::new_uint(0);
+    calls.push_back(std::move(call));
+  }
+
+  // Login, then 9 calls at 8 per ComPkt
+  target.logout();
+  io_counters used;
+  {
+    io_scope scope(target, &used);
+    target.login(LOCKING_SP, ADMIN_BASE + 1, "owner");
+    vector<unsigned> status = target.invoke_batch(std::move(calls), results);
+    for (size_t i = 0; i < status.size(); i++)
+    {
+      if (status[i])
+      {
+	fail("range not unlocked");
+      }
+    }
+  }
+  printf("  %lu IF-SEND, %lu IF-RECV (%lu polls), %lu / %lu bytes\n",
+	 (unsigned long)used.if_sends, (unsigned long)used.if_recvs,
+	 (unsigned long)used.polls, (unsigned long)used.bytes_sent,
+	 (unsigned long)used.bytes_recv);
+  if ((used.if_sends > 3) || (used.sessions != 1) || (used.methods != 10) ||
+      (used.if_recvs < used.if_sends) || !used.bytes_sent || !used.bytes_recv)
+  {
+    fail("round trip budget exceeded");
+  }
+
+  // Counters start over on reset
+  target.reset_counters();
+  if (target.counters().if_sends || target.counters().bytes_recv)
+  {
+    fail("counters not reset");
+  }
+  test_count++;
+}
+
+// Queued Sets merge per object, keep order around other calls, and fail by label
+void check_call_batch(simdrive &sim, drive &target)
+{
+  printf("Testing call batch ...\n");
+
+  call_batch batch(target);
+  batch.set(LBA_RANGE_BASE + 2, 3, 100, "a");
+  batch.set(LBA_RANGE_BASE + 2, 4, 200, "a");
+  batch.set(LBA_RANGE_BASE + 3, 3, 300, "b");
+  batch.set(LBA_RANGE_BASE + 2, 4, 50, "c");
+  if (batch.size() != 2)
+  {
+    fail("sets not merged");
+  }
+  sim.reset_stats();
+  batch.flush();
+  if ((sim.stats().methods != 2) || (sim.stats().packets != 1))
+  {
+    fail("batch not sent in one ComPkt");
+  }
+  if ((target.table_get(LBA_RANGE_BASE + 2, 3).get_uint() != 100) ||
+      (target.table_get(LBA_RANGE_BASE + 2, 4).get_uint() != 50) ||
+      (target.table_get(LBA_RANGE_BASE + 3, 3).get_uint() != 300))
+  {
+    fail("batched sets not applied");
+  }
+
+  // Set after another call stays after it
+  batch.set(LBA_RANGE_BASE + 2, 3, 1, "d");
+  batch.call(get_call(LBA_RANGE_BASE + 2, 3), "e");
+  batch.set(LBA_RANGE_BASE + 2, 3, 2, "f");
+  if (batch.size() != 3)
+  {
+    fail("set merged past call");
+  }
+  batch.flush();
+  if (target.table_get(LBA_RANGE_BASE + 2, 3).get_uint() != 2)
+  {
+    fail("batch out of order");
+  }
+
+  // Failures name the request, batch starts over
+  batch.set(LBA_RANGE_BASE + 99, 7, 1, "line 9");
+  try
+  {
+    batch.flush();
+    fail("bad set accepted");
+  }
+  catch (topaz_exception &e)
+  {
+    if (!strstr(e.what(), "line 9"))
+    {
+      fail("failure not labelled");
+    }
+  }
+  if (batch.size())
+  {
+    fail("batch not emptied");
+  }
+
+  // Back as we found them
+  for (unsigned i = 2; i <= 3; i++)
+  {
+    batch.set(LBA_RANGE_BASE + i, 3, 0);
+    batch.set(LBA_RANGE_BASE + i, 4, 0);
+  }
+  batch.flush();
+  test_count++;
+}
+
+// All ranges erased in a handful of round trips
+void check_erase(simdrive &sim, drive &target)
+{
+  printf("Testing multi-range erase ...\n");
+
+  vector<uint64_t> ranges;
+  vector<uint64_t> before;
+  ranges.push_back(LBA_RANGE_GLOBAL);
+  before.push_back(sim.key_generation(_UID_MAKE(0x806, 0x1)));
+  for (unsigned i = 1; i <= 8; i++)
+  {
+    ranges.push_back(LBA_RANGE_BASE + i);
+    before.push_back(sim.key_generation(_UID_MAKE(0x806, 0x30000 + i)));
+  }
+
+  // 9 Gets and 9 GenKeys at 8 methods per ComPkt
+  sim.reset_stats();
+  vector<unsigned> status = target.erase_ranges(ranges);
+  printf("  %u ComPkts, %u methods\n", (unsigned)sim.stats().packets,
+	 (unsigned)sim.stats().methods);
+  if ((sim.stats().packets != 4) || (sim.stats().methods != 18))
+  {
+    fail("unexpected round trips");
+  }
+  for (unsigned i = 0; i <= 8; i++)
+  {
+    uint64_t key = (i ? _UID_MAKE(0x806, 0x30000 + i) : _UID_MAKE(0x806, 0x1));
+    if (status[i] || (sim.key_generation(key) != before[i] + 1))
+    {
+      fail("key not regenerated");
+    }
+  }
+
+  // A range without a key fails alone
+  ranges.assign(1, LBA_RANGE_BASE + 2);
+  ranges.push_back(LBA_RANGE_BASE + 3);
+  ranges.push_back(LBA_RANGE_BASE + 4);
+  uint64_t key3 = target.table_get(LBA_RANGE_BASE + 3, 10).get_uid();
+  uint64_t gen2 = sim.key_generation(_UID_MAKE(0x806, 0x30002));
+  uint64_t gen4 = sim.key_generation(_UID_MAKE(0x806, 0x30004));
+  target.table_set(LBA_RANGE_BASE + 3, 10, 0);
+  status = target.erase_ranges(ranges);
+  target.table_set(LBA_RANGE_BASE + 3, 10, atom::new_uid(key3));
+  if ((status[0] != 0) || (status[1] != drive::STA_NO_KEY) || (status[2] != 0) ||
+      (sim.key_generation(_UID_MAKE(0x806, 0x30002)) != gen2 + 1) ||
+      (sim.key_generation(_UID_MAKE(0x806, 0x30004)) != gen4 + 1))
+  {
+    fail("missing key stopped other ranges");
+  }
+  test_count++;
+}
+
+// Deadline missed on slow key generation, drive still usable after
+void check_deadline(simdrive &sim, drive &target)
+{
+  printf("Testing erase deadline ...\n");
+
+  vector<uint64_t> ranges(1, LBA_RANGE_BASE + 2);
+  sim.latency().set("GenKey", 200000);
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  vector<unsigned> status = target.erase_ranges(ranges, 20);
+  double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+  printf("  gave up after %.1f ms\n", ms);
+  if ((status[0] != drive::STA_INCOMPLETE) || (ms > 150))
+  {
+    fail("deadline not honored");
+  }
+
+  // Session gone, but login works again
+  sim.latency().set("GenKey", 0);
+  if (!try_login(target, LOCKING_SP, ADMIN_BASE + 1, "owner"))
+  {
+    fail("login after missed deadline");
+  }
+  test_count++;
+}
+
+// Shadow MBR byte table, read back larger than one block
+void check_mbr(simdrive &sim, drive &target)
+{
+  printf("Testing MBR table ...\n");
+
+  vector<uint8_t> image(100000);
+  for (size_t i = 0; i < image.size(); i++)
+  {
+    image[i] = (uint8_t)(i * 7);
+  }
+  target.table_set_bin(MBR, 0, &(image[0]), image.size());
+  if (memcmp(&(sim.mbr_data()[0]), &(image[0]), image.size()) != 0)
+  {
+    fail("MBR contents differ");
+  }
+
+  // Get[startRow, endRow] response spans several blocks
+  datum params;
+  params[0][0].name()        = atom::new_uint(1);
+  params[0][0].named_value() = atom::new_uint(1000);
+  params[0][1].name()        = atom::new_uint(2);
+  params[0][1].named_value() = atom::new_uint(2999);
+  datum rc = target.invoke(MBR, GET, std::move(params));
+  if ((rc[0].value().get_bin_size() != 2000) ||
+      memcmp(rc[0].value().get_bin_data(), &(image[1000]), 2000))
+  {
+    fail("MBR read back differs");
+  }
+  test_count++;
+}
+
+// Latency profile replays samples in order
+void check_profile()
+{
+  printf("Testing latency profile ...\n");
+
+  char path[] = "/tmp/topaz-sim-XXXXXX";
+  int fd = mkstemp(path);
+  FILE *fp = fdopen(fd, "w");
+  fprintf(fp, "# measured\nGenKey 300 100 200\ndefault 5\n");
+  fclose(fp);
+
+  sim_latency lat;
+  lat.load(path);
+  unlink(path);
+  if ((lat.next("GenKey") != 300) || (lat.next("GenKey") != 100) ||
+      (lat.next("GenKey") != 200) || (lat.next("GenKey") != 300) ||
+      (lat.next("Get") != 5))
+  {
+    fail("profile not replayed");
+  }
+  test_count++;
+}
+
+// PSID revert back to factory
+void check_revert(simdrive &sim, drive &target)
+{
+  printf("Testing PSID revert ...\n");
+
+  target.login(ADMIN_SP, PSID, "SIMULATED-PSID");
+  target.admin_sp_revert();
+  if (!try_login(target, ADMIN_SP, SID, "SIMULATED-MSID") ||
+      (target.table_get(LOCKING_SP, 6).get_uint() != 8) ||
+      try_login(target, LOCKING_SP, ADMIN_BASE + 1, "owner"))
+  {
+    fail("not back to factory state");
+  }
+  test_count++;
+}
+
+int main()
+{
+  try
+  {
+    simdrive sim;
+    drive target(sim);
+
+    // Discovery matched simulated shape
+    printf("Testing discovery ...\n");
+    if ((target.get_max_admins() != 4) || (target.get_max_users() != 8))
+    {
+      fail("unexpected discovery");
+    }
+    test_count++;
+
+    check_ownership(sim, target);
+    check_locking(sim, target);
+    check_batch(sim, target);
+    check_budget(sim, target);
+    check_call_batch(sim, target);
+    check_erase(sim, target);
+    check_deadline(sim, target);
+    check_mbr(sim, target);
+    check_profile();
+    check_revert(sim, target);
+
+    printf("\n******** %d Tests Passed ********\n\n", test_count);
+  }
+  catch (topaz_exception &e)
+  {
+    printf("Exception raised: %s\n", e.what());
+    return 1;
+  }
+
+  return 0;
+}
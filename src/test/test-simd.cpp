@@ -0,0 +1,305 @@
+/**
+ * Topaz Test - Simulated Drives over Unix Socket
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <string>
+#include <topaz/drive.h>
+#include <topaz/exceptions.h>
+#include <topaz/fleet.h>
+#include <topaz/simsock.h>
+#include <topaz/uid.h>
+using namespace std;
+using namespace topaz;
+
+// Global, eh ....
+int test_count = 0;
+string sock_path;
+
+// Bail out
+void fail(char const *why)
+{
+  printf("*** Failed (%s) ***\n", why);
+  exit(1);
+}
+
+// Remove directory and the files in it
+void remove_dir(char const *path)
+{
+  DIR *dir = opendir(path);
+  struct dirent *entry;
+  while (dir && (entry = readdir(dir)))
+  {
+    if (entry->d_name[0] != '.')
+    {
+      unlink((string(path) + "/" + entry->d_name).c_str());
+    }
+  }
+  if (dir)
+  {
+    closedir(dir);
+  }
+  rmdir(path);
+}
+
+// Device path of simulated drive
+string sim_path(unsigned index)
+{
+  return "sim:" + sock_path + "#" + to_string(index);
+}
+
+// Does opening the path fail?
+bool open_fails(string const &path)
+{
+  try
+  {
+    drive target(path.c_str());
+  }
+  catch (topaz_exception &e)
+  {
+    return true;
+  }
+  return false;
+}
+
+// Does login succeed?
+bool try_login(drive &target, uint64_t sp_uid, uint64_t auth_uid, char const *pin)
+{
+  try
+  {
+    target.login(sp_uid, auth_uid, pin);
+  }
+  catch (topaz_exception &e)
+  {
+    return false;
+  }
+  return true;
+}
+
+// Device paths select the socket transport
+void check_open()
+{
+  printf("Testing device paths ...\n");
+
+  drive target(sim_path(0).c_str());
+  if ((target.get_max_admins() != 4) || (target.get_max_users() != 8))
+  {
+    fail("unexpected discovery");
+  }
+  if (!open_fails(sim_path(99)) || !open_fails("sim:" + sock_path + "#x") ||
+      !open_fails("sim:/nonexistent/tper.sock"))
+  {
+    fail("bad simulated drive path accepted");
+  }
+  test_count++;
+}
+
+// Size of file, 0 if missing
+off_t file_size(string const &path)
+{
+  struct stat info;
+  return (stat(path.c_str(), &info) == 0 ? info.st_size : 0);
+}
+
+// Drives recorded by one process each get their own trace
+void check_record()
+{
+  printf("Testing recording of several drives ...\n");
+
+  string trace = "/tmp/topaz-test-simd." + to_string(getpid()) + ".trace";
+  setenv("TOPAZ_RECORD", trace.c_str(), 1);
+  {
+    drive first(sim_path(2).c_str()), second(sim_path(3).c_str());
+  }
+  unsetenv("TOPAZ_RECORD");
+
+  off_t size0 = file_size(trace), size1 = file_size(trace + ".1");
+  unlink(trace.c_str());
+  unlink((trace + ".1").c_str());
+  if ((size0 == 0) || (size1 == 0))
+  {
+    fail("trace overwritten");
+  }
+  test_count++;
+}
+
+// Each drive on the server keeps its own state
+void check_independent()
+{
+  printf("Testing independent drives ...\n");
+
+  {
+    drive target(sim_path(0).c_str());
+    target.login(ADMIN_SP, SID, "SIMULATED-MSID");
+    target.table_set(C_PIN_SID, 3, atom::new_bin("owner"));
+  }
+
+  drive first(sim_path(0).c_str()), second(sim_path(1).c_str());
+  if (try_login(first, ADMIN_SP, SID, "SIMULATED-MSID") ||
+      !try_login(first, ADMIN_SP, SID, "owner") ||
+      !try_login(second, ADMIN_SP, SID, "SIMULATED-MSID"))
+  {
+    fail("drives share state");
+  }
+  test_count++;
+}
+
+// Another process opening the drive waits for our lease, unless taking over
+void check_collision()
+{
+  printf("Testing session collision between processes ...\n");
+
+  drive target(sim_path(2).c_str());
+  target.login(ADMIN_SP, SID, "SIMULATED-MSID");
+  target.table_get(LOCKING_SP, 6);
+
+  // Second tool waits for the lease, then gives up (exit 2), leaving the
+  // session alone; told to take over, it resets the ComID
+  for (int takeover = 0; takeover < 2; takeover++)
+  {
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      lease_policy policy;
+      policy.mode = (takeover ? LEASE_TAKEOVER : LEASE_WAIT);
+      policy.wait_ms = 100;
+      try
+      {
+	drive other(sim_path(2).c_str(), policy);
+      }
+      catch (topaz_exception &e)
+      {
+	_exit(strstr(e.what(), "in use") ? 2 : 1);
+      }
+      _exit(0);
+    }
+    int status;
+    if ((pid == -1) || (waitpid(pid, &status, 0) != pid) || !WIFEXITED(status) ||
+	(WEXITSTATUS(status) != (takeover ? 0 : 2)))
+    {
+      fail(takeover ? "second process could not take over drive"
+	   : "second process did not wait for lease");
+    }
+
+    atom val;
+    bool alive = (target.try_table_get(LOCKING_SP, 6, val) == datum::STA_SUCCESS);
+    if (!takeover && !alive)
+    {
+      fail("session lost while leased");
+    }
+    if (takeover && alive)
+    {
+      fail("session survived ComID reset");
+    }
+  }
+  if (!try_login(target, ADMIN_SP, SID, "SIMULATED-MSID"))
+  {
+    fail("cannot log in again");
+  }
+  test_count++;
+}
+
+// Fleet executor across many simulated drives
+void check_fleet(unsigned count)
+{
+  printf("Testing fleet of %u simulated drives ...\n", count);
+
+  fleet pool(8, 0);
+  for (unsigned i = 0; i < count; i++)
+  {
+    pool.add(sim_path(i), "sim");
+  }
+  vector<fleet_result> results = pool.run([](drive &target, fleet_result &result)
+  {
+    target.login_anon(ADMIN_SP);
+    result.note = target.default_pin();
+  });
+  for (size_t i = 0; i < results.size(); i++)
+  {
+    if (!results[i].ok || (results[i].note != "SIMULATED-MSID"))
+    {
+      fail("fleet operation failed");
+    }
+  }
+  test_count++;
+}
+
+int main()
+{
+  const unsigned DRIVES = 24;
+
+  try
+  {
+    sock_path = "/tmp/topaz-test-simd." + to_string(getpid()) + ".sock";
+    char lease_dir[] = "/tmp/topaz-test-simd-lease.XXXXXX";
+    if (!mkdtemp(lease_dir))
+    {
+      fail("cannot create lease directory");
+    }
+    setenv("TOPAZ_LEASE_DIR", lease_dir, 1);
+    sim_server server(sock_path, DRIVES);
+
+    // Server runs in its own process, as tp_simd would
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      prctl(PR_SET_PDEATHSIG, SIGTERM);
+      server.run();
+      _exit(0);
+    }
+    if (pid == -1)
+    {
+      fail("cannot start server");
+    }
+
+    check_open();
+    check_independent();
+    check_record();
+    check_collision();
+    check_fleet(DRIVES);
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    remove_dir(lease_dir);
+
+    printf("\n******** %d Tests Passed ********\n\n", test_count);
+  }
+  catch (topaz_exception &e)
+  {
+    printf("Exception raised: %s\n", e.what());
+    return 1;
+  }
+
+  return 0;
+}
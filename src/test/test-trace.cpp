@@ -0,0 +1,222 @@
+/**
+ * Topaz Test - Event Tracing
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <topaz/drive.h>
+#include <topaz/exceptions.h>
+#include <topaz/simdrive.h>
+#include <topaz/trace.h>
+#include <topaz/uid.h>
+using namespace std;
+using namespace topaz;
+
+// Global, eh ....
+int test_count = 0;
+
+// Bail out
+void fail(char const *why)
+{
+  printf("*** Failed (%s) ***\n", why);
+  exit(1);
+}
+
+// Events of one type
+size_t count_type(vector<trace_event> const &events, trace_type type)
+{
+  size_t count = 0;
+  for (size_t i = 0; i < events.size(); i++)
+  {
+    count += (events[i].type == (uint32_t)type ? 1 : 0);
+  }
+  return count;
+}
+
+// Spans nest, instants are instant, off means off
+void check_record()
+{
+  vector<trace_event> events;
+  printf("Testing record ...\n");
+
+  trace_clear();
+  trace_enable(false);
+  {
+    TOPAZ_TRACE_SPAN(ignored, TRACE_INVOKE, 1, 2);
+  }
+  trace_enable(true);
+  {
+    TOPAZ_TRACE_SPAN(outer, TRACE_INVOKE, 0x205, 0x6000016);
+    usleep(1000);
+    TOPAZ_TRACE_EVENT(TRACE_POLL, 1, 0);
+    TOPAZ_TRACE_ARGS(outer, 0x205, 0x6000017);
+  }
+  trace_snapshot(events);
+
+  if ((events.size() != 2) || (events[0].type != TRACE_INVOKE) ||
+      (events[0].b != 0x6000017) || (events[0].dur_ns < 1000000) ||
+      (events[1].type != TRACE_POLL) || (events[1].dur_ns != 0) ||
+      (events[1].start_ns < events[0].start_ns) ||
+      (events[1].start_ns > events[0].start_ns + events[0].dur_ns))
+  {
+    fail("unexpected events");
+  }
+  test_count++;
+}
+
+// Every thread has its own ring, oldest events give way
+void check_threads()
+{
+  vector<trace_event> events;
+  vector<thread> pool;
+  size_t per_thread = 50000;
+  printf("Testing threads ...\n");
+
+  trace_clear();
+  for (unsigned t = 0; t < 4; t++)
+  {
+    pool.push_back(thread([t, per_thread]()
+			  {
+			    for (size_t i = 0; i < per_thread; i++)
+			    {
+			      TOPAZ_TRACE_EVENT(TRACE_POLL, i, t);
+			    }
+			  }));
+  }
+  for (size_t t = 0; t < pool.size(); t++)
+  {
+    pool[t].join();
+  }
+  trace_snapshot(events);
+
+  // Each thread kept its newest, in order
+  vector<uint64_t> next(4, 0), seen(4, 0);
+  for (size_t i = 0; i < events.size(); i++)
+  {
+    unsigned t = events[i].b;
+    if ((t >= 4) || (next[t] && (events[i].a != next[t])))
+    {
+      fail("events lost or out of order within ring");
+    }
+    next[t] = events[i].a + 1;
+    seen[t]++;
+  }
+  for (unsigned t = 0; t < 4; t++)
+  {
+    printf("  thread %u kept %zu of %zu\n", t, (size_t)seen[t], per_thread);
+    if (!seen[t] || (seen[t] >= per_thread) || (next[t] != per_thread))
+    {
+      fail("ring did not keep newest events");
+    }
+  }
+  test_count++;
+}
+
+// Library calls against simulated drive, exported for Perfetto
+void check_export(char const *path)
+{
+  vector<trace_event> events;
+  printf("Testing export ...\n");
+
+  trace_clear();
+  if (trace_available())
+  {
+    simdrive sim;
+    drive target(sim);
+    target.login_anon(ADMIN_SP);
+    target.table_get(ADMIN_SP, 6);
+  }
+  else
+  {
+    // Library without instrumentation, make some of our own
+    TOPAZ_TRACE_SPAN(session, TRACE_SESSION_START, ADMIN_SP, 0);
+    TOPAZ_TRACE_SPAN(send, TRACE_IF_SEND, (1 << 16) | 0x1000, 512);
+  }
+  trace_snapshot(events);
+  trace_export(path);
+
+  size_t invokes = count_type(events, TRACE_INVOKE);
+  size_t sends = count_type(events, TRACE_IF_SEND);
+  printf("  %zu events (%zu invoke, %zu IF-SEND), library %s\n", events.size(),
+	 invokes, sends, trace_available() ? "instrumented" : "not instrumented");
+  if (trace_available() &&
+      ((count_type(events, TRACE_PROBE) < 3) || (invokes < 3) || (sends < 3) ||
+       (count_type(events, TRACE_SESSION_START) != 1) ||
+       (count_type(events, TRACE_DECODE) < 3)))
+  {
+    fail("library events missing");
+  }
+
+  ifstream in(path);
+  stringstream json;
+  json << in.rdbuf();
+  string text = json.str();
+  if ((text.compare(0, 2, "{\"") != 0) ||
+      (text.find("\"traceEvents\":[") == string::npos) ||
+      (text.find("\"ph\":\"X\"") == string::npos) ||
+      (text.find("\"thread_name\"") == string::npos) ||
+      (text.substr(text.size() - 3) != "]}\n"))
+  {
+    fail("export is not trace JSON");
+  }
+  if (trace_available() && (text.find("\"name\":\"StartSession\"") == string::npos))
+  {
+    fail("method names missing from export");
+  }
+  test_count++;
+}
+
+int main()
+{
+  char path[] = "/tmp/topaz-trace-XXXXXX";
+  int fd = mkstemp(path);
+  close(fd);
+
+  try
+  {
+    check_record();
+    check_threads();
+    check_export(path);
+    unlink(path);
+
+    printf("\n******** %d Tests Passed ********\n\n", test_count);
+  }
+  catch (topaz_exception &e)
+  {
+    unlink(path);
+    printf("Exception raised: %s\n", e.what());
+    return 1;
+  }
+
+  return 0;
+}
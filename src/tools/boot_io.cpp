@@ -0,0 +1,129 @@
+/**
+ * Topaz Tools - Pre-boot drive I/O
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <cstring>
+#include <sys/ioctl.h>
+#include <scsi/sg.h>
+#include "boot_io.h"
+using namespace topaz;
+
+// Trusted send / receive timeout (seconds)
+#define ATA_WAIT 5
+
+// Run a Trusted Send (0x5e) / Receive (0x5c) through ATA12 pass-through
+static int ata_trusted(int fd, bool to_dev, uint8_t proto, uint16_t comid,
+		       void *data, size_t bcount)
+{
+  struct sg_io_hdr sg_io;  // ioctl data structure
+  unsigned char cdb[12];   // Command descriptor block
+  unsigned char sense[32]; // SCSI sense (error) data
+  
+  // Initialize structures
+  memset(&sg_io, 0, sizeof(sg_io));
+  memset(cdb, 0, sizeof(cdb));
+  memset(sense, 0, sizeof(sense));
+  
+  // Pass through, see rawdrive::ata_exec_12
+  sg_io.interface_id    = 'S';
+  sg_io.cmdp            = cdb;
+  sg_io.cmd_len         = sizeof(cdb);
+  sg_io.dxferp          = data;
+  sg_io.dxfer_len       = bcount * 512;
+  sg_io.dxfer_direction = (to_dev ? SG_DXFER_TO_DEV : SG_DXFER_FROM_DEV);
+  sg_io.sbp             = sense;
+  sg_io.mx_sb_len       = sizeof(sense);
+  sg_io.timeout         = ATA_WAIT * 1000;
+  
+  // ATA12, PIO-out / PIO-in, size in sector count
+  cdb[0] = 0xA1;
+  cdb[1] = (to_dev ? 5 : 4) << 1;
+  cdb[2] = (to_dev ? 0x26 : 0x2e);
+  cdb[3] = proto;            // Feature
+  cdb[4] = bcount;           // Count
+  cdb[6] = comid & 0xff;     // LBA mid
+  cdb[7] = comid >> 8;       // LBA high
+  cdb[9] = (to_dev ? 0x5e : 0x5c);
+  
+  // System call, then sense data
+  if (ioctl(fd, SG_IO, &sg_io) != 0)
+  {
+    return -1;
+  }
+  if (sense[0] != 0x72 || sense[7] != 0x0e || sense[8] != 0x09
+      || sense[9] != 0x0c || sense[10] != 0x00)
+  {
+    return -1;
+  }
+  return 0;
+}
+
+static int boot_if_send(void *ctx, uint8_t proto, uint16_t comid,
+			void const *data, size_t bcount)
+{
+  return ata_trusted(((boot_dev_t*)ctx)->fd, true, proto, comid, (void*)data, bcount);
+}
+
+static int boot_if_recv(void *ctx, uint8_t proto, uint16_t comid,
+			void *data, size_t bcount)
+{
+  return ata_trusted(((boot_dev_t*)ctx)->fd, false, proto, comid, data, bcount);
+}
+
+static void boot_delay_ms(void *ctx, unsigned ms)
+{
+  usleep(ms * 1000);
+}
+
+// Open drive (0 on success)
+int boot_io_open(boot_dev_t *dev, char const *path)
+{
+  dev->fd = open(path, O_RDWR);
+  return (dev->fd == -1 ? -1 : 0);
+}
+
+// Close drive
+void boot_io_close(boot_dev_t *dev)
+{
+  if (dev->fd != -1)
+  {
+    close(dev->fd);
+    dev->fd = -1;
+  }
+}
+
+// Unlock core hooks for an open drive
+core_io_t boot_io_hooks(boot_dev_t *dev)
+{
+  core_io_t io;
+  io.ctx      = dev;
+  io.if_send  = boot_if_send;
+  io.if_recv  = boot_if_recv;
+  io.delay_ms = boot_delay_ms;
+  return io;
+}
@@ -0,0 +1,94 @@
+/**
+ * Topaz Tools - Command Scripts
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <topaz/exceptions.h>
+#include "script.h"
+using namespace std;
+using namespace topaz;
+
+// Read script from file ("-" for stdin)
+vector<script_cmd> read_script(char const *path)
+{
+  vector<script_cmd> script;
+  ifstream file;
+  string name = path, text;
+  istream *in = &cin;
+  
+  // Input
+  if (name == "-")
+  {
+    name = "stdin";
+  }
+  else
+  {
+    file.open(path);
+    if (!file)
+    {
+      throw topaz_exception("Cannot open script " + name);
+    }
+    in = &file;
+  }
+  
+  // One command per line, comments and blank lines skipped
+  for (unsigned line = 1; getline(*in, text); line++)
+  {
+    script_cmd cmd;
+    string word;
+    
+    istringstream words(text.substr(0, text.find('#')));
+    while (words >> word)
+    {
+      cmd.args.push_back(word);
+    }
+    if (cmd.args.empty())
+    {
+      continue;
+    }
+    cmd.line  = line;
+    cmd.label = name + ":" + to_string(line);
+    script.push_back(cmd);
+  }
+  if (in->bad())
+  {
+    throw topaz_exception("Cannot read script " + name);
+  }
+  
+  return script;
+}
+
+// Command given on the command line, as a script of one
+script_cmd command_line(int argc, char **argv)
+{
+  script_cmd cmd;
+  cmd.line  = 0;
+  cmd.label = argv[0];
+  cmd.args.assign(argv, argv + argc);
+  return cmd;
+}
@@ -0,0 +1,176 @@
+/**
+ * Topaz Tools - Management Daemon
+ *
+ * Holds TCG Opal drives open and serves lock, unlock, PIN and range
+ * requests over a Unix socket (see topaz/mgmt.h, and tp_ctl), keeping
+ * authenticated sessions warm between requests.
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <signal.h>
+#include <thread>
+#include <unistd.h>
+#include <topaz/debug.h>
+#include <topaz/exceptions.h>
+#include <topaz/mgmt.h>
+using namespace std;
+using namespace topaz;
+
+void stop_handler(int sig);
+void usage();
+
+// Servers being run (for signal handler)
+mgmt_server *running = NULL;
+metrics_server *running_metrics = NULL;
+
+int main(int argc, char **argv)
+{
+  char const *path = "/run/topazd.sock";
+  mgmt_policy policy;
+  int metrics_port = -1;
+  int c;
+
+  // Process command line switches
+  opterr = 0;
+  while ((c = getopt(argc, argv, "S:i:m:v")) != -1)
+  {
+    switch (c)
+    {
+      case 'S':
+	path = optarg;
+	break;
+
+      case 'i':
+	policy.idle_ms = atoi(optarg);
+	break;
+
+      case 'm':
+	metrics_port = atoi(optarg);
+	break;
+
+      case 'v':
+	topaz_debug++;
+	break;
+
+      default:
+	cerr << "Invalid command line option " << (char)optopt << endl;
+	usage();
+	return -1;
+    }
+  }
+
+  // At least one drive
+  if (optind >= argc)
+  {
+    cerr << "Invalid arguments" << endl;
+    usage();
+    return -1;
+  }
+
+  try
+  {
+    mgmt_server server(path, policy);
+
+    // Drives are named as given (name=path to pick another name)
+    for (int i = optind; i < argc; i++)
+    {
+      char const *split = strchr(argv[i], '=');
+      if (split)
+      {
+	server.add(string(argv[i], split - argv[i]), split + 1);
+      }
+      else
+      {
+	server.add(argv[i], argv[i]);
+      }
+    }
+
+    // Metrics on localhost, alongside
+    unique_ptr<metrics_server> scrape;
+    thread scrape_thread;
+    if (metrics_port >= 0)
+    {
+      scrape.reset(new metrics_server(server.metrics(), metrics_port));
+      scrape_thread = thread(&metrics_server::run, scrape.get());
+      running_metrics = scrape.get();
+    }
+
+    // Stop cleanly (logging out, removing the socket) on Ctl-C or kill
+    running = &server;
+    signal(SIGINT, stop_handler);
+    signal(SIGTERM, stop_handler);
+
+    cout << "Serving " << (argc - optind) << " drives on " << path;
+    if (scrape)
+    {
+      cout << ", metrics on port " << scrape->port();
+    }
+    cout << endl;
+    server.run();
+    running = NULL;
+
+    if (scrape)
+    {
+      scrape->stop();
+      scrape_thread.join();
+      running_metrics = NULL;
+    }
+  }
+  catch (topaz_exception &e)
+  {
+    cerr << "Exception raised: " << e.what() << endl;
+    return -1;
+  }
+
+  return 0;
+}
+
+void stop_handler(int sig)
+{
+  if (running)
+  {
+    running->stop();
+  }
+}
+
+void usage()
+{
+  cerr << endl
+       << "Usage:" << endl
+       << "  topazd [opts] <drive> ... - Serve TCG Opal drives to tp_ctl" << endl
+       << endl
+       << "Drives are named in requests as given, or [name=]<drive> to pick a name." << endl
+       << endl
+       << "Options:" << endl
+       << "  -S <path> - Socket (default /run/topazd.sock)" << endl
+       << "  -i <ms>   - Keep idle sessions open (default 30000, 0 - never)" << endl
+       << "  -m <port> - Serve Prometheus metrics on localhost port" << endl
+       << "  -v        - Increase debug verbosity" << endl;
+}
@@ -34,11 +34,13 @@
 #include <cstring>
 #include <ctype.h>
 #include <iostream>
+#include <topaz/batch.h>
 #include <topaz/debug.h>
 #include <topaz/drive.h>
 #include <topaz/exceptions.h>
 #include <topaz/uid.h>
 #include "pinutil.h"
+#include "script.h"
 using namespace std;
 using namespace topaz;
 
@@ -46,11 +48,17 @@ void ctl_c_handler(int sig);
 void usage();
 char const *lifecycle_to_string(uint64_t val);
 void do_auth_login(drive &target, string pin, bool pin_valid);
+string check_command(vector<string> const &args);
+bool needs_flush(vector<string> const &args);
+void run_command(drive &target, call_batch &batch, script_cmd const &cmd,
+		 string &new_pin, bool new_pin_valid);
 
 int main(int argc, char **argv)
 {
   string cur_pin, new_pin;
-  bool cur_pin_valid = false, new_pin_valid = false;
+  bool cur_pin_valid = false, new_pin_valid = false, auth = false;
+  vector<script_cmd> script;
+  bool from_stdin = false;
   char c;
   
   // Install handler for Ctl-C to restore terminal to sane state
@@ -107,6 +115,61 @@ int main(int argc, char **argv)
     return -1;
   }
   
+  // Command(s) to run, all checked before the drive is touched
+  try
+  {
+    if (strcmp(argv[optind + 1], "script") == 0)
+    {
+      if ((argc - optind) != 3)
+      {
+	cerr << "Script mode takes one script file (- for stdin)" << endl;
+	usage();
+	return -1;
+      }
+      from_stdin = (strcmp(argv[optind + 2], "-") == 0);
+      script = read_script(argv[optind + 2]);
+    }
+    else
+    {
+      script.push_back(command_line(argc - optind - 1, argv + optind + 1));
+    }
+  }
+  catch (topaz_exception &e)
+  {
+    cerr << e.what() << endl;
+    return -1;
+  }
+  for (size_t i = 0; i < script.size(); i++)
+  {
+    string problem = check_command(script[i].args);
+
+    // Console is the script, PINs would be read from it
+    if (problem.empty() && from_stdin && !new_pin_valid &&
+	(script[i].args[0] == "setpin") && (script[i].args.size() == 1))
+    {
+      problem = "New PIN must be given inline or with -n or -N to read script from stdin";
+    }
+    if (!problem.empty())
+    {
+      cerr << (script[i].line ? script[i].label + ": " : "") << problem << endl;
+      usage();
+      return -1;
+    }
+    auth = auth || (script[i].args[0] != "status");
+    
+    // Nothing left to talk to after a revert
+    if ((script[i].args[0] == "revert") && (i + 1 < script.size()))
+    {
+      cerr << script[i].label << ": revert must be the last command" << endl;
+      return -1;
+    }
+  }
+  if (from_stdin && auth && !cur_pin_valid)
+  {
+    cerr << "Current PIN must be given with -p or -P to read script from stdin" << endl;
+    return -1;
+  }
+  
   // Open the device
   try
   {
@@ -114,8 +177,67 @@ int main(int argc, char **argv)
     drive target(argv[optind]);
     target.login_anon(ADMIN_SP);
     
+    // Authorized session needed (once, for all commands)
+    if (auth)
+    {
+      do_auth_login(target, cur_pin, cur_pin_valid);
+    }
+    
+    // Table changes and Activate are queued and go out together, when a
+    // command needs to see the drive or after the last command
+    call_batch batch(target);
+    for (size_t i = 0; i < script.size(); i++)
+    {
+      if (needs_flush(script[i].args))
+      {
+	batch.flush();
+      }
+      run_command(target, batch, script[i], new_pin, new_pin_valid);
+    }
+    batch.flush();
+  }
+  catch (topaz_exception &e)
+  {
+    cerr << "Exception raised: " << e.what() << endl;
+    return -1;
+  }
+  
+  return 0;
+}
+
+// Problem with command, empty if none
+string check_command(vector<string> const &args)
+{
+  string const &cmd = args[0];
+  
+  if (cmd == "setpin")
+  {
+    return (args.size() <= 2 ? "" : "Too many arguments to setpin");
+  }
+  else if ((cmd == "status") || (cmd == "login") || (cmd == "activate") ||
+	   (cmd == "revert"))
+  {
+    return (args.size() == 1 ? "" : "Too many arguments to " + cmd);
+  }
+  return "Unknown comand " + cmd;
+}
+
+// Does command read the drive, or end the session?
+bool needs_flush(vector<string> const &args)
+{
+  return ((args[0] == "status") || (args[0] == "revert"));
+}
+
+// Run one (checked) command in authorized session, queueing changes on batch
+void run_command(drive &target, call_batch &batch, script_cmd const &cmd,
+		 string &new_pin, bool new_pin_valid)
+{
+  string const &op = cmd.args[0];
+  
+  try
+  {
     // Determine our operation
-    if (strcmp(argv[optind + 1], "status") == 0)
+    if (op == "status")
     {
       atom val;
       
@@ -128,65 +250,54 @@ int main(int argc, char **argv)
       cout << "Locking SP : " << lifecycle_to_string(val.get_uint()) << endl;
     }
     // Test admin credentials
-    else if (strcmp(argv[optind + 1], "login") == 0)
+    else if (op == "login")
     {
-      // Authorized session needed
-      do_auth_login(target, cur_pin, cur_pin_valid);
-      
       // Let user know status
       cout << "Login credentials OK" << endl;
     }
     // Change SID(Admin) PIN
-    else if (strcmp(argv[optind + 1], "setpin") == 0)
+    else if (op == "setpin")
     {
-      // Authorized session needed
-      do_auth_login(target, cur_pin, cur_pin_valid);
+      string pin = new_pin;
       
-      // Ensure new pin was provided
-      if (!new_pin_valid)
+      // PIN from script, options, or console
+      if (cmd.args.size() > 1)
       {
-	// No, query for one now
-	new_pin = pin_from_console("new SID(admin)");
+	pin = cmd.args[1];
+      }
+      else if (!new_pin_valid)
+      {
+	pin = pin_from_console("new SID(admin)");
       }
-      
-      // Convert PIN to atom for table I/O
-      atom new_pin_atom = atom::new_bin(new_pin.c_str());
       
       // Set PIN of SID (Drive Owner) in Admin SP
-      target.table_set(C_PIN_SID, 3, new_pin_atom);
+      batch.set(C_PIN_SID, 3, atom::new_bin(pin.c_str()), cmd.label);
     }
     // Activate Locking SP
-    else if (strcmp(argv[optind + 1], "activate") == 0)
+    else if (op == "activate")
     {
-      // Authorized session needed
-      do_auth_login(target, cur_pin, cur_pin_valid);
-      
       // Locking_SP.Activate[]
-      target.invoke(LOCKING_SP, ACTIVATE);
+      datum call;
+      call.object_uid() = LOCKING_SP;
+      call.method_uid() = ACTIVATE;
+      batch.call(std::move(call), cmd.label);
     }
     // Revert TPer (Admin & anything else)
-    else if (strcmp(argv[optind + 1], "revert") == 0)
+    else if (op == "revert")
     {
-      // Authorized session needed
-      do_auth_login(target, cur_pin, cur_pin_valid);
-      
       // Admin_SP.Revert[]
       target.invoke(ADMIN_SP, REVERT);
     }
-    else
-    {
-      // Nada
-      cerr << "Unknown comand " << argv[optind + 1] << endl;
-      usage();
-      return -1;
-    }
   }
   catch (topaz_exception &e)
   {
-    cerr << "Exception raised: " << e.what() << endl;
+    // Say which line of a script failed
+    if (cmd.line)
+    {
+      throw topaz_exception(cmd.label + ": " + e.what());
+    }
+    throw;
   }
-  
-  return 0;
 }
 
 void ctl_c_handler(int sig)
@@ -205,7 +316,12 @@ void usage()
        << "  tp_admin [opts] <drive> setpin   - Set/Change SID(admin) PIN" << endl
        << "  tp_admin [opts] <drive> activate - Activate Locking SP" << endl
        << "  tp_admin [opts] <drive> revert   - Revert/Reset Admin SP (DATA LOSS!)" << endl
+       << "  tp_admin [opts] <drive> script <file> - Run commands from file (- stdin)" << endl
        << endl
+       << "Scripts hold one command per line, as above without 'tp_admin [opts] <drive>'" << endl
+       << "('setpin [new pin]' takes the new PIN inline), '#' starts a comment. All" << endl
+       << "commands run in one session, revert only as the last. Scripts run in" << endl
+       << "the Admin SP only, Locking SP commands go in a tp_lock script." << endl
        << "Options:" << endl
        << "  -p <pin>  - Provide current SID PIN" << endl
        << "  -P <file> - Read current PIN from file" << endl
@@ -0,0 +1,594 @@
+/**
+ * Topaz Tools - Drive Benchmark
+ *
+ * Runs timed scenarios (discovery, logins, Get / Set, whole table Get,
+ * binary table writes and GenKey) against a drive or simulated TPer, and
+ * reports per-operation latency percentiles and throughput. Each operation
+ * is split into time spent in IF-SEND, polling for the response, IF-RECV,
+ * and the rest (codec and library overhead). Built with TOPAZ_ALLOC, heap
+ * allocations per operation and per method invocation are reported too.
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <getopt.h>
+#include <unistd.h>
+#include <topaz/alloc.h>
+#include <topaz/debug.h>
+#include <topaz/drive.h>
+#include <topaz/exceptions.h>
+#include <topaz/simdrive.h>
+#include <topaz/uid.h>
+#include "pinutil.h"
+using namespace std;
+using namespace topaz;
+
+typedef chrono::steady_clock bench_clock;
+
+// Time spent per phase of one operation (microseconds)
+typedef struct
+{
+  double   send_us;  // In IF-SEND
+  double   poll_us;  // Waiting on "no data yet" IF-RECVs, and between them
+  double   recv_us;  // In IF-RECVs that carried data
+  unsigned polls;    // "No data yet" IF-RECVs
+} phase_t;
+
+// Samples of one scenario
+typedef struct
+{
+  string          name;
+  size_t          bytes;   // Payload moved per operation (0 - n/a)
+  vector<double>  total_us;
+  vector<phase_t> phases;
+  alloc_stats     heap;    // Every allocation (TOPAZ_ALLOC builds)
+  alloc_stats     invoke;  // Within method invocations
+} scenario_result;
+
+// Scenario to run: setup once, then operation per iteration
+typedef struct
+{
+  string                 name;
+  size_t                 bytes;
+  bool                   destructive;  // Changes drive state or data
+  function<void(drive&)> setup;
+  function<void(drive&)> op;
+} scenario;
+
+/**
+ * \brief Transport timing each IF-SEND / IF-RECV by phase
+ */
+class timed_transport : public transport
+{
+
+public:
+
+  timed_transport(transport &io)
+    : io(io), polling(false)
+  {
+    clear();
+  }
+
+  virtual void if_send(uint8_t proto, uint16_t comid, void *data, uint8_t bcount)
+  {
+    bench_clock::time_point start = bench_clock::now();
+    io.if_send(proto, comid, data, bcount);
+    phase.send_us += since_us(start, bench_clock::now());
+    polling = false;
+  }
+
+  virtual void if_recv(uint8_t proto, uint16_t comid, void *data, uint8_t bcount)
+  {
+    bench_clock::time_point start = bench_clock::now(), end;
+
+    // Host slept between polls
+    if (polling)
+    {
+      phase.poll_us += since_us(last, start);
+    }
+    io.if_recv(proto, comid, data, bcount);
+    end = bench_clock::now();
+
+    polling = no_data_yet(proto, comid, data, bcount * ATA_BLOCK_SIZE);
+    if (polling)
+    {
+      phase.poll_us += since_us(start, end);
+      phase.polls++;
+    }
+    else
+    {
+      phase.recv_us += since_us(start, end);
+    }
+    last = end;
+  }
+
+  // Same device, same lease
+  virtual string device_id() const
+  {
+    return io.device_id();
+  }
+
+  void clear()
+  {
+    memset(&phase, 0, sizeof(phase));
+    polling = false;
+  }
+
+  static double since_us(bench_clock::time_point start, bench_clock::time_point end)
+  {
+    return chrono::duration<double, micro>(end - start).count();
+  }
+
+  phase_t phase;
+
+protected:
+
+  transport &io;
+  bool polling;
+  bench_clock::time_point last;
+
+};
+
+void usage();
+uint64_t get_uid(char const *user_str);
+void take_ownership(drive &target, string const &pin);
+vector<scenario> make_scenarios(transport &io, uint64_t user_uid, string const &pin,
+				vector<size_t> const &chunks, vector<uint8_t> &buf);
+void run_scenario(scenario const &scn, timed_transport &io, drive &target,
+		  unsigned iters, scenario_result &res);
+void report(scenario_result &res, bool json);
+
+// Long spellings of options
+static struct option const long_opts[] =
+{
+  {"destructive", no_argument, NULL, 'D'},
+  {NULL,          0,           NULL, 0}
+};
+
+int main(int argc, char **argv)
+{
+  string pin = "bench", only;
+  char const *profile = NULL;
+  uint64_t user_uid = ADMIN_BASE + 1;
+  vector<size_t> chunks;
+  unsigned iters = 100;
+  bool in_proc = false, init = false, json = false, destructive = false;
+  sim_latency lat;
+  int c;
+
+  // Process command line switches
+  opterr = 0;
+  while ((c = getopt_long(argc, argv, "sl:In:S:b:u:p:f:jDv", long_opts, NULL)) != -1)
+  {
+    switch (c)
+    {
+      case 'D':
+	destructive = true;
+	break;
+
+      case 's':
+	in_proc = true;
+	break;
+
+      case 'l':
+	profile = optarg;
+	break;
+
+      case 'I':
+	init = true;
+	break;
+
+      case 'n':
+	iters = atoi(optarg);
+	break;
+
+      case 'S':
+	only = string(",") + optarg + ",";
+	break;
+
+      case 'b':
+	{
+	  stringstream list(optarg);
+	  string item;
+	  while (getline(list, item, ','))
+	  {
+	    chunks.push_back(strtoul(item.c_str(), NULL, 0));
+	  }
+	}
+	break;
+
+      case 'u':
+	user_uid = get_uid(optarg);
+	break;
+
+      case 'p':
+	pin = optarg;
+	break;
+
+      case 'f':
+	pin = pin_from_file(optarg);
+	break;
+
+      case 'j':
+	json = true;
+	break;
+
+      case 'v':
+	topaz_debug++;
+	break;
+
+      default:
+	cerr << "Invalid command line option " << (char)optopt << endl;
+	usage();
+	return -1;
+    }
+  }
+
+  // Drive, unless simulated in process
+  if ((in_proc && (argc != optind)) || (!in_proc && (argc - optind) != 1) || !iters)
+  {
+    cerr << "Invalid arguments" << endl;
+    usage();
+    return -1;
+  }
+  if (chunks.empty())
+  {
+    chunks.push_back(512);
+    chunks.push_back(4096);
+    chunks.push_back(32768);
+    chunks.push_back(131072);
+  }
+
+  try
+  {
+    // Underlying transport, every call timed by phase
+    unique_ptr<transport> dev;
+    if (in_proc)
+    {
+      if (profile)
+      {
+	lat.load(profile);
+      }
+      dev.reset(new simdrive(sim_config(), lat));
+      init = true;
+      
+      // Nothing to lose on a simulated drive
+      destructive = true;
+    }
+    else
+    {
+      dev.reset(open_transport(argv[optind]));
+    }
+    timed_transport io(*dev);
+    drive target(io);
+    if (init)
+    {
+      take_ownership(target, pin);
+    }
+
+    vector<uint8_t> buf;
+    vector<scenario> scenarios = make_scenarios(io, user_uid, pin, chunks, buf);
+    vector<bool> selected(scenarios.size());
+    string skipped;
+    for (size_t i = 0; i < scenarios.size(); i++)
+    {
+      string name = scenarios[i].name;
+      if (name.compare(0, 8, "set_bin_") == 0)
+      {
+	name = "set_bin";
+      }
+      bool asked = (only.find("," + name + ",") != string::npos) ||
+	           (only.find("," + scenarios[i].name + ",") != string::npos);
+      if (!only.empty() && !asked)
+      {
+	continue;
+      }
+      
+      // Data and lock state are only touched when asked to
+      if (scenarios[i].destructive && !destructive)
+      {
+	if (asked)
+	{
+	  throw topaz_exception("Scenario " + scenarios[i].name +
+				" changes the drive, needs --destructive");
+	}
+	if (skipped.find(name) == string::npos)
+	{
+	  skipped += (skipped.empty() ? "" : ", ") + name;
+	}
+	continue;
+      }
+      selected[i] = true;
+    }
+    if (!skipped.empty())
+    {
+      cerr << "Skipping " << skipped << " (they change the drive, see --destructive)" << endl;
+    }
+    for (size_t i = 0; i < scenarios.size(); i++)
+    {
+      if (!selected[i])
+      {
+	continue;
+      }
+
+      scenario_result res;
+      run_scenario(scenarios[i], io, target, iters, res);
+      report(res, json);
+    }
+  }
+  catch (topaz_exception &e)
+  {
+    cerr << "Exception raised: " << e.what() << endl;
+    return -1;
+  }
+
+  return 0;
+}
+
+// Fresh drive: SID and Admin1 PIN set, Locking SP active
+void take_ownership(drive &target, string const &pin)
+{
+  target.login_anon(ADMIN_SP);
+  target.login(ADMIN_SP, SID, target.default_pin());
+  target.table_set(C_PIN_SID, 3, atom::new_bin(pin.c_str()));
+  if (target.table_get(LOCKING_SP, 6).get_uint() == 8)
+  {
+    target.invoke(LOCKING_SP, ACTIVATE);
+  }
+}
+
+// Everything tp_bench knows how to time
+vector<scenario> make_scenarios(transport &io, uint64_t user_uid, string const &pin,
+				vector<size_t> const &chunks, vector<uint8_t> &buf)
+{
+  vector<scenario> list;
+  scenario scn;
+  auto login = [user_uid, pin](drive &target)
+  {
+    target.login(LOCKING_SP, user_uid, pin);
+  };
+  auto nothing = [](drive &target) {};
+
+  // Transport is reused, drive is rebuilt each time (sharing the lease
+  // target holds, so the ComID isn't reset under it)
+  scn.name = "discovery";
+  scn.bytes = 0;
+  scn.destructive = false;
+  scn.setup = nothing;
+  scn.op = [&io](drive &target)
+  {
+    lease_policy lease;
+    lease.mode = LEASE_SHARE;
+    drive fresh(io, lease);
+  };
+  list.push_back(scn);
+
+  scn.name = "login_anon";
+  scn.op = [](drive &target) { target.login_anon(ADMIN_SP); };
+  list.push_back(scn);
+
+  scn.name = "login";
+  scn.op = login;
+  list.push_back(scn);
+
+  scn.name = "get";
+  scn.setup = login;
+  scn.op = [](drive &target) { target.table_get(LBA_RANGE_GLOBAL, 7); };
+  list.push_back(scn);
+
+  // ReadLocked of global range, Shadow MBR and a media key below are
+  // overwritten (genkey crypto erases Locking_Range1)
+  scn.name = "set";
+  scn.destructive = true;
+  scn.op = [](drive &target) { target.table_set(LBA_RANGE_GLOBAL, 7, (uint64_t)0); };
+  list.push_back(scn);
+
+  scn.name = "table_get";
+  scn.destructive = false;
+  scn.op = [](drive &target) { target.table_get(LBA_RANGE_GLOBAL); };
+  list.push_back(scn);
+
+  size_t largest = *max_element(chunks.begin(), chunks.end());
+  buf.assign(largest, 0x5a);
+  for (size_t i = 0; i < chunks.size(); i++)
+  {
+    size_t len = chunks[i];
+    uint8_t const *data = &(buf[0]);
+    scn.name = "set_bin_" + to_string(len);
+    scn.bytes = len;
+    scn.destructive = true;
+    scn.op = [len, data](drive &target) { target.table_set_bin(MBR, 0, data, len); };
+    list.push_back(scn);
+  }
+
+  // Regenerate key of first non-global range
+  shared_ptr<uint64_t> key(new uint64_t(0));
+  scn.name = "genkey";
+  scn.bytes = 0;
+  scn.destructive = true;
+  scn.setup = [login, key](drive &target)
+  {
+    login(target);
+    *key = target.table_get(LBA_RANGE_BASE + 1, 10).get_uid();
+  };
+  scn.op = [key](drive &target) { target.invoke(*key, GENKEY); };
+  list.push_back(scn);
+
+  return list;
+}
+
+// Time every iteration of one scenario
+void run_scenario(scenario const &scn, timed_transport &io, drive &target,
+		  unsigned iters, scenario_result &res)
+{
+  res.name = scn.name;
+  res.bytes = scn.bytes;
+  scn.setup(target);
+  alloc_reset();
+
+  for (unsigned i = 0; i < iters; i++)
+  {
+    io.clear();
+    bench_clock::time_point start = bench_clock::now();
+    scn.op(target);
+    res.total_us.push_back(timed_transport::since_us(start, bench_clock::now()));
+    res.phases.push_back(io.phase);
+  }
+  res.heap = alloc_totals();
+  res.invoke = alloc_site_stats(ALLOC_INVOKE);
+}
+
+// Nearest rank percentile of sorted samples
+double percentile(vector<double> const &sorted, double pct)
+{
+  size_t rank = (size_t)((pct / 100.0) * sorted.size() + 0.5);
+  rank = (rank ? rank - 1 : 0);
+  return sorted[min(rank, sorted.size() - 1)];
+}
+
+// Print one scenario's summary
+void report(scenario_result &res, bool json)
+{
+  static bool header = false;
+  vector<double> sorted(res.total_us);
+  sort(sorted.begin(), sorted.end());
+
+  double sum = 0, send = 0, poll = 0, recv = 0, polls = 0;
+  for (size_t i = 0; i < sorted.size(); i++)
+  {
+    sum   += res.total_us[i];
+    send  += res.phases[i].send_us;
+    poll  += res.phases[i].poll_us;
+    recv  += res.phases[i].recv_us;
+    polls += res.phases[i].polls;
+  }
+  double n = sorted.size(), mean = sum / n;
+  double ops = 1e6 / mean, mbs = res.bytes * ops / 1e6;
+  double host = mean - (send + poll + recv) / n;
+  double invokes = (res.invoke.calls ? res.invoke.calls : 1);
+
+  if (json)
+  {
+    printf("{\"scenario\":\"%s\",\"ops\":%zu,\"mean_us\":%.1f,\"p50_us\":%.1f,"
+	   "\"p90_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f,\"ops_per_s\":%.1f,"
+	   "\"mb_per_s\":%.2f,\"send_us\":%.1f,\"poll_us\":%.1f,\"polls\":%.2f,"
+	   "\"recv_us\":%.1f,\"codec_us\":%.1f",
+	   res.name.c_str(), sorted.size(), mean, percentile(sorted, 50),
+	   percentile(sorted, 90), percentile(sorted, 99), sorted.back(), ops,
+	   mbs, send / n, poll / n, polls / n, recv / n, host);
+    if (alloc_available())
+    {
+      printf(",\"allocs_per_op\":%.1f,\"alloc_bytes_per_op\":%.1f,"
+	     "\"invokes_per_op\":%.2f,\"allocs_per_invoke\":%.1f,"
+	     "\"alloc_bytes_per_invoke\":%.1f,\"invoke_peak_bytes\":%llu",
+	     res.heap.allocs / n, res.heap.bytes / n, res.invoke.calls / n,
+	     res.invoke.allocs / invokes, res.invoke.bytes / invokes,
+	     (unsigned long long)res.invoke.peak);
+    }
+    printf("}\n");
+    return;
+  }
+
+  if (!header)
+  {
+    printf("%-16s %6s %9s %9s %9s %9s %9s %9s %8s | %8s %8s %6s %8s %8s\n",
+	   "scenario", "ops", "mean", "p50", "p90", "p99", "max", "ops/s", "MB/s",
+	   "send", "poll", "polls", "recv", "codec");
+    header = true;
+  }
+  printf("%-16s %6zu %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %8.2f | %8.1f %8.1f %6.2f %8.1f %8.1f\n",
+	 res.name.c_str(), sorted.size(), mean, percentile(sorted, 50),
+	 percentile(sorted, 90), percentile(sorted, 99), sorted.back(), ops,
+	 mbs, send / n, poll / n, polls / n, recv / n, host);
+  if (alloc_available())
+  {
+    printf("%-16s heap %.1f allocs (%.0f bytes) per op, %.1f allocs (%.0f bytes, "
+	   "peak %llu) per invoke\n", "", res.heap.allocs / n, res.heap.bytes / n,
+	   res.invoke.allocs / invokes, res.invoke.bytes / invokes,
+	   (unsigned long long)res.invoke.peak);
+  }
+}
+
+void usage()
+{
+  cerr << endl
+       << "Usage:" << endl
+       << "  tp_bench [opts] <drive> - Time operations on a TCG Opal drive" << endl
+       << "  tp_bench [opts] -s      - Time operations on an in-process simulated drive" << endl
+       << endl
+       << "Scenarios:" << endl
+       << "  discovery, login_anon, login, get, table_get - read only" << endl
+       << "  set, set_bin, genkey - overwrite global range ReadLocked, the Shadow MBR," << endl
+       << "                         and Locking_Range1's media key (erasing its data);" << endl
+       << "                         real drives run these only with --destructive" << endl
+       << endl
+       << "Times are in microseconds. Each operation is split into IF-SEND, polling" << endl
+       << "for the response, IF-RECV, and codec (everything else on the host)." << endl
+       << endl
+       << "Options:" << endl
+       << "  -s          - Simulated drive in this process (implies -I)" << endl
+       << "  -l <file>   - Latency profile for simulated drive" << endl
+       << "  -I          - Take ownership first (factory fresh drives only)" << endl
+       << "  -n <num>    - Iterations per scenario (default 100)" << endl
+       << "  -S <list>   - Comma separated scenarios to run (default all allowed)" << endl
+       << "  -D          - Also run scenarios that change the drive (--destructive)" << endl
+       << "  -b <list>   - Comma separated set_bin sizes (default 512,4096,32768,131072)" << endl
+       << "  -u <user>   - Specify user (default admin1)" << endl
+       << "  -p <pin>    - Provide PIN credentials (default \"bench\")" << endl
+       << "  -f <file>   - Read PIN credentials from file" << endl
+       << "  -j          - One JSON object per scenario" << endl
+       << "  -v          - Increase debug verbosity" << endl;
+}
+
+uint64_t get_uid(char const *user_str)
+{
+  uint64_t base = 0;
+  unsigned int num = 0;
+
+  // Users come in two patterns:
+  if (sscanf(user_str, "admin%u", &num) == 1)
+  {
+    base = ADMIN_BASE;
+  }
+  else if (sscanf(user_str, "user%u", &num) == 1)
+  {
+    base = USER_BASE;
+  }
+  else
+  {
+    // Illegal
+    throw topaz_exception("Illegal Locking SP user");
+  }
+
+  return base + num;
+}
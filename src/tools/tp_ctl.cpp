@@ -0,0 +1,128 @@
+/**
+ * Topaz Tools - Management Client
+ *
+ * Sends one request to topazd and prints its answer.
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <topaz/debug.h>
+#include <topaz/exceptions.h>
+#include <topaz/mgmt.h>
+#include "pinutil.h"
+using namespace std;
+using namespace topaz;
+
+void usage();
+
+int main(int argc, char **argv)
+{
+  char const *path = "/run/topazd.sock";
+  string request;
+  int c;
+
+  // Process command line switches
+  opterr = 0;
+  while ((c = getopt(argc, argv, "S:v")) != -1)
+  {
+    switch (c)
+    {
+      case 'S':
+	path = optarg;
+	break;
+
+      case 'v':
+	topaz_debug++;
+	break;
+
+      default:
+	cerr << "Invalid command line option " << (char)optopt << endl;
+	usage();
+	return -1;
+    }
+  }
+
+  if (optind >= argc)
+  {
+    cerr << "Invalid arguments" << endl;
+    usage();
+    return -1;
+  }
+
+  // Request words as given, PIN read from console if given as '-'
+  for (int i = optind; i < argc; i++)
+  {
+    string word = argv[i];
+    if ((i == optind + 3) && (word == "-"))
+    {
+      word = pin_from_console("current");
+    }
+    request += (i > optind ? " " : "") + mgmt_client::escape(word);
+  }
+
+  try
+  {
+    mgmt_client client(path);
+    string answer = client.call(request);
+    if (!answer.empty())
+    {
+      cout << answer << endl;
+    }
+  }
+  catch (topaz_exception &e)
+  {
+    cerr << "Error: " << e.what() << endl;
+    return -1;
+  }
+
+  return 0;
+}
+
+void usage()
+{
+  cerr << endl
+       << "Usage:" << endl
+       << "  tp_ctl [opts] <request> - Send request to topazd" << endl
+       << endl
+       << "Requests:" << endl
+       << "  list" << endl
+       << "  query <drive>" << endl
+       << "  range <drive> <auth> <pin> <range>" << endl
+       << "  setrange <drive> <auth> <pin> <range> <start> <length>" << endl
+       << "  lock <drive> <auth> <pin> <range>[,<range> ...]" << endl
+       << "  unlock <drive> <auth> <pin> <range>[,<range> ...]" << endl
+       << "  setpin <drive> <auth> <pin> <target auth> <new pin>" << endl
+       << "  logout <drive> <auth> <pin>" << endl
+       << endl
+       << "Authorities are admin<N>, user<N> or sid, range 0 is the global range." << endl
+       << "A PIN of '-' is read from the console." << endl
+       << endl
+       << "Options:" << endl
+       << "  -S <path> - Socket (default /run/topazd.sock)" << endl
+       << "  -v        - Increase debug verbosity" << endl;
+}
@@ -0,0 +1,312 @@
+/**
+ * Topaz Tools - Fleet Operations
+ *
+ * Runs one operation (probe, unlock, lock, PIN change or wipe) across many
+ * TCG Opal drives in parallel, optionally capping drives in flight per controller,
+ * then reports per-drive results and overall timing.
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <iostream>
+#include <iomanip>
+#include <signal.h>
+#include <unistd.h>
+#include <topaz/debug.h>
+#include <topaz/drive.h>
+#include <topaz/exceptions.h>
+#include <topaz/fleet.h>
+#include <topaz/uid.h>
+#include "pinutil.h"
+using namespace std;
+using namespace topaz;
+
+void ctl_c_handler(int sig);
+void usage();
+uint64_t get_uid(char const *user_str);
+void wipe_target(drive &target, uint64_t uid, string pin);
+
+int main(int argc, char **argv)
+{
+  string cur_pin, new_pin;
+  bool cur_pin_valid = false, new_pin_valid = false;
+  uint64_t user_uid = ADMIN_BASE + 1, wipe_uid = 0;
+  unsigned threads = 0, per_controller = 0;
+  int c;
+  
+  // Install handler for Ctl-C to restore terminal to sane state
+  signal(SIGINT, ctl_c_handler);
+  
+  // Process command line switches
+  opterr = 0;
+  while ((c = getopt(argc, argv, "j:c:u:p:f:n:s:P:v")) != -1)
+  {
+    switch (c)
+    {
+      case 'j':
+	threads = atoi(optarg);
+	break;
+	
+      case 'c':
+	per_controller = atoi(optarg);
+	break;
+	
+      case 'u':
+	user_uid = get_uid(optarg);
+	break;
+	
+      case 'p':
+	cur_pin = optarg;
+	cur_pin_valid = true;
+	break;
+	
+      case 'f':
+	cur_pin = pin_from_file(optarg);
+	cur_pin_valid = true;
+	break;
+	
+      case 'n':
+	new_pin = optarg;
+	new_pin_valid = true;
+	break;
+	
+      case 's':
+	// SID credentials
+	wipe_uid = SID;
+	cur_pin = optarg;
+	cur_pin_valid = true;
+	break;
+	
+      case 'P':
+	// PSID credentials (usually differ per drive, so rarely useful here)
+	wipe_uid = PSID;
+	cur_pin = optarg;
+	cur_pin_valid = true;
+	break;
+	
+      case 'v':
+	topaz_debug++;
+	break;
+	
+      default:
+	cerr << "Invalid command line option " << (char)optopt << endl;
+	usage();
+	return -1;
+    }
+  }
+  
+  // Operation, then drives
+  if ((argc - optind) < 2)
+  {
+    cerr << "Invalid number of arguments" << endl;
+    usage();
+    return -1;
+  }
+  string op = argv[optind];
+  if ((op != "probe") && (op != "unlock") && (op != "lock") &&
+      (op != "setpin") && (op != "wipe"))
+  {
+    cerr << "Unknown operation " << op << endl;
+    usage();
+    return -1;
+  }
+  
+  // Gather credentials once, up front, for the whole fleet
+  if ((op == "unlock") || (op == "lock") || (op == "setpin"))
+  {
+    if (!cur_pin_valid)
+    {
+      cur_pin = pin_from_console("current");
+    }
+    if ((op == "setpin") && (!new_pin_valid))
+    {
+      new_pin = pin_from_console("new");
+    }
+  }
+  
+  // Line up the drives
+  fleet pool(threads, per_controller);
+  for (int i = optind + 1; i < argc; i++)
+  {
+    pool.add(argv[i]);
+  }
+  
+  // Off they go
+  vector<fleet_result> results = pool.run([&](drive &target, fleet_result &result)
+  {
+    if (op == "probe")
+    {
+      // Opening the drive already ran discovery
+      result.note = "opal";
+    }
+    else if (op == "wipe")
+    {
+      wipe_target(target, wipe_uid, cur_pin);
+      result.note = "wiped";
+    }
+    else
+    {
+      target.login(LOCKING_SP, user_uid, cur_pin);
+      if (op == "setpin")
+      {
+	// Set PIN of current user in Locking SP
+	target.table_set(user_uid + (C_PIN_USER_BASE - USER_BASE), 3,
+			 atom::new_bin(new_pin.c_str()));
+	result.note = "pin changed";
+      }
+      else
+      {
+	uint64_t lock = (op == "lock" ? 1 : 0);
+	
+	// Global range, "Read Lock"(7) / "Write Lock"(8)
+	target.table_set(LBA_RANGE_GLOBAL, 7, lock);
+	target.table_set(LBA_RANGE_GLOBAL, 8, lock);
+	
+	// MBR shadow hidden when unlocked, shown when locked
+	target.table_set(MBR_CONTROL, 2, 1 - lock);
+	result.note = (lock ? "locked" : "unlocked");
+      }
+    }
+  });
+  
+  // Per drive report
+  for (size_t i = 0; i < results.size(); i++)
+  {
+    fleet_result const &res = results[i];
+    cout << left << setw(14) << res.path << " "
+	 << setw(8) << (res.ok ? "ok" : "FAILED") << " "
+	 << fixed << setprecision(1)
+	 << "queue " << setw(8) << res.queue_ms << " "
+	 << "open " << setw(8) << res.open_ms << " "
+	 << "run " << setw(8) << res.run_ms << " "
+	 << (res.ok ? res.note : res.error) << endl;
+  }
+  
+  // Aggregate
+  fleet_summary const &sum = pool.summary();
+  cout << endl
+       << sum.ok << " ok, " << sum.failed << " failed in " << sum.wall_ms << " ms"
+       << " (slowest drive " << sum.slowest_ms << " ms, serial estimate "
+       << sum.busy_ms << " ms)" << endl;
+  for (map<string, unsigned>::const_iterator it = sum.peak.begin(); it != sum.peak.end(); it++)
+  {
+    cout << "  " << it->first << ": peak " << it->second << " in flight" << endl;
+  }
+  
+  return (sum.failed ? 1 : 0);
+}
+
+void ctl_c_handler(int sig)
+{
+  // Make sure this is on when program terminates
+  enable_terminal_echo();
+  exit(0);
+}
+
+void usage()
+{
+  cerr << endl
+       << "Usage:" << endl
+       << "  tp_fleet [opts] <op> <drive> [drive ...] - Operate on many TCG Opal drives" << endl
+       << endl
+       << "Operations:" << endl
+       << "  probe  - Open each drive (discovery) and report timing" << endl
+       << "  unlock - Unlock global range, hide MBR shadow" << endl
+       << "  lock   - Lock global range, show MBR shadow" << endl
+       << "  setpin - Change PIN of user" << endl
+       << "  wipe   - Cryptographic wipe (Admin SP revert)" << endl
+       << endl
+       << "Options:" << endl
+       << "  -j <num>  - Worker threads (default one per drive)" << endl
+       << "  -c <num>  - Max drives in flight per SCSI host (default 0 - no cap)" << endl
+       << "  -u <user> - Specify user (default admin1)" << endl
+       << "  -p <pin>  - Provide PIN credentials" << endl
+       << "  -f <file> - Read PIN credentials from file" << endl
+       << "  -n <pin>  - Provide new PIN (setpin)" << endl
+       << "  -s <pin>  - Use SID credentials for wipe (default MSID)" << endl
+       << "  -P <pin>  - Use PSID credentials for wipe" << endl
+       << "  -v        - Increase debug verbosity" << endl;
+}
+
+uint64_t get_uid(char const *user_str)
+{
+  uint64_t base = 0;
+  unsigned int num = 0;
+  
+  // Users come in two patterns:
+  if (sscanf(user_str, "admin%u", &num) == 1)
+  {
+    base = ADMIN_BASE;
+  }
+  else if (sscanf(user_str, "user%u", &num) == 1)
+  {
+    base = USER_BASE;
+  }
+  else
+  {
+    // Illegal
+    throw topaz_exception("Illegal Locking SP user");
+  }
+  
+  return base + num;
+}
+
+// Same sequence as tp_wipe
+void wipe_target(drive &target, uint64_t uid, string pin)
+{
+  // If no credentials specified, assume
+  // Manufactured default SID (MSID) PIN
+  if (uid == 0)
+  {
+    target.login_anon(ADMIN_SP);
+    uid = SID;
+    pin = target.default_pin();
+  }
+  target.login(ADMIN_SP, uid, pin);
+  
+  // Locking_SP in any state other than Manufactured-Inactive(8)?
+  bool lock_active = target.table_get(LOCKING_SP, 6).get_uint() != 8;
+  
+  // PSID revert either finishes the job, or resets SID to MSID
+  if (uid == PSID)
+  {
+    target.admin_sp_revert();
+    if (lock_active)
+    {
+      return;
+    }
+    target.login_anon(ADMIN_SP);
+    target.login(ADMIN_SP, SID, target.default_pin());
+  }
+  
+  // Revert only wipes with Locking_SP active
+  if (!lock_active)
+  {
+    target.invoke(LOCKING_SP, ACTIVATE);
+  }
+  target.admin_sp_revert();
+}
@@ -30,39 +30,53 @@
 
 #include <unistd.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <cstdio>
 #include <cstring>
 #include <ctype.h>
 #include <iostream>
 #include <iomanip>
+#include <topaz/batch.h>
 #include <topaz/debug.h>
+#include <topaz/desired.h>
 #include <topaz/drive.h>
 #include <topaz/exceptions.h>
 #include <topaz/uid.h>
 #include "spinner.h"
 #include "pinutil.h"
+#include "script.h"
 using namespace std;
 using namespace topaz;
 
 void ctl_c_handler(int sig);
 void usage();
-bool require_args(int min, int passed);
 uint64_t range_id_to_uid(uint64_t id);
 char const *key_uid_to_str(uint64_t uid);
 char const *key_mode_to_str(uint64_t mode);
 uint64_t get_uid(char const *user_str);
 uint64_t get_max_lba_ranges(drive &target);
+string check_command(vector<string> const &args);
+bool needs_flush(vector<string> const &args);
+void run_command(drive &target, call_batch &batch, script_cmd const &cmd,
+		 uint64_t user_uid, string &new_pin, bool new_pin_valid);
 void query_acct(drive &target, uint64_t uid, char const *name, int num);
 void query_range(drive &target, uint64_t id);
-void lock_ctl(drive &target, uint64_t id, bool on_reset, bool rd_lock, bool wr_lock);
-void range_ctl(drive &target, uint64_t id, uint64_t first, uint64_t last);
-void wipe_range(drive &target, uint64_t id);
+void lock_ctl(call_batch &batch, uint64_t id, bool on_reset, bool rd_lock, bool wr_lock,
+	      string const &label);
+void range_ctl(call_batch &batch, uint64_t id, uint64_t first, uint64_t last,
+	       string const &label);
+void mbr_load(drive &target, char const *path);
+void wipe_ranges(drive &target, vector<uint64_t> const &ids);
 
 int main(int argc, char **argv)
 {
   string cur_pin, new_pin;
   bool cur_pin_valid = false, new_pin_valid = false;
-  uint64_t user_uid = ADMIN_BASE + 1, range_id, start, size;
+  uint64_t user_uid = ADMIN_BASE + 1;
+  vector<script_cmd> script;
+  bool from_stdin = false;
   char c;
   
   // Install handler for Ctl-C to restore terminal to sane state
@@ -124,12 +138,58 @@ int main(int argc, char **argv)
     return -1;
   }
   
+  // Command(s) to run, all checked before the drive is touched
+  try
+  {
+    if (strcmp(argv[optind + 1], "script") == 0)
+    {
+      if ((argc - optind) != 3)
+      {
+	cerr << "Script mode takes one script file (- for stdin)" << endl;
+	usage();
+	return -1;
+      }
+      from_stdin = (strcmp(argv[optind + 2], "-") == 0);
+      if (from_stdin && !cur_pin_valid)
+      {
+	cerr << "Current PIN must be given with -p or -P to read script from stdin" << endl;
+	return -1;
+      }
+      script = read_script(argv[optind + 2]);
+    }
+    else
+    {
+      script.push_back(command_line(argc - optind - 1, argv + optind + 1));
+    }
+  }
+  catch (topaz_exception &e)
+  {
+    cerr << e.what() << endl;
+    return -1;
+  }
+  for (size_t i = 0; i < script.size(); i++)
+  {
+    string problem = check_command(script[i].args);
+
+    // Console is the script, the PIN would be read from it
+    if (problem.empty() && from_stdin && !new_pin_valid &&
+	(script[i].args[0] == "setpin") && (script[i].args.size() == 1))
+    {
+      problem = "New PIN must be given inline or with -n or -N to read script from stdin";
+    }
+    if (!problem.empty())
+    {
+      cerr << (script[i].line ? script[i].label + ": " : "") << problem << endl;
+      usage();
+      return -1;
+    }
+  }
+  
   // Open the device
   try
   {
     // Open the device
     drive target(argv[optind]);
-    uint64_t max_range, i;
     
     // Query pin if not yet specified
     if (!cur_pin_valid)
@@ -137,36 +197,138 @@ int main(int argc, char **argv)
       cur_pin = pin_from_console("current");
     }
     
-    // Login
+    // Login, once for all commands
     target.login(LOCKING_SP, user_uid, cur_pin);
     
-    ////
-    // Determine our operation
-    //
+    // Table changes are queued and go out together (a Set per object),
+    // when a command needs to see the drive or after the last command
+    call_batch batch(target);
+    io_counters used;
+    {
+      io_scope scope(target, &used);
+      for (size_t i = 0; i < script.size(); i++)
+      {
+	if (needs_flush(script[i].args))
+	{
+	  batch.flush();
+	}
+	run_command(target, batch, script[i], user_uid, new_pin, new_pin_valid);
+      }
+      batch.flush();
+    }
+    TOPAZ_DEBUG(1) printf("%u commands, %lu method calls in %lu IF-SEND\n",
+			  (unsigned)script.size(), (unsigned long)used.methods,
+			  (unsigned long)used.if_sends);
+  }
+  catch (topaz_exception &e)
+  {
+    cerr << "Exception raised: " << e.what() << endl;
+    return -1;
+  }
+  
+  return 0;
+}
+
+// Problem with command, empty if none
+string check_command(vector<string> const &args)
+{
+  string const &cmd = args[0];
+  size_t count = args.size();
+  
+  if ((cmd == "users") || (cmd == "ranges"))
+  {
+    return "";
+  }
+  else if (cmd == "setpin")
+  {
+    return (count <= 2 ? "" : "Too many arguments to setpin");
+  }
+  else if (cmd == "mbr")
+  {
+    if (count < 2)
+    {
+      return "Insufficient arguments";
+    }
+    if ((args[1] != "enable") && (args[1] != "disable") &&
+	(args[1] != "hide") && (args[1] != "unhide"))
+    {
+      return "Unknown MBR command";
+    }
+    return "";
+  }
+  else if ((cmd == "mbr_load") || (cmd == "wipe") ||
+	   (cmd == "lock_on_reset") || (cmd == "wr_lock_on_reset") ||
+	   (cmd == "unlock_on_reset") || (cmd == "lock") ||
+	   (cmd == "wr_lock") || (cmd == "unlock"))
+  {
+    return (count >= 2 ? "" : "Insufficient arguments");
+  }
+  else if (cmd == "setrange")
+  {
+    return (count >= 4 ? "" : "Insufficient arguments");
+  }
+  else if ((cmd == "apply") || (cmd == "plan"))
+  {
+    if (count != 2)
+    {
+      return "Insufficient arguments";
+    }
     
+    // Document is read again when run, problems show up now
+    try
+    {
+      desired_state state;
+      state.load(args[1]);
+    }
+    catch (topaz_exception &e)
+    {
+      return e.what();
+    }
+    return "";
+  }
+  return "Unknown comand " + cmd;
+}
+
+// Does command read the drive, or do more than set table cells?
+bool needs_flush(vector<string> const &args)
+{
+  return ((args[0] == "users") || (args[0] == "ranges") ||
+	  (args[0] == "mbr_load") || (args[0] == "wipe") ||
+	  (args[0] == "apply") || (args[0] == "plan"));
+}
+
+// Run one (checked) command, queueing table changes on batch
+void run_command(drive &target, call_batch &batch, script_cmd const &cmd,
+		 uint64_t user_uid, string &new_pin, bool new_pin_valid)
+{
+  vector<string> const &args = cmd.args;
+  uint64_t max_range, i;
+  
+  try
+  {
     // Change PIN
-    if (strcmp(argv[optind + 1], "setpin") == 0)
+    if (args[0] == "setpin")
     {
       // Identify C_PIN table UID for user's UID
       uint64_t pin_uid = user_uid + (C_PIN_USER_BASE - USER_BASE);
+      string pin = new_pin;
       
-      // If new PIN not specified, get it now
-      if (!new_pin_valid)
+      // PIN from script, options, or console
+      if (args.size() > 1)
       {
-	new_pin = pin_from_console("new");
+	pin = args[1];
+      }
+      else if (!new_pin_valid)
+      {
+	pin = pin_from_console("new");
       }
-      
-      // Convert PIN to atom for table I/O
-      atom new_pin_atom = atom::new_bin(new_pin.c_str());
       
       // Set PIN of current user in Locking SP
-      target.table_set(pin_uid, 3, new_pin_atom);
+      batch.set(pin_uid, 3, atom::new_bin(pin.c_str()), cmd.label);
     }
     // Display available users
-    else if (strcmp(argv[optind + 1], "users") == 0)
+    else if (args[0] == "users")
     {
-      uint64_t i;
-      
       // Current admin accounts
       for (i = 1; i <= target.get_max_admins(); i++)
       {
@@ -180,97 +342,32 @@ int main(int argc, char **argv)
       }
     }
     // MBR stuff
-    else if  (strcmp(argv[optind + 1], "mbr") == 0)
+    else if (args[0] == "mbr")
     {
-      if (require_args(3, argc - optind))
+      // MBR Ctl columns "Enable(1)" and "Done(2)"
+      if (args[1] == "enable")
       {
-	if (strcmp(argv[optind + 2], "enable") == 0)
-	{
-	  // Set MBR Ctl column "Enable(1)" to 1
-	  target.table_set(MBR_CONTROL, 1, 1);
-	}
-	else if (strcmp(argv[optind + 2], "disable") == 0)
-	{
-	  // Set MBR Ctl column "Enable(1)" to 0
-	  target.table_set(MBR_CONTROL, 1, 0);
-	}
-	else if (strcmp(argv[optind + 2], "hide") == 0)
-	{
-	  // Set MBR Ctl column "Done(2)" to 1
-	  target.table_set(MBR_CONTROL, 2, 1);
-	}
-	else if (strcmp(argv[optind + 2], "unhide") == 0)
-	{
-	  // Set MBR Ctl column "Done(2)" to 0
-	  target.table_set(MBR_CONTROL, 2, 0);
-	}
-	else
-	{
-	  // ??
-	  throw topaz_exception("Unknown MBR command");
-	}
+	batch.set(MBR_CONTROL, 1, 1, cmd.label);
       }
-    }
-    // MBR stuff
-    else if  (strcmp(argv[optind + 1], "mbr_load") == 0)
-    {
-      if (require_args(3, argc - optind))
+      else if (args[1] == "disable")
       {
-	size_t mbr_max = 128 * 1024 * 1024; // Maximum size of MBR (hardcode for now)
-	size_t xfer_max = 32 * 512;         // Maximum transfer size
-	size_t file_len; //, xfer_start = 0;
-	
-	// Open up input file
-	FILE *ifile = fopen(argv[optind + 2], "r");
-	if (ifile == NULL)
-	{
-	  throw topaz_exception("Cannot open input file for MBR shadow");
-	}
-	
-	// Verify size of file
-	fseek(ifile, 0, SEEK_END);
-	file_len = ftell(ifile);
-	fseek(ifile, 0, SEEK_SET);
-	if (file_len > mbr_max)
-	{
-	  throw topaz_exception("Input file too large for MBR shadow");
-	}
-	
-	// Count how many transfers are needed for write
-	size_t xfer_count = 1 + (file_len - 1) / xfer_max;
-	printf("Transfer will require %u block operations ...\n",
-	       (unsigned int)xfer_count);
-	
-	// Allocate space
-	char *xfer_data = new char[xfer_max];
-	
-	// Visual feedback
-	spinner spin(xfer_count);
-	
-	// Do the transfer
-	for (size_t xfer_num = 0; xfer_num < xfer_count; xfer_num++)
-	{
-	  // Read the data out of the file
-	  int rc = fread(xfer_data, 1, xfer_max, ifile);
-	  if (rc < 1)
-	  {
-	    delete [] xfer_data;
-	    throw topaz_exception("Invalid read on MBR input file");
-	  }
-	  
-	  // Flush data to MBR shadow
-	  target.table_set_bin(MBR_UID, xfer_num * xfer_max, xfer_data, rc);
-	  
-	  // Visual feedback
-	  spin.tick();
-	}
-	
-	// Cleanup
-	delete [] xfer_data;
+	batch.set(MBR_CONTROL, 1, 0, cmd.label);
+      }
+      else if (args[1] == "hide")
+      {
+	batch.set(MBR_CONTROL, 2, 1, cmd.label);
+      }
+      else if (args[1] == "unhide")
+      {
+	batch.set(MBR_CONTROL, 2, 0, cmd.label);
       }
     }
+    else if (args[0] == "mbr_load")
+    {
+      mbr_load(target, args[1].c_str());
+    }
     // Display locking ranges
-    else if (strcmp(argv[optind + 1], "ranges") == 0)
+    else if (args[0] == "ranges")
     {
       // Column headers
       cout << "Range\tCipher\tMode\tLock\t Start       Size        Last" << endl;
@@ -280,86 +377,88 @@ int main(int argc, char **argv)
 	query_range(target, i);
       }
     }
-    else if (strcmp(argv[optind + 1], "lock_on_reset") == 0)
+    else if (args[0] == "lock_on_reset")
     {
-      if (require_args(3, argc - optind))
-      {
-	range_id = atoi(argv[optind + 2]);
-	lock_ctl(target, range_id, true, true, true);
-      }
+      lock_ctl(batch, atoi(args[1].c_str()), true, true, true, cmd.label);
     }
-    else if (strcmp(argv[optind + 1], "wr_lock_on_reset") == 0)
+    else if (args[0] == "wr_lock_on_reset")
     {
-      if (require_args(3, argc - optind))
-      {
-	range_id = atoi(argv[optind + 2]);
-	lock_ctl(target, range_id, true, false, true);
-      }
+      lock_ctl(batch, atoi(args[1].c_str()), true, false, true, cmd.label);
     }
-    else if (strcmp(argv[optind + 1], "unlock_on_reset") == 0)
+    else if (args[0] == "unlock_on_reset")
     {
-      if (require_args(3, argc - optind))
-      {
-	range_id = atoi(argv[optind + 2]);
-	lock_ctl(target, range_id, true, false, false);
-      }
+      lock_ctl(batch, atoi(args[1].c_str()), true, false, false, cmd.label);
     }
-    else if (strcmp(argv[optind + 1], "lock") == 0)
+    else if (args[0] == "lock")
     {
-      if (require_args(3, argc - optind))
-      {
-	range_id = atoi(argv[optind + 2]);
-	lock_ctl(target, range_id, false, true, true);
-      }
+      lock_ctl(batch, atoi(args[1].c_str()), false, true, true, cmd.label);
     }
-    else if (strcmp(argv[optind + 1], "wr_lock") == 0)
+    else if (args[0] == "wr_lock")
     {
-      if (require_args(3, argc - optind))
-      {
-	range_id = atoi(argv[optind + 2]);
-	lock_ctl(target, range_id, false, false, true);
-      }
+      lock_ctl(batch, atoi(args[1].c_str()), false, false, true, cmd.label);
     }
-    else if (strcmp(argv[optind + 1], "unlock") == 0)
+    else if (args[0] == "unlock")
     {
-      if (require_args(3, argc - optind))
-      {
-	range_id = atoi(argv[optind + 2]);
-	lock_ctl(target, range_id, false, false, false);
-      }
+      lock_ctl(batch, atoi(args[1].c_str()), false, false, false, cmd.label);
     }
-    else if (strcmp(argv[optind + 1], "setrange") == 0)
+    else if (args[0] == "setrange")
     {
-      if (require_args(5, argc - optind))
-      {
-	range_id = atoi(argv[optind + 2]);
-	start    = atoi(argv[optind + 3]);
-	size     = atoi(argv[optind + 4]);
-	range_ctl(target, range_id, start, size);
-      }
+      range_ctl(batch, atoi(args[1].c_str()), atoi(args[2].c_str()),
+		atoi(args[3].c_str()), cmd.label);
     }
-    else if (strcmp(argv[optind + 1], "wipe") == 0)
+    else if (args[0] == "wipe")
     {
-      if (require_args(3, argc - optind))
+      vector<uint64_t> ids;
+      if (args[1] == "all")
       {
-	range_id = atoi(argv[optind + 2]);
-	wipe_range(target, range_id);
+	max_range = get_max_lba_ranges(target);
+	for (i = 0; i <= max_range; i++)
+	{
+	  ids.push_back(i);
+	}
+      }
+      else
+      {
+	for (size_t arg = 1; arg < args.size(); arg++)
+	{
+	  ids.push_back(atoi(args[arg].c_str()));
+	}
       }
+      wipe_ranges(target, ids);
     }
-    else
+    // Desired state, setting only cells that differ ("plan" sets nothing)
+    else if ((args[0] == "apply") || (args[0] == "plan"))
     {
-      // Nada
-      cerr << "Unknown comand " << argv[optind + 1] << endl;
-      usage();
-      return -1;
+      desired_state state;
+      state.load(args[1]);
+      vector<state_change> changes = state.apply(target, args[0] == "plan");
+      for (i = 0; i < changes.size(); i++)
+      {
+	state_change const &change = changes[i];
+	cout << change.label << ": ";
+	if (change.current.get_type() == atom::EMPTY)
+	{
+	  cout << "(not read)";
+	}
+	else
+	{
+	  cout << change.current.get_uint();
+	}
+	cout << " -> " << change.desired.get_uint() << endl;
+      }
+      cout << changes.size() << " of " << state.size() << " cells "
+	   << (args[0] == "plan" ? "to change" : "changed") << endl;
     }
   }
   catch (topaz_exception &e)
   {
-    cerr << "Exception raised: " << e.what() << endl;
+    // Say which line of a script failed
+    if (cmd.line)
+    {
+      throw topaz_exception(cmd.label + ": " + e.what());
+    }
+    throw;
   }
-  
-  return 0;
 }
 
 void ctl_c_handler(int sig)
@@ -386,8 +485,21 @@ void usage()
        << "  tp_lock [opts] <drive> unlock_on_reset <range> - Disable Lock on range" << endl
        << "  tp_lock [opts] <drive> lock <range>            - Lock range (until reset)" << endl
        << "  tp_lock [opts] <drive> unlock <range>          - Unlock range (until reset)" << endl
-    
+       << "  tp_lock [opts] <drive> wipe <range> [range..]  - Crypto erase range(s)" << endl
+       << "  tp_lock [opts] <drive> wipe all                - Crypto erase all ranges" << endl
+       << "  tp_lock [opts] <drive> setrange <range> <first> <last> - Set range LBAs" << endl
+       << "  tp_lock [opts] <drive> plan <file>             - Show cells desired state changes" << endl
+       << "  tp_lock [opts] <drive> apply <file>            - Set cells that differ from desired state" << endl
+       << "  tp_lock [opts] <drive> script <file>           - Run commands from file (- stdin)" << endl
        << endl
+       << "Scripts hold one command per line, as above without 'tp_lock [opts] <drive>'" << endl
+       << "('setpin [new pin]' takes the new PIN inline), '#' starts a comment. All" << endl
+       << "commands run in one session, table changes are sent together. Scripts" << endl
+       << "run in the Locking SP only, Admin SP commands go in a tp_admin script." << endl
+       << "Desired state files hold one object per line (see topaz/desired.h), eg -" << endl
+       << "  range 1 start=2048 length=1048576 read_lock_enabled=1 write_lock_enabled=1" << endl
+       << "  mbr enable=0" << endl
+       << "  user1 enabled=1" << endl
        << "Options:" << endl
        << "  -p <pin>  - Provide current SID PIN" << endl
        << "  -P <file> - Read current PIN from file" << endl
@@ -396,20 +508,6 @@ void usage()
        << "  -v        - Increase debug verbosity" << endl;
 }
 
-bool require_args(int min, int passed)
-{
-  if (passed < min)
-  {
-    cerr << "Insufficient arguments" << endl;
-    usage();
-    return false;
-  }
-  else
-  {
-    return true;
-  }
-}
-
 uint64_t range_id_to_uid(uint64_t id)
 {
   if (id == 0)
@@ -613,7 +711,8 @@ void query_range(drive &target, uint64_t id)
   cout << std::right << endl;
 }
 
-void lock_ctl(drive &target, uint64_t id, bool on_reset, bool rd_lock, bool wr_lock)
+void lock_ctl(call_batch &batch, uint64_t id, bool on_reset, bool rd_lock, bool wr_lock,
+	      string const &label)
 {
   uint64_t col_base;
   
@@ -630,29 +729,128 @@ void lock_ctl(drive &target, uint64_t id, bool on_reset, bool rd_lock, bool wr_l
   }
   
   // Enable locks
-  target.table_set(range_id_to_uid(id), col_base + 0, rd_lock);
-  target.table_set(range_id_to_uid(id), col_base + 1, wr_lock);
+  batch.set(range_id_to_uid(id), col_base + 0, rd_lock, label);
+  batch.set(range_id_to_uid(id), col_base + 1, wr_lock, label);
 }
 
-void range_ctl(drive &target, uint64_t id, uint64_t first, uint64_t last)
+void range_ctl(call_batch &batch, uint64_t id, uint64_t first, uint64_t last,
+	       string const &label)
 {
   uint64_t size = last + 1 - first;
   
   // Set range boundaries
-  target.table_set(range_id_to_uid(id), 3, first);
-  target.table_set(range_id_to_uid(id), 4, size);
+  batch.set(range_id_to_uid(id), 3, first, label);
+  batch.set(range_id_to_uid(id), 4, size, label);
+}
+
+void mbr_load(drive &target, char const *path)
+{
+  size_t mbr_max = 128 * 1024 * 1024; // Maximum size of MBR (hardcode for now)
+  size_t xfer_max = 32 * 512;         // Maximum transfer size
+  size_t file_len;
+  struct stat info;
+  
+  // Open up input file
+  int ifd = open(path, O_RDONLY);
+  if (ifd == -1)
+  {
+    throw topaz_exception("Cannot open input file for MBR shadow");
+  }
+  
+  // Verify size of file
+  if (fstat(ifd, &info) != 0)
+  {
+    close(ifd);
+    throw topaz_exception("Cannot query input file for MBR shadow");
+  }
+  file_len = info.st_size;
+  if (file_len > mbr_max)
+  {
+    close(ifd);
+    throw topaz_exception("Input file too large for MBR shadow");
+  }
+  
+  // Map the file, so data is only copied once (straight into ComPkt)
+  char const *file_data = (char const*)mmap(NULL, file_len, PROT_READ,
+					    MAP_PRIVATE, ifd, 0);
+  close(ifd);
+  if (file_data == MAP_FAILED)
+  {
+    throw topaz_exception("Cannot map input file for MBR shadow");
+  }
+  
+  // Count how many transfers are needed for write
+  size_t xfer_count = 1 + (file_len - 1) / xfer_max;
+  printf("Transfer will require %u block operations ...\n",
+         (unsigned int)xfer_count);
+  
+  // Visual feedback
+  spinner spin(xfer_count);
+  
+  // Do the transfer
+  try
+  {
+    for (size_t xfer_num = 0; xfer_num < xfer_count; xfer_num++)
+    {
+      size_t offset = xfer_num * xfer_max;
+      size_t rc = (file_len - offset < xfer_max ? file_len - offset : xfer_max);
+      
+      // Flush data to MBR shadow
+      target.table_set_bin(MBR_UID, offset, file_data + offset, rc);
+      
+      // Visual feedback
+      spin.tick();
+    }
+  }
+  catch (topaz_exception &e)
+  {
+    munmap((void*)file_data, file_len);
+    throw;
+  }
+  
+  // Cleanup
+  munmap((void*)file_data, file_len);
 }
 
-void wipe_range(drive &target, uint64_t id)
+void wipe_ranges(drive &target, vector<uint64_t> const &ids)
 {
-  uint64_t range_uid, key_uid;
+  vector<uint64_t> range_uids;
+  vector<unsigned> status;
+  bool failed = false;
   
-  // UID of desired range
-  range_uid = range_id_to_uid(id);
+  // UIDs of desired ranges
+  for (size_t i = 0; i < ids.size(); i++)
+  {
+    range_uids.push_back(range_id_to_uid(ids[i]));
+  }
   
-  // Find UID of range's crypto key
-  key_uid = target.table_get(range_uid, 10).get_uid();
+  // Key lookups and Key.GENKEY[] calls batched -> Crypto scramble
+  status = target.erase_ranges(range_uids);
   
-  // Key.GENKEY[] -> Crypto scramble
-  target.invoke(key_uid, GENKEY);
+  // Report per range
+  for (size_t i = 0; i < ids.size(); i++)
+  {
+    cout << "Range " << ids[i] << ": ";
+    if (status[i] == drive::STA_INCOMPLETE)
+    {
+      cout << "not completed before deadline" << endl;
+    }
+    else if (status[i] == drive::STA_NO_KEY)
+    {
+      cout << "failed (no media key)" << endl;
+    }
+    else if (status[i])
+    {
+      cout << "failed (status " << status[i] << ")" << endl;
+    }
+    else
+    {
+      cout << "wiped" << endl;
+    }
+    failed = failed || status[i];
+  }
+  if (failed)
+  {
+    throw topaz_exception("Not all ranges wiped");
+  }
 }
@@ -0,0 +1,702 @@
+/**
+ * Topaz Tools - Fleet Scalability Benchmark
+ *
+ * Drives N devices (real or simulated) from M threads, with K sessions per
+ * device, running a mixed Get / Set / unlock workload for a fixed time.
+ * Every combination of the given N, M and K is run, and each reports
+ * aggregate throughput, latency percentiles, time spent waiting for the
+ * device lock, session hand-offs and CPU time per operation, so scaling
+ * regressions in the session and transport layers show up run to run.
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <signal.h>
+#include <sstream>
+#include <thread>
+#include <getopt.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <topaz/debug.h>
+#include <topaz/drive.h>
+#include <topaz/exceptions.h>
+#include <topaz/simdrive.h>
+#include <topaz/uid.h>
+#include "pinutil.h"
+using namespace std;
+using namespace topaz;
+
+typedef chrono::steady_clock bench_clock;
+
+// Workload operations
+enum op_kind
+{
+  OP_GET,     // Get ReadLocked of global range
+  OP_SET,     // Set ReadLocked of first range
+  OP_UNLOCK,  // Own session: login, unlock first range, logout
+  OP_KINDS
+};
+
+char const *op_names[OP_KINDS] = { "get", "set", "unlock" };
+
+// Ctl-C / kill seen, finish up and put lock state back
+atomic<bool> stopping(false);
+
+struct session_slot;
+
+// One device, shared by its sessions (the TPer runs one session at a time)
+struct device_slot
+{
+  unique_ptr<transport> io;
+  mutex                 lock;
+  session_slot         *active;  // Session logged in, if any
+  uint64_t              locked[2];  // First range Read/WriteLocked before the run
+  bool                  saved;
+};
+
+// One host session handle on a device
+struct session_slot
+{
+  device_slot          *dev;
+  unique_ptr<drive>     target;
+};
+
+// What one worker thread saw
+typedef struct
+{
+  vector<double> lat_us;     // Per operation, including wait for device
+  double         wait_us;    // Waiting for device lock
+  double         max_wait_us;
+  uint64_t       contended;  // Device lock was already held
+  uint64_t       switches;   // Session logins to take over device
+  uint64_t       errors;
+  uint64_t       ops[OP_KINDS];
+} worker_stats;
+
+// Zeroed counters
+void clear(worker_stats &stats)
+{
+  stats.lat_us.clear();
+  stats.wait_us = stats.max_wait_us = 0;
+  stats.contended = stats.switches = stats.errors = 0;
+  memset(stats.ops, 0, sizeof(stats.ops));
+}
+
+// One point of the N x M x K sweep
+typedef struct
+{
+  unsigned drives;
+  unsigned threads;
+  unsigned sessions;
+  double   seconds;
+  double   cpu_us;           // User + system, whole process
+  worker_stats total;
+} scale_result;
+
+void stop_handler(int sig);
+void usage();
+uint64_t get_uid(char const *user_str);
+vector<unsigned> parse_list(char const *str);
+void take_ownership(drive &target, string const &pin);
+void save_locks(device_slot &dev, uint64_t user_uid, string const &pin);
+void restore_locks(vector<unique_ptr<device_slot> > &devs, uint64_t user_uid,
+		   string const &pin);
+void run_point(vector<unique_ptr<device_slot> > &devs, unsigned drives,
+	       unsigned threads, unsigned sessions, double seconds,
+	       unsigned const *mix, uint64_t user_uid, string const &pin,
+	       scale_result &res);
+void report(scale_result &res, bool json);
+
+static struct option const long_opts[] =
+{
+  {"destructive", no_argument, NULL, 'D'},
+  {NULL,          0,           NULL, 0}
+};
+
+int main(int argc, char **argv)
+{
+  string pin = "bench";
+  char const *profile = NULL;
+  uint64_t user_uid = ADMIN_BASE + 1;
+  vector<unsigned> drive_list, thread_list(1, 1), session_list(1, 1);
+  unsigned sim_count = 0, mix[OP_KINDS] = { 70, 20, 10 };
+  double seconds = 2;
+  bool init = false, json = false, destructive = false, mixed = false;
+  sim_latency lat;
+  int c;
+
+  // Process command line switches
+  opterr = 0;
+  while ((c = getopt_long(argc, argv, "s:l:IN:M:K:t:w:u:p:f:jDv", long_opts, NULL)) != -1)
+  {
+    switch (c)
+    {
+      case 's':
+	sim_count = atoi(optarg);
+	break;
+
+      case 'l':
+	profile = optarg;
+	break;
+
+      case 'I':
+	init = true;
+	break;
+
+      case 'N':
+	drive_list = parse_list(optarg);
+	break;
+
+      case 'M':
+	thread_list = parse_list(optarg);
+	break;
+
+      case 'K':
+	session_list = parse_list(optarg);
+	break;
+
+      case 't':
+	seconds = atof(optarg);
+	break;
+
+      case 'w':
+	{
+	  // get=70,set=20,unlock=10 (omitted operations don't run)
+	  stringstream list(optarg);
+	  string item;
+	  memset(mix, 0, sizeof(mix));
+	  while (getline(list, item, ','))
+	  {
+	    size_t eq = item.find('=');
+	    string name = item.substr(0, eq);
+	    unsigned kind;
+	    for (kind = 0; (kind < OP_KINDS) && (name != op_names[kind]); kind++);
+	    if ((kind == OP_KINDS) || (eq == string::npos))
+	    {
+	      cerr << "Invalid workload mix " << optarg << endl;
+	      usage();
+	      return -1;
+	    }
+	    mix[kind] = atoi(item.c_str() + eq + 1);
+	  }
+	  mixed = true;
+	}
+	break;
+
+      case 'u':
+	user_uid = get_uid(optarg);
+	break;
+
+      case 'p':
+	pin = optarg;
+	break;
+
+      case 'f':
+	pin = pin_from_file(optarg);
+	break;
+
+      case 'j':
+	json = true;
+	break;
+
+      case 'D':
+	destructive = true;
+	break;
+
+      case 'v':
+	topaz_debug++;
+	break;
+
+      default:
+	cerr << "Invalid command line option " << (char)optopt << endl;
+	usage();
+	return -1;
+    }
+  }
+
+  // Lock state of real drives is only touched when asked to
+  if (sim_count)
+  {
+    destructive = true;
+  }
+  if (!destructive && (mix[OP_SET] || mix[OP_UNLOCK]))
+  {
+    if (mixed)
+    {
+      cerr << "Workload set / unlock change the drive, needs --destructive" << endl;
+      return -1;
+    }
+    cerr << "Skipping set, unlock (they change the drive, see --destructive)" << endl;
+    mix[OP_SET] = mix[OP_UNLOCK] = 0;
+  }
+
+  // Drives, unless simulated in process
+  size_t available = (sim_count ? sim_count : argc - optind);
+  if ((sim_count && (argc != optind)) || !available || (seconds <= 0) ||
+      !(mix[OP_GET] + mix[OP_SET] + mix[OP_UNLOCK]))
+  {
+    cerr << "Invalid arguments" << endl;
+    usage();
+    return -1;
+  }
+  if (drive_list.empty())
+  {
+    drive_list.push_back(available);
+  }
+  if (*max_element(drive_list.begin(), drive_list.end()) > available ||
+      !*min_element(drive_list.begin(), drive_list.end()) ||
+      !*min_element(thread_list.begin(), thread_list.end()) ||
+      !*min_element(session_list.begin(), session_list.end()))
+  {
+    cerr << "Invalid drive, thread or session count" << endl;
+    usage();
+    return -1;
+  }
+
+  // Devices are opened once, and kept across the sweep
+  vector<unique_ptr<device_slot> > devs;
+  try
+  {
+    if (profile)
+    {
+      lat.load(profile);
+    }
+    for (size_t i = 0; i < available; i++)
+    {
+      devs.push_back(unique_ptr<device_slot>(new device_slot()));
+      devs[i]->active = NULL;
+      devs[i]->saved = false;
+      if (sim_count)
+      {
+	devs[i]->io.reset(new simdrive(sim_config(), lat));
+      }
+      else
+      {
+	devs[i]->io.reset(open_transport(argv[optind + i]));
+      }
+      if (sim_count || init)
+      {
+	drive target(*(devs[i]->io));
+	take_ownership(target, pin);
+      }
+      
+      // set / unlock change the first range, put it back afterwards
+      if (mix[OP_SET] || mix[OP_UNLOCK])
+      {
+	save_locks(*(devs[i]), user_uid, pin);
+      }
+    }
+
+    // Interrupted sweeps stop early, lock state is still put back
+    signal(SIGINT, stop_handler);
+    signal(SIGTERM, stop_handler);
+    for (size_t n = 0; (n < drive_list.size()) && !stopping; n++)
+    {
+      for (size_t m = 0; (m < thread_list.size()) && !stopping; m++)
+      {
+	for (size_t k = 0; (k < session_list.size()) && !stopping; k++)
+	{
+	  scale_result res;
+	  run_point(devs, drive_list[n], thread_list[m], session_list[k],
+		    seconds, mix, user_uid, pin, res);
+	  report(res, json);
+	}
+      }
+    }
+    restore_locks(devs, user_uid, pin);
+  }
+  catch (topaz_exception &e)
+  {
+    cerr << "Exception raised: " << e.what() << endl;
+    restore_locks(devs, user_uid, pin);
+    return -1;
+  }
+
+  return (stopping ? 1 : 0);
+}
+
+void stop_handler(int sig)
+{
+  // Second one ends it there and then
+  stopping = true;
+  signal(sig, SIG_DFL);
+}
+
+// Comma separated counts
+vector<unsigned> parse_list(char const *str)
+{
+  vector<unsigned> list;
+  stringstream in(str);
+  string item;
+  while (getline(in, item, ','))
+  {
+    list.push_back(strtoul(item.c_str(), NULL, 0));
+  }
+  return list;
+}
+
+// Fresh drive: SID and Admin1 PIN set, Locking SP active
+void take_ownership(drive &target, string const &pin)
+{
+  target.login_anon(ADMIN_SP);
+  target.login(ADMIN_SP, SID, target.default_pin());
+  target.table_set(C_PIN_SID, 3, atom::new_bin(pin.c_str()));
+  if (target.table_get(LOCKING_SP, 6).get_uint() == 8)
+  {
+    target.invoke(LOCKING_SP, ACTIVATE);
+  }
+}
+
+// Remember lock state of first range, as the workload user sees it
+void save_locks(device_slot &dev, uint64_t user_uid, string const &pin)
+{
+  drive target(*(dev.io));
+  target.login(LOCKING_SP, user_uid, pin);
+  dev.locked[0] = target.table_get(LBA_RANGE_BASE + 1, 7).get_uint();
+  dev.locked[1] = target.table_get(LBA_RANGE_BASE + 1, 8).get_uint();
+  dev.saved = true;
+}
+
+// Put lock state of first range back (best effort, every device tried)
+void restore_locks(vector<unique_ptr<device_slot> > &devs, uint64_t user_uid,
+		   string const &pin)
+{
+  for (size_t i = 0; i < devs.size(); i++)
+  {
+    if (!devs[i]->saved)
+    {
+      continue;
+    }
+    try
+    {
+      drive target(*(devs[i]->io));
+      target.login(LOCKING_SP, user_uid, pin);
+      target.table_set(LBA_RANGE_BASE + 1, 7, devs[i]->locked[0]);
+      target.table_set(LBA_RANGE_BASE + 1, 8, devs[i]->locked[1]);
+      devs[i]->saved = false;
+    }
+    catch (topaz_exception &e)
+    {
+      cerr << "Cannot restore lock state of drive " << i << ": " << e.what() << endl;
+    }
+  }
+}
+
+// CPU time used by whole process so far (microseconds)
+double cpu_us()
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e6 +
+    usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+double since_us(bench_clock::time_point start, bench_clock::time_point end)
+{
+  return chrono::duration<double, micro>(end - start).count();
+}
+
+// One operation, device lock held
+void run_op(op_kind kind, session_slot &sess, uint64_t user_uid,
+	    string const &pin, worker_stats &stats)
+{
+  device_slot &dev = *(sess.dev);
+
+  // Take over device session from whichever handle has it
+  if ((kind == OP_UNLOCK) || (dev.active != &sess))
+  {
+    if (dev.active)
+    {
+      dev.active->target->logout();
+      dev.active = NULL;
+    }
+    sess.target->login(LOCKING_SP, user_uid, pin);
+    dev.active = &sess;
+    stats.switches++;
+  }
+
+  switch (kind)
+  {
+    case OP_GET:
+      sess.target->table_get(LBA_RANGE_GLOBAL, 7);
+      break;
+
+    case OP_SET:
+      sess.target->table_set(LBA_RANGE_BASE + 1, 7, (uint64_t)1);
+      break;
+
+    default:
+      sess.target->table_set(LBA_RANGE_BASE + 1, 7, (uint64_t)0);
+      sess.target->table_set(LBA_RANGE_BASE + 1, 8, (uint64_t)0);
+      sess.target->logout();
+      dev.active = NULL;
+      break;
+  }
+}
+
+// Worker: random operations on random sessions until deadline
+void worker(vector<unique_ptr<session_slot> > &sessions, unsigned seed,
+	    bench_clock::time_point deadline, unsigned const *mix,
+	    uint64_t user_uid, string const &pin, worker_stats &stats)
+{
+  minstd_rand rng(seed);
+  unsigned weight = mix[OP_GET] + mix[OP_SET] + mix[OP_UNLOCK];
+
+  while (!stopping && (bench_clock::now() < deadline))
+  {
+    unsigned pick = rng() % weight;
+    op_kind kind = (pick < mix[OP_GET] ? OP_GET :
+		    pick < mix[OP_GET] + mix[OP_SET] ? OP_SET : OP_UNLOCK);
+    session_slot &sess = *(sessions[rng() % sessions.size()]);
+
+    bench_clock::time_point start = bench_clock::now();
+    unique_lock<mutex> guard(sess.dev->lock, try_to_lock);
+    if (!guard.owns_lock())
+    {
+      stats.contended++;
+      guard.lock();
+    }
+    double wait = since_us(start, bench_clock::now());
+    stats.wait_us += wait;
+    stats.max_wait_us = max(stats.max_wait_us, wait);
+
+    try
+    {
+      run_op(kind, sess, user_uid, pin, stats);
+      stats.ops[kind]++;
+    }
+    catch (topaz_exception &e)
+    {
+      // Don't trust the session after a failure
+      TOPAZ_DEBUG(1) printf("%s failed: %s\n", op_names[kind], e.what());
+      sess.target->logout();
+      sess.dev->active = NULL;
+      stats.errors++;
+    }
+    guard.unlock();
+    stats.lat_us.push_back(since_us(start, bench_clock::now()));
+  }
+}
+
+// Run one N x M x K point of the sweep
+void run_point(vector<unique_ptr<device_slot> > &devs, unsigned drives,
+	       unsigned threads, unsigned sessions, double seconds,
+	       unsigned const *mix, uint64_t user_uid, string const &pin,
+	       scale_result &res)
+{
+  vector<unique_ptr<session_slot> > slots;
+  vector<worker_stats> stats(threads);
+  vector<thread> pool;
+
+  // Session handles (discovery each), nobody logged in yet
+  for (unsigned d = 0; d < drives; d++)
+  {
+    for (unsigned k = 0; k < sessions; k++)
+    {
+      slots.push_back(unique_ptr<session_slot>(new session_slot()));
+      slots.back()->dev = devs[d].get();
+
+      // Handles after the first share its device lease, not waiting on it
+      lease_policy lease;
+      if (k)
+      {
+	lease.mode = LEASE_SHARE;
+      }
+      slots.back()->target.reset(new drive(*(devs[d]->io), lease));
+    }
+  }
+
+  double cpu_start = cpu_us();
+  bench_clock::time_point start = bench_clock::now();
+  bench_clock::time_point deadline =
+    start + chrono::microseconds((uint64_t)(seconds * 1e6));
+  for (unsigned t = 0; t < threads; t++)
+  {
+    clear(stats[t]);
+    pool.push_back(thread(worker, ref(slots), t + 1, deadline, mix,
+			  user_uid, cref(pin), ref(stats[t])));
+  }
+  for (unsigned t = 0; t < threads; t++)
+  {
+    pool[t].join();
+  }
+
+  res.drives   = drives;
+  res.threads  = threads;
+  res.sessions = sessions;
+  res.seconds  = since_us(start, bench_clock::now()) / 1e6;
+  res.cpu_us   = cpu_us() - cpu_start;
+
+  // Merge per thread figures
+  worker_stats &total = res.total;
+  clear(total);
+  for (unsigned t = 0; t < threads; t++)
+  {
+    total.lat_us.insert(total.lat_us.end(), stats[t].lat_us.begin(), stats[t].lat_us.end());
+    total.wait_us    += stats[t].wait_us;
+    total.max_wait_us = max(total.max_wait_us, stats[t].max_wait_us);
+    total.contended  += stats[t].contended;
+    total.switches   += stats[t].switches;
+    total.errors     += stats[t].errors;
+    for (unsigned kind = 0; kind < OP_KINDS; kind++)
+    {
+      total.ops[kind] += stats[t].ops[kind];
+    }
+  }
+
+  // Leave devices without a session for the next point
+  for (size_t i = 0; i < slots.size(); i++)
+  {
+    slots[i]->dev->active = NULL;
+  }
+}
+
+// Nearest rank percentile of sorted samples
+double percentile(vector<double> const &sorted, double pct)
+{
+  size_t rank = (size_t)((pct / 100.0) * sorted.size() + 0.5);
+  rank = (rank ? rank - 1 : 0);
+  return sorted[min(rank, sorted.size() - 1)];
+}
+
+// Print one point of the sweep
+void report(scale_result &res, bool json)
+{
+  static bool header = false;
+  worker_stats &total = res.total;
+  vector<double> &sorted = total.lat_us;
+  sort(sorted.begin(), sorted.end());
+
+  size_t ops = sorted.size();
+  double n = max(ops, (size_t)1), sum = 0;
+  for (size_t i = 0; i < ops; i++)
+  {
+    sum += sorted[i];
+  }
+  if (sorted.empty())
+  {
+    sorted.push_back(0);
+  }
+  double ops_s    = ops / res.seconds;
+  double wait_pct = (sum ? 100.0 * total.wait_us / sum : 0);
+  double cont_pct = 100.0 * total.contended / n;
+
+  if (json)
+  {
+    printf("{\"drives\":%u,\"threads\":%u,\"sessions\":%u,\"ops\":%zu,"
+	   "\"get\":%" PRIu64 ",\"set\":%" PRIu64 ",\"unlock\":%" PRIu64 ","
+	   "\"ops_per_s\":%.1f,\"mean_us\":%.1f,\"p50_us\":%.1f,\"p99_us\":%.1f,"
+	   "\"p999_us\":%.1f,\"max_us\":%.1f,\"lock_wait_pct\":%.1f,"
+	   "\"lock_wait_max_us\":%.1f,\"contended_pct\":%.1f,\"switches\":%" PRIu64 ","
+	   "\"cpu_us_per_op\":%.1f,\"errors\":%" PRIu64 "}\n",
+	   res.drives, res.threads, res.sessions, ops,
+	   total.ops[OP_GET], total.ops[OP_SET], total.ops[OP_UNLOCK],
+	   ops_s, sum / n, percentile(sorted, 50), percentile(sorted, 99),
+	   percentile(sorted, 99.9), sorted.back(), wait_pct, total.max_wait_us,
+	   cont_pct, total.switches, res.cpu_us / n, total.errors);
+    return;
+  }
+
+  if (!header)
+  {
+    printf("%3s %3s %3s | %8s %9s %9s %9s %9s %9s | %6s %9s %6s %8s | %8s %6s\n",
+	   "N", "M", "K", "ops", "ops/s", "p50", "p99", "p99.9", "max",
+	   "wait%", "wait max", "cont%", "switches", "cpu/op", "errors");
+    header = true;
+  }
+  printf("%3u %3u %3u | %8zu %9.1f %9.1f %9.1f %9.1f %9.1f | %6.1f %9.1f %6.1f %8" PRIu64
+	 " | %8.1f %6" PRIu64 "\n",
+	 res.drives, res.threads, res.sessions, ops,
+	 ops_s, percentile(sorted, 50), percentile(sorted, 99),
+	 percentile(sorted, 99.9), sorted.back(), wait_pct, total.max_wait_us,
+	 cont_pct, total.switches, res.cpu_us / n, total.errors);
+}
+
+void usage()
+{
+  cerr << endl
+       << "Usage:" << endl
+       << "  tp_scale [opts] <drive> [drive ...] - Scaling sweep over TCG Opal drives" << endl
+       << "  tp_scale [opts] -s <count>          - Scaling sweep over in-process simulated drives" << endl
+       << endl
+       << "Every combination of drives (N), threads (M) and sessions per drive (K)" << endl
+       << "runs the workload mix for a fixed time. Threads pick a random session for" << endl
+       << "each operation and wait for its drive; a drive runs one session at a time," << endl
+       << "so a session whose drive was last used by another handle logs in again" << endl
+       << "(a switch). Times are in microseconds; wait% is the share of operation" << endl
+       << "time spent waiting for the drive, cont% the share of operations that found" << endl
+       << "it busy, and cpu/op is process CPU time (simulated drives included)." << endl
+       << endl
+       << "Options:" << endl
+       << "  -s <count>  - Simulated drives in this process (implies -I)" << endl
+       << "  -l <file>   - Latency profile for simulated drives" << endl
+       << "  -I          - Take ownership first (factory fresh drives only)" << endl
+       << "  -N <list>   - Comma separated drive counts (default all)" << endl
+       << "  -M <list>   - Comma separated thread counts (default 1)" << endl
+       << "  -K <list>   - Comma separated sessions per drive (default 1)" << endl
+       << "  -t <secs>   - Run time per combination (default 2)" << endl
+       << "  -w <mix>    - Workload weights (default get=70,set=20,unlock=10," << endl
+       << "                set and unlock on real drives only with --destructive)" << endl
+       << "  -u <user>   - Specify user (default admin1)" << endl
+       << "  -p <pin>    - Provide PIN credentials (default \"bench\")" << endl
+       << "  -f <file>   - Read PIN credentials from file" << endl
+       << "  -j          - One JSON object per combination" << endl
+       << "  -D          - Allow set / unlock, which change the lock state of range 1 on" << endl
+       << "                real drives (--destructive, put back on exit or Ctl-C)" << endl
+       << "  -v          - Increase debug verbosity" << endl;
+}
+
+uint64_t get_uid(char const *user_str)
+{
+  uint64_t base = 0;
+  unsigned int num = 0;
+
+  // Users come in two patterns:
+  if (sscanf(user_str, "admin%u", &num) == 1)
+  {
+    base = ADMIN_BASE;
+  }
+  else if (sscanf(user_str, "user%u", &num) == 1)
+  {
+    base = USER_BASE;
+  }
+  else
+  {
+    // Illegal
+    throw topaz_exception("Illegal Locking SP user");
+  }
+
+  return base + num;
+}
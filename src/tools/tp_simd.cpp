@@ -0,0 +1,160 @@
+/**
+ * Topaz Tools - Simulated Drive Server
+ *
+ * Serves a set of simulated TCG Opal drives over a Unix domain socket, so
+ * the other tools (and several of them at once) can be pointed at
+ * "sim:<socket>#<drive>" instead of a real device.
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <signal.h>
+#include <unistd.h>
+#include <topaz/debug.h>
+#include <topaz/exceptions.h>
+#include <topaz/simsock.h>
+using namespace std;
+using namespace topaz;
+
+void stop_handler(int sig);
+void usage();
+
+// Server being run (for signal handler)
+sim_server *running = NULL;
+
+int main(int argc, char **argv)
+{
+  unsigned count = 1;
+  sim_config cfg;
+  sim_latency lat;
+  int c;
+
+  // Process command line switches
+  opterr = 0;
+  while ((c = getopt(argc, argv, "n:l:r:u:m:M:v")) != -1)
+  {
+    switch (c)
+    {
+      case 'n':
+	count = atoi(optarg);
+	break;
+
+      case 'l':
+	try
+	{
+	  lat.load(optarg);
+	}
+	catch (topaz_exception &e)
+	{
+	  cerr << "Cannot load latency profile " << optarg << ": " << e.what() << endl;
+	  return -1;
+	}
+	break;
+
+      case 'r':
+	cfg.ranges = atoi(optarg);
+	break;
+
+      case 'u':
+	cfg.users = atoi(optarg);
+	break;
+
+      case 'm':
+	cfg.max_methods = atoi(optarg);
+	break;
+
+      case 'M':
+	cfg.msid = optarg;
+	break;
+
+      case 'v':
+	topaz_debug++;
+	break;
+
+      default:
+	cerr << "Invalid command line option " << (char)optopt << endl;
+	usage();
+	return -1;
+    }
+  }
+
+  // Socket path
+  if ((argc - optind) != 1 || count == 0)
+  {
+    cerr << "Invalid arguments" << endl;
+    usage();
+    return -1;
+  }
+
+  try
+  {
+    sim_server server(argv[optind], count, cfg, lat);
+
+    // Stop cleanly (removing the socket) on Ctl-C or kill
+    running = &server;
+    signal(SIGINT, stop_handler);
+    signal(SIGTERM, stop_handler);
+
+    cout << "Serving " << count << " simulated drives as sim:"
+	 << argv[optind] << "#0 .. #" << (count - 1) << endl;
+    server.run();
+    running = NULL;
+  }
+  catch (topaz_exception &e)
+  {
+    cerr << "Exception raised: " << e.what() << endl;
+    return -1;
+  }
+
+  return 0;
+}
+
+void stop_handler(int sig)
+{
+  if (running)
+  {
+    running->stop();
+  }
+}
+
+void usage()
+{
+  cerr << endl
+       << "Usage:" << endl
+       << "  tp_simd [opts] <socket> - Serve simulated TCG Opal drives" << endl
+       << endl
+       << "Drives are then reachable by other tools as sim:<socket>#<num>." << endl
+       << endl
+       << "Options:" << endl
+       << "  -n <num>  - Number of drives (default 1)" << endl
+       << "  -l <file> - Latency profile, one \"<op> <usec> [usec ...]\" per line" << endl
+       << "  -r <num>  - Locking ranges besides global (default 8)" << endl
+       << "  -u <num>  - Locking SP users (default 8)" << endl
+       << "  -m <num>  - MaxMethods per ComPkt (default 8)" << endl
+       << "  -M <pin>  - MSID (default SIMULATED-MSID)" << endl
+       << "  -v        - Increase debug verbosity" << endl;
+}
@@ -0,0 +1,498 @@
+/**
+ * Topaz Tools - Pre-boot Unlock
+ *
+ * Size optimized, statically linked unlock for initramfs use. Finds every
+ * locked TCG Opal drive, asks for the PIN once, then unlocks all drives in
+ * parallel using one session per drive. Each drive's range count comes from
+ * its Locking Info, and one Set[] goes to every range found locked.
+ *
+ * Built on the freestanding unlock core only (no iostreams or exceptions).
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <dirent.h>
+#include <new>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <topaz/core.h>
+#include <topaz/uid.h>
+#include "boot_io.h"
+using namespace topaz;
+
+// Limits
+#define MAX_TARGETS  32
+#define MAX_PIN      256
+#define MAX_ATTEMPTS 3
+
+// Method status for bad credentials (see datum::status_t)
+#define STA_NOT_AUTHORIZED 0x01
+
+// Per drive state, each worked on by its own thread
+typedef struct
+{
+  char       path[64];
+  boot_dev_t dev;
+  core      *unlock;      // Constructed in place in storage
+  alignas(core) unsigned char storage[sizeof(core)];
+  
+  bool       opal;        // Discovery succeeded
+  bool       locked;      // Locking feature reports locked ranges
+  bool       done;        // Unlock succeeded
+  bool       tried;       // Logged in and unlocked what it could (not retried)
+  int        session_rc;  // StartSession result code / method status
+  int        rc;          // First failed Get / Set result code / method status
+  unsigned   denied;      // Sets refused (NotAuthorized), eg - no ACE on range
+  
+  // Timing (millisecs)
+  double     t_discover;
+  double     t_session;
+  double     t_set;
+  double     t_end;
+  unsigned   trips;       // Get[] / Set[] round trips
+} target_t;
+
+// Shared, read only while threads run
+static target_t targets[MAX_TARGETS];
+static size_t target_count = 0;
+static uint64_t user_uid = ADMIN_BASE + 1;
+static uint64_t range_limit = UINT64_MAX;  // Highest range to unlock
+static char pin[MAX_PIN];
+static size_t pin_len = 0;
+
+void ctl_c_handler(int sig);
+void usage();
+bool get_uid(char const *user_str, uint64_t *uid);
+void scan_targets();
+void add_target(char const *path);
+bool read_pin();
+void set_echo(bool on);
+double now_ms();
+void run_all(void *(*fn)(void*));
+void *discover_target(void *arg);
+void *unlock_target(void *arg);
+
+int main(int argc, char **argv)
+{
+  bool pin_valid = false;
+  size_t i, locked = 0, unlocked = 0;
+  unsigned attempt;
+  double start, wall = 0;
+  int c;
+  
+  // Install handler for Ctl-C to restore terminal to sane state
+  signal(SIGINT, ctl_c_handler);
+  
+  // Process command line switches
+  opterr = 0;
+  while ((c = getopt(argc, argv, "u:p:r:")) != -1)
+  {
+    switch (c)
+    {
+      case 'u':
+	if (!get_uid(optarg, &user_uid))
+	{
+	  fprintf(stderr, "Illegal Locking SP user %s\n", optarg);
+	  return 1;
+	}
+	break;
+	
+      case 'p':
+	strncpy(pin, optarg, MAX_PIN - 1);
+	pin_len = strlen(pin);
+	pin_valid = true;
+	break;
+	
+      case 'r':
+	{
+	  char *end = NULL;
+	  range_limit = strtoull(optarg, &end, 10);
+	  if ((optarg[0] < '0') || (optarg[0] > '9') || (*end != '\0'))
+	  {
+	    fprintf(stderr, "Illegal range count %s\n", optarg);
+	    return 1;
+	  }
+	  if (range_limit == 0)
+	  {
+	    fprintf(stderr, "Range count must be at least 1\n");
+	    return 1;
+	  }
+	  range_limit--;
+	}
+	break;
+	
+      default:
+	usage();
+	return 1;
+    }
+  }
+  
+  // Drives from command line, or every disk on the system
+  for (i = optind; i < (size_t)argc; i++)
+  {
+    add_target(argv[i]);
+  }
+  if (target_count == 0)
+  {
+    scan_targets();
+  }
+  
+  // Discover all drives at once
+  start = now_ms();
+  run_all(discover_target);
+  wall += now_ms() - start;
+  for (i = 0; i < target_count; i++)
+  {
+    if (targets[i].locked)
+    {
+      locked++;
+    }
+  }
+  if (locked == 0)
+  {
+    printf("No locked Opal drives found\n");
+    return 0;
+  }
+  
+  // One PIN for all of them, retried on bad credentials
+  for (attempt = 0; attempt < MAX_ATTEMPTS; attempt++)
+  {
+    if ((!pin_valid) && (!read_pin()))
+    {
+      return 1;
+    }
+    
+    // Unlock all drives at once
+    start = now_ms();
+    run_all(unlock_target);
+    wall += now_ms() - start;
+    
+    // Retry only if some drive rejected the PIN (not a range refusing the user)
+    bool denied = false;
+    for (i = 0; i < target_count; i++)
+    {
+      if (targets[i].locked && (targets[i].session_rc == STA_NOT_AUTHORIZED))
+      {
+	denied = true;
+      }
+    }
+    if (!denied)
+    {
+      break;
+    }
+    fprintf(stderr, "Invalid credentials\n");
+    pin_valid = false;
+  }
+  memset(pin, 0, sizeof(pin));
+  
+  // Timing report
+  for (i = 0; i < target_count; i++)
+  {
+    target_t *tgt = targets + i;
+    if (!tgt->locked)
+    {
+      continue;
+    }
+    if (tgt->done)
+    {
+      unlocked++;
+    }
+    printf("%-12s %-8s discover %7.2f ms  session %7.2f ms  unlock %7.2f ms"
+	   " (%u round trips)  end %7.2f ms\n", tgt->path,
+	   (tgt->done ? "unlocked" : "FAILED"), tgt->t_discover, tgt->t_session,
+	   tgt->t_set, tgt->trips, tgt->t_end);
+    if (tgt->session_rc != core::OK)
+    {
+      printf("%-12s login failed (%d)\n", tgt->path, tgt->session_rc);
+    }
+    else if (tgt->denied)
+    {
+      printf("%-12s %u range(s) not authorized for this user\n", tgt->path, tgt->denied);
+    }
+    else if (tgt->rc != core::OK)
+    {
+      printf("%-12s unlock failed (%d)\n", tgt->path, tgt->rc);
+    }
+  }
+  printf("Unlocked %u of %u drives in %.2f ms (excluding PIN entry)\n",
+	 (unsigned)unlocked, (unsigned)locked, wall);
+  
+  return (unlocked == locked ? 0 : 1);
+}
+
+void ctl_c_handler(int sig)
+{
+  // Make sure this is on when program terminates
+  set_echo(true);
+  _exit(1);
+}
+
+void usage()
+{
+  fprintf(stderr,
+	  "\n"
+	  "Usage:\n"
+	  "  tp_unlock_boot [opts] [drive ...] - Unlock all locked TCG Opal drives\n"
+	  "\n"
+	  "Options:\n"
+	  "  -p <pin>  - Provide PIN credentials\n"
+	  "  -u <user> - Specify user (default admin1)\n"
+	  "  -r <num>  - Unlock only the first <num> LBA ranges, global first\n"
+	  "              (default every range the drive has)\n");
+}
+
+bool get_uid(char const *user_str, uint64_t *uid)
+{
+  unsigned int num = 0;
+  
+  // Users come in two patterns:
+  if (sscanf(user_str, "admin%u", &num) == 1)
+  {
+    *uid = ADMIN_BASE + num;
+  }
+  else if (sscanf(user_str, "user%u", &num) == 1)
+  {
+    *uid = USER_BASE + num;
+  }
+  else
+  {
+    return false;
+  }
+  return true;
+}
+
+// Every SCSI / ATA disk known to the kernel
+void scan_targets()
+{
+  DIR *dir = opendir("/sys/block");
+  struct dirent *ent;
+  char path[sizeof("/dev/") + sizeof(ent->d_name)];
+  
+  if (dir == NULL)
+  {
+    return;
+  }
+  while ((ent = readdir(dir)) != NULL)
+  {
+    if (strncmp(ent->d_name, "sd", 2) == 0)
+    {
+      snprintf(path, sizeof(path), "/dev/%s", ent->d_name);
+      add_target(path);
+    }
+  }
+  closedir(dir);
+}
+
+void add_target(char const *path)
+{
+  if (target_count >= MAX_TARGETS)
+  {
+    fprintf(stderr, "More than %u drives, %s skipped\n", MAX_TARGETS, path);
+    return;
+  }
+  target_t *tgt = targets + target_count++;
+  memset(tgt, 0, sizeof(*tgt));
+  strncpy(tgt->path, path, sizeof(tgt->path) - 1);
+  tgt->dev.fd = -1;
+}
+
+// Read a PIN from console, without echo
+bool read_pin()
+{
+  printf("Please enter user PIN: ");
+  fflush(stdout);
+  set_echo(false);
+  bool ok = (fgets(pin, sizeof(pin), stdin) != NULL);
+  set_echo(true);
+  printf("\n");
+  
+  // Drop line ending
+  pin_len = strcspn(pin, "\r\n");
+  pin[pin_len] = 0;
+  return ok;
+}
+
+// Turn character echo on terminal on / off
+void set_echo(bool on)
+{
+  struct termios cur;
+  
+  if (tcgetattr(STDIN_FILENO, &cur) == 0)
+  {
+    if (on)
+    {
+      cur.c_lflag |= ECHO;
+    }
+    else
+    {
+      cur.c_lflag &= ~ECHO;
+    }
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &cur);
+  }
+}
+
+// Monotonic clock (millisecs)
+double now_ms()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Run one thread per target, and wait for all of them
+void run_all(void *(*fn)(void*))
+{
+  pthread_t threads[MAX_TARGETS];
+  bool started[MAX_TARGETS];
+  
+  for (size_t i = 0; i < target_count; i++)
+  {
+    started[i] = (pthread_create(threads + i, NULL, fn, targets + i) == 0);
+    if (!started[i])
+    {
+      // Out of threads, do it here
+      fn(targets + i);
+    }
+  }
+  for (size_t i = 0; i < target_count; i++)
+  {
+    if (started[i])
+    {
+      pthread_join(threads[i], NULL);
+    }
+  }
+}
+
+// Open drive and run Level 0 Discovery
+void *discover_target(void *arg)
+{
+  target_t *tgt = (target_t*)arg;
+  double start = now_ms();
+  
+  // Not a drive we can talk to is not an error, just skip it
+  if (boot_io_open(&tgt->dev, tgt->path) != 0)
+  {
+    return NULL;
+  }
+  tgt->unlock = new (tgt->storage) core(boot_io_hooks(&tgt->dev));
+  tgt->rc = tgt->unlock->discover();
+  tgt->opal = (tgt->rc == core::OK);
+  tgt->locked = tgt->opal && (tgt->unlock->is_locked() || tgt->unlock->mbr_pending());
+  tgt->t_discover = now_ms() - start;
+  
+  // Done with drives we won't touch again
+  if (!tgt->locked)
+  {
+    boot_io_close(&tgt->dev);
+  }
+  return NULL;
+}
+
+// One session: MBR done (if needed), number of ranges from Locking Info,
+// then a Set[] of ReadLocked(7) / WriteLocked(8) off on each range, unread
+// (clearing locks already off costs the same round trip as reading them)
+void *unlock_target(void *arg)
+{
+  target_t *tgt = (target_t*)arg;
+  core::column_t mbr_done[] = {{2, 1}};
+  core::column_t max_ranges[] = {{4, 0}};
+  core::column_t unlocked[] = {{7, 0}, {8, 0}};
+  uint64_t last;
+  double start;
+  int rc;
+  
+  // Nothing to do? (PIN was not the problem if logged in before)
+  if ((!tgt->locked) || tgt->done || tgt->tried)
+  {
+    return NULL;
+  }
+  tgt->t_session = tgt->t_set = tgt->t_end = 0;
+  tgt->trips = tgt->denied = 0;
+  tgt->rc = core::OK;
+  
+  // Login
+  start = now_ms();
+  tgt->session_rc = tgt->unlock->start_session(LOCKING_SP, user_uid, pin, pin_len);
+  tgt->t_session = now_ms() - start;
+  if (tgt->session_rc != core::OK)
+  {
+    return NULL;
+  }
+  
+  // Unlock, a range the user may not touch doesn't stop the others
+  tgt->tried = true;
+  start = now_ms();
+  if (tgt->unlock->mbr_pending())
+  {
+    rc = tgt->unlock->set(MBR_CONTROL, mbr_done, 1);
+    tgt->trips++;
+    if (rc == STA_NOT_AUTHORIZED)
+    {
+      tgt->denied++;
+    }
+    else if (rc != core::OK)
+    {
+      tgt->rc = rc;
+    }
+  }
+  if (tgt->rc == core::OK)
+  {
+    tgt->rc = tgt->unlock->get(LOCKINGINFO, max_ranges, 1);
+    tgt->trips++;
+  }
+  last = (max_ranges[0].val < range_limit ? max_ranges[0].val : range_limit);
+  for (uint64_t range = 0; (tgt->rc == core::OK) && (range <= last); range++)
+  {
+    uint64_t lba_uid = (range == 0 ? LBA_RANGE_GLOBAL : LBA_RANGE_BASE + range);
+    rc = tgt->unlock->set(lba_uid, unlocked, 2);
+    tgt->trips++;
+    if (rc == STA_NOT_AUTHORIZED)
+    {
+      tgt->denied++;
+    }
+    else if (rc != core::OK)
+    {
+      tgt->rc = rc;
+    }
+  }
+  tgt->t_set = now_ms() - start;
+  
+  // Logout
+  start = now_ms();
+  tgt->unlock->end_session();
+  tgt->t_end = now_ms() - start;
+  
+  tgt->done = ((tgt->rc == core::OK) && (tgt->denied == 0));
+  if (tgt->done)
+  {
+    boot_io_close(&tgt->dev);
+  }
+  return NULL;
+}
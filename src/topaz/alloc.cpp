@@ -0,0 +1,294 @@
+/**
+ * Topaz - Heap Allocation Accounting
+ *
+ * This file implements per call site heap accounting. With TOPAZ_ALLOC,
+ * global operator new / delete are replaced here, and every allocation is
+ * charged to the process totals and to each call site active on the
+ * allocating thread.
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <malloc.h>
+#include <new>
+#include <topaz/alloc.h>
+#include <topaz/trace.h>
+using namespace std;
+using namespace topaz;
+
+// Nesting of call sites tracked per thread
+#define ALLOC_DEPTH 8
+
+namespace
+{
+
+  // Counts of a site (zeroed before any constructor runs)
+  struct site_counts
+  {
+    atomic<uint64_t> calls;
+    atomic<uint64_t> allocs;
+    atomic<uint64_t> bytes;
+    atomic<uint64_t> frees;
+    atomic<uint64_t> peak;
+  };
+
+  site_counts     sites[ALLOC_SITES];
+  site_counts     totals;
+  atomic<int64_t> live_bytes;
+
+  // One active call site on this thread
+  struct alloc_frame
+  {
+    uint32_t site;
+    uint64_t allocs;
+    uint64_t bytes;
+    uint64_t frees;
+    int64_t  live;
+    int64_t  peak;
+  };
+
+  // Active sites are frames[0 .. depth), those from base on are charged
+  thread_local alloc_frame frames[ALLOC_DEPTH];
+  thread_local unsigned    depth;
+  thread_local unsigned    base;
+
+  void store_max(atomic<uint64_t> &target, uint64_t value)
+  {
+    uint64_t seen = target.load(memory_order_relaxed);
+    while ((value > seen) &&
+	   !target.compare_exchange_weak(seen, value, memory_order_relaxed));
+  }
+
+  void zero(site_counts &counts)
+  {
+    counts.calls.store(0, memory_order_relaxed);
+    counts.allocs.store(0, memory_order_relaxed);
+    counts.bytes.store(0, memory_order_relaxed);
+    counts.frees.store(0, memory_order_relaxed);
+    counts.peak.store(0, memory_order_relaxed);
+  }
+
+  alloc_stats read(site_counts const &counts)
+  {
+    alloc_stats stats;
+    stats.calls  = counts.calls.load(memory_order_relaxed);
+    stats.allocs = counts.allocs.load(memory_order_relaxed);
+    stats.bytes  = counts.bytes.load(memory_order_relaxed);
+    stats.frees  = counts.frees.load(memory_order_relaxed);
+    stats.peak   = counts.peak.load(memory_order_relaxed);
+    return stats;
+  }
+
+  // Live bytes are tracked by usable size, so frees balance allocations
+  void note_alloc(void *ptr, size_t len)
+  {
+    int64_t held = malloc_usable_size(ptr);
+    totals.allocs.fetch_add(1, memory_order_relaxed);
+    totals.bytes.fetch_add(len, memory_order_relaxed);
+    store_max(totals.peak, live_bytes.fetch_add(held, memory_order_relaxed) + held);
+
+    for (unsigned i = base; i < depth; i++)
+    {
+      alloc_frame &f = frames[i];
+      f.allocs++;
+      f.bytes += len;
+      f.live  += held;
+      f.peak   = max(f.peak, f.live);
+    }
+  }
+
+  void note_free(void *ptr)
+  {
+    if (ptr == NULL)
+    {
+      return;
+    }
+    int64_t held = malloc_usable_size(ptr);
+    totals.frees.fetch_add(1, memory_order_relaxed);
+    live_bytes.fetch_sub(held, memory_order_relaxed);
+
+    for (unsigned i = base; i < depth; i++)
+    {
+      frames[i].frees++;
+      frames[i].live -= held;
+    }
+  }
+
+};
+
+// Instrumented library replaces operator new / delete for every program
+#define TOPAZ_ALLOC_LIBRARY
+#include <topaz/alloc_new.h>
+
+/**
+ * \brief Allocate, counting it
+ */
+void *topaz::alloc_counted(size_t len, size_t align)
+{
+  void *ptr = NULL;
+  if (align <= alignof(max_align_t))
+  {
+    ptr = malloc(len ? len : 1);
+  }
+  else if (posix_memalign(&ptr, align, len ? len : 1) != 0)
+  {
+    ptr = NULL;
+  }
+  if (ptr == NULL)
+  {
+    throw bad_alloc();
+  }
+  note_alloc(ptr, len);
+  return ptr;
+}
+
+/**
+ * \brief Free memory from alloc_counted(), counting it
+ */
+void topaz::free_counted(void *ptr)
+{
+  note_free(ptr);
+  free(ptr);
+}
+
+/**
+ * \brief Was the library built with instrumentation (TOPAZ_ALLOC)?
+ */
+bool topaz::alloc_available()
+{
+#ifdef TOPAZ_ALLOC
+  return true;
+#else
+  return false;
+#endif
+}
+
+/**
+ * \brief Zero counts of every site, and process totals
+ */
+void topaz::alloc_reset()
+{
+  for (unsigned i = 0; i < ALLOC_SITES; i++)
+  {
+    zero(sites[i]);
+  }
+
+  // Live bytes carry on, peak starts again from them
+  zero(totals);
+  totals.peak.store(max<int64_t>(live_bytes.load(memory_order_relaxed), 0),
+		    memory_order_relaxed);
+}
+
+/**
+ * \brief Counts for one call site
+ */
+alloc_stats topaz::alloc_site_stats(alloc_site site)
+{
+  return read(sites[site]);
+}
+
+/**
+ * \brief Counts for the whole process
+ */
+alloc_stats topaz::alloc_totals()
+{
+  return read(totals);
+}
+
+/**
+ * \brief Call site name
+ */
+char const *topaz::alloc_site_name(unsigned site)
+{
+  switch (site)
+  {
+    case ALLOC_INVOKE:    return "invoke";
+    case ALLOC_SEND:      return "send";
+    case ALLOC_ENCODE:    return "encode_vector";
+    case ALLOC_DECODE:    return "decode_bytes";
+    case ALLOC_NEW_UID:   return "new_uid";
+    case ALLOC_SIMULATED: return "simulated_tper";
+    default:              return "unknown";
+  }
+}
+
+/**
+ * \brief Enter call site
+ */
+alloc_scope::alloc_scope(alloc_site site)
+  : site(site), frame(-1), outer(base)
+{
+  // Already inside this site (recursion), inside the simulated TPer's own
+  // codec, or nested too deep - leave to outer
+  for (unsigned i = 0; i < depth; i++)
+  {
+    if ((frames[i].site == (uint32_t)site) || (frames[i].site == ALLOC_SIMULATED))
+    {
+      return;
+    }
+  }
+  if (depth >= ALLOC_DEPTH)
+  {
+    return;
+  }
+
+  frame = depth++;
+  if (site == ALLOC_SIMULATED)
+  {
+    base = frame;
+  }
+  alloc_frame &f = frames[frame];
+  f.site   = site;
+  f.allocs = f.bytes = f.frees = 0;
+  f.live   = f.peak = 0;
+}
+
+/**
+ * \brief Leave call site, adding its counts
+ */
+alloc_scope::~alloc_scope()
+{
+  if (frame < 0)
+  {
+    return;
+  }
+  alloc_frame f = frames[frame];
+  depth = frame;
+  base = outer;
+
+  site_counts &counts = sites[site];
+  counts.calls.fetch_add(1, memory_order_relaxed);
+  counts.allocs.fetch_add(f.allocs, memory_order_relaxed);
+  counts.bytes.fetch_add(f.bytes, memory_order_relaxed);
+  counts.frees.fetch_add(f.frees, memory_order_relaxed);
+  store_max(counts.peak, f.peak);
+
+  if (trace_on.load(memory_order_relaxed))
+  {
+    trace_emit(TRACE_ALLOC, chrono::steady_clock::now(), 0,
+	       ((uint64_t)site << 32) | min<uint64_t>(f.allocs, UINT32_MAX), f.bytes);
+  }
+}
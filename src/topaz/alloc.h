@@ -0,0 +1,146 @@
+#ifndef TOPAZ_ALLOC_H
+#define TOPAZ_ALLOC_H
+
+/**
+ * Topaz - Heap Allocation Accounting
+ *
+ * This file implements optional heap accounting for the codec and method
+ * invocation paths. Built with TOPAZ_ALLOC, the library replaces global
+ * operator new / delete and attributes allocations, bytes and peak live
+ * memory to the call sites below. Counts for a site include any sites
+ * nested within it (an invoke includes its encode and decode), and a site
+ * re-entered while already active (eg - recursive decode) counts once.
+ * The simulated TPer runs inside the host's IF-SEND / IF-RECV, so its
+ * allocations are kept apart from the sites that called it.
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace topaz
+{
+
+  // Call sites
+  enum alloc_site
+  {
+    ALLOC_INVOKE,     // drive::try_invoke, each ComPkt of drive::invoke_batch
+    ALLOC_SEND,       // drive::send (ComPkt build and IF-SEND)
+    ALLOC_ENCODE,     // encodable::encode_vector
+    ALLOC_DECODE,     // atom / datum decode_bytes
+    ALLOC_NEW_UID,    // atom::new_uid
+    ALLOC_SIMULATED,  // simdrive IF-SEND / IF-RECV (not charged to callers)
+    ALLOC_SITES
+  };
+
+  typedef struct
+  {
+    uint64_t calls;   // Times site was entered (0 for process totals)
+    uint64_t allocs;  // operator new calls
+    uint64_t bytes;   // Bytes requested
+    uint64_t frees;   // operator delete calls
+    uint64_t peak;    // Largest growth in live bytes within one call
+                      // (process totals - largest live bytes overall)
+  } alloc_stats;
+
+  /**
+   * \brief Was the library built with instrumentation (TOPAZ_ALLOC)?
+   */
+  bool alloc_available();
+
+  /**
+   * \brief Zero counts of every site, and process totals
+   */
+  void alloc_reset();
+
+  /**
+   * \brief Counts for one call site
+   */
+  alloc_stats alloc_site_stats(alloc_site site);
+
+  /**
+   * \brief Counts for the whole process (every allocation, site or not)
+   */
+  alloc_stats alloc_totals();
+
+  /**
+   * \brief Call site name (eg - "encode_vector")
+   */
+  char const *alloc_site_name(unsigned site);
+
+  /**
+   * \brief Allocate, counting it (what operator new does, see alloc_new.h)
+   *
+   * @param len   Bytes requested
+   * @param align Alignment (0 - default)
+   * @return Memory, bad_alloc thrown if none
+   */
+  void *alloc_counted(size_t len, size_t align);
+
+  /**
+   * \brief Free memory from alloc_counted(), counting it
+   */
+  void free_counted(void *ptr);
+
+  /**
+   * \brief Call site, active until end of scope (use TOPAZ_ALLOC_SITE)
+   *
+   * On exit, the call's counts are added to the site and, if tracing is
+   * on, recorded as a TRACE_ALLOC event.
+   */
+  class alloc_scope
+  {
+
+  public:
+
+    alloc_scope(alloc_site site);
+    ~alloc_scope();
+
+    alloc_scope(alloc_scope const &) = delete;
+    alloc_scope &operator=(alloc_scope const &) = delete;
+
+  protected:
+
+    alloc_site site;
+    int        frame;  // Slot in thread's stack of active sites (-1 - none)
+    unsigned   outer;  // First slot charged before this one (ALLOC_SIMULATED)
+
+  };
+
+};
+
+#ifdef TOPAZ_ALLOC
+
+/* Call site lasting until end of enclosing scope */
+#define TOPAZ_ALLOC_SITE(var, site) topaz::alloc_scope var(site)
+
+#else
+
+#define TOPAZ_ALLOC_SITE(var, site)
+
+#endif
+
+#endif
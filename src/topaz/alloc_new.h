@@ -0,0 +1,74 @@
+#ifndef TOPAZ_ALLOC_NEW_H
+#define TOPAZ_ALLOC_NEW_H
+
+/**
+ * Topaz - Counted Operator New / Delete
+ *
+ * This file replaces global operator new / delete with ones counted into
+ * alloc_totals(). Built with TOPAZ_ALLOC the library already does so for
+ * every program, and this file adds nothing. Otherwise a program that
+ * wants process heap counts (eg - a benchmark) includes it from exactly
+ * one source file.
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <new>
+#include <topaz/alloc.h>
+
+#if (defined(TOPAZ_ALLOC) && defined(TOPAZ_ALLOC_LIBRARY)) || \
+    (!defined(TOPAZ_ALLOC) && !defined(TOPAZ_ALLOC_LIBRARY))
+
+void *operator new(size_t len)
+{
+  return topaz::alloc_counted(len, 0);
+}
+
+void *operator new[](size_t len)
+{
+  return topaz::alloc_counted(len, 0);
+}
+
+void *operator new(size_t len, std::align_val_t align)
+{
+  return topaz::alloc_counted(len, (size_t)align);
+}
+
+void *operator new[](size_t len, std::align_val_t align)
+{
+  return topaz::alloc_counted(len, (size_t)align);
+}
+
+void operator delete(void *ptr) noexcept { topaz::free_counted(ptr); }
+void operator delete[](void *ptr) noexcept { topaz::free_counted(ptr); }
+void operator delete(void *ptr, size_t) noexcept { topaz::free_counted(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { topaz::free_counted(ptr); }
+void operator delete(void *ptr, std::align_val_t) noexcept { topaz::free_counted(ptr); }
+void operator delete[](void *ptr, std::align_val_t) noexcept { topaz::free_counted(ptr); }
+void operator delete(void *ptr, size_t, std::align_val_t) noexcept { topaz::free_counted(ptr); }
+void operator delete[](void *ptr, size_t, std::align_val_t) noexcept { topaz::free_counted(ptr); }
+
+#endif
+
+#endif
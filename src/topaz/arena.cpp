@@ -0,0 +1,85 @@
+/**
+ * Topaz - Codec Arena
+ *
+ * This file implements a bump allocator for atoms and datums. All nodes of a
+ * method call and its response may be drawn from a single arena, which is then
+ * released in one step (or reset and reused by the next call).
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <topaz/arena.h>
+using namespace topaz;
+
+/**
+ * \brief Arena Constructor
+ *
+ * @param size     Size of initial region (allocated once, reused on reset)
+ * @param upstream Fallback for requests beyond initial region
+ */
+arena::arena(size_t size, mem_resource *upstream)
+  : region(new byte[size]), pool(region.get(), size, upstream)
+{
+  // Nada
+}
+
+/**
+ * \brief Arena Destructor
+ */
+arena::~arena()
+{
+  // Nada
+}
+
+/**
+ * \brief Release everything handed out, rewind to initial region
+ */
+void arena::reset()
+{
+  pool.release();
+}
+
+/**
+ * \brief Allocate from region (memory_resource interface)
+ */
+void *arena::do_allocate(size_t bytes, size_t align)
+{
+  return pool.allocate(bytes, align);
+}
+
+/**
+ * \brief Deallocate (no-op until reset)
+ */
+void arena::do_deallocate(void *ptr, size_t bytes, size_t align)
+{
+  // Nada - everything is returned at once on reset
+}
+
+/**
+ * \brief Compare resources (memory_resource interface)
+ */
+bool arena::do_is_equal(mem_resource const &ref) const noexcept
+{
+  return this == &ref;
+}
@@ -0,0 +1,104 @@
+#ifndef TOPAZ_ARENA_H
+#define TOPAZ_ARENA_H
+
+/**
+ * Topaz - Codec Arena
+ *
+ * This file implements a bump allocator for atoms and datums. All nodes of a
+ * method call and its response may be drawn from a single arena, which is then
+ * released in one step (or reset and reused by the next call).
+ *
+ * Typical use, with results going out of scope before the reset:
+ *
+ *   arena mem;
+ *   while (monitoring)
+ *   {
+ *     {
+ *       datum rc = target.table_get(LOCKING, &mem);
+ *       ...
+ *     }
+ *     mem.reset();
+ *   }
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <memory>
+#include <topaz/defs.h>
+
+namespace topaz
+{
+  
+  class arena : public mem_resource
+  {
+    
+  public:
+    
+    /**
+     * \brief Arena Constructor
+     *
+     * @param size     Size of initial region (allocated once, reused on reset)
+     * @param upstream Fallback for requests beyond initial region
+     */
+    arena(size_t size = 16384,
+	  mem_resource *upstream = std::pmr::get_default_resource());
+    
+    /**
+     * \brief Arena Destructor
+     */
+    ~arena();
+    
+    /**
+     * \brief Release everything handed out, rewind to initial region
+     *
+     * Anything allocated from this arena must be destroyed first.
+     */
+    void reset();
+    
+  protected:
+    
+    /**
+     * \brief Allocate from region (memory_resource interface)
+     */
+    virtual void *do_allocate(size_t bytes, size_t align);
+    
+    /**
+     * \brief Deallocate (no-op until reset)
+     */
+    virtual void do_deallocate(void *ptr, size_t bytes, size_t align);
+    
+    /**
+     * \brief Compare resources (memory_resource interface)
+     */
+    virtual bool do_is_equal(mem_resource const &ref) const noexcept;
+    
+    // Initial region, and bump allocator carving it up
+    std::unique_ptr<byte[]>             region;
+    std::pmr::monotonic_buffer_resource pool;
+    
+  };
+  
+};
+
+#endif
@@ -29,15 +29,116 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
 #include <endian.h>
 #include <inttypes.h>
+#include <topaz/alloc.h>
 #include <topaz/atom.h>
 #include <topaz/exceptions.h>
 #include <topaz/uid.h>
 using namespace topaz;
 
+namespace
+{
+  
+  // Header classification for a single leading byte
+  struct head_info
+  {
+    uint8_t type;     // atom::type_t, or BAD_TOKEN
+    uint8_t enc;      // atom::enc_t
+    uint8_t head;     // Header size in bytes (0 for tiny / empty)
+    uint8_t len_mask; // Length bits carried in the first byte
+    bool    cont;     // Binary segment, more segments follow
+  };
+  
+  // Marker for unusable header bytes (reserved, or non-atom token)
+  const uint8_t BAD_TOKEN = 0xff;
+  
+  // Map bin / sign flags (values 0-3) to atom type. With the bin flag
+  // set, the sign flag instead marks a continued byte sequence.
+  constexpr uint8_t flags_to_type(unsigned bits)
+  {
+    return (bits == 0) ? (uint8_t)atom::UINT  :
+           (bits == 1) ? (uint8_t)atom::INT   : (uint8_t)atom::BYTES;
+  }
+  
+  // Classify one header byte (see Core Spec 3.2.2.3.1)
+  constexpr head_info classify(unsigned b)
+  {
+    if (b == atom::EMPTY_TOK)
+    {
+      return {atom::EMPTY, atom::NONE, 0, 0, false};
+    }
+    else if (b < atom::SHORT_TOK)
+    {
+      return {flags_to_type(0x01 & (b >> 6)), atom::TINY, 0, 0x3f, false};
+    }
+    else if (b < atom::MEDIUM_TOK)
+    {
+      return {flags_to_type(0x03 & (b >> 4)), atom::SHORT, 1, 0x0f,
+	      (0x03 & (b >> 4)) == 3};
+    }
+    else if (b < atom::LONG_TOK)
+    {
+      return {flags_to_type(0x03 & (b >> 3)), atom::MEDIUM, 2, 0x07,
+	      (0x03 & (b >> 3)) == 3};
+    }
+    else if (b < 0xe4)
+    {
+      return {flags_to_type(0x03 & b), atom::LONG, 4, 0x00, (0x03 & b) == 3};
+    }
+    return {BAD_TOKEN, atom::NONE, 0, 0, false};
+  }
+  
+  // Full 256 entry table, built at compile time
+  struct head_table
+  {
+    head_info entry[256];
+    
+    constexpr head_table() : entry()
+    {
+      for (unsigned b = 0; b < 256; b++)
+      {
+	entry[b] = classify(b);
+      }
+    }
+  };
+  
+  constexpr head_table head_lut;
+  
+  // Header size by encoding (indexed by atom::enc_t, first segment if continued)
+  constexpr uint8_t enc_head_size[] = {0, 0, 1, 2, 4, 4};
+  
+  // Payload length from a short / medium / long atom header
+  inline size_t head_count(head_info const &info, byte const *data)
+  {
+    size_t count = info.len_mask & data[0];
+    for (size_t i = 1; i < info.head; i++)
+    {
+      count = (count << 8) | data[i];
+    }
+    return count;
+  }
+  
+  // Load a big endian integer of len (1-8) bytes, unaligned
+  inline uint64_t load_be(byte const *data, size_t len)
+  {
+    uint64_t raw = 0;
+    memcpy(reinterpret_cast<byte*>(&raw) + (8 - len), data, len);
+    return be64toh(raw);
+  }
+  
+  // Store the low len (1-8) bytes of a value big endian, unaligned
+  inline void store_be(byte *data, uint64_t value, size_t len)
+  {
+    uint64_t raw = htobe64(value);
+    memcpy(data, reinterpret_cast<byte const*>(&raw) + (8 - len), len);
+  }
+  
+};
+
 /**
  * \brief Default Constructor
  */
@@ -48,6 +149,53 @@ atom::atom()
   data_enc = atom::NONE;
   int_skip = 0;
   uint_val = 0;
+  ref_data = NULL;
+  ref_len = 0;
+}
+
+/**
+ * \brief Allocator Constructor
+ *
+ * @param alloc Allocator for binary payload storage
+ */
+atom::atom(allocator_type const &alloc)
+  : bytes(alloc)
+{
+  // Initialize
+  data_type = atom::EMPTY;
+  data_enc = atom::NONE;
+  int_skip = 0;
+  uint_val = 0;
+  ref_data = NULL;
+  ref_len = 0;
+}
+
+/**
+ * \brief Allocator-Extended Copy Constructor
+ *
+ * @param ref   Atom to copy
+ * @param alloc Allocator for binary payload storage
+ */
+atom::atom(atom const &ref, allocator_type const &alloc)
+  : data_type(ref.data_type), data_enc(ref.data_enc), int_skip(ref.int_skip),
+    uint_val(ref.uint_val), bytes(ref.bytes, alloc), ref_data(ref.ref_data),
+    ref_len(ref.ref_len)
+{
+  // Nada
+}
+
+/**
+ * \brief Allocator-Extended Move Constructor
+ *
+ * @param ref   Atom to move from
+ * @param alloc Allocator for binary payload storage
+ */
+atom::atom(atom &&ref, allocator_type const &alloc)
+  : data_type(ref.data_type), data_enc(ref.data_enc), int_skip(ref.int_skip),
+    uint_val(ref.uint_val), bytes(std::move(ref.bytes), alloc),
+    ref_data(ref.ref_data), ref_len(ref.ref_len)
+{
+  // Nada
 }
 
 /**
@@ -65,11 +213,6 @@ atom::~atom()
  */
 atom atom::new_int(int64_t value)
 {
-  union
-  {
-    uint64_t flip;
-    byte     raw[8];
-  };
   atom ret;
   
   // Intitialize
@@ -85,26 +228,12 @@ atom atom::new_int(int64_t value)
   }
   else // Determine how many bytes are really needed
   {
-    // Byteflip to big endian
-    flip = htobe64(value);
-    
-    // Logic differs a bit based on sign
-    if (value < 0)
-    {
-      // Negative condition is to drop 0xff bytes,
-      // provided the remaining value is still negative
-      // (most significant remaining bit is a 1)
-      for (ret.int_skip = 0; (ret.int_skip < 8) && (raw[ret.int_skip] == 0xff) &&
-	     ((raw[ret.int_skip + 1] & 0x80) == 0x80); ret.int_skip++) {}
-    }
-    else
-    {
-      // Positive condition is to drop 0x00 bytes,
-      // provided the remaining value is still positive
-      // (most significant remaining bit is a 0)
-      for (ret.int_skip = 0; (ret.int_skip < 8) && (raw[ret.int_skip] == 0x00) &&
-	     ((raw[ret.int_skip + 1] & 0x80) == 0x00); ret.int_skip++) {}
-    }
+    // Folding negatives onto their complement makes leading sign bits
+    // into leading zeroes, so both signs count the same way. One more
+    // bit is needed on top of the magnitude to carry the sign.
+    uint64_t mag = (value < 0) ? ~(uint64_t)value : (uint64_t)value;
+    size_t bits = 65 - __builtin_clzll(mag);
+    ret.int_skip = 8 - ((bits + 7) / 8);
     
     // All integers less than 16 bytes long (128 bits) will fit in this ...
     ret.data_enc = atom::SHORT;
@@ -118,11 +247,6 @@ atom atom::new_int(int64_t value)
  */
 atom atom::new_uint(uint64_t value)
 {
-  union
-  {
-    uint64_t flip;
-    byte     raw[8];
-  };
   atom ret;
   
   // Intitialize
@@ -138,12 +262,8 @@ atom atom::new_uint(uint64_t value)
   }
   else // Determine how many bytes are really needed
   {
-    // Byteflip to big endian
-    flip = htobe64(value);
-    
-    // Drop unneeded leading zeroes (up to 7)
-    for (ret.int_skip = 0; (ret.int_skip < 8) && (raw[ret.int_skip] == 0x00);
-	 ret.int_skip++) {}
+    // Drop unneeded leading zero bytes (value is nonzero here)
+    ret.int_skip = __builtin_clzll(value) / 8;
     
     // All integers less than 16 bytes long (128 bits) will fit in this ...
     ret.data_enc = atom::SHORT;
@@ -157,11 +277,7 @@ atom atom::new_uint(uint64_t value)
  */
 atom atom::new_uid(uint64_t value)
 {
-  union
-  {
-    uint64_t flip;
-    byte     raw[8];
-  };
+  TOPAZ_ALLOC_SITE(site, ALLOC_NEW_UID);
   atom ret;
   
   // Unique ID's (UIDs) are quirky. They are 64 bit integers, but get
@@ -176,16 +292,10 @@ atom atom::new_uid(uint64_t value)
   ret.data_type = atom::BYTES;
   ret.data_enc = atom::SHORT;
   
-  // Flip integer big endian
-  flip = htobe64(value);
-  
-  // Now binary
+  // Now binary, big endian
   ret.bytes.resize(8);
-  for (size_t i = 0; i < 8; i++)
-  {
-    ret.bytes[i] = raw[i];
-  }
-    
+  store_be(ret.bytes.data(), value, 8);
+  
   return ret;
 }
 
@@ -203,11 +313,7 @@ atom atom::new_bin(byte const *data, size_t len)
   ret.pick_encoding(len);
   
   // Copy data over
-  ret.bytes.resize(len);
-  for (size_t i = 0; i < len; i++)
-  {
-    ret.bytes[i] = data[i];
-  }
+  ret.bytes.assign(data, data + len);
   
   return ret;
 }
@@ -221,11 +327,44 @@ atom atom::new_bin(char const *str)
 }
 
 /**
- * \brief Factory Method - Binary Data
+ * \brief Factory Method - Binary Data (sink, moved into atom)
  */
 atom atom::new_bin(byte_vector data)
 {
-  return atom::new_bin(&(data[0]), data.size());
+  atom ret;
+  
+  // Intialize
+  ret.data_type = atom::BYTES;
+  
+  // Pick data encoding
+  ret.pick_encoding(data.size());
+  
+  // Take over caller's container
+  ret.bytes = std::move(data);
+  
+  return ret;
+}
+
+/**
+ * \brief Factory Method - Borrowed Binary Data
+ *
+ * No copy is made; caller's buffer must outlive the atom (and its copies).
+ */
+atom atom::new_bin_ref(byte const *data, size_t len)
+{
+  atom ret;
+  
+  // Intialize
+  ret.data_type = atom::BYTES;
+  
+  // Pick data encoding
+  ret.pick_encoding(len);
+  
+  // Just remember where it lives
+  ret.ref_data = data;
+  ret.ref_len = len;
+  
+  return ret;
 }
 
 /**
@@ -251,20 +390,12 @@ bool atom::operator==(atom const &ref)
 	break;
 	
       case atom::BYTES:
-	// Compare size and bytes
-	if (bytes.size() == ref.bytes.size())
+	// Compare size and bytes (owned or borrowed)
+	if (get_bin_size() == ref.get_bin_size())
 	{
-	  // Check each byte
-	  for (size_t i = 0; i < bytes.size(); i++)
-	  {
-	    if (bytes[i] != ref.bytes[i])
-	    {
-	      return false;
-	    }
-	  }
-	  
-	  // All bytes match 
-	  return true;
+	  // Check bytes (empty data may carry NULL pointers)
+	  return ((get_bin_size() == 0) ||
+		  (memcmp(get_bin_data(), ref.get_bin_data(), get_bin_size()) == 0));
 	}
 	break;
 	
@@ -301,10 +432,17 @@ size_t atom::size() const
   {
     return 1;
   }
+  else if (data_enc == atom::CONTINUED)
+  {
+    // Full segments, plus whatever is left over
+    size_t len = get_bin_size();
+    return ((len / atom::MAX_SEGMENT) * atom::segment_size(atom::MAX_SEGMENT) +
+	    ((len % atom::MAX_SEGMENT) ? atom::segment_size(len % atom::MAX_SEGMENT) : 0));
+  }
   else if (data_type == atom::BYTES)
   {
     // Binary data
-    return get_header_size() + bytes.size();
+    return get_header_size() + get_bin_size();
   }
   else
   {
@@ -322,12 +460,7 @@ size_t atom::size() const
 size_t atom::encode_bytes(byte *data) const
 {
   size_t len, i = 0;
-  union
-  {
-    uint64_t flip;
-    byte     raw[8];
-  };
-  byte const *enc_data;
+  byte const *enc_data = NULL;
 
   // Figure out WHAT we're encoding
   switch (data_type)
@@ -339,16 +472,25 @@ size_t atom::encode_bytes(byte *data) const
       
     case atom::UINT:
     case atom::INT:
-      // Integers
+      // Integers (stored big endian after the header)
       len = 8 - int_skip;         // How many bytes getting stored
-      flip = htobe64(uint_val);   // Big endian order
-      enc_data = raw + int_skip;  // Pointer to starting byte
       break;
       
     default: // atom::BYTES:
       // Binary data
-      len = bytes.size();         // Length from container
-      enc_data = &(bytes[0]);     // Pointer to starting byte
+      len = get_bin_size();       // Length from container / borrowed buffer
+      enc_data = get_bin_data();  // Pointer to starting byte
+      
+      // Too big for one atom, emit a run of continued segments
+      if (data_enc == atom::CONTINUED)
+      {
+	for (size_t off = 0; off < len; off += atom::MAX_SEGMENT)
+	{
+	  size_t seg = std::min(len - off, atom::MAX_SEGMENT);
+	  i += encode_segment(data + i, enc_data + off, seg, off + seg < len);
+	}
+	return i;
+      }
       break;
   }
   
@@ -413,7 +555,14 @@ size_t atom::encode_bytes(byte *data) const
   }
   
   // Finally, copy in the atom's payload
-  memcpy(data + i, enc_data, len);
+  if (enc_data)
+  {
+    memcpy(data + i, enc_data, len);
+  }
+  else
+  {
+    store_be(data + i, uint_val, len);
+  }
   
   // Final byte count
   return i + len;
@@ -428,108 +577,180 @@ size_t atom::encode_bytes(byte *data) const
  */
 size_t atom::decode_bytes(byte const *data, size_t len)
 {
-  size_t head_bytes = 0, count = 0;
+  TOPAZ_ALLOC_SITE(site, ALLOC_DECODE);
+  size_t count;
+  
+  // Decoded atoms always own their bytes
+  ref_data = NULL;
+  ref_len = 0;
   
   // Minimum 1 byte
   decode_check_size(len, 1);
   
-  // What is it?
-  if (data[0] == atom::EMPTY_TOK)
+  // What is it? (One table lookup covers type, encoding and header size)
+  head_info const &info = head_lut.entry[data[0]];
+  if (info.type == BAD_TOKEN)
+  {
+    printf("***** Bad Char - %x *****\n", data[0]);
+    throw topaz_exception("Cannot parse atom (invalid token)");
+  }
+  data_type = (atom::type_t)info.type;
+  data_enc = (atom::enc_t)info.enc;
+  
+  // Empty Atom (no data)
+  if (data_type == atom::EMPTY)
   {
-    // Empty Atom (no data)
-    data_type = atom::EMPTY;
-    data_enc = atom::NONE;
-    
     // No further processing
     return 1;
   }
-  if (data[0] < atom::SHORT_TOK)
+  
+  // Tiny Atom (Data stored in header)
+  if (data_enc == atom::TINY)
   {
-    // Tiny Atom (Data stored in header)
-    data_enc = atom::TINY;
-    
-    // Determine type
-    decode_set_type(0x03 & (data[0] >> 6));
-    
-    // Must be integer (Note: union type)
-    int_val = 0x3f & data[0];
-    if ((data_type == atom::INT) && (data[0] & 0x20))
+    // Must be integer (Note: union type), signed values sign extend
+    // by shifting the 6 bit field up against the top of the word
+    int_skip = 0;
+    uint_val = info.len_mask & data[0];
+    if (data_type == atom::INT)
     {
-      // Negative signed integer - Sign extend
-      int_val |= ~(0x3fULL);
+      int_val = (int64_t)(uint_val << 58) >> 58;
     }
     
     // No further processing
     return 1;
   }
-  else if (data[0] < atom::MEDIUM_TOK)
-  {
-    // Short Atom (1 byte header)
-    data_enc = atom::SHORT;
-    head_bytes = 1;
-    
-    // Determine type
-    decode_set_type(0x03 & (data[0] >> 4));
-    
-    // Determine size
-    count = data[0] & 0x0f;
-  }
-  else if (data[0] < atom::LONG_TOK)
+  
+  // Continued byte sequence, gather every segment into one value
+  if (info.cont)
   {
-    // Medium Atom (2 byte header)
-    data_enc = atom::MEDIUM;
-    head_bytes = 2;
-    decode_check_size(len, head_bytes);
-    
-    // Determine type
-    decode_set_type(0x03 & (data[0] >> 3));
-    
-    // Determine size
-    count = 0x07 & data[0];
-    count = (count << 8) + data[1];
+    bytes.clear();
+    count = decode_segments(data, len, [this](byte const *seg, size_t seg_len)
+			    {
+			      bytes.insert(bytes.end(), seg, seg + seg_len);
+			    });
+    pick_encoding(bytes.size());
+    return count;
   }
-  else if (data[0] < 0xe4)
+  
+  // Determine size (leading bits from the token, then the header bytes)
+  decode_check_size(len, info.head);
+  count = head_count(info, data);
+  
+  // Ensure expected remaining data is present
+  decode_check_size(len, info.head + count);
+  
+  // Load atom payload
+  if (data_type == atom::BYTES)
   {
-    // Long Atom (4 byte header)
-    data_enc = atom::LONG;
-    head_bytes = 4;
-    decode_check_size(len, head_bytes);
-    
-    // Determine type
-    decode_set_type(0x03 & data[0]);
-    
-    // Determine size
-    count = data[1];
-    count = (count << 8) + data[2];
-    count = (count << 8) + data[3];
+    // Binary data
+    bytes.assign(data + info.head, data + info.head + count);
   }
-  else // Reserved, or non-atom token (0xe4 - 0xfe)
+  else
   {
-    printf("***** Bad Char - %x *****\n", data[0]);
-    throw topaz_exception("Cannot parse atom (invalid token)");
+    // Parse integers
+    decode_int(data + info.head, count);
   }
   
-  // Ensure expected remaining data is present
-  decode_check_size(len, head_bytes + count);
+  // Final size
+  return info.head + count;
+}
+
+/**
+ * \brief Encoded size of one byte sequence segment
+ *
+ * @param len Segment payload length
+ * @return Header plus payload size
+ */
+size_t atom::segment_size(size_t len)
+{
+  return ((len < 16) ? 1 : ((len < 2048) ? 2 : 4)) + len;
+}
+
+/**
+ * \brief Encode one segment of a (possibly continued) byte sequence
+ *
+ * @param data Data buffer of at least segment_size(len) bytes
+ * @param seg  Segment payload
+ * @param len  Segment payload length
+ * @param more True if further segments follow
+ * @return Number of bytes encoded
+ */
+size_t atom::encode_segment(byte *data, byte const *seg, size_t len, bool more)
+{
+  size_t i = 0;
   
-  // Load atom payload
-  if ((data_type == atom::UINT) || (data_type == atom::INT))
+  // Smallest header that fits, continued flag set unless last
+  if (len < 16)
   {
-    // Parse integers
-    decode_int(data + head_bytes, count);
+    data[i++] = atom::SHORT_TOK | atom::SHORT_BIN | (more ? atom::SHORT_CONT : 0) | len;
   }
-  else if (data_type == atom::BYTES)
+  else if (len < 2048)
   {
-    // Binary data
-    bytes.resize(count);
-    for (size_t i = 0; i < count; i++)
+    data[i++] = atom::MEDIUM_TOK | atom::MEDIUM_BIN | (more ? atom::MEDIUM_CONT : 0) | (len >> 8);
+    data[i++] = 0xff & len;
+  }
+  else if (len <= atom::MAX_SEGMENT)
+  {
+    data[i++] = atom::LONG_TOK | atom::LONG_BIN | (more ? atom::LONG_CONT : 0);
+    data[i++] = 0xff & (len >> 16);
+    data[i++] = 0xff & (len >> 8);
+    data[i++] = 0xff & len;
+  }
+  else
+  {
+    throw topaz_exception("Atom segment too large to encode");
+  }
+  
+  // Payload
+  memcpy(data + i, seg, len);
+  
+  return i + len;
+}
+
+/**
+ * \brief Decode a (possibly continued) byte sequence, segment by segment
+ *
+ * @param data Location to read encoded bytes
+ * @param len  Length of buffer
+ * @param sink Receives each segment payload
+ * @return Number of bytes processed
+ */
+size_t atom::decode_segments(byte const *data, size_t len, segment_sink const &sink)
+{
+  size_t pos = 0, count;
+  bool more = true;
+  
+  while (more)
+  {
+    // Every segment is a binary short / medium / long atom
+    if (len - pos < 1)
+    {
+      throw topaz_exception("Atom encoding too short");
+    }
+    head_info const &info = head_lut.entry[data[pos]];
+    if ((info.type != atom::BYTES) || (info.head == 0))
     {
-      bytes[i] = data[head_bytes + i];
+      throw topaz_exception("Atom is not binary data");
     }
+    
+    // Segment length
+    if (len - pos < info.head)
+    {
+      throw topaz_exception("Atom encoding too short");
+    }
+    count = head_count(info, data + pos);
+    if (len - pos - info.head < count)
+    {
+      throw topaz_exception("Atom encoding too short");
+    }
+    
+    // Hand it over
+    sink(data + pos + info.head, count);
+    pos += info.head + count;
+    more = info.cont;
   }
   
-  // Final size
-  return head_bytes + count;
+  return pos;
 }
 
 /**
@@ -559,25 +780,7 @@ atom::enc_t atom::get_enc() const
  */
 size_t atom::get_header_size() const
 {
-  switch (data_enc)
-  {
-    case atom::NONE:
-    case atom::TINY:
-      return 0;
-      break;
-
-    case atom::SHORT:
-      return 1;
-      break;
-      
-    case atom::MEDIUM:
-      return 2;
-      break;
-      
-    default: // atom::LONG:
-      return 4;
-      break;
-  }
+  return enc_head_size[data_enc];
 }
 
 /**
@@ -585,25 +788,15 @@ size_t atom::get_header_size() const
  */
 uint64_t atom::get_uid() const
 {
-  union
-  {
-    uint64_t flip;
-    char     raw[8];
-  };
+  std::optional<uint64_t> uid = try_get_uid();
   
-  // Unique ID's (UIDs) are quirky. They are 64 bit integers, but get
-  // encoded like a byte sequence, of a single length 8 (short).
-  // This is simultaneously simpler, and infuriating ...
-  if ((data_type != atom::BYTES) || (data_enc != atom::SHORT) || (bytes.size() != 8))
+  // Sanity check
+  if (!uid)
   {
     throw topaz_exception("Invalid UID Atom");
   }
   
-  // Extract the bytes
-  memcpy(raw, &(bytes[0]), 8);
-  
-  // Flip to native endianess
-  return be64toh(flip);
+  return *uid;
 }
 
 /**
@@ -636,6 +829,47 @@ int64_t atom::get_int() const
   return int_val;
 }
 
+/**
+ * \brief Try Get Unsigned Integer Stored as UID (Bytes)
+ */
+std::optional<uint64_t> atom::try_get_uid() const
+{
+  // Unique ID's (UIDs) are quirky. They are 64 bit integers, but get
+  // encoded like a byte sequence, of a single length 8 (short).
+  // This is simultaneously simpler, and infuriating ...
+  if ((data_type != atom::BYTES) || (data_enc != atom::SHORT) || (get_bin_size() != 8))
+  {
+    return std::nullopt;
+  }
+  
+  // Extract the bytes in native endianess
+  return load_be(get_bin_data(), 8);
+}
+
+/**
+ * \brief Try Get Unsigned Integer Value
+ */
+std::optional<uint64_t> atom::try_get_uint() const
+{
+  if (data_type != atom::UINT)
+  {
+    return std::nullopt;
+  }
+  return uint_val;
+}
+
+/**
+ * \brief Try Get Signed Integer Value
+ */
+std::optional<int64_t> atom::try_get_int() const
+{
+  if (data_type != atom::INT)
+  {
+    return std::nullopt;
+  }
+  return int_val;
+}
+
 /**
  * \brief Get Binary Data
  */
@@ -646,11 +880,39 @@ byte_vector const &atom::get_bytes() const
   {
     throw topaz_exception("Atom is not binary data");
   }
+  if (ref_data)
+  {
+    throw topaz_exception("Atom binary data is borrowed (use get_bin_data)");
+  }
   
   // Return reference
   return bytes;
 }
 
+/**
+ * \brief Get Binary Data Pointer (owned or borrowed)
+ */
+byte const *atom::get_bin_data() const
+{
+  return (ref_data ? ref_data : bytes.data());
+}
+
+/**
+ * \brief Get Binary Data Length (owned or borrowed)
+ */
+size_t atom::get_bin_size() const
+{
+  return (ref_data ? ref_len : bytes.size());
+}
+
+/**
+ * \brief Query if Binary Data is Borrowed
+ */
+bool atom::is_borrowed() const
+{
+  return (ref_data != NULL);
+}
+
 /**
  * \brief Get String
  */
@@ -662,7 +924,15 @@ std::string atom::get_string() const
     throw topaz_exception("Atom is not binary data");
   }
   
-  return std::string(bytes.begin(), bytes.end());
+  return std::string((char const*)get_bin_data(), get_bin_size());
+}
+
+/**
+ * \brief Query Allocator
+ */
+atom::allocator_type atom::get_allocator() const
+{
+  return bytes.get_allocator();
 }
 
 /**
@@ -670,7 +940,8 @@ std::string atom::get_string() const
  */
 void atom::print() const
 {
-  size_t i;
+  byte const *bin = get_bin_data();
+  size_t i, bin_len = get_bin_size();
   bool is_print;
   
   // Determine what it is ...
@@ -696,30 +967,30 @@ void atom::print() const
       
       // First, check for printable chars
       is_print = true;
-      for (i = 0; i < bytes.size(); i++)
+      for (i = 0; i < bin_len; i++)
       {
-	if (!isprint(bytes[i]))
+	if (!isprint(bin[i]))
 	{
 	  is_print = false;
 	}
       }
       
       // Nonzero length of printable chars are probably strings
-      if ((bytes.size() > 0) && (is_print))
+      if ((bin_len > 0) && (is_print))
       {
 	// Assuming string ...
 	printf("\'");
-	for (i = 0; i < bytes.size(); i++)
+	for (i = 0; i < bin_len; i++)
 	{
-	  printf("%c", bytes[i]);
+	  printf("%c", bin[i]);
 	}
 	printf("\'");
       }
       // UIDs are two (usually small) numbers, stored together as a uint64.
       // If it looks like two signed or unsigned uint32's, assume UID.
-      else if ((bytes.size() == 8) &&
-	       ((bytes[0] == 0x00) || (bytes[0] == 0xff)) &&
-	       ((bytes[4] == 0x00) || (bytes[4] == 0xff)))
+      else if ((bin_len == 8) &&
+	       ((bin[0] == 0x00) || (bin[0] == 0xff)) &&
+	       ((bin[4] == 0x00) || (bin[4] == 0xff)))
       {
 	// Assuming UID ...
 	uint64_t uid = get_uid();
@@ -732,9 +1003,9 @@ void atom::print() const
       else
       {
 	printf("[");
-	for (i = 0; (i < 16) && (i < bytes.size()); i++)
+	for (i = 0; (i < 16) && (i < bin_len); i++)
 	{
-	  printf("%02X ", bytes[i]);
+	  printf("%02X ", bin[i]);
 	}
 	if (i == 16)
 	{
@@ -772,8 +1043,8 @@ void atom::pick_encoding(size_t byte_count)
   }
   else
   {
-    // Really?
-    throw topaz_exception("Atom too large to encode");
+    // Really? Split into continued long atoms
+    data_enc = atom::CONTINUED;
   }
 }
 
@@ -791,69 +1062,27 @@ void atom::decode_check_size(size_t len, size_t min) const
   }
 }
 
-/**
- * \brief Set atom type based on bin and sign flags
- *
- * @param bits Binary / Sign flags (values 0-3)
- */
-void atom::decode_set_type(uint8_t bits)
-{
-  switch(bits)
-  {
-    case 0:
-      data_type = atom::UINT;
-      break;
-      
-    case 1:
-      data_type = atom::INT;
-      break;
-      
-    case 2:
-      data_type = atom::BYTES;
-      break;
-      
-    default:
-      throw topaz_exception("Invalid / Unhandled atom type");
-      break;
-  }
-}
-
 /**
  * \brief Decode unsigned / signed integer
  */
 void atom::decode_int(byte const *data, size_t len)
 {
-  union
-  {
-    uint64_t flip;
-    byte     raw[8];
-  };
-  
   // Sanity check
   if ((len == 0) || (len > 8))
   {
     throw topaz_exception("Invalid integer Atom length");
   }
   
-  // How many bytes don't get set in raw ...
+  // How many bytes don't get set ...
   int_skip = 8 - len;
   
-  // Sign extend negative values
-  if ((data_type == atom::INT) && (data[0] & 0x80))
-  {
-    flip = -1; // Unsigned, so 0xfffffffff ....
-  }
-  else
-  {
-    flip = 0;
-  }
+  // Big endian load (Note: union type)
+  uint_val = load_be(data, len);
   
-  // Copy data over
-  for (size_t i = 0; i < len; i++)
+  // Sign extend negative values by shifting the top payload bit up to
+  // bit 63 and arithmetic shifting back down
+  if (data_type == atom::INT)
   {
-    raw[int_skip + i] = data[i];
+    int_val = (int64_t)(uint_val << (8 * int_skip)) >> (8 * int_skip);
   }
-  
-  // Byteflip (Note: union type)
-  uint_val = be64toh(flip);
 }
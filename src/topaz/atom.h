@@ -32,6 +32,8 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <functional>
+#include <optional>
 #include <string>
 #include <topaz/defs.h>
 #include <topaz/encodable.h>
@@ -44,6 +46,9 @@ namespace topaz
     
   public:
     
+    // Allocator used for binary payload storage
+    typedef mem_allocator allocator_type;
+    
     // Valid atom types
     typedef enum
     {
@@ -60,7 +65,8 @@ namespace topaz
       TINY,   // Integers 6 bits or less
       SHORT,  // Data < 16 bytes
       MEDIUM, // Data < 2048 bytes
-      LONG    // Data < 16777216 bytes
+      LONG,   // Data < 16777216 bytes
+      CONTINUED // Binary data split across several atoms
     } enc_t;
     
     // Valid tokens for encoding atoms
@@ -74,26 +80,68 @@ namespace topaz
       SHORT_TOK   = 0x80,
       SHORT_BIN   = 0x20, // Modifier to SHORT_ATOM
       SHORT_SIGN  = 0x10, // Modifier to SHORT_ATOM
+      SHORT_CONT  = 0x10, // Modifier to binary SHORT_ATOM (more follows)
       
       // Medium Atoms
       MEDIUM_TOK  = 0xc0,
       MEDIUM_BIN  = 0x10, // Modifier to MEDIUM_ATOM
       MEDIUM_SIGN = 0x08, // Modifier to MEDIUM_ATOM
+      MEDIUM_CONT = 0x08, // Modifier to binary MEDIUM_ATOM (more follows)
       
       // Long Atoms
       LONG_TOK    = 0xe0,
       LONG_BIN    = 0x02, // Modifier to LONG_ATOM
       LONG_SIGN   = 0x01, // Modifier to LONG_ATOM
+      LONG_CONT   = 0x01, // Modifier to binary LONG_ATOM (more follows)
       
       // Empty
       EMPTY_TOK   = 0xff
     } tokens_t;
     
+    // Largest payload carried by a single (long) atom
+    static constexpr size_t MAX_SEGMENT = 0xffffff;
+    
+    // Receives each segment of a continued byte sequence, in order
+    typedef std::function<void(byte const *seg, size_t len)> segment_sink;
+    
     /**
      * \brief Default Constructor
      */
     atom();
     
+    /**
+     * \brief Allocator Constructor
+     *
+     * @param alloc Allocator for binary payload storage
+     */
+    explicit atom(allocator_type const &alloc);
+    
+    /**
+     * \brief Copy Constructor
+     */
+    atom(atom const &ref) = default;
+    
+    /**
+     * \brief Move Constructor
+     */
+    atom(atom &&ref) noexcept = default;
+    
+    /**
+     * \brief Allocator-Extended Copy Constructor
+     *
+     * @param ref   Atom to copy
+     * @param alloc Allocator for binary payload storage
+     */
+    atom(atom const &ref, allocator_type const &alloc);
+    
+    /**
+     * \brief Allocator-Extended Move Constructor
+     *
+     * @param ref   Atom to move from
+     * @param alloc Allocator for binary payload storage
+     */
+    atom(atom &&ref, allocator_type const &alloc);
+    
     /**
      * \brief Destructor
      */
@@ -125,10 +173,27 @@ namespace topaz
     static topaz::atom new_bin(char const *str);
     
     /**
-     * \brief Factory Method - Binary Data
+     * \brief Factory Method - Binary Data (sink, moved into atom)
      */
     static topaz::atom new_bin(byte_vector data);
     
+    /**
+     * \brief Factory Method - Borrowed Binary Data
+     *
+     * No copy is made; caller's buffer must outlive the atom (and its copies).
+     */
+    static topaz::atom new_bin_ref(byte const *data, size_t len);
+    
+    /**
+     * \brief Copy Assignment
+     */
+    atom &operator=(atom const &ref) = default;
+    
+    /**
+     * \brief Move Assignment
+     */
+    atom &operator=(atom &&ref) = default;
+    
     /**
      * \brief Equality Operator
      *
@@ -167,6 +232,42 @@ namespace topaz
      */
     virtual size_t decode_bytes(byte const *data, size_t len);
     
+    /**
+     * \brief Encoded size of one byte sequence segment
+     *
+     * @param len Segment payload length (up to MAX_SEGMENT)
+     * @return Header plus payload size
+     */
+    static size_t segment_size(size_t len);
+    
+    /**
+     * \brief Encode one segment of a (possibly continued) byte sequence
+     *
+     * Lets callers stream a large value through a bounded buffer, one
+     * segment at a time. The final segment must have more set to false.
+     *
+     * @param data Data buffer of at least segment_size(len) bytes
+     * @param seg  Segment payload
+     * @param len  Segment payload length (up to MAX_SEGMENT)
+     * @param more True if further segments follow
+     * @return Number of bytes encoded
+     */
+    static size_t encode_segment(byte *data, byte const *seg, size_t len, bool more);
+    
+    /**
+     * \brief Decode a (possibly continued) byte sequence, segment by segment
+     *
+     * Segments are handed to the sink straight from the input buffer,
+     * so the whole value is never gathered in memory.
+     *
+     * @param data Location to read encoded bytes
+     * @param len  Length of buffer
+     * @param sink Receives each segment payload
+     * @return Number of bytes processed
+     */
+    static size_t decode_segments(byte const *data, size_t len,
+				  segment_sink const &sink);
+    
     /**
      * \brief Query Atom Type
      *
@@ -203,16 +304,57 @@ namespace topaz
      */
     int64_t get_int() const;
     
+    /**
+     * \brief Try Get Unsigned Integer Stored as UID (Bytes)
+     *
+     * @return UID, or nothing if atom is not a UID
+     */
+    std::optional<uint64_t> try_get_uid() const;
+    
+    /**
+     * \brief Try Get Unsigned Integer Value
+     *
+     * @return Value, or nothing if atom is not an unsigned integer
+     */
+    std::optional<uint64_t> try_get_uint() const;
+    
+    /**
+     * \brief Try Get Signed Integer Value
+     *
+     * @return Value, or nothing if atom is not a signed integer
+     */
+    std::optional<int64_t> try_get_int() const;
+    
     /**
      * \brief Get Binary Data
      */
     byte_vector const &get_bytes() const;
     
+    /**
+     * \brief Get Binary Data Pointer (owned or borrowed)
+     */
+    byte const *get_bin_data() const;
+    
+    /**
+     * \brief Get Binary Data Length (owned or borrowed)
+     */
+    size_t get_bin_size() const;
+    
+    /**
+     * \brief Query if Binary Data is Borrowed
+     */
+    bool is_borrowed() const;
+    
     /**
      * \brief Get String
      */
     std::string get_string() const;
     
+    /**
+     * \brief Query Allocator
+     */
+    allocator_type get_allocator() const;
+    
     /**
      * \brief Debug print
      */
@@ -235,13 +377,6 @@ namespace topaz
      */
     void decode_check_size(size_t len, size_t min) const;
     
-    /**
-     * \brief Set atom type based on bin and sign flags
-     *
-     * @param bits Binary / Sign flags (values 0-3)
-     */
-    void decode_set_type(uint8_t bits);
-    
     /**
      * \brief Decode unsigned / signed integer
      *
@@ -260,6 +395,8 @@ namespace topaz
       int64_t  int_val;     // Decoded integer value
     };
     byte_vector bytes;      // Container for binary bytes
+    byte const *ref_data;   // Borrowed binary bytes (NULL if owned)
+    size_t ref_len;         // Length of borrowed binary bytes
     
   };
 
@@ -0,0 +1,160 @@
+/**
+ * Topaz - Call Batch
+ *
+ * This file implements the queue of method calls sent together with
+ * drive::invoke_batch (see batch.h).
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstdio>
+#include <topaz/batch.h>
+#include <topaz/exceptions.h>
+#include <topaz/uid.h>
+using namespace std;
+using namespace topaz;
+
+/**
+ * \brief Call Batch Constructor
+ */
+call_batch::call_batch(drive &target)
+  : target(target), merge_from(0)
+{
+}
+
+/**
+ * \brief Queue Set[] of one cell
+ */
+void call_batch::set(uint64_t obj_uid, uint64_t col, atom val, string const &label)
+{
+  // Pending Set of the same object, with no other call since?
+  for (size_t i = merge_from; i < calls.size(); i++)
+  {
+    if ((calls[i].object_uid() == obj_uid) && (calls[i].method_uid() == SET))
+    {
+      // Later value of a cell wins
+      datum &values = calls[i][0].named_value();
+      datum *cell = values.try_find_by_name(col);
+      if (cell)
+      {
+	*cell = datum(std::move(val));
+      }
+      else
+      {
+	size_t n = values.list().size();
+	values[n].name()        = atom::new_uint(col);
+	values[n].named_value() = std::move(val);
+      }
+      if (!label.empty() && (labels[i].find(label) == string::npos))
+      {
+	labels[i] += (labels[i].empty() ? "" : ", ") + label;
+      }
+      return;
+    }
+  }
+
+  // UID.Set[Values = [col = val]]
+  datum call;
+  call.object_uid() = obj_uid;
+  call.method_uid() = SET;
+  call[0].name()                         = atom::new_uint(1);
+  call[0].named_value()[0].name()        = atom::new_uint(col);
+  call[0].named_value()[0].named_value() = std::move(val);
+  calls.push_back(std::move(call));
+  labels.push_back(label);
+}
+
+/**
+ * \brief Queue Set[] of one unsigned cell
+ */
+void call_batch::set(uint64_t obj_uid, uint64_t col, uint64_t val, string const &label)
+{
+  set(obj_uid, col, atom::new_uint(val), label);
+}
+
+/**
+ * \brief Queue any method call
+ */
+void call_batch::call(datum call, string const &label)
+{
+  calls.push_back(std::move(call));
+  labels.push_back(label);
+
+  // Sets queued after this must stay after it
+  merge_from = calls.size();
+}
+
+/**
+ * \brief Method calls queued
+ */
+size_t call_batch::size() const
+{
+  return calls.size();
+}
+
+/**
+ * \brief Send queued calls
+ */
+void call_batch::flush(unsigned timeout_ms)
+{
+  if (calls.empty())
+  {
+    return;
+  }
+
+  datum_vector pending, results;
+  vector<string> names;
+  pending.swap(calls);
+  names.swap(labels);
+  merge_from = 0;
+
+  vector<unsigned> status = target.invoke_batch(std::move(pending), results, timeout_ms);
+  for (size_t i = 0; i < status.size(); i++)
+  {
+    if (status[i] != datum::STA_SUCCESS)
+    {
+      char buf[64];
+      if (status[i] == drive::STA_INCOMPLETE)
+      {
+	snprintf(buf, sizeof(buf), "not completed");
+      }
+      else
+      {
+	snprintf(buf, sizeof(buf), "method status 0x%02x", status[i]);
+      }
+      throw topaz_exception((names[i].empty() ? string("Batched call") : names[i]) +
+			    ": " + buf);
+    }
+  }
+}
+
+/**
+ * \brief Drop queued calls
+ */
+void call_batch::clear()
+{
+  calls.clear();
+  labels.clear();
+  merge_from = 0;
+}
@@ -0,0 +1,118 @@
+#ifndef TOPAZ_BATCH_H
+#define TOPAZ_BATCH_H
+
+/**
+ * Topaz - Call Batch
+ *
+ * This file implements a queue of method calls sent together with
+ * drive::invoke_batch. Sets of cells on the same object are merged into
+ * one Set[] call, so a run of independent configuration changes (eg - a
+ * provisioning script) costs as few method calls and ComPkts as the TPer
+ * allows. Calls keep their order; a Set is only merged past other Sets.
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <topaz/drive.h>
+
+namespace topaz
+{
+
+  class call_batch
+  {
+
+  public:
+
+    /**
+     * \brief Call Batch Constructor
+     *
+     * @param target Drive calls go to, in session when flushed
+     */
+    call_batch(drive &target);
+
+    /**
+     * \brief Queue Set[] of one cell
+     *
+     * @param obj_uid Object (table row) to set
+     * @param col     Column
+     * @param val     Value (moved into batch)
+     * @param label   Names the request in errors (eg - "line 3")
+     */
+    void set(uint64_t obj_uid, uint64_t col, atom val,
+	     std::string const &label = std::string());
+
+    /**
+     * \brief Queue Set[] of one unsigned cell
+     *
+     * @param obj_uid Object (table row) to set
+     * @param col     Column
+     * @param val     Value
+     * @param label   Names the request in errors (eg - "line 3")
+     */
+    void set(uint64_t obj_uid, uint64_t col, uint64_t val,
+	     std::string const &label = std::string());
+
+    /**
+     * \brief Queue any method call (never merged)
+     *
+     * @param call  Method call datum (moved into batch)
+     * @param label Names the request in errors
+     */
+    void call(datum call, std::string const &label = std::string());
+
+    /**
+     * \brief Method calls queued
+     */
+    size_t size() const;
+
+    /**
+     * \brief Send queued calls, throwing on the first that failed
+     *
+     * The queue is empty afterwards, whatever happened.
+     *
+     * @param timeout_ms Deadline for the whole batch (0 - usual per ComPkt timeout)
+     */
+    void flush(unsigned timeout_ms = 0);
+
+    /**
+     * \brief Drop queued calls
+     */
+    void clear();
+
+  protected:
+
+    /* internal data */
+    drive &target;
+    datum_vector calls;
+    std::vector<std::string> labels;
+    size_t merge_from;  // First call a Set may be merged into
+
+  };
+
+};
+
+#endif
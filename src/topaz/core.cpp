@@ -0,0 +1,731 @@
+/**
+ * Topaz - Unlock Core
+ *
+ * This file implements a freestanding subset of the TCG Opal protocol, just
+ * enough to discover a drive, start a session, set lock columns and end the
+ * session. Built without exceptions / RTTI, and without heap or libc I/O.
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <topaz/core.h>
+using namespace topaz;
+
+// Token values (see datum::token_t)
+#define TOK_START_LIST  0xf0
+#define TOK_END_LIST    0xf1
+#define TOK_START_NAME  0xf2
+#define TOK_END_NAME    0xf3
+#define TOK_CALL        0xf8
+#define TOK_END_OF_DATA 0xf9
+#define TOK_END_SESSION 0xfa
+
+// ComPkt / Packet / SubPacket headers (see opal_header_t)
+#define HDR_COM_ID      4
+#define HDR_COM_LEN     16
+#define HDR_TPER_SID    20
+#define HDR_HOST_SID    24
+#define HDR_PKT_LEN     40
+#define HDR_SUB_LEN     52
+#define HDR_SIZE        56
+
+// Level 0 Discovery features
+#define FEAT_LOCK       0x0002
+#define FEAT_OPAL1      0x0200
+#define FEAT_OPAL2      0x0203
+
+// How often to poll the device for data (millisecs), and for how long
+#define POLL_MS 10
+#define TIMEOUT_SECS 5
+
+#define PAD_TO_MULTIPLE(val, mult) (((val + (mult - 1)) / mult) * mult)
+
+namespace
+{
+  
+  // Big endian accessors (no endian.h in freestanding builds)
+  inline uint32_t load_be(uint8_t const *p, size_t len)
+  {
+    uint32_t val = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+      val = (val << 8) | p[i];
+    }
+    return val;
+  }
+  
+  inline void store_be(uint8_t *p, uint64_t val, size_t len)
+  {
+    for (size_t i = len; i > 0; i--)
+    {
+      p[i - 1] = 0xff & val;
+      val >>= 8;
+    }
+  }
+  
+  inline void fill(uint8_t *p, size_t len)
+  {
+    for (size_t i = 0; i < len; i++)
+    {
+      p[i] = 0;
+    }
+  }
+  
+};
+
+/**
+ * \brief Unlock Core Constructor
+ *
+ * @param io Transport hooks
+ */
+core::core(core_io_t const &io)
+  : io(io)
+{
+  // Initialization
+  pos = HDR_SIZE;
+  resp_len = 0;
+  overflow = false;
+  com_id = 0;
+  has_opal2 = false;
+  lock_flags = 0;
+  tper_session_id = 0;
+  host_session_id = 0;
+}
+
+/**
+ * \brief Level 0 Discovery, followed by ComID reset on Opal 2 drives
+ */
+int core::discover()
+{
+  size_t total, offset;
+  
+  // Level0 Discovery over IF-RECV
+  fill(buffer, BLOCK_SIZE);
+  if (io.if_recv(io.ctx, 1, 1, buffer, 1))
+  {
+    return ERR_IO;
+  }
+  
+  // Verify major / minor number of structure
+  total = 4 + load_be(buffer, 4);
+  if ((load_be(buffer + 4, 2) != 0) || (load_be(buffer + 6, 2) != 1))
+  {
+    return ERR_PROTO;
+  }
+  if (total > BLOCK_SIZE)
+  {
+    total = BLOCK_SIZE;
+  }
+  
+  // Tick through returned feature descriptors (48 byte header, 4 byte
+  // descriptor headers), only those that fit in what was returned
+  com_id = 0;
+  for (offset = 48; offset + 4 <= total; offset += 4 + buffer[offset + 3])
+  {
+    uint16_t code = load_be(buffer + offset, 2);
+    uint8_t const *feat = buffer + offset + 4;
+    size_t len = buffer[offset + 3];
+    
+    if (offset + 4 + len > total)
+    {
+      break;
+    }
+    if ((code == FEAT_LOCK) && (len >= 1))
+    {
+      lock_flags = feat[0];
+    }
+    else if (((code == FEAT_OPAL1) || (code == FEAT_OPAL2)) && (len >= 2))
+    {
+      com_id = load_be(feat, 2);
+      has_opal2 = (code == FEAT_OPAL2);
+    }
+  }
+  if (com_id == 0)
+  {
+    return ERR_NO_OPAL;
+  }
+  
+  // If we can, make sure we're starting from a blank slate
+  return (has_opal2 ? stack_reset() : (int)OK);
+}
+
+/**
+ * \brief Start session to SP
+ */
+int core::start_session(uint64_t sp_uid, uint64_t auth_uid,
+			void const *pin, size_t pin_len)
+{
+  uint8_t const *data = buffer + HDR_SIZE;
+  size_t len, used, i;
+  uint64_t host_id, tper_id;
+  int rc;
+  
+  // Sanity check
+  if (com_id == 0)
+  {
+    return ERR_STATE;
+  }
+  
+  // If present, end any session in progress
+  end_session();
+  
+  // Required Arguments - Host Session ID, SP, Read/Write Session
+  begin_call(SESSION_MGR, START_SESSION);
+  put_uint(1);
+  put_uid(sp_uid);
+  put_uint(1);
+  
+  // Optional Arguments - Host Challenge, Host Signing Authority
+  if (auth_uid)
+  {
+    put_token(TOK_START_NAME);
+    put_uint(0);
+    put_bin(pin, pin_len);
+    put_token(TOK_END_NAME);
+    put_token(TOK_START_NAME);
+    put_uint(3);
+    put_uid(auth_uid);
+    put_token(TOK_END_NAME);
+  }
+  
+  // Session manager is stateless, and doesn't use session ID's ...
+  rc = finish_call(false);
+  if (rc != OK)
+  {
+    return rc;
+  }
+  
+  // Response is SyncSession[HostSessionID, SPSessionID ...]
+  len = resp_len;
+  if ((len < 20) || (data[0] != TOK_CALL) || (data[19] != TOK_START_LIST))
+  {
+    return ERR_PROTO;
+  }
+  i = 20;
+  used = get_uint(data + i, len - i, &host_id);
+  if (used == 0)
+  {
+    return ERR_PROTO;
+  }
+  i += used;
+  used = get_uint(data + i, len - i, &tper_id);
+  if (used == 0)
+  {
+    return ERR_PROTO;
+  }
+  
+  host_session_id = host_id;
+  tper_session_id = tper_id;
+  return OK;
+}
+
+/**
+ * \brief Set unsigned columns of one object, in a single Set[] call
+ */
+int core::set(uint64_t obj_uid, column_t const *cols, size_t count)
+{
+  // Sanity check
+  if (tper_session_id == 0)
+  {
+    return ERR_STATE;
+  }
+  
+  // Set[Values = [col = val ...]]
+  begin_call(obj_uid, SET);
+  put_token(TOK_START_NAME);
+  put_uint(1);
+  put_token(TOK_START_LIST);
+  for (size_t i = 0; i < count; i++)
+  {
+    put_token(TOK_START_NAME);
+    put_uint(cols[i].col);
+    put_uint(cols[i].val);
+    put_token(TOK_END_NAME);
+  }
+  put_token(TOK_END_LIST);
+  put_token(TOK_END_NAME);
+  
+  return finish_call(true);
+}
+
+/**
+ * \brief Get unsigned columns of one object, in a single Get[] call
+ */
+int core::get(uint64_t obj_uid, column_t *cols, size_t count)
+{
+  uint8_t const *data = buffer + HDR_SIZE;
+  uint64_t first = UINT64_MAX, last = 0, col;
+  size_t i, n, at, found = 0;
+  int rc;
+  
+  // Sanity check
+  if (tper_session_id == 0)
+  {
+    return ERR_STATE;
+  }
+  if (count == 0)
+  {
+    return OK;
+  }
+  for (i = 0; i < count; i++)
+  {
+    first = (cols[i].col < first ? cols[i].col : first);
+    last  = (cols[i].col > last  ? cols[i].col : last);
+  }
+  
+  // Get[Cellblock = [startColumn(3) = first, endColumn(4) = last]]
+  begin_call(obj_uid, GET);
+  put_token(TOK_START_LIST);
+  put_token(TOK_START_NAME);
+  put_uint(3);
+  put_uint(first);
+  put_token(TOK_END_NAME);
+  put_token(TOK_START_NAME);
+  put_uint(4);
+  put_uint(last);
+  put_token(TOK_END_NAME);
+  put_token(TOK_END_LIST);
+  rc = finish_call(true);
+  if (rc != OK)
+  {
+    return rc;
+  }
+  
+  // [[col = val ...]] ahead of the status list
+  if ((resp_len < 8) || (data[0] != TOK_START_LIST) || (data[1] != TOK_START_LIST))
+  {
+    return ERR_PROTO;
+  }
+  for (at = 2; (at < resp_len - 6) && (data[at] == TOK_START_NAME); )
+  {
+    n = get_uint(data + at + 1, resp_len - 6 - at - 1, &col);
+    if (n == 0)
+    {
+      return ERR_PROTO;
+    }
+    at += 1 + n;
+    
+    // Value of a column asked for, or one to step over
+    for (i = 0; (i < count) && (cols[i].col != col); i++);
+    if (i < count)
+    {
+      n = get_uint(data + at, resp_len - 6 - at, &cols[i].val);
+      found++;
+    }
+    else
+    {
+      n = atom_size(data + at, resp_len - 6 - at);
+    }
+    if ((n == 0) || (at + n >= resp_len - 6) || (data[at + n] != TOK_END_NAME))
+    {
+      return ERR_PROTO;
+    }
+    at += n + 1;
+  }
+  
+  return (found == count ? OK : ERR_PROTO);
+}
+
+/**
+ * \brief End session (session IDs cleared even on failure)
+ */
+int core::end_session()
+{
+  size_t len;
+  int rc;
+  
+  // Nothing to do?
+  if (tper_session_id == 0)
+  {
+    return OK;
+  }
+  
+  // End of session is a single token
+  fill(buffer, BLOCK_SIZE);
+  buffer[HDR_SIZE] = TOK_END_SESSION;
+  rc = send(1, true);
+  if (rc == OK)
+  {
+    rc = recv(&len);
+  }
+  
+  // Mark state
+  tper_session_id = 0;
+  host_session_id = 0;
+  return rc;
+}
+
+/**
+ * \brief Query ComID found by discovery
+ */
+uint16_t core::get_com_id() const
+{
+  return com_id;
+}
+
+/**
+ * \brief Query if Locking feature reports locked ranges
+ */
+bool core::is_locked() const
+{
+  return (lock_flags & 0x04);
+}
+
+/**
+ * \brief Query if Locking feature reports MBR shadowing enabled (and not done)
+ */
+bool core::mbr_pending() const
+{
+  return ((lock_flags & 0x30) == 0x10);
+}
+
+/**
+ * \brief Query if a session is open
+ */
+bool core::in_session() const
+{
+  return (tper_session_id != 0);
+}
+
+/**
+ * \brief STACK_RESET of ComID (Opal 2)
+ */
+int core::stack_reset()
+{
+  // Cook up the COMID management packet
+  fill(buffer, BLOCK_SIZE);
+  store_be(buffer, com_id, 2);
+  store_be(buffer + 4, 0x02, 4);     // STACK_RESET
+  
+  // Hit the reset
+  if (io.if_send(io.ctx, 2, com_id, buffer, 1) ||
+      io.if_recv(io.ctx, 2, com_id, buffer, 1))
+  {
+    return ERR_IO;
+  }
+  
+  // Check result (avail_data / failed)
+  if ((load_be(buffer + 8, 4) != 4) || (load_be(buffer + 12, 4) != 0))
+  {
+    return ERR_PROTO;
+  }
+  return OK;
+}
+
+/**
+ * \brief Begin method call in buffer
+ */
+void core::begin_call(uint64_t obj_uid, uint64_t method_uid)
+{
+  fill(buffer, BLOCK_SIZE);
+  pos = HDR_SIZE;
+  overflow = false;
+  
+  put_token(TOK_CALL);
+  put_uid(obj_uid);
+  put_uid(method_uid);
+  put_token(TOK_START_LIST);
+}
+
+/**
+ * \brief Finish method call, exchange with drive, check status
+ */
+int core::finish_call(bool session_ids)
+{
+  uint8_t const *data = buffer + HDR_SIZE;
+  size_t len;
+  int rc;
+  
+  // Close parameter list, then method status / control list
+  put_token(TOK_END_LIST);
+  put_token(TOK_END_OF_DATA);
+  put_token(TOK_START_LIST);
+  put_uint(0);
+  put_uint(0);
+  put_uint(0);
+  put_token(TOK_END_LIST);
+  if (overflow)
+  {
+    return ERR_SPACE;
+  }
+  
+  // Exchange
+  rc = send(pos - HDR_SIZE, session_ids);
+  if (rc == OK)
+  {
+    rc = recv(&len);
+  }
+  if (rc != OK)
+  {
+    return rc;
+  }
+  
+  // Trailing status list - EOD [status 0 0]
+  if ((len < 6) || (data[len - 6] != TOK_END_OF_DATA) ||
+      (data[len - 5] != TOK_START_LIST) || (data[len - 1] != TOK_END_LIST))
+  {
+    return ERR_PROTO;
+  }
+  
+  // Leave payload length for response parsing
+  resp_len = len;
+  return data[len - 4];
+}
+
+/**
+ * \brief Send payload already placed in buffer
+ */
+int core::send(size_t len, bool session_ids)
+{
+  size_t pkt_size, com_size;
+  
+  // SubPacket padded to 4 bytes inside the Packet, which sits in the ComPkt
+  pkt_size = PAD_TO_MULTIPLE(len + 12, 4);
+  com_size = pkt_size + 24;
+  if (com_size + 20 > BLOCK_SIZE)
+  {
+    return ERR_SPACE;
+  }
+  
+  // Fill in headers
+  fill(buffer, HDR_SIZE);
+  store_be(buffer + HDR_COM_ID, com_id, 2);
+  store_be(buffer + HDR_COM_LEN, com_size, 4);
+  store_be(buffer + HDR_PKT_LEN, pkt_size, 4);
+  store_be(buffer + HDR_SUB_LEN, len, 4);
+  if (session_ids)
+  {
+    store_be(buffer + HDR_TPER_SID, tper_session_id, 4);
+    store_be(buffer + HDR_HOST_SID, host_session_id, 4);
+  }
+  
+  // Off it goes
+  if (io.if_send(io.ctx, 1, com_id, buffer, 1))
+  {
+    return ERR_IO;
+  }
+  return OK;
+}
+
+/**
+ * \brief Poll for response, leaving payload in buffer
+ */
+int core::recv(size_t *len)
+{
+  int max_iters = (TIMEOUT_SECS * 1000) / POLL_MS;
+  
+  // If still processing, drive may respond with "no data yet" ...
+  while (1)
+  {
+    if (io.if_recv(io.ctx, 1, com_id, buffer, 1))
+    {
+      return ERR_IO;
+    }
+    if (load_be(buffer + HDR_COM_ID, 2) != com_id)
+    {
+      return ERR_PROTO;
+    }
+    if (load_be(buffer + HDR_COM_LEN, 4) != 0)
+    {
+      break;
+    }
+    if (--max_iters <= 0)
+    {
+      return ERR_TIMEOUT;
+    }
+    if (io.delay_ms)
+    {
+      io.delay_ms(io.ctx, POLL_MS);
+    }
+  }
+  
+  // Payload size
+  *len = load_be(buffer + HDR_SUB_LEN, 4);
+  if (*len > BLOCK_SIZE - HDR_SIZE)
+  {
+    return ERR_PROTO;
+  }
+  return OK;
+}
+
+/**
+ * \brief Append token
+ */
+void core::put_token(uint8_t tok)
+{
+  if (pos < BLOCK_SIZE)
+  {
+    buffer[pos++] = tok;
+  }
+  else
+  {
+    overflow = true;
+  }
+}
+
+/**
+ * \brief Append unsigned integer atom (tiny or short)
+ */
+void core::put_uint(uint64_t val)
+{
+  size_t len = 1;
+  
+  // Really small values fit into a single byte
+  if (val < 0x40)
+  {
+    put_token(val);
+    return;
+  }
+  
+  // Minimal byte count, then big endian
+  while ((len < 8) && (val >> (8 * len)))
+  {
+    len++;
+  }
+  if (pos + 1 + len > BLOCK_SIZE)
+  {
+    overflow = true;
+    return;
+  }
+  buffer[pos++] = 0x80 | len;
+  store_be(buffer + pos, val, len);
+  pos += len;
+}
+
+/**
+ * \brief Append UID (8 byte short binary atom)
+ */
+void core::put_uid(uint64_t uid)
+{
+  if (pos + 9 > BLOCK_SIZE)
+  {
+    overflow = true;
+    return;
+  }
+  buffer[pos++] = 0xa8;
+  store_be(buffer + pos, uid, 8);
+  pos += 8;
+}
+
+/**
+ * \brief Append binary atom (short or medium)
+ */
+void core::put_bin(void const *data, size_t len)
+{
+  uint8_t const *src = (uint8_t const *)data;
+  
+  // Header
+  if ((len >= 2048) || (pos + 2 + len > BLOCK_SIZE))
+  {
+    overflow = true;
+    return;
+  }
+  if (len < 16)
+  {
+    buffer[pos++] = 0xa0 | len;
+  }
+  else
+  {
+    buffer[pos++] = 0xd0 | (len >> 8);
+    buffer[pos++] = 0xff & len;
+  }
+  
+  // Payload
+  for (size_t i = 0; i < len; i++)
+  {
+    buffer[pos++] = src[i];
+  }
+}
+
+/**
+ * \brief Decode unsigned integer atom
+ */
+size_t core::get_uint(uint8_t const *data, size_t len, uint64_t *val)
+{
+  size_t count;
+  
+  if (len < 1)
+  {
+    return 0;
+  }
+  
+  // Tiny
+  if (data[0] < 0x40)
+  {
+    *val = data[0];
+    return 1;
+  }
+  
+  // Short, unsigned, up to 8 bytes
+  count = data[0] & 0x0f;
+  if (((data[0] & 0xf0) != 0x80) || (count == 0) || (count > 8) || (len < 1 + count))
+  {
+    return 0;
+  }
+  *val = 0;
+  for (size_t i = 1; i <= count; i++)
+  {
+    *val = (*val << 8) | data[i];
+  }
+  return 1 + count;
+}
+
+/**
+ * \brief Length of encoded atom (any type)
+ */
+size_t core::atom_size(uint8_t const *data, size_t len)
+{
+  size_t count, head;
+  
+  if (len < 1)
+  {
+    return 0;
+  }
+  
+  // Tiny, short, medium, long
+  if (data[0] < 0x80)
+  {
+    return 1;
+  }
+  else if (data[0] < 0xc0)
+  {
+    head  = 1;
+    count = data[0] & 0x0f;
+  }
+  else if ((data[0] < 0xe0) && (len >= 2))
+  {
+    head  = 2;
+    count = ((data[0] & 0x07) << 8) | data[1];
+  }
+  else if ((data[0] < 0xe4) && (len >= 4))
+  {
+    head  = 4;
+    count = (data[1] << 16) | (data[2] << 8) | data[3];
+  }
+  else
+  {
+    return 0;
+  }
+  return (head + count <= len ? head + count : 0);
+}
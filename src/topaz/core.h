@@ -0,0 +1,239 @@
+#ifndef TOPAZ_CORE_H
+#define TOPAZ_CORE_H
+
+/**
+ * Topaz - Unlock Core
+ *
+ * This file implements a freestanding subset of the TCG Opal protocol, just
+ * enough to discover a drive, start a session, set lock columns and end the
+ * session. It uses one fixed block buffer and no heap, exceptions, STL or
+ * stdio, so it can be linked into pre-boot unlock environments.
+ *
+ * Errors are returned as negative result codes, nonzero method status from
+ * the drive is returned as-is (positive). I/O is routed through a table of
+ * plain function hooks (see transport::get_core_io for the adapter).
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <topaz/uid.h>
+
+namespace topaz
+{
+  
+  // Transport hooks used by the core (0 on success, nonzero on failure)
+  typedef struct
+  {
+    void *ctx;  // Passed back to each hook
+    
+    // TCG IF-SEND / IF-RECV, bcount in 512 byte blocks
+    int (*if_send)(void *ctx, uint8_t proto, uint16_t comid,
+		   void const *data, size_t bcount);
+    int (*if_recv)(void *ctx, uint8_t proto, uint16_t comid,
+		   void *data, size_t bcount);
+    
+    // Wait between response polls (NULL to poll without waiting)
+    void (*delay_ms)(void *ctx, unsigned ms);
+  } core_io_t;
+  
+  class core
+  {
+    
+  public:
+    
+    // Result codes (method status from drive is returned as-is, >0)
+    typedef enum
+    {
+      OK          =  0,
+      ERR_IO      = -1, // Transport hook failed
+      ERR_PROTO   = -2, // Malformed or unexpected response
+      ERR_NO_OPAL = -3, // Drive does not report Opal SSC
+      ERR_TIMEOUT = -4, // No response from drive in time
+      ERR_SPACE   = -5, // Request does not fit in block buffer
+      ERR_STATE   = -6  // Call made in the wrong state (eg - no discovery)
+    } result_t;
+    
+    // Column / unsigned value pair for set()
+    typedef struct
+    {
+      uint64_t col;
+      uint64_t val;
+    } column_t;
+    
+    // Size of the single I/O buffer (one ATA block)
+    static constexpr size_t BLOCK_SIZE = 512;
+    
+    /**
+     * \brief Unlock Core Constructor
+     *
+     * @param io Transport hooks
+     */
+    core(core_io_t const &io);
+    
+    /**
+     * \brief Level 0 Discovery, followed by ComID reset on Opal 2 drives
+     *
+     * @return Result code
+     */
+    int discover();
+    
+    /**
+     * \brief Start session to SP
+     *
+     * @param sp_uid   Target Security Provider (ADMIN_SP / LOCKING_SP)
+     * @param auth_uid Authority to log in as (0 for anonymous)
+     * @param pin      Credential (ignored if anonymous)
+     * @param pin_len  Length of credential in bytes
+     * @return Result code, or method status
+     */
+    int start_session(uint64_t sp_uid, uint64_t auth_uid,
+		      void const *pin, size_t pin_len);
+    
+    /**
+     * \brief Set unsigned columns of one object, in a single Set[] call
+     *
+     * @param obj_uid Object (row) to modify
+     * @param cols    Column / value pairs
+     * @param count   Number of pairs
+     * @return Result code, or method status
+     */
+    int set(uint64_t obj_uid, column_t const *cols, size_t count);
+    
+    /**
+     * \brief Get unsigned columns of one object, in a single Get[] call
+     *
+     * Columns are read as one cell block, from the lowest to the highest
+     * asked for, so columns between them must hold simple atoms too.
+     *
+     * @param obj_uid Object (row) to read
+     * @param cols    Columns to read, values filled in
+     * @param count   Number of pairs
+     * @return Result code (ERR_PROTO if a column is missing or not
+     *         unsigned), or method status
+     */
+    int get(uint64_t obj_uid, column_t *cols, size_t count);
+    
+    /**
+     * \brief End session (session IDs cleared even on failure)
+     *
+     * @return Result code
+     */
+    int end_session();
+    
+    /**
+     * \brief Query ComID found by discovery
+     */
+    uint16_t get_com_id() const;
+    
+    /**
+     * \brief Query if Locking feature reports locked ranges
+     */
+    bool is_locked() const;
+    
+    /**
+     * \brief Query if Locking feature reports MBR shadowing enabled (and not done)
+     */
+    bool mbr_pending() const;
+    
+    /**
+     * \brief Query if a session is open
+     */
+    bool in_session() const;
+    
+  protected:
+    
+    /**
+     * \brief STACK_RESET of ComID (Opal 2)
+     */
+    int stack_reset();
+    
+    /**
+     * \brief Begin method call in buffer
+     */
+    void begin_call(uint64_t obj_uid, uint64_t method_uid);
+    
+    /**
+     * \brief Finish method call, exchange with drive, check status
+     *
+     * @param session_ids Include session IDs in packet header?
+     * @return Result code, or method status
+     */
+    int finish_call(bool session_ids);
+    
+    /**
+     * \brief Send payload already placed in buffer
+     */
+    int send(size_t len, bool session_ids);
+    
+    /**
+     * \brief Poll for response, leaving payload in buffer
+     *
+     * @param len Payload length on success
+     */
+    int recv(size_t *len);
+    
+    // Encoders, appending to the buffer (overflow is sticky)
+    void put_token(uint8_t tok);
+    void put_uint(uint64_t val);
+    void put_uid(uint64_t uid);
+    void put_bin(void const *data, size_t len);
+    
+    /**
+     * \brief Decode unsigned integer atom
+     *
+     * @param data Encoded atom
+     * @param len  Available bytes
+     * @param val  Decoded value
+     * @return Bytes consumed, or 0 on error
+     */
+    static size_t get_uint(uint8_t const *data, size_t len, uint64_t *val);
+    
+    /**
+     * \brief Length of encoded atom (any type)
+     *
+     * @param data Encoded atom
+     * @param len  Available bytes
+     * @return Bytes it takes, or 0 if not an atom / truncated
+     */
+    static size_t atom_size(uint8_t const *data, size_t len);
+    
+    /* internal data */
+    core_io_t io;
+    uint8_t   buffer[BLOCK_SIZE];
+    size_t    pos;             // Encode position within buffer
+    size_t    resp_len;        // Payload length of last response
+    bool      overflow;        // Encoded past end of buffer
+    uint16_t  com_id;
+    bool      has_opal2;
+    uint8_t   lock_flags;      // Level 0 Locking feature bits
+    uint32_t  tper_session_id;
+    uint32_t  host_session_id;
+    
+  };
+  
+};
+
+#endif
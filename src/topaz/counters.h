@@ -0,0 +1,211 @@
+#ifndef TOPAZ_COUNTERS_H
+#define TOPAZ_COUNTERS_H
+
+/**
+ * Topaz - Round Trip Counters
+ *
+ * This file implements cumulative counters of drive traffic (IF-SEND /
+ * IF-RECV commands, "no data yet" polls, bytes, sessions and method calls),
+ * so a workflow's round trips can be measured and held to a budget, and of
+ * method outcomes (status codes, timeouts).
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <atomic>
+#include <stdint.h>
+
+namespace topaz
+{
+
+  // Traffic, as read at one point in time
+  struct io_counters
+  {
+    uint64_t if_sends   = 0;  // IF-SEND commands
+    uint64_t if_recvs   = 0;  // IF-RECV commands (polls included)
+    uint64_t polls      = 0;  // IF-RECVs answered "no data yet"
+    uint64_t bytes_sent = 0;  // IF-SEND transfer sizes
+    uint64_t bytes_recv = 0;  // IF-RECV transfer sizes
+    uint64_t sessions   = 0;  // Sessions started
+    uint64_t methods    = 0;  // Method calls sent
+
+    /**
+     * \brief Traffic since an earlier reading
+     */
+    io_counters operator-(io_counters const &earlier) const
+    {
+      io_counters diff;
+      diff.if_sends   = if_sends   - earlier.if_sends;
+      diff.if_recvs   = if_recvs   - earlier.if_recvs;
+      diff.polls      = polls      - earlier.polls;
+      diff.bytes_sent = bytes_sent - earlier.bytes_sent;
+      diff.bytes_recv = bytes_recv - earlier.bytes_recv;
+      diff.sessions   = sessions   - earlier.sessions;
+      diff.methods    = methods    - earlier.methods;
+      return diff;
+    }
+  };
+
+  /**
+   * \brief Live counters (relaxed atomics, readable from any thread)
+   */
+  class io_counter_set
+  {
+
+  public:
+
+    io_counter_set()
+    {
+      reset();
+    }
+
+    void sent(uint64_t bytes)
+    {
+      if_sends.fetch_add(1, std::memory_order_relaxed);
+      bytes_sent.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    void received(uint64_t bytes)
+    {
+      if_recvs.fetch_add(1, std::memory_order_relaxed);
+      bytes_recv.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    void polled()
+    {
+      polls.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void session()
+    {
+      sessions.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void called(uint64_t count)
+    {
+      methods.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    io_counters read() const
+    {
+      io_counters now;
+      now.if_sends   = if_sends.load(std::memory_order_relaxed);
+      now.if_recvs   = if_recvs.load(std::memory_order_relaxed);
+      now.polls      = polls.load(std::memory_order_relaxed);
+      now.bytes_sent = bytes_sent.load(std::memory_order_relaxed);
+      now.bytes_recv = bytes_recv.load(std::memory_order_relaxed);
+      now.sessions   = sessions.load(std::memory_order_relaxed);
+      now.methods    = methods.load(std::memory_order_relaxed);
+      return now;
+    }
+
+    void reset()
+    {
+      if_sends.store(0, std::memory_order_relaxed);
+      if_recvs.store(0, std::memory_order_relaxed);
+      polls.store(0, std::memory_order_relaxed);
+      bytes_sent.store(0, std::memory_order_relaxed);
+      bytes_recv.store(0, std::memory_order_relaxed);
+      sessions.store(0, std::memory_order_relaxed);
+      methods.store(0, std::memory_order_relaxed);
+    }
+
+  protected:
+
+    /* internal data */
+    std::atomic<uint64_t> if_sends;
+    std::atomic<uint64_t> if_recvs;
+    std::atomic<uint64_t> polls;
+    std::atomic<uint64_t> bytes_sent;
+    std::atomic<uint64_t> bytes_recv;
+    std::atomic<uint64_t> sessions;
+    std::atomic<uint64_t> methods;
+
+  };
+
+  // Method outcomes, as read at one point in time
+  struct status_counts
+  {
+    static const unsigned CODES = 0x40;  // Method status codes 0x00 - 0x3f
+
+    uint64_t status[CODES] = {};  // Calls answered, by method status
+    uint64_t timeouts = 0;        // Responses not in by deadline
+  };
+
+  /**
+   * \brief Live method outcome counters (relaxed atomics)
+   */
+  class status_counter_set
+  {
+
+  public:
+
+    status_counter_set()
+    {
+      reset();
+    }
+
+    // Codes beyond the table count as FAIL (0x3f)
+    void answered(unsigned status)
+    {
+      unsigned slot = (status < status_counts::CODES ? status : status_counts::CODES - 1);
+      codes[slot].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void timed_out()
+    {
+      timeouts.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    status_counts read() const
+    {
+      status_counts now;
+      for (unsigned i = 0; i < status_counts::CODES; i++)
+      {
+	now.status[i] = codes[i].load(std::memory_order_relaxed);
+      }
+      now.timeouts = timeouts.load(std::memory_order_relaxed);
+      return now;
+    }
+
+    void reset()
+    {
+      for (unsigned i = 0; i < status_counts::CODES; i++)
+      {
+	codes[i].store(0, std::memory_order_relaxed);
+      }
+      timeouts.store(0, std::memory_order_relaxed);
+    }
+
+  protected:
+
+    /* internal data */
+    std::atomic<uint64_t> codes[status_counts::CODES];
+    std::atomic<uint64_t> timeouts;
+
+  };
+
+};
+
+#endif
@@ -31,6 +31,9 @@
  */
 
 #include <cstdio>
+#include <cstring>
+#include <endian.h>
+#include <topaz/alloc.h>
 #include <topaz/datum.h>
 #include <topaz/exceptions.h>
 using namespace topaz;
@@ -46,11 +49,25 @@ datum::datum()
   data_method_uid = 0;
 }
 
+/**
+ * \brief Allocator Constructor
+ *
+ * @param alloc Allocator for this datum and everything nested in it
+ */
+datum::datum(allocator_type const &alloc)
+  : data_atom(alloc), data_list(alloc)
+{
+  // Datum type not yet known
+  data_type = datum::UNSET;
+  data_object_uid = 0;
+  data_method_uid = 0;
+}
+
 /**
  * \brief Token Constructor
  */
-datum::datum(datum::type_t data_type)
-  : data_type(data_type)
+datum::datum(datum::type_t data_type, allocator_type const &alloc)
+  : data_type(data_type), data_atom(alloc), data_list(alloc)
 {
   // Specified datum type
   data_object_uid = 0;
@@ -64,17 +81,45 @@ datum::datum(datum::type_t data_type)
 }
 
 /**
- * \brief Atom->Datum Promotion Constructor
+ * \brief Atom->Datum Promotion Constructor (sink, moved into datum)
  */
-datum::datum(atom val)
+datum::datum(atom val, allocator_type const &alloc)
+  : data_atom(std::move(val), alloc), data_list(alloc)
 {
   // Datum type not yet known
   data_type = datum::ATOM;
-  data_atom = val;
   data_object_uid = 0;
   data_method_uid = 0;
 }
 
+/**
+ * \brief Allocator-Extended Copy Constructor
+ *
+ * @param ref   Datum to copy
+ * @param alloc Allocator for this datum and everything nested in it
+ */
+datum::datum(datum const &ref, allocator_type const &alloc)
+  : data_type(ref.data_type), data_atom(ref.data_atom, alloc),
+    data_list(ref.data_list, alloc), data_object_uid(ref.data_object_uid),
+    data_method_uid(ref.data_method_uid)
+{
+  // Nada
+}
+
+/**
+ * \brief Allocator-Extended Move Constructor
+ *
+ * @param ref   Datum to move from
+ * @param alloc Allocator for this datum and everything nested in it
+ */
+datum::datum(datum &&ref, allocator_type const &alloc)
+  : data_type(ref.data_type), data_atom(std::move(ref.data_atom), alloc),
+    data_list(std::move(ref.data_list), alloc), data_object_uid(ref.data_object_uid),
+    data_method_uid(ref.data_method_uid)
+{
+  // Nada
+}
+
 /**
  * \brief Destructor
  */
@@ -169,10 +214,10 @@ size_t datum::encode_bytes(byte *data) const
       *data++ = datum::TOK_CALL;
       
       // Object UID
-      data += atom::new_uid(data_object_uid).encode_bytes(data);
+      data += encode_uid(data, data_object_uid);
       
       // Method UID
-      data += atom::new_uid(data_method_uid).encode_bytes(data);
+      data += encode_uid(data, data_method_uid);
       
       // No break - fall through to handle parameters
       
@@ -208,6 +253,7 @@ size_t datum::encode_bytes(byte *data) const
  */
 size_t datum::decode_bytes(byte const *data, size_t len)
 {
+  TOPAZ_ALLOC_SITE(site, ALLOC_DECODE);
   size_t size = 0;
   
   // Clear out any stale data
@@ -237,10 +283,9 @@ size_t datum::decode_bytes(byte const *data, size_t len)
 	break;
       }
       
-      // Else, assume some other datum type
-      datum tmp;
-      size += tmp.decode_bytes(data + size, len - size);
-      data_list.push_back(tmp);
+      // Else, assume some other datum type (decoded in place)
+      data_list.emplace_back();
+      size += data_list.back().decode_bytes(data + size, len - size);
     }
   }
   else if (data[size] == datum::TOK_START_NAME)
@@ -261,7 +306,7 @@ size_t datum::decode_bytes(byte const *data, size_t len)
   }
   else if (data[size] == datum::TOK_CALL)
   {
-    atom uid;
+    atom uid(get_allocator());
     
     // Method call
     data_type = datum::METHOD;
@@ -292,10 +337,9 @@ size_t datum::decode_bytes(byte const *data, size_t len)
 	break;
       }
       
-      // Else, assume some other datum type
-      datum tmp;
-      size += tmp.decode_bytes(data + size, len - size);
-      data_list.push_back(tmp);
+      // Else, assume some other datum type (decoded in place)
+      data_list.emplace_back();
+      size += data_list.back().decode_bytes(data + size, len - size);
     }
   }
   else if (data[size] == datum::TOK_END_SESSION)
@@ -534,6 +578,15 @@ datum_vector const &datum::list() const
  * \brief Query Named Value in List
  */
 datum &datum::find_by_name(uint64_t id)
+{
+  // Same search, mutable result
+  return const_cast<datum&>(static_cast<datum const*>(this)->find_by_name(id));
+}
+
+/**
+ * \brief Query Named Value in List (const)
+ */
+datum const &datum::find_by_name(uint64_t id) const
 {
   // Must be list
   if (data_type != datum::LIST)
@@ -542,40 +595,57 @@ datum &datum::find_by_name(uint64_t id)
   }
   
   // Search for named value
-  for (size_t i = 0; i < data_list.size(); i++)
+  datum const *found = try_find_by_name(id);
+  if (found == NULL)
   {
-    if ((data_list[i].get_type() == datum::NAMED) &&
-	(data_list[i].name().get_uint() == id))
-    {
-      return data_list[i].named_value();
-    }
+    throw topaz_exception("Named value not found in list");
   }
   
-  throw topaz_exception("Named value not found in list");
+  return *found;
 }
 
 /**
- * \brief Query Named Value in List (const)
+ * \brief Search for Named Value in List
  */
-datum const &datum::find_by_name(uint64_t id) const
+datum *datum::try_find_by_name(uint64_t id)
+{
+  // Same search, mutable result
+  return const_cast<datum*>(static_cast<datum const*>(this)->try_find_by_name(id));
+}
+
+/**
+ * \brief Search for Named Value in List (const)
+ */
+datum const *datum::try_find_by_name(uint64_t id) const
 {
   // Must be list
   if (data_type != datum::LIST)
   {
-    throw topaz_exception("Datum has no list");
+    return NULL;
   }
   
-  // Search for named value
+  // Search for named value (Note: other name types, such as strings, skipped)
   for (size_t i = 0; i < data_list.size(); i++)
   {
-    if ((data_list[i].get_type() == datum::NAMED) &&
-	(data_list[i].name().get_uint() == id))
+    if (data_list[i].get_type() == datum::NAMED)
     {
-      return data_list[i].named_value();
+      std::optional<uint64_t> name = data_list[i].name().try_get_uint();
+      if (name && (*name == id))
+      {
+	return &data_list[i].named_value();
+      }
     }
   }
   
-  throw topaz_exception("Named value not found in list");
+  return NULL;
+}
+
+/**
+ * \brief Query Allocator
+ */
+datum::allocator_type datum::get_allocator() const
+{
+  return data_list.get_allocator();
 }
 
 /**
@@ -765,3 +835,21 @@ void datum::decode_check_token(byte const *data, size_t len, size_t idx, byte ne
     throw topaz_exception("Unexpected token in datum encoding");
   }
 }
+
+/**
+ * \brief Encode UID directly to data buffer (no temporary atom)
+ *
+ * @param data Data buffer of at least 9 bytes
+ * @param uid  Unique ID to encode
+ * @return Number of bytes encoded
+ */
+size_t datum::encode_uid(byte *data, uint64_t uid)
+{
+  uint64_t flip = htobe64(uid);
+  
+  // UIDs are always short binary atoms of 8 bytes
+  data[0] = atom::SHORT_TOK | atom::SHORT_BIN | 8;
+  memcpy(data + 1, &flip, 8);
+  
+  return 9;
+}
@@ -44,6 +44,9 @@ namespace topaz
     
   public:
     
+    // Allocator handed down to nested atoms and lists
+    typedef mem_allocator allocator_type;
+    
     // Enumeration of various datum types
     typedef enum
     {
@@ -100,15 +103,48 @@ namespace topaz
      */
     datum();
     
+    /**
+     * \brief Allocator Constructor
+     *
+     * @param alloc Allocator for this datum and everything nested in it
+     */
+    explicit datum(allocator_type const &alloc);
+    
     /**
      * \brief Token Constructor
      */
-    datum(datum::type_t data_type);
+    datum(datum::type_t data_type, allocator_type const &alloc = allocator_type());
+    
+    /**
+     * \brief Atom->Datum Promotion Constructor (sink, moved into datum)
+     */
+    datum(atom val, allocator_type const &alloc = allocator_type());
+    
+    /**
+     * \brief Copy Constructor
+     */
+    datum(datum const &ref) = default;
     
     /**
-     * \brief Atom->Datum Promotion Constructor
+     * \brief Move Constructor
      */
-    datum(atom val);
+    datum(datum &&ref) noexcept = default;
+    
+    /**
+     * \brief Allocator-Extended Copy Constructor
+     *
+     * @param ref   Datum to copy
+     * @param alloc Allocator for this datum and everything nested in it
+     */
+    datum(datum const &ref, allocator_type const &alloc);
+    
+    /**
+     * \brief Allocator-Extended Move Constructor
+     *
+     * @param ref   Datum to move from
+     * @param alloc Allocator for this datum and everything nested in it
+     */
+    datum(datum &&ref, allocator_type const &alloc);
     
     /**
      * \brief Destructor
@@ -214,6 +250,39 @@ namespace topaz
      */
     datum const &find_by_name(uint64_t id) const;
     
+    /**
+     * \brief Search for Named Value in List
+     *
+     * Names that are not unsigned integers are skipped, not an error.
+     *
+     * @param id Unsigned integer name to look for
+     * @return Named value, or NULL if not a list or not present
+     */
+    datum *try_find_by_name(uint64_t id);
+    
+    /**
+     * \brief Search for Named Value in List (const)
+     *
+     * @param id Unsigned integer name to look for
+     * @return Named value, or NULL if not a list or not present
+     */
+    datum const *try_find_by_name(uint64_t id) const;
+    
+    /**
+     * \brief Query Allocator
+     */
+    allocator_type get_allocator() const;
+    
+    /**
+     * \brief Copy Assignment
+     */
+    datum &operator=(datum const &ref) = default;
+    
+    /**
+     * \brief Move Assignment
+     */
+    datum &operator=(datum &&ref) = default;
+    
     /**
      * \brief Equality Operator
      *
@@ -261,6 +330,15 @@ namespace topaz
      */
     void decode_check_token(byte const *data, size_t len, size_t idx, byte next) const;
     
+    /**
+     * \brief Encode UID directly to data buffer (no temporary atom)
+     *
+     * @param data Data buffer of at least 9 bytes
+     * @param uid  Unique ID to encode
+     * @return Number of bytes encoded
+     */
+    static size_t encode_uid(byte *data, uint64_t uid);
+    
     // What sort of object
     datum::type_t data_type;
     
@@ -32,6 +32,7 @@
 
 #include <stdlib.h> // For size_t
 #include <stdint.h>
+#include <memory_resource>
 #include <vector>
 
 /********* NOTE: All Structures Listed Herein Are Big Endian *********/
@@ -49,16 +50,22 @@ namespace topaz
   // Vector of bytes
   typedef unsigned char byte;
   
+  // Source of memory for codec containers (arenas, pools, or the heap)
+  typedef std::pmr::memory_resource mem_resource;
+  
+  // Allocator handed down through nested atoms / datums
+  typedef std::pmr::polymorphic_allocator<byte> mem_allocator;
+  
   // Vector of bytes
-  typedef std::vector<byte> byte_vector;
+  typedef std::pmr::vector<byte> byte_vector;
   
   // Vector of atoms (forward declare to avoid circular deps)
   class atom;
-  typedef std::vector<atom> atom_vector;
+  typedef std::pmr::vector<atom> atom_vector;
   
   // Vector of datums (forward declare to avoid circular deps)
   class datum;
-  typedef std::vector<datum> datum_vector;
+  typedef std::pmr::vector<datum> datum_vector;
   
   //////////////////////////////////////////////////////////////////////////////
   // ATA Definitions
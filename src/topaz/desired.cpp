@@ -0,0 +1,364 @@
+/**
+ * Topaz - Desired State
+ *
+ * This file implements declarative Locking SP configuration: reading the
+ * cells a desired state names, and setting only those that differ.
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <topaz/batch.h>
+#include <topaz/desired.h>
+#include <topaz/exceptions.h>
+#include <topaz/uid.h>
+using namespace std;
+using namespace topaz;
+
+namespace
+{
+
+  // Column a document key names
+  struct key_col
+  {
+    char const *key;
+    uint64_t    col;
+  };
+
+  // Locking table (LBA range) columns
+  key_col const range_keys[] =
+  {
+    { "start",              3 },
+    { "length",             4 },
+    { "read_lock_enabled",  5 },
+    { "write_lock_enabled", 6 },
+    { "read_locked",        7 },
+    { "write_locked",       8 },
+    { NULL,                 0 }
+  };
+
+  // MBRControl columns
+  key_col const mbr_keys[] =
+  {
+    { "enable", 1 },
+    { "done",   2 },
+    { NULL,     0 }
+  };
+
+  // Authority columns
+  key_col const auth_keys[] =
+  {
+    { "enabled", 5 },
+    { NULL,      0 }
+  };
+
+  // Unsigned number, the whole word
+  bool parse_uint(string const &word, uint64_t &val)
+  {
+    char *end = NULL;
+    if (word.empty() || (word[0] == '-'))
+    {
+      return false;
+    }
+    val = strtoull(word.c_str(), &end, 0);
+    return (*end == '\0');
+  }
+
+  // Same value, whatever its encoding (a TPer may send 0 as a Short atom)
+  bool same_value(atom &current, atom &desired)
+  {
+    if (current.get_type() != desired.get_type())
+    {
+      return false;
+    }
+    switch (current.get_type())
+    {
+      case atom::UINT:
+	return (current.get_uint() == desired.get_uint());
+      case atom::INT:
+	return (current.get_int() == desired.get_int());
+      default:
+	return (current == desired);
+    }
+  }
+
+};
+
+/**
+ * \brief Ask for a cell to hold a value
+ */
+void desired_state::set(uint64_t obj_uid, uint64_t col, atom val, string const &label)
+{
+  for (size_t i = 0; i < cells.size(); i++)
+  {
+    if ((cells[i].uid == obj_uid) && (cells[i].col == col))
+    {
+      cells[i].value = std::move(val);
+      cells[i].label = label;
+      return;
+    }
+  }
+
+  cell next;
+  next.uid   = obj_uid;
+  next.col   = col;
+  next.value = std::move(val);
+  next.label = label;
+  cells.push_back(std::move(next));
+}
+
+/**
+ * \brief Ask for an unsigned cell to hold a value
+ */
+void desired_state::set(uint64_t obj_uid, uint64_t col, uint64_t val, string const &label)
+{
+  set(obj_uid, col, atom::new_uint(val), label);
+}
+
+/**
+ * \brief Add desired state document
+ */
+void desired_state::parse(istream &in, string const &name)
+{
+  string text;
+  unsigned line = 0;
+
+  while (getline(in, text))
+  {
+    string where = name + ":" + to_string(++line);
+
+    // Comments run to end of line
+    size_t hash = text.find('#');
+    if (hash != string::npos)
+    {
+      text.erase(hash);
+    }
+    istringstream words(text);
+    string object, word;
+    if (!(words >> object))
+    {
+      continue;
+    }
+
+    // Which object, and which columns it takes
+    key_col const *keys;
+    uint64_t uid, num;
+    unsigned idx;
+    if (object == "range")
+    {
+      if (!(words >> word))
+      {
+	throw topaz_exception(where + ": range needs a number");
+      }
+      if (word == "global")
+      {
+	num = 0;
+      }
+      else if (!parse_uint(word, num))
+      {
+	throw topaz_exception(where + ": bad range '" + word + "'");
+      }
+      uid  = (num ? LBA_RANGE_BASE + num : LBA_RANGE_GLOBAL);
+      keys = range_keys;
+    }
+    else if (object == "mbr")
+    {
+      uid  = MBR_CONTROL;
+      keys = mbr_keys;
+    }
+    else if ((sscanf(object.c_str(), "admin%u", &idx) == 1) && idx)
+    {
+      uid  = ADMIN_BASE + idx;
+      keys = auth_keys;
+    }
+    else if ((sscanf(object.c_str(), "user%u", &idx) == 1) && idx)
+    {
+      uid  = USER_BASE + idx;
+      keys = auth_keys;
+    }
+    else
+    {
+      throw topaz_exception(where + ": unknown object '" + object + "'");
+    }
+
+    // key=value ...
+    while (words >> word)
+    {
+      size_t eq = word.find('=');
+      string key = word.substr(0, eq);
+      key_col const *k = keys;
+      while (k->key && (key != k->key))
+      {
+	k++;
+      }
+      if ((eq == string::npos) || (k->key == NULL))
+      {
+	throw topaz_exception(where + ": unknown setting '" + word + "' for " + object);
+      }
+      // Everything but range boundaries is a flag
+      bool flag = (keys != range_keys) || (k->col > 4);
+      if (!parse_uint(word.substr(eq + 1), num) || (flag && (num > 1)))
+      {
+	throw topaz_exception(where + ": bad value in '" + word + "'");
+      }
+      // Global range always covers the whole drive
+      if ((uid == LBA_RANGE_GLOBAL) && !flag)
+      {
+	throw topaz_exception(where + ": global range has no " + key);
+      }
+      set(uid, k->col, num, where + " " + key);
+    }
+  }
+}
+
+/**
+ * \brief Add desired state document from file
+ */
+void desired_state::load(string const &path)
+{
+  ifstream in(path.c_str());
+  if (!in)
+  {
+    throw topaz_exception("Cannot open desired state " + path);
+  }
+  parse(in, path);
+}
+
+/**
+ * \brief Cells asked for
+ */
+size_t desired_state::size() const
+{
+  return cells.size();
+}
+
+/**
+ * \brief Cells of drive not in desired state
+ */
+vector<state_change> desired_state::diff(drive &target) const
+{
+  vector<state_change> changes;
+  if (cells.empty())
+  {
+    return changes;
+  }
+
+  // Objects in the order first named, with the columns wanted of each
+  vector<uint64_t> objects;
+  map<uint64_t, pair<uint64_t, uint64_t> > span;
+  for (size_t i = 0; i < cells.size(); i++)
+  {
+    uint64_t uid = cells[i].uid, col = cells[i].col;
+    if (span.find(uid) == span.end())
+    {
+      objects.push_back(uid);
+      span[uid] = make_pair(col, col);
+    }
+    span[uid].first  = min(span[uid].first, col);
+    span[uid].second = max(span[uid].second, col);
+  }
+
+  // UID.Get[Cellblock = [startColumn, endColumn]] of every object, one batch
+  datum_vector calls, results;
+  for (size_t i = 0; i < objects.size(); i++)
+  {
+    datum call;
+    call.object_uid() = objects[i];
+    call.method_uid() = GET;
+    call[0][0].name()        = atom::new_uint(3);
+    call[0][0].named_value() = atom::new_uint(span[objects[i]].first);
+    call[0][1].name()        = atom::new_uint(4);
+    call[0][1].named_value() = atom::new_uint(span[objects[i]].second);
+    calls.push_back(std::move(call));
+  }
+  vector<unsigned> status = target.invoke_batch(std::move(calls), results);
+
+  // Cell by cell
+  map<uint64_t, size_t> row;
+  for (size_t i = 0; i < objects.size(); i++)
+  {
+    row[objects[i]] = i;
+  }
+  for (size_t i = 0; i < cells.size(); i++)
+  {
+    cell const &want = cells[i];
+    size_t n = row[want.uid];
+    if (status[n] != datum::STA_SUCCESS)
+    {
+      char buf[64];
+      snprintf(buf, sizeof(buf), "cannot read (method status 0x%02x)", status[n]);
+      throw topaz_exception(want.label + ": " + buf);
+    }
+
+    state_change change;
+    datum &rc = results[n];
+    datum *col = NULL;
+    if ((rc.get_type() == datum::LIST) && (rc.list().size() > 0))
+    {
+      col = rc.list()[0].try_find_by_name(want.col);
+    }
+    if (col && (col->get_type() == datum::ATOM))
+    {
+      change.current = col->value();
+    }
+    change.desired = want.value;
+    if ((change.current.get_type() == atom::EMPTY) ||
+	!same_value(change.current, change.desired))
+    {
+      change.uid   = want.uid;
+      change.col   = want.col;
+      change.label = want.label;
+      changes.push_back(std::move(change));
+    }
+  }
+
+  return changes;
+}
+
+/**
+ * \brief Bring drive to desired state
+ */
+vector<state_change> desired_state::apply(drive &target, bool dry_run) const
+{
+  vector<state_change> changes = diff(target);
+  if (dry_run || changes.empty())
+  {
+    return changes;
+  }
+
+  // Cells of an object merge into one Set
+  call_batch batch(target);
+  for (size_t i = 0; i < changes.size(); i++)
+  {
+    batch.set(changes[i].uid, changes[i].col, changes[i].desired, changes[i].label);
+  }
+  batch.flush();
+
+  return changes;
+}
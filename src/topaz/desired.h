@@ -0,0 +1,147 @@
+#ifndef TOPAZ_DESIRED_H
+#define TOPAZ_DESIRED_H
+
+/**
+ * Topaz - Desired State
+ *
+ * This file implements declarative Locking SP configuration. A desired
+ * state names table cells and the values they should hold; applying it
+ * reads every named object in one batch, compares cell by cell, and sets
+ * only the cells that differ (one Set per object, batched). A drive that
+ * already complies costs the read and nothing else.
+ *
+ * Documents hold one object per line, '#' starts a comment:
+ *
+ *   range <N|global> [start=<lba>] [length=<lbas>] [read_lock_enabled=0|1]
+ *                    [write_lock_enabled=0|1] [read_locked=0|1] [write_locked=0|1]
+ *                    (global - no start or length, it covers the whole drive)
+ *   mbr [enable=0|1] [done=0|1]
+ *   admin<N> enabled=0|1
+ *   user<N> enabled=0|1
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <iosfwd>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <topaz/drive.h>
+
+namespace topaz
+{
+
+  // One cell that does not hold its desired value
+  struct state_change
+  {
+    uint64_t    uid;      // Object (table row)
+    uint64_t    col;      // Column
+    atom        current;  // Value read (empty if the drive did not return it)
+    atom        desired;  // Value to set
+    std::string label;    // Where it was asked for (eg - "policy:3 start")
+  };
+
+  class desired_state
+  {
+
+  public:
+
+    /**
+     * \brief Ask for a cell to hold a value (a later value of a cell wins)
+     *
+     * @param obj_uid Object (table row)
+     * @param col     Column
+     * @param val     Desired value
+     * @param label   Names the cell in plans and errors
+     */
+    void set(uint64_t obj_uid, uint64_t col, atom val,
+	     std::string const &label = std::string());
+
+    /**
+     * \brief Ask for an unsigned cell to hold a value
+     *
+     * @param obj_uid Object (table row)
+     * @param col     Column
+     * @param val     Desired value
+     * @param label   Names the cell in plans and errors
+     */
+    void set(uint64_t obj_uid, uint64_t col, uint64_t val,
+	     std::string const &label = std::string());
+
+    /**
+     * \brief Add desired state document
+     *
+     * @param in   Document text
+     * @param name Document name, for labels (eg - file name)
+     */
+    void parse(std::istream &in, std::string const &name);
+
+    /**
+     * \brief Add desired state document from file
+     *
+     * @param path File to read
+     */
+    void load(std::string const &path);
+
+    /**
+     * \brief Cells asked for
+     */
+    size_t size() const;
+
+    /**
+     * \brief Cells of drive not in desired state (one batched read)
+     *
+     * @param target Drive, in Locking SP session
+     * @return Cells to set, in the order they were asked for
+     */
+    std::vector<state_change> diff(drive &target) const;
+
+    /**
+     * \brief Bring drive to desired state
+     *
+     * @param target  Drive, in Locking SP session
+     * @param dry_run Only report what would be set
+     * @return Cells set (or that would be set)
+     */
+    std::vector<state_change> apply(drive &target, bool dry_run = false) const;
+
+  protected:
+
+    // Cell asked for
+    struct cell
+    {
+      uint64_t    uid;
+      uint64_t    col;
+      atom        value;
+      std::string label;
+    };
+
+    /* internal data */
+    std::vector<cell> cells;
+
+  };
+
+};
+
+#endif
@@ -29,14 +29,19 @@
  */
 
 #include <unistd.h>
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
+#include <ctime>
 #include <endian.h>
 #include <inttypes.h>
+#include <optional>
+#include <topaz/alloc.h>
 #include <topaz/defs.h>
 #include <topaz/debug.h>
 #include <topaz/drive.h>
 #include <topaz/exceptions.h>
+#include <topaz/trace.h>
 #include <topaz/uid.h>
 using namespace std;
 using namespace topaz;
@@ -49,22 +54,64 @@ using namespace topaz;
 // How long to wait before timeout thrown
 #define TIMEOUT_SECS 5
 
+// How long long-running methods (eg - GenKey) get by default
+#define LONG_TIMEOUT_SECS 60
+
+// Most methods per ComPkt offered to the TPer
+#define HOST_MAX_METHODS 16
+
+// IF-RECV transfer length is a single byte of blocks
+#define MAX_RECV_BLOCKS 255
+
+// Nanoseconds since start
+static uint64_t elapsed_ns(chrono::steady_clock::time_point start)
+{
+  return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+}
+
 /**
  * \brief Topaz Hard Drive Constructor
  *
- * @param path OS path to specified drive (eg - '/dev/sdX')
+ * @param path  OS path to specified drive (eg - '/dev/sdX')
+ * @param lease What to do if another process has the device open
+ */
+drive::drive(char const *path, lease_policy const &lease)
+  : owned(open_transport(path)), raw(*owned)
+{
+  init(lease);
+}
+
+/**
+ * \brief Topaz Hard Drive Constructor (caller supplied transport)
+ *
+ * @param io    Transport to TPer (eg - simulator), must outlive drive
+ * @param lease What to do if another process has the device open
+ */
+drive::drive(transport &io, lease_policy const &lease)
+  : raw(io)
+{
+  init(lease);
+}
+
+/**
+ * \brief Discovery and comms setup common to all constructors
  */
-drive::drive(char const *path)
-  : raw(path)
+void drive::init(lease_policy const &lease)
 {
   // Initialization
   tper_session_id = 0;
   host_session_id = 0;
+  session_live = false;
   has_opal1 = false;
   has_opal2 = false;
+  has_locking = false;
+  lock_flags = 0;
   lba_align = 1;
   com_id = 0;
   max_com_pkt_size = 512; // Until otherwise identified
+  max_methods = 1;
+  call_transfer_ns = 0;
+  call_think_ns = 0;
   
   // Check for drive TPM
   probe_tpm();
@@ -72,8 +119,12 @@ drive::drive(char const *path)
   // Level 0 Discovery tells us about Opal support ...
   probe_level0();
   
+  // Wait for (or share, or take over from) anyone else using the drive,
+  // their session would not survive our reset
+  lease_lock.reset(new device_lease(raw.device_id(), lease));
+  
   // If we can, make sure we're starting from a blank slate
-  if (has_opal2) reset_comid(com_id);
+  if (has_opal2 && lease_lock->may_reset()) reset_comid(com_id);
   
   // Query Opal Comm Properties
   probe_level1();
@@ -111,6 +162,8 @@ uint64_t drive::get_max_users()
  */
 void drive::login_anon(uint64_t sp_uid)
 {
+  TOPAZ_TRACE_SPAN(span, TRACE_SESSION_START, sp_uid, 0);
+  
   // If present, end any session in progress
   logout();
   
@@ -121,13 +174,15 @@ void drive::login_anon(uint64_t sp_uid)
   params[2].value()   = atom::new_uint(1);        // Read/Write Session
   
   // Off it goes
-  datum rc = invoke(SESSION_MGR, START_SESSION, params);
+  datum rc = invoke(SESSION_MGR, START_SESSION, std::move(params));
   
   // Host session ID
   host_session_id = rc[0].value().get_uint();
   
   // TPer session ID
   tper_session_id = rc[1].value().get_uint();
+  traffic.session();
+  session_live = true;
   
   // Debug
   TOPAZ_DEBUG(1) printf("Anonymous Session %" PRIx64 ":%" PRIx64 " Started\n",
@@ -142,6 +197,8 @@ void drive::login_anon(uint64_t sp_uid)
  */
 void drive::login(uint64_t sp_uid, uint64_t auth_uid, string pin)
 {
+  TOPAZ_TRACE_SPAN(span, TRACE_SESSION_START, sp_uid, auth_uid);
+  
   // If present, end any session in progress
   logout();
   
@@ -158,13 +215,15 @@ void drive::login(uint64_t sp_uid, uint64_t auth_uid, string pin)
   params[4].named_value() = atom::new_uid(auth_uid);
   
   // Off it goes
-  datum rc = invoke(SESSION_MGR, START_SESSION, params);
+  datum rc = invoke(SESSION_MGR, START_SESSION, std::move(params));
   
   // Host session ID
   host_session_id = rc[0].value().get_uint();
   
   // TPer session ID
   tper_session_id = rc[1].value().get_uint();
+  traffic.session();
+  session_live = true;
   
   // Debug
   TOPAZ_DEBUG(1) printf("Authorized Session %" PRIx64 ":%" PRIx64 " Started\n",
@@ -175,19 +234,20 @@ void drive::login(uint64_t sp_uid, uint64_t auth_uid, string pin)
  * \brief Query Value from Specified Table
  *
  * @param tbl_uid Identifier of target table
+ * @param alloc   Allocator (eg - arena) for call and returned data
  * @return Queried parameter
  */
-datum drive::table_get(uint64_t tbl_uid)
+datum drive::table_get(uint64_t tbl_uid, mem_allocator const &alloc)
 {
   // Parameters - Required Arguments (Simple Atoms)
-  datum params;
+  datum params(alloc);
   params[0] = datum(datum::LIST); // Empty list
   
   // Method Call - UID.Get[]
-  datum rc = invoke(tbl_uid, GET, params);
+  datum rc = invoke(tbl_uid, GET, std::move(params), alloc);
   
-  // Return first element of nested array
-  return rc[0];
+  // Return first element of nested array (no deep copy)
+  return std::move(rc[0]);
 }
 
 /**
@@ -198,6 +258,31 @@ datum drive::table_get(uint64_t tbl_uid)
  * @return Queried parameter
  */
 atom drive::table_get(uint64_t tbl_uid, uint64_t tbl_col)
+{
+  atom val;
+  
+  // Method Call - UID.Get[]
+  if (try_table_get(tbl_uid, tbl_col, val))
+  {
+    throw topaz_exception("Method call failed");
+  }
+  if (val.get_type() == atom::EMPTY)
+  {
+    throw topaz_exception("Named value not found in list");
+  }
+  
+  return val;
+}
+
+/**
+ * \brief Probe Value from Specified Table (method failures not thrown)
+ *
+ * @param tbl_uid Identifier of target table
+ * @param tbl_col Column number of data to retrieve (table specific)
+ * @param val Queried parameter, left empty if column was not returned
+ * @return Method status
+ */
+unsigned drive::try_table_get(uint64_t tbl_uid, uint64_t tbl_col, atom &val)
 {
   // Parameters - Required Arguments (Simple Atoms)
   datum params;
@@ -207,10 +292,26 @@ atom drive::table_get(uint64_t tbl_uid, uint64_t tbl_col)
   params[0][1].named_value() = atom::new_uint(tbl_col);
   
   // Method Call - UID.Get[]
-  datum rc = invoke(tbl_uid, GET, params);
+  datum rc;
+  val = atom();
+  unsigned status = try_invoke(tbl_uid, GET, rc, std::move(params));
+  if (status)
+  {
+    return status;
+  }
+  
+  // Pull requested column out of nested array, if the drive sent it
+  datum *col = NULL;
+  if ((rc.get_type() == datum::LIST) && (rc.list().size() > 0))
+  {
+    col = rc.list()[0].try_find_by_name(tbl_col);
+  }
+  if (col && (col->get_type() == datum::ATOM))
+  {
+    val = std::move(col->value());
+  }
   
-  // Return first element of nested array
-  return rc[0][0].named_value().value();
+  return status;
 }
 
 /**
@@ -220,7 +321,7 @@ atom drive::table_get(uint64_t tbl_uid, uint64_t tbl_col)
 void drive::table_set_bin(uint64_t tbl_uid, uint64_t offset,
 			  void const *ptr, uint64_t len)
 {
-  byte const *raw = (byte const *)ptr;
+  topaz::byte const *raw = (topaz::byte const *)ptr;
   uint64_t chunk_size, send_size;
   
   // First, estimate how much data we can send with each set call
@@ -241,15 +342,15 @@ void drive::table_set_bin(uint64_t tbl_uid, uint64_t offset,
     // Next send is at most chunk_size
     send_size = (len > chunk_size ? chunk_size : len);
     
-    // Cook up parameter list for table set
+    // Cook up parameter list for table set (data borrowed, not copied)
     datum params;
-    params[0].name()        = atom::new_uint(0);             // Where
-    params[0].named_value() = atom::new_uint(offset);        // Offset of 0
-    params[1].name()        = atom::new_uint(1);             // Values
-    params[1].named_value() = atom::new_bin(raw, send_size); // Data
+    params[0].name()        = atom::new_uint(0);                 // Where
+    params[0].named_value() = atom::new_uint(offset);            // Offset of 0
+    params[1].name()        = atom::new_uint(1);                 // Values
+    params[1].named_value() = atom::new_bin_ref(raw, send_size); // Data
     
     // Invoke method
-    invoke(tbl_uid, SET, params);
+    invoke(tbl_uid, SET, std::move(params));
     
     // Bump counters, pointers
     len    -= send_size;
@@ -263,7 +364,7 @@ void drive::table_set_bin(uint64_t tbl_uid, uint64_t offset,
  *
  * @param tbl_uid Identifier of target table
  * @param tbl_col Column number of data to retrieve (table specific)
- * @param val Value to set in column
+ * @param val Value to set in column (moved into call)
  */
 void drive::table_set(uint64_t tbl_uid, uint64_t tbl_col, atom val)
 {
@@ -271,10 +372,10 @@ void drive::table_set(uint64_t tbl_uid, uint64_t tbl_col, atom val)
   datum params;
   params[0].name()                         = atom::new_uint(1);       // Values
   params[0].named_value()[0].name()        = atom::new_uint(tbl_col);
-  params[0].named_value()[0].named_value() = val;
+  params[0].named_value()[0].named_value() = std::move(val);
   
   // Method Call - UID.Set[]
-  datum rc = invoke(tbl_uid, SET, params);
+  invoke(tbl_uid, SET, std::move(params));
 }
 
 /**
@@ -287,7 +388,7 @@ void drive::table_set(uint64_t tbl_uid, uint64_t tbl_col, atom val)
 void drive::table_set(uint64_t tbl_uid, uint64_t tbl_col, uint64_t val)
 {
   // Convenience / clarity wrapper ...
-  return table_set(tbl_uid, tbl_col, atom::new_uint(val));
+  table_set(tbl_uid, tbl_col, atom::new_uint(val));
 }
 
 /**
@@ -295,35 +396,56 @@ void drive::table_set(uint64_t tbl_uid, uint64_t tbl_col, uint64_t val)
  */
 string drive::default_pin()
 {
-  // MSID PIN is encoded as a byte_vector atom
-  byte_vector pin_bytes = table_get(C_PIN_MSID, 3).get_bytes();
+  // MSID PIN is encoded as a binary atom, reroll to string
+  return table_get(C_PIN_MSID, 3).get_string();
+}
+
+/**
+ * \brief Method invocation
+ *
+ * \param object_uid UID indicating object to use for invocation
+ * \param method_uid UID indicating method to call on object
+ * \param params Parameters for method call (moved into call)
+ * \param alloc Allocator (eg - arena) for call, buffers and returned data
+ * \return Any data returned from method call
+ */
+datum drive::invoke(uint64_t object_uid, uint64_t method_uid, datum params,
+		    mem_allocator const &alloc)
+{
+  datum rc(alloc);
   
-  // Reroll to string
-  string pin;
-  for (size_t i = 0; i < pin_bytes.size(); i++)
+  // Fail out on bad method status
+  if (try_invoke(object_uid, method_uid, rc, std::move(params)))
   {
-    pin += pin_bytes[i];
+    throw topaz_exception("Method call failed");
   }
- 
-  // Completed PIN as string
-  return pin;
+  
+  return rc;
 }
 
 /**
- * \brief Method invocation
+ * \brief Method invocation, returning method status instead of throwing
  *
  * \param object_uid UID indicating object to use for invocation
  * \param method_uid UID indicating method to call on object
- * \param params Parameters for method call
- * \return Any data returned from method call
+ * \param result Data returned from method call
+ * \param params Parameters for method call (moved into call)
+ * \return Method status
  */
-datum drive::invoke(uint64_t object_uid, uint64_t method_uid, datum params)
+unsigned drive::try_invoke(uint64_t object_uid, uint64_t method_uid,
+			   datum &result, datum params)
 {
+  mem_allocator alloc = result.get_allocator();
+  TOPAZ_TRACE_SPAN(span, TRACE_INVOKE, object_uid, method_uid);
+  TOPAZ_ALLOC_SITE(site, ALLOC_INVOKE);
+  drive_clock::time_point start = drive_clock::now();
+  call_transfer_ns = call_think_ns = 0;
+  
   // Set up basic method call
-  datum call;
+  datum call(alloc);
   call.object_uid() = object_uid;
   call.method_uid() = method_uid;
-  call.list()       = params.list();
+  call.list()       = std::move(params.list());
   
   // Debug
   TOPAZ_DEBUG(3)
@@ -333,27 +455,21 @@ datum drive::invoke(uint64_t object_uid, uint64_t method_uid, datum params)
     printf("\n");
   }
   
-  // Convert to byte vector
-  byte_vector bytes = call.encode_vector();
-  
-  // Tack on method status / control code (TBD - Something cleaner?)
-  bytes.push_back(datum::TOK_END_OF_DATA);
-  bytes.push_back(datum::TOK_START_LIST);
-  bytes.push_back(0); // 0 for execute, some values cancel operations .. (TBD?)
-  bytes.push_back(0); // Reserved
-  bytes.push_back(0); // Reserved
-  bytes.push_back(datum::TOK_END_LIST);
-  
-  // Send packet to drive.
+  // Send packet to drive, encoded straight into ComPkt.
   // NOTE: Session manager is stateless and doesn't use session ID's ...
-  send(bytes, (object_uid != SESSION_MGR));
+  send(call, (object_uid != SESSION_MGR));
   
   // Gather response
+  byte_vector bytes(alloc);
   recv(bytes);
   
   // Decode response
-  datum rc;
-  size_t count = rc.decode_vector(bytes);
+  drive_clock::time_point decode_start = drive_clock::now();
+  size_t count;
+  {
+    TOPAZ_TRACE_SPAN(decode_span, TRACE_DECODE, 1, bytes.size());
+    count = result.decode_vector(bytes);
+  }
   
   // Check status code (TBD - Clean this up)
   if (bytes.size() - count != 6)
@@ -361,12 +477,14 @@ datum drive::invoke(uint64_t object_uid, uint64_t method_uid, datum params)
     throw topaz_exception("Invalid method status on return");
   }
   unsigned status = bytes[count + 2];
+  outcome.answered(status);
+  record_call(method_uid, start, decode_start);
   
   // Debug
   TOPAZ_DEBUG(3)
   {
     printf("Opal Return : ");
-    rc.print();
+    result.print();
     if (status)
     {
       printf(" <STATUS=%u>", status);
@@ -374,13 +492,7 @@ datum drive::invoke(uint64_t object_uid, uint64_t method_uid, datum params)
     printf("\n");
   }
   
-  // Fail out
-  if (status)
-  {
-    throw topaz_exception("Method call failed");
-  }
-  
-  return rc;
+  return status;
 }
 
 /**
@@ -394,22 +506,277 @@ void drive::admin_sp_revert()
   // If this succeeds, the session is terminated immediately
   tper_session_id = 0;
   host_session_id = 0;
+  session_live = false;
+}
+
+/**
+ * \brief Batched method invocation
+ *
+ * \param calls Method call datums (moved into call)
+ * \param results Data returned from each call
+ * \param timeout_ms Deadline for the whole batch (0 - usual per ComPkt timeout)
+ * \return Method status of each call
+ */
+vector<unsigned> drive::invoke_batch(datum_vector calls, datum_vector &results,
+				     unsigned timeout_ms)
+{
+  vector<unsigned> status(calls.size(), STA_INCOMPLETE);
+  mem_allocator alloc = calls.get_allocator();
+  struct timespec start, now;
+  size_t first = 0, last;
+  
+  // Room in a ComPkt for calls, after headers and padding
+  size_t room = max_com_pkt_size - sizeof(opal_header_t) - 3;
+  
+  results.clear();
+  results.resize(calls.size());
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  
+  while (first < calls.size())
+  {
+    // Pack as many calls as the TPer will take (each with status list)
+    size_t used = calls[first].size() + 6;
+    for (last = first + 1; (last < calls.size()) && (last - first < max_methods); last++)
+    {
+      size_t next = calls[last].size() + 6;
+      if (used + next > room)
+      {
+	break;
+      }
+      used += next;
+    }
+    
+    TOPAZ_TRACE_SPAN(span, TRACE_INVOKE, calls[first].object_uid(), calls[first].method_uid());
+    TOPAZ_ALLOC_SITE(site, ALLOC_INVOKE);
+    drive_clock::time_point pkt_start = drive_clock::now();
+    call_transfer_ns = call_think_ns = 0;
+    
+    // Debug
+    TOPAZ_DEBUG(3)
+    {
+      for (size_t i = first; i < last; i++)
+      {
+	printf("Opal Call [%u/%u]: ", (unsigned)(i + 1), (unsigned)calls.size());
+	calls[i].print();
+	printf("\n");
+      }
+    }
+    
+    // Off it goes, session manager is stateless
+    send(&(calls[first]), last - first, (calls[first].object_uid() != SESSION_MGR));
+    
+    // Whatever is left of the deadline
+    unsigned wait_ms = TIMEOUT_SECS * 1000;
+    if (timeout_ms)
+    {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      uint64_t spent = ((now.tv_sec - start.tv_sec) * 1000 +
+			(now.tv_nsec - start.tv_nsec) / 1000000);
+      wait_ms = (spent < timeout_ms ? timeout_ms - spent : 0);
+    }
+    
+    // Out of time, the rest stays incomplete
+    byte_vector bytes(alloc);
+    if (!try_recv(bytes, wait_ms))
+    {
+      outcome.timed_out();
+      abort_comid();
+      break;
+    }
+    
+    // One result and status list per call, as far as the TPer got
+    TOPAZ_TRACE_SPAN(decode_span, TRACE_DECODE, last - first, bytes.size());
+    drive_clock::time_point decode_start = drive_clock::now();
+    size_t offset = 0;
+    for (size_t i = first; (i < last) && (offset < bytes.size()); i++)
+    {
+      results[i] = datum(alloc);
+      offset += results[i].decode_bytes(&(bytes[offset]), bytes.size() - offset);
+      if ((bytes.size() - offset < 6) || (bytes[offset] != datum::TOK_END_OF_DATA))
+      {
+	throw topaz_exception("Invalid method status on return");
+      }
+      status[i] = bytes[offset + 2];
+      outcome.answered(status[i]);
+      offset += 6;
+      
+      // Debug
+      TOPAZ_DEBUG(3)
+      {
+	printf("Opal Return [%u/%u]: ", (unsigned)(i + 1), (unsigned)calls.size());
+	results[i].print();
+	if (status[i])
+	{
+	  printf(" <STATUS=%u>", status[i]);
+	}
+	printf("\n");
+      }
+    }
+    record_call(calls[first].method_uid(), pkt_start, decode_start);
+    
+    first = last;
+  }
+  
+  return status;
+}
+
+/**
+ * \brief Crypto Erase Locking Ranges in a Single Session
+ *
+ * \param range_uids Locking objects to erase
+ * \param timeout_ms Deadline for key regeneration (0 - long operation default)
+ * \return Method status per range
+ */
+vector<unsigned> drive::erase_ranges(vector<uint64_t> const &range_uids,
+				     unsigned timeout_ms)
+{
+  datum_vector calls, results;
+  vector<size_t> keyed;
+  vector<unsigned> status;
+  size_t i;
+  
+  // Locking.Get[] of each range's key, column 10 (ActiveKey)
+  for (i = 0; i < range_uids.size(); i++)
+  {
+    datum call;
+    call.object_uid() = range_uids[i];
+    call.method_uid() = GET;
+    call[0][0].name()        = atom::new_uint(3);  // Starting Table Column
+    call[0][0].named_value() = atom::new_uint(10);
+    call[0][1].name()        = atom::new_uint(4);  // Ending Table Column
+    call[0][1].named_value() = atom::new_uint(10);
+    calls.push_back(std::move(call));
+  }
+  status = invoke_batch(std::move(calls), results);
+  
+  // Key.GenKey[] for every key found, in as few ComPkts as allowed
+  calls.clear();
+  for (i = 0; i < range_uids.size(); i++)
+  {
+    if (status[i] != datum::STA_SUCCESS)
+    {
+      continue;
+    }
+    
+    // Pull key UID out of nested array
+    datum const *key = NULL;
+    if ((results[i].get_type() == datum::LIST) && (results[i].list().size() > 0))
+    {
+      key = results[i].list()[0].try_find_by_name(10);
+    }
+    if ((key == NULL) || (key->get_type() != datum::ATOM) || !key->value().try_get_uid())
+    {
+      // Nothing to regenerate here, the other ranges still go ahead
+      status[i] = STA_NO_KEY;
+      continue;
+    }
+    
+    datum call;
+    call.object_uid() = *key->value().try_get_uid();
+    call.method_uid() = GENKEY;
+    calls.push_back(std::move(call));
+    keyed.push_back(i);
+  }
+  
+  // Regeneration can take a while, give it the long deadline
+  vector<unsigned> key_status;
+  key_status = invoke_batch(std::move(calls), results,
+			    (timeout_ms ? timeout_ms : LONG_TIMEOUT_SECS * 1000));
+  for (i = 0; i < keyed.size(); i++)
+  {
+    status[keyed[i]] = key_status[i];
+  }
+  
+  return status;
 }
 
 /**
  * \brief Send payload to TCG Opal drive
  *
- * @param outbuf Outbound data buffer
+ * Payload is encoded straight into the outbound ComPkt block. Method calls
+ * are followed by the method status / control list.
+ *
+ * @param payload Method call (or other token) to send
  * \param session_ids Include TPer session IDs in ComPkt?
  */
-void drive::send(byte_vector const &outbuf, bool session_ids)
+void drive::send(datum const &payload, bool session_ids)
 {
-  unsigned char *block, *payload;
-  opal_header_t *header;
-  size_t sub_size, pkt_size, com_size, tot_size;
+  TOPAZ_ALLOC_SITE(site, ALLOC_SEND);
+  
+  // Method calls are followed by the method status / control code
+  if (payload.get_type() == datum::METHOD)
+  {
+    send(&payload, 1, session_ids);
+    return;
+  }
+  
+  // Set up block, encode payload in place
+  byte_vector block(payload.get_allocator());
+  topaz::byte *data = send_prep(block, payload.size(), session_ids);
+  payload.encode_bytes(data);
+  
+  // Hand off formatted Com Packet
+  TOPAZ_TRACE_SPAN(span, TRACE_IF_SEND, (1 << 16) | com_id, block.size());
+  drive_clock::time_point start = drive_clock::now();
+  raw.if_send(1, com_id, &(block[0]), block.size() / ATA_BLOCK_SIZE);
+  call_transfer_ns += elapsed_ns(start);
+  traffic.sent(block.size());
+}
+
+/**
+ * \brief Send several method calls to TCG Opal drive in one ComPkt
+ *
+ * @param calls Method calls to send
+ * @param count Number of calls
+ * \param session_ids Include TPer session IDs in ComPkt?
+ */
+void drive::send(datum const *calls, size_t count, bool session_ids)
+{
+  TOPAZ_ALLOC_SITE(site, ALLOC_SEND);
+  byte_vector block(calls[0].get_allocator());
+  topaz::byte *data;
+  size_t sub_size = 0, i;
+  
+  // Each call carries its own method status / control list
+  for (i = 0; i < count; i++)
+  {
+    sub_size += calls[i].size() + 6;
+  }
   
-  // Sub Packet contains the actual data
-  sub_size = outbuf.size();
+  // Set up block, encode calls in place
+  data = send_prep(block, sub_size, session_ids);
+  traffic.called(count);
+  for (i = 0; i < count; i++)
+  {
+    data += calls[i].encode_bytes(data);
+    *data++ = datum::TOK_END_OF_DATA;
+    *data++ = datum::TOK_START_LIST;
+    *data++ = 0; // 0 for execute, some values cancel operations .. (TBD?)
+    *data++ = 0; // Reserved
+    *data++ = 0; // Reserved
+    *data++ = datum::TOK_END_LIST;
+  }
+  
+  // Hand off formatted Com Packet
+  TOPAZ_TRACE_SPAN(span, TRACE_IF_SEND, (1 << 16) | com_id, block.size());
+  drive_clock::time_point start = drive_clock::now();
+  raw.if_send(1, com_id, &(block[0]), block.size() / ATA_BLOCK_SIZE);
+  call_transfer_ns += elapsed_ns(start);
+  traffic.sent(block.size());
+}
+
+/**
+ * \brief Prepare ComPkt block for outbound payload
+ *
+ * @param block Block to size (zeroed) and fill with ComPkt headers
+ * @param sub_size Size of payload in bytes
+ * \param session_ids Include TPer session IDs in ComPkt?
+ * @return Location of payload within block
+ */
+topaz::byte *drive::send_prep(byte_vector &block, size_t sub_size, bool session_ids)
+{
+  opal_header_t *header;
+  size_t pkt_size, com_size, tot_size;
   
   // Packet includes Sub Packet header
   pkt_size = sub_size + sizeof(opal_sub_packet_header_t);
@@ -432,15 +799,9 @@ void drive::send(byte_vector const &outbuf, bool session_ids)
     throw topaz_exception("ComPkt too large for drive");
   }
   
-  // Allocate some mem to work with
-  block = new unsigned char[tot_size];
-  
-  // Set up pointers
-  header = (opal_header_t*)block;
-  payload = block + sizeof(opal_header_t);
-  
-  // Clear it out
-  memset(block, 0, tot_size);
+  // Some (zeroed) mem to work with
+  block.assign(tot_size, 0);
+  header = (opal_header_t*)&(block[0]);
   
   // Fill in headers
   header->com_hdr.com_id = htobe16(com_id);
@@ -455,14 +816,8 @@ void drive::send(byte_vector const &outbuf, bool session_ids)
     header->pkt_hdr.host_session_id = htobe32(host_session_id);
   }
   
-  // Copy over payload data
-  memcpy(payload, &(outbuf[0]), outbuf.size());
-  
-  // Hand off formatted Com Packet
-  raw.if_send(1, com_id, block, tot_size / ATA_BLOCK_SIZE);
-  
-  // Cleanup
-  delete [] block;
+  // Payload follows headers
+  return &(block[0]) + sizeof(opal_header_t);
 }
 
 /**
@@ -472,48 +827,251 @@ void drive::send(byte_vector const &outbuf, bool session_ids)
  */
 void drive::recv(byte_vector &inbuf)
 {
-  unsigned char block[ATA_BLOCK_SIZE] = {0}, *payload;
+  if (!try_recv(inbuf, TIMEOUT_SECS * 1000))
+  {
+    outcome.timed_out();
+    throw topaz_exception("Timeout waiting for response");
+  }
+}
+
+/**
+ * \brief Receive payload from TCG Opal drive, within deadline
+ *
+ * @param inbuf Inbound data buffer
+ * @param timeout_ms How long to poll for a response
+ * @return False if no response arrived in time
+ */
+bool drive::try_recv(byte_vector &inbuf, unsigned timeout_ms)
+{
+  byte_vector block(ATA_BLOCK_SIZE, 0, inbuf.get_allocator());
   opal_header_t *header;
-  size_t count;
-  byte_vector bytes;
+  size_t count, need;
+  drive_clock::time_point start = drive_clock::now(), xfer_start;
+  uint64_t xfer_ns;
   
   // Maximum poll attempts before timeout
-  int max_iters = (TIMEOUT_SECS * 1000) / POLL_MS;
-  
-  // Set up pointers
-  header = (opal_header_t*)block;
-  payload = block + sizeof(opal_header_t);
+  unsigned max_iters = timeout_ms / POLL_MS, iters = 0;
   
   // If still processing, drive may respond with "no data yet" ...
-  do
+  while (true)
   {
     // Receive formatted Com Packet
-    raw.if_recv(1, com_id, block, 1);
+    {
+      TOPAZ_TRACE_SPAN(span, TRACE_IF_RECV, (1 << 16) | com_id, block.size());
+      xfer_start = drive_clock::now();
+      raw.if_recv(1, com_id, &(block[0]), block.size() / ATA_BLOCK_SIZE);
+      xfer_ns = elapsed_ns(xfer_start);
+      traffic.received(block.size());
+    }
+    header = (opal_header_t*)&(block[0]);
     
     // Do some cursory verification here
     if (be16toh(header->com_hdr.com_id) != com_id)
     {
       throw topaz_exception("Unexpected ComID in drive response");
     }
-    if (be32toh(header->com_hdr.length) == 0)
+    if (be32toh(header->com_hdr.length) != 0)
     {
-      // Response is not yet ready ... wait a bit and try again
-      usleep(POLL_MS * 1000);
+      // Everything but the IF-RECV that brought the response was waiting
+      uint64_t total_ns = elapsed_ns(start);
+      call_transfer_ns += xfer_ns;
+      call_think_ns += total_ns - xfer_ns;
+      poll_wait.record(total_ns - xfer_ns);
+      poll_iters.record(iters);
+      break;
     }
-  } while ((be32toh(header->com_hdr.length) == 0) && (--max_iters > 0));
-  
-  // Check for timeout
-  if (max_iters == 0)
-  {
-    throw topaz_exception("Timeout waiting for response");
+    
+    // Response is ready but bigger than our buffer? Grow and ask again
+    need = PAD_TO_MULTIPLE(be32toh(header->com_hdr.min_xfer), ATA_BLOCK_SIZE);
+    if (need > block.size())
+    {
+      if (need > MAX_RECV_BLOCKS * ATA_BLOCK_SIZE)
+      {
+	throw topaz_exception("Drive response too large");
+      }
+      block.assign(need, 0);
+      continue;
+    }
+    
+    // Response is not yet ready ... wait a bit and try again
+    traffic.polled();
+    if (iters++ >= max_iters)
+    {
+      poll_wait.record(elapsed_ns(start));
+      poll_iters.record(iters);
+      return false;
+    }
+    TOPAZ_TRACE_EVENT(TRACE_POLL, iters, 0);
+    usleep(POLL_MS * 1000);
   }
   
   // Ready the receiver buffer
   count = be32toh(header->sub_hdr.length);
+  if (count > block.size() - sizeof(opal_header_t))
+  {
+    throw topaz_exception("Invalid SubPacket length in drive response");
+  }
   
   // Extract response
-  inbuf.resize(count);
-  memcpy(&(inbuf[0]), payload, count);
+  inbuf.assign(block.begin() + sizeof(opal_header_t),
+	       block.begin() + sizeof(opal_header_t) + count);
+  return true;
+}
+
+/**
+ * \brief Add finished method call to its latency histograms
+ */
+void drive::record_call(uint64_t method_uid, drive_clock::time_point start,
+			drive_clock::time_point decode)
+{
+  topaz::method_latency *rec = call_latency.get(method_uid);
+  if (rec)
+  {
+    uint64_t total_ns = elapsed_ns(start), decode_ns = elapsed_ns(decode);
+    uint64_t wire_ns = call_transfer_ns + call_think_ns + decode_ns;
+    rec->total.record(total_ns);
+    rec->encode.record(total_ns > wire_ns ? total_ns - wire_ns : 0);
+    rec->transfer.record(call_transfer_ns);
+    rec->think.record(call_think_ns);
+    rec->decode.record(decode_ns);
+  }
+}
+
+/**
+ * \brief Latency of method calls by method UID, split by phase (ns)
+ */
+method_latency_table const &drive::method_latency() const
+{
+  return call_latency;
+}
+
+/**
+ * \brief Time spent waiting on "no data yet" per response (ns)
+ */
+latency_histogram const &drive::poll_latency() const
+{
+  return poll_wait;
+}
+
+/**
+ * \brief "No data yet" polls per response
+ */
+latency_histogram const &drive::poll_count() const
+{
+  return poll_iters;
+}
+
+/**
+ * \brief SG_IO latency per ATA command opcode (ns)
+ */
+command_latency_table const *drive::command_latency() const
+{
+  rawdrive *dev = dynamic_cast<rawdrive*>(&raw);
+  return dev ? &(dev->command_latency()) : NULL;
+}
+
+/**
+ * \brief Clear all latency histograms
+ */
+void drive::reset_latency()
+{
+  rawdrive *dev = dynamic_cast<rawdrive*>(&raw);
+  topaz::reset_latency(call_latency);
+  poll_wait.reset();
+  poll_iters.reset();
+  if (dev)
+  {
+    topaz::reset_latency(dev->command_latency());
+  }
+}
+
+/**
+ * \brief Traffic so far
+ */
+io_counters drive::counters() const
+{
+  return traffic.read();
+}
+
+/**
+ * \brief Method outcomes so far
+ */
+status_counts drive::outcomes() const
+{
+  return outcome.read();
+}
+
+/**
+ * \brief Start counting traffic and outcomes from zero
+ */
+void drive::reset_counters()
+{
+  traffic.reset();
+  outcome.reset();
+}
+
+/**
+ * \brief Discovery results and session state
+ */
+drive_health drive::health() const
+{
+  drive_health now;
+  now.has_locking      = has_locking;
+  now.locking          = lock_flags;
+  now.session_open     = session_live;
+  now.max_com_pkt_size = max_com_pkt_size;
+  now.max_methods      = max_methods;
+  return now;
+}
+
+/**
+ * \brief Lease on device held while open
+ */
+device_lease const &drive::lease() const
+{
+  return *lease_lock;
+}
+
+/**
+ * \brief Traffic Scope Constructor
+ */
+io_scope::io_scope(drive const &target, io_counters *out)
+  : target(target), start(target.counters()), out(out)
+{
+}
+
+/**
+ * \brief Traffic Scope Destructor
+ */
+io_scope::~io_scope()
+{
+  if (out)
+  {
+    *out = used();
+  }
+}
+
+/**
+ * \brief Traffic since start of scope
+ */
+io_counters io_scope::used() const
+{
+  return target.counters() - start;
+}
+
+/**
+ * \brief Abandon session and ComID state after a missed response
+ */
+void drive::abort_comid()
+{
+  // Whatever the TPer eventually answers can't be matched up anymore
+  tper_session_id = 0;
+  host_session_id = 0;
+  session_live = false;
+  if (has_opal2 && lease_lock->may_reset())
+  {
+    reset_comid(com_id);
+  }
 }
 
 /**
@@ -524,10 +1082,12 @@ void drive::probe_tpm()
   tpm_protos_t protos;
   int i, count;
   bool has_opal = false;
+  TOPAZ_TRACE_SPAN(span, TRACE_PROBE, TRACE_PROBE_TPM, 0);
   
   // TPM protocols listed by IF-RECV
   TOPAZ_DEBUG(1) printf("Probe TPM Security Protocols\n");
   raw.if_recv(0, 0, &protos, 1);
+  traffic.received(ATA_BLOCK_SIZE);
   
   // Browse results
   count = be16toh(protos.list_len);
@@ -566,10 +1126,12 @@ void drive::probe_level0()
   uint32_t total_len;
   uint16_t major, minor, code;
   size_t offset = sizeof(level0_header_t);
+  TOPAZ_TRACE_SPAN(span, TRACE_PROBE, TRACE_PROBE_LEVEL0, 0);
   
   // Level0 Discovery over IF-RECV
   TOPAZ_DEBUG(1) printf("Establish Level 0 Comms - Discovery\n");
   raw.if_recv(1, 1, &data, 1);
+  traffic.received(ATA_BLOCK_SIZE);
   total_len = 4 + be32toh(header->length);
   major = be16toh(header->major_ver);
   minor = be16toh(header->minor_ver);
@@ -616,6 +1178,8 @@ void drive::probe_level0()
     }
     else if (code == FEAT_LOCK)
     {
+      has_locking = true;
+      lock_flags = 0x3f & data[offset];
       TOPAZ_DEBUG(2)
       {
 	printf("Locking\n");
@@ -754,15 +1318,23 @@ void drive::probe_level0()
  */
 void drive::probe_level1()
 {
+  TOPAZ_TRACE_SPAN(span, TRACE_PROBE, TRACE_PROBE_LEVEL1, 0);
   TOPAZ_DEBUG(1) printf("Establish Level 1 Comms - Host Properties\n");
 
+  // Offer to take several methods per ComPkt (HostProperties, named 0)
+  datum params;
+  params[0].name()                         = atom::new_uint(0);
+  params[0].named_value()[0].name()        = atom::new_bin("MaxMethods");
+  params[0].named_value()[0].named_value() = atom::new_uint(HOST_MAX_METHODS);
+  
   // Ask session manager about it's comms properties
-  datum rc = invoke(SESSION_MGR, PROPERTIES);
+  datum rc = invoke(SESSION_MGR, PROPERTIES, std::move(params));
   
   // Comm props stored in list (first element) of named items
   datum_vector const &props = rc[0].list();
   TOPAZ_DEBUG(2) printf("  Received %u items\n", (unsigned int)props.size());
   
+  uint64_t tper_methods = 1;
   for (size_t i = 0; i < props.size(); i++)
   {
     // Name of property
@@ -771,15 +1343,51 @@ void drive::probe_level1()
     // Value
     uint64_t val = props[i].named_value().value().get_uint();
     
-    // Only one we want here is the MaxComPacketSize,
-    // which specifies the maximum I/O packet length
+    // MaxComPacketSize specifies the maximum I/O packet length,
+    // MaxMethods how many calls may share one
     if (name == "MaxComPacketSize")
     {
       max_com_pkt_size = val;
       TOPAZ_DEBUG(2) printf("  Max ComPkt Size is %" PRIu64 " (%" PRIu64 " blocks)\n",
 			    val, val / ATA_BLOCK_SIZE);
     }
+    else if (name == "MaxMethods")
+    {
+      tper_methods = val;
+    }
+  }
+  
+  // Batch only as far as the TPer accepted our host properties (named 0,
+  // response is a method call so no list lookup)
+  datum const *host = NULL;
+  for (size_t i = 1; i < rc.list().size(); i++)
+  {
+    if ((rc.list()[i].get_type() == datum::NAMED) &&
+	(rc.list()[i].name().try_get_uint() == 0u))
+    {
+      host = &(rc.list()[i].named_value());
+    }
   }
+  if (host && (host->get_type() == datum::LIST))
+  {
+    datum_vector const &accepted = host->list();
+    for (size_t i = 0; i < accepted.size(); i++)
+    {
+      if ((accepted[i].get_type() == datum::NAMED) &&
+	  (accepted[i].name().get_type() == atom::BYTES) &&
+	  (accepted[i].name().get_string() == "MaxMethods") &&
+	  (accepted[i].named_value().get_type() == datum::ATOM))
+      {
+	optional<uint64_t> val = accepted[i].named_value().value().try_get_uint();
+	max_methods = min(tper_methods, val.value_or(1));
+      }
+    }
+  }
+  if (max_methods == 0)
+  {
+    max_methods = 1;
+  }
+  TOPAZ_DEBUG(2) printf("  Max Methods per ComPkt is %" PRIu64 "\n", max_methods);
 }
 
 /**
@@ -789,6 +1397,8 @@ void drive::logout()
 {
   if (tper_session_id)
   {
+    TOPAZ_TRACE_SPAN(span, TRACE_SESSION_END, tper_session_id, 0);
+    
     // Debug
     TOPAZ_DEBUG(1) printf("Stopping TPM Session %" PRIx64 ":%" PRIx64 "\n",
 			  tper_session_id, host_session_id);
@@ -796,12 +1406,11 @@ void drive::logout()
     // Off it goes
     try
     {
-      // End of session is a single byte
+      // End of session is a single token
       byte_vector bytes;
-      bytes.push_back(datum::TOK_END_SESSION);
       
       // Bye!
-      send(bytes);
+      send(datum(datum::END_SESSION));
       recv(bytes);
     }
     catch (topaz_exception &e)
@@ -813,6 +1422,7 @@ void drive::logout()
     // Mark state
     tper_session_id = 0;
     host_session_id = 0;
+    session_live = false;
   }
 }
 
@@ -824,6 +1434,7 @@ void drive::reset_comid(uint32_t com_id)
   unsigned char block[ATA_BLOCK_SIZE] = {0};
   opal_comid_req_t *cmd = (opal_comid_req_t*)block;
   opal_comid_resp_t *resp = (opal_comid_resp_t*)block;
+  TOPAZ_TRACE_SPAN(span, TRACE_PROBE, TRACE_PROBE_RESET_COMID, com_id);
 
   // Debug
   TOPAZ_DEBUG(1) printf("Reset ComID 0x%x\n", com_id);
@@ -834,7 +1445,9 @@ void drive::reset_comid(uint32_t com_id)
   
   // Hit the reset
   raw.if_send(2, com_id, block, 1);
+  traffic.sent(ATA_BLOCK_SIZE);
   raw.if_recv(2, com_id, block, 1);
+  traffic.received(ATA_BLOCK_SIZE);
   
   // Check result
   if ((htobe32(resp->avail_data) != 4) || (htobe32(resp->failed) != 0))
@@ -31,24 +31,70 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <chrono>
+#include <memory>
 #include <string>
+#include <vector>
 #include <topaz/rawdrive.h>
+#include <topaz/counters.h>
 #include <topaz/datum.h>
+#include <topaz/latency.h>
+#include <topaz/lease.h>
 
 namespace topaz
 {
 
+  // Level 0 Locking feature flags (drive_health::locking)
+  enum lock_flag
+  {
+    LOCK_SUPPORTED   = 0x01,
+    LOCK_ENABLED     = 0x02,
+    LOCK_LOCKED      = 0x04,
+    LOCK_MEDIA_ENCR  = 0x08,
+    LOCK_MBR_ENABLED = 0x10,
+    LOCK_MBR_DONE    = 0x20
+  };
+
+  // Drive state as last seen by the library (reading it sends no commands)
+  typedef struct
+  {
+    bool     has_locking;       // Level 0 reported Locking feature
+    uint8_t  locking;           // lock_flag bits, as of discovery
+    bool     session_open;      // Session in progress
+    uint64_t max_com_pkt_size;  // Negotiated MaxComPacketSize
+    uint64_t max_methods;       // Method calls per ComPkt
+  } drive_health;
+
   class drive
   {
     
   public:
     
+    // Status of a batched call the TPer did not answer (deadline passed, or
+    // it stopped processing the ComPkt early)
+    static constexpr unsigned STA_INCOMPLETE = 0x100;
+    
+    // Status of a range erase_ranges found no media key for
+    static constexpr unsigned STA_NO_KEY = 0x101;
+    
     /**
      * \brief Topaz Hard Drive Constructor
      *
-     * @param path OS path to specified drive (eg - '/dev/sdX')
+     * The device is leased from other processes (see lease.h) until the
+     * drive is destroyed.
+     *
+     * @param path  OS path to specified drive (eg - '/dev/sdX', 'sim:/run/tper.sock#3')
+     * @param lease What to do if another process has the device open
      */
-    drive(char const *path);
+    drive(char const *path, lease_policy const &lease = lease_policy());
+    
+    /**
+     * \brief Topaz Hard Drive Constructor (caller supplied transport)
+     *
+     * @param io    Transport to TPer (eg - simulator), must outlive drive
+     * @param lease What to do if another process has the device open
+     */
+    drive(transport &io, lease_policy const &lease = lease_policy());
     
     /**
      * \brief Topaz Hard Drive Destructor
@@ -80,13 +126,19 @@ namespace topaz
      */
     void login(uint64_t sp_uid, uint64_t auth_uid, std::string pin);
     
+    /**
+     * \brief End TPM session (if any), so another host handle may start one
+     */
+    void logout();
+    
     /**
      * \brief Query Whole Table
      *
      * @param tbl_uid Identifier of target table
+     * @param alloc   Allocator (eg - arena) for call and returned data
      * @return Queried parameters
      */
-    datum table_get(uint64_t tbl_uid);
+    datum table_get(uint64_t tbl_uid, mem_allocator const &alloc = mem_allocator());
     
     /**
      * \brief Query Value from Specified Table
@@ -97,12 +149,22 @@ namespace topaz
      */
     atom table_get(uint64_t tbl_uid, uint64_t tbl_col);
     
+    /**
+     * \brief Probe Value from Specified Table (method failures not thrown)
+     *
+     * @param tbl_uid Identifier of target table
+     * @param tbl_col Column number of data to retrieve (table specific)
+     * @param val Queried parameter, left empty if column was not returned
+     * @return Method status (datum::STA_SUCCESS on success)
+     */
+    unsigned try_table_get(uint64_t tbl_uid, uint64_t tbl_col, atom &val);
+    
     /**
      * \brief Set Value in Specified Table
      *
      * @param tbl_uid Identifier of target table
      * @param tbl_col Column number of data to retrieve (table specific)
-     * @param val Value to set in column
+     * @param val Value to set in column (moved into call)
      */
     void table_set(uint64_t tbl_uid, uint64_t tbl_col, atom val);
     
@@ -132,26 +194,152 @@ namespace topaz
      *
      * \param object_uid UID indicating object to use for invocation
      * \param method_uid UID indicating method to call on object
-     * \param params List datum with parameters for method call
+     * \param params List datum with parameters for method call (moved into call)
+     * \param alloc Allocator (eg - arena) for call, buffers and returned data
      * \return Any data returned from method call
      */
     datum invoke(uint64_t object_uid, uint64_t method_uid,
-		 datum params = datum(datum::LIST));
+		 datum params = datum(datum::LIST),
+		 mem_allocator const &alloc = mem_allocator());
+    
+    /**
+     * \brief Method invocation, returning method status instead of throwing
+     *
+     * Transport and protocol errors are still thrown, only a nonzero
+     * method status is handed back.
+     *
+     * \param object_uid UID indicating object to use for invocation
+     * \param method_uid UID indicating method to call on object
+     * \param result Data returned from method call (its allocator is used
+     *               for call, buffers and result)
+     * \param params List datum with parameters for method call (moved into call)
+     * \return Method status (datum::STA_SUCCESS on success)
+     */
+    unsigned try_invoke(uint64_t object_uid, uint64_t method_uid, datum &result,
+			datum params = datum(datum::LIST));
+    
+    /**
+     * \brief Batched method invocation
+     *
+     * Calls are packed into as few ComPkts as the TPer allows (MaxMethods,
+     * MaxComPacketSize), and each call's method status is handed back
+     * separately. Transport and protocol errors are still thrown.
+     *
+     * \param calls Method call datums (moved into call)
+     * \param results Data returned from each call (resized to match calls)
+     * \param timeout_ms Deadline for the whole batch (0 - usual per ComPkt timeout)
+     * \return Method status of each call (STA_INCOMPLETE if never answered)
+     */
+    std::vector<unsigned> invoke_batch(datum_vector calls, datum_vector &results,
+				       unsigned timeout_ms = 0);
+    
+    /**
+     * \brief Crypto Erase Locking Ranges in a Single Session
+     *
+     * Key UIDs of all ranges are looked up in one batch, then all keys are
+     * regenerated in another, under one deadline for the whole operation.
+     *
+     * \param range_uids Locking objects to erase (eg - LBA_RANGE_GLOBAL)
+     * \param timeout_ms Deadline for key regeneration (0 - long operation default)
+     * \return Method status per range (STA_INCOMPLETE if not done in time,
+     *         STA_NO_KEY if the range has no readable media key)
+     */
+    std::vector<unsigned> erase_ranges(std::vector<uint64_t> const &range_uids,
+				       unsigned timeout_ms = 0);
     
     /**
      * \brief Invoke Revert[] on Admin_SP, and handle session termination
      */
     void admin_sp_revert();
+    
+    /**
+     * \brief Latency of method calls by method UID, split by phase (ns)
+     *
+     * Batched calls are counted once per ComPkt, under the first call's method.
+     */
+    method_latency_table const &method_latency() const;
+    
+    /**
+     * \brief Time spent waiting on "no data yet" per response (ns)
+     */
+    latency_histogram const &poll_latency() const;
+    
+    /**
+     * \brief "No data yet" polls per response
+     */
+    latency_histogram const &poll_count() const;
+    
+    /**
+     * \brief SG_IO latency per ATA command opcode (ns)
+     *
+     * @return Histograms, NULL unless drive is a local device
+     */
+    command_latency_table const *command_latency() const;
+    
+    /**
+     * \brief Clear all latency histograms
+     */
+    void reset_latency();
+    
+    /**
+     * \brief Traffic so far: IF-SEND / IF-RECV commands, polls, bytes,
+     *        sessions started and method calls sent
+     */
+    io_counters counters() const;
+    
+    /**
+     * \brief Method outcomes so far: calls answered by status, timeouts
+     */
+    status_counts outcomes() const;
+    
+    /**
+     * \brief Start counting traffic and outcomes from zero
+     */
+    void reset_counters();
+    
+    /**
+     * \brief Discovery results and session state (safe from any thread)
+     */
+    drive_health health() const;
+    
+    /**
+     * \brief Lease on device held while open
+     */
+    device_lease const &lease() const;
 
   protected:
     
+    typedef std::chrono::steady_clock drive_clock;
+    
     /**
      * \brief Send payload to TCG Opal drive
      *
-     * @param outbuf Outbound data buffer
+     * Payload is encoded straight into the outbound ComPkt block. Method calls
+     * are followed by the method status / control list.
+     *
+     * @param payload Method call (or other token) to send
+     * \param session_ids Include TPer session IDs in ComPkt?
+     */
+    void send(datum const &payload, bool session_ids = true);
+    
+    /**
+     * \brief Send several method calls to TCG Opal drive in one ComPkt
+     *
+     * @param calls Method calls to send
+     * @param count Number of calls
+     * \param session_ids Include TPer session IDs in ComPkt?
+     */
+    void send(datum const *calls, size_t count, bool session_ids = true);
+    
+    /**
+     * \brief Prepare ComPkt block for outbound payload
+     *
+     * @param block Block to size (zeroed) and fill with ComPkt headers
+     * @param sub_size Size of payload in bytes
      * \param session_ids Include TPer session IDs in ComPkt?
+     * @return Location of payload within block
      */
-    void send(byte_vector const &outbuf, bool session_ids = true);
+    byte *send_prep(byte_vector &block, size_t sub_size, bool session_ids);
     
     /**
      * \brief Receive payload from TCG Opal drive
@@ -160,6 +348,27 @@ namespace topaz
      */
     void recv(byte_vector &inbuf);
     
+    /**
+     * \brief Receive payload from TCG Opal drive, within deadline
+     *
+     * @param inbuf Inbound data buffer
+     * @param timeout_ms How long to poll for a response
+     * @return False if no response arrived in time
+     */
+    bool try_recv(byte_vector &inbuf, unsigned timeout_ms);
+    
+    /**
+     * \brief Abandon session and ComID state after a missed response
+     */
+    void abort_comid();
+    
+    /**
+     * \brief Discovery and comms setup common to all constructors
+     *
+     * @param lease What to do if another process has the device open
+     */
+    void init(lease_policy const &lease);
+    
     /**
      * \brief Probe Available TPM Security Protocols
      */
@@ -175,11 +384,6 @@ namespace topaz
      */
     void probe_level1();
 
-    /**
-     * \brief End TPM session
-     */
-    void logout();
-    
     /**
      * \brief Probe TCG Opal Communication Properties
      */
@@ -193,8 +397,19 @@ namespace topaz
      */
     char const *lookup_tpm_proto(uint8_t proto);
     
-    // Underlying Device implementing IF-SEND/RECV
-    rawdrive raw;
+    /**
+     * \brief Add finished method call to its latency histograms
+     *
+     * @param method_uid Method called
+     * @param start      Call started
+     * @param decode     Response arrived, decode started
+     */
+    void record_call(uint64_t method_uid, drive_clock::time_point start,
+		     drive_clock::time_point decode);
+    
+    // Underlying Device implementing IF-SEND/RECV (owned when opened by path)
+    std::unique_ptr<transport> owned;
+    transport &raw;
     
     // TPM session data
     uint64_t tper_session_id;
@@ -206,9 +421,68 @@ namespace topaz
     uint32_t com_id;
     uint64_t lba_align;
     uint64_t max_com_pkt_size;
+    uint64_t max_methods;
     unsigned admin_count;
     unsigned user_count;
     
+    // Call latency (always on), and phase times of the call in progress
+    method_latency_table call_latency;
+    latency_histogram poll_wait;
+    latency_histogram poll_iters;
+    uint64_t call_transfer_ns;
+    uint64_t call_think_ns;
+    
+    // Round trips and bytes, method outcomes
+    io_counter_set traffic;
+    status_counter_set outcome;
+    
+    // Level 0 Locking feature, and session state for other threads
+    bool has_locking;
+    uint8_t lock_flags;
+    std::atomic<bool> session_live;
+    
+    // Cross-process lease, decides whether we may reset the ComID
+    std::unique_ptr<device_lease> lease_lock;
+    
+  };
+  
+  /**
+   * \brief Traffic used within a scope
+   *
+   * Takes a reading of the drive's counters when constructed. used() is
+   * the traffic since then, which is also stored to *out (if given) when
+   * the scope ends, eg - to hold a workflow to a round trip budget.
+   */
+  class io_scope
+  {
+    
+  public:
+    
+    /**
+     * \brief Start measuring
+     *
+     * @param target Drive to watch (must outlive scope)
+     * @param out    Receives traffic used at end of scope (optional)
+     */
+    io_scope(drive const &target, io_counters *out = NULL);
+    
+    /**
+     * \brief Stop measuring (stores to out)
+     */
+    ~io_scope();
+    
+    /**
+     * \brief Traffic since start of scope
+     */
+    io_counters used() const;
+    
+  protected:
+    
+    /* internal data */
+    drive const &target;
+    io_counters start;
+    io_counters *out;
+    
   };
   
 };
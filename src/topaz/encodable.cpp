@@ -28,6 +28,7 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <topaz/alloc.h>
 #include <topaz/encodable.h>
 #include <topaz/exceptions.h>
 using namespace topaz;
@@ -51,11 +52,13 @@ encodable::~encodable()
 /**
  * \brief Encode to Container
  *
+ * @param alloc Allocator for returned container (defaults to heap)
  * @return Encoded data
  */
-byte_vector encodable::encode_vector() const
+byte_vector encodable::encode_vector(mem_allocator const &alloc) const
 {
-  byte_vector data;
+  TOPAZ_ALLOC_SITE(site, ALLOC_ENCODE);
+  byte_vector data(alloc);
   
   // Resize to appropriate size
   data.resize(size());
@@ -63,9 +63,10 @@ namespace topaz
     /**
      * \brief Encode to Container
      *
+     * @param alloc Allocator for returned container (defaults to heap)
      * @return Encoded data
      */
-    byte_vector encode_vector() const;
+    byte_vector encode_vector(mem_allocator const &alloc = mem_allocator()) const;
     
     /**
      * \brief Decode from data buffer
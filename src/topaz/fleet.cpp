@@ -0,0 +1,380 @@
+/**
+ * Topaz - Fleet Executor
+ *
+ * This file implements running one workflow across many drives at once, on a
+ * work-stealing thread pool with per-controller concurrency caps.
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <topaz/debug.h>
+#include <topaz/drive.h>
+#include <topaz/exceptions.h>
+#include <topaz/fleet.h>
+using namespace std;
+using namespace topaz;
+
+// Upper bound on worker threads when sized by device count
+#define MAX_THREADS 64
+
+namespace
+{
+  
+  typedef chrono::steady_clock fleet_clock;
+  
+  // Millisecs between two clock readings
+  double elapsed_ms(fleet_clock::time_point from, fleet_clock::time_point to)
+  {
+    return chrono::duration<double, milli>(to - from).count();
+  }
+  
+  // One worker's queue of device indices (owner pops front, thieves pop back)
+  struct work_queue
+  {
+    mutex        lock;
+    deque<size_t> jobs;
+  };
+  
+  // Shared state for one run
+  struct run_state
+  {
+    vector<fleet_result>         *results;
+    vector<unique_ptr<work_queue>> queues;
+    unsigned                      per_controller;
+    
+    // Controller slots, and completion signalling
+    mutex                         slot_lock;
+    condition_variable            slot_free;
+    map<string, unsigned>         in_flight;
+    map<string, unsigned>         peak;
+    atomic<size_t>                remaining;
+    fleet_clock::time_point       start;
+  };
+  
+  // Claim a slot on a controller, if under the cap
+  bool acquire_slot(run_state &state, string const &controller)
+  {
+    lock_guard<mutex> guard(state.slot_lock);
+    unsigned &count = state.in_flight[controller];
+    if (state.per_controller && (count >= state.per_controller))
+    {
+      return false;
+    }
+    count++;
+    if (count > state.peak[controller])
+    {
+      state.peak[controller] = count;
+    }
+    return true;
+  }
+  
+  // Give a slot back, and wake anyone waiting on one
+  void release_slot(run_state &state, string const &controller)
+  {
+    {
+      lock_guard<mutex> guard(state.slot_lock);
+      state.in_flight[controller]--;
+      state.remaining--;
+    }
+    state.slot_free.notify_all();
+  }
+  
+  // Find a runnable job: own queue first (front), then steal (back)
+  bool take_job(run_state &state, unsigned self, size_t &idx, bool &stolen)
+  {
+    size_t count = state.queues.size();
+    for (size_t n = 0; n < count; n++)
+    {
+      work_queue &queue = *state.queues[(self + n) % count];
+      lock_guard<mutex> guard(queue.lock);
+      
+      // Skip over jobs whose controller is full
+      for (size_t i = 0; i < queue.jobs.size(); i++)
+      {
+	size_t pos = (n == 0 ? i : queue.jobs.size() - 1 - i);
+	size_t job = queue.jobs[pos];
+	if (acquire_slot(state, (*state.results)[job].controller))
+	{
+	  queue.jobs.erase(queue.jobs.begin() + pos);
+	  idx = job;
+	  stolen = (n != 0);
+	  return true;
+	}
+      }
+    }
+    return false;
+  }
+  
+  // Worker thread body
+  void worker(run_state &state, unsigned self, fleet::task const &fn)
+  {
+    while (1)
+    {
+      size_t idx;
+      bool stolen;
+      
+      if (take_job(state, self, idx, stolen))
+      {
+	fleet_result &result = (*state.results)[idx];
+	result.worker = self;
+	result.stolen = stolen;
+	result.queue_ms = elapsed_ms(state.start, fleet_clock::now());
+	
+	// Failures stay with the device, never the pool
+	try
+	{
+	  fn(result);
+	  result.ok = true;
+	}
+	catch (exception &e)
+	{
+	  result.ok = false;
+	  result.error = e.what();
+	}
+	
+	release_slot(state, result.controller);
+	continue;
+      }
+      
+      // Nothing runnable right now - done, or wait for a slot to free up
+      unique_lock<mutex> guard(state.slot_lock);
+      if (state.remaining == 0)
+      {
+	break;
+      }
+      state.slot_free.wait_for(guard, chrono::milliseconds(10));
+    }
+  }
+  
+};
+
+/**
+ * \brief Fleet Executor Constructor
+ *
+ * @param threads        Worker threads (0 - one per device, up to 64)
+ * @param per_controller Max devices in flight per controller (0 - no cap)
+ */
+fleet::fleet(unsigned threads, unsigned per_controller)
+  : threads(threads), per_controller(per_controller)
+{
+  last.ok = 0;
+  last.failed = 0;
+  last.wall_ms = 0;
+  last.busy_ms = 0;
+  last.slowest_ms = 0;
+}
+
+/**
+ * \brief Add device, controller looked up in sysfs
+ */
+void fleet::add(string const &path)
+{
+  add(path, controller_of(path));
+}
+
+/**
+ * \brief Add device on given controller
+ */
+void fleet::add(string const &path, string const &controller)
+{
+  fleet_result result;
+  result.path = path;
+  result.controller = controller;
+  result.ok = false;
+  result.worker = 0;
+  result.stolen = false;
+  result.queue_ms = 0;
+  result.open_ms = 0;
+  result.run_ms = 0;
+  devices.push_back(result);
+}
+
+/**
+ * \brief Open every device and run workflow on it (blocks until done)
+ */
+vector<fleet_result> fleet::run(workflow const &fn)
+{
+  return run_tasks([&fn](fleet_result &result)
+		   {
+		     // Open once, including discovery, then hand it over
+		     fleet_clock::time_point start = fleet_clock::now();
+		     drive target(result.path.c_str());
+		     result.open_ms = elapsed_ms(start, fleet_clock::now());
+		     
+		     start = fleet_clock::now();
+		     try
+		     {
+		       fn(target, result);
+		     }
+		     catch (...)
+		     {
+		       result.run_ms = elapsed_ms(start, fleet_clock::now());
+		       throw;
+		     }
+		     result.run_ms = elapsed_ms(start, fleet_clock::now());
+		   });
+}
+
+/**
+ * \brief Run raw task for every device (blocks until done)
+ */
+vector<fleet_result> fleet::run_tasks(task const &fn)
+{
+  vector<fleet_result> results = devices;
+  run_state state;
+  unsigned count = threads;
+  
+  // Size the pool
+  if (count == 0)
+  {
+    count = (devices.size() < MAX_THREADS ? devices.size() : MAX_THREADS);
+  }
+  if (count == 0)
+  {
+    count = 1;
+  }
+  
+  // Deal devices out round robin, interleaved by controller so each
+  // worker starts on a mix of controllers
+  map<string, deque<size_t> > by_controller;
+  for (size_t i = 0; i < results.size(); i++)
+  {
+    by_controller[results[i].controller].push_back(i);
+  }
+  for (unsigned i = 0; i < count; i++)
+  {
+    state.queues.push_back(unique_ptr<work_queue>(new work_queue));
+  }
+  for (size_t dealt = 0; dealt < results.size(); )
+  {
+    for (map<string, deque<size_t> >::iterator it = by_controller.begin();
+	 it != by_controller.end(); it++)
+    {
+      if (!it->second.empty())
+      {
+	state.queues[dealt++ % count]->jobs.push_back(it->second.front());
+	it->second.pop_front();
+      }
+    }
+  }
+  
+  // Off they go
+  state.results = &results;
+  state.per_controller = per_controller;
+  state.remaining = results.size();
+  state.start = fleet_clock::now();
+  TOPAZ_DEBUG(1) printf("Fleet run: %u devices, %u workers, cap %u per controller\n",
+			(unsigned)results.size(), count, per_controller);
+  vector<thread> pool;
+  for (unsigned i = 0; i < count; i++)
+  {
+    pool.push_back(thread(worker, ref(state), i, cref(fn)));
+  }
+  for (size_t i = 0; i < pool.size(); i++)
+  {
+    pool[i].join();
+  }
+  
+  // Tally up
+  last.ok = 0;
+  last.failed = 0;
+  last.wall_ms = elapsed_ms(state.start, fleet_clock::now());
+  last.busy_ms = 0;
+  last.slowest_ms = 0;
+  last.peak = state.peak;
+  for (size_t i = 0; i < results.size(); i++)
+  {
+    double dev_ms = results[i].open_ms + results[i].run_ms;
+    (results[i].ok ? last.ok : last.failed)++;
+    last.busy_ms += dev_ms;
+    if (dev_ms > last.slowest_ms)
+    {
+      last.slowest_ms = dev_ms;
+    }
+  }
+  
+  return results;
+}
+
+/**
+ * \brief Aggregate timing of last run
+ */
+fleet_summary const &fleet::summary() const
+{
+  return last;
+}
+
+/**
+ * \brief Find controller (SCSI host) of a block device via sysfs
+ *
+ * /sys/class/block/sdX resolves to something like
+ *   /sys/devices/pci0000:00/0000:00:1f.2/ata1/host0/target0:0:0/0:0:0:0/block/sda
+ * and everything up to the hostN component identifies the HBA port.
+ */
+string fleet::controller_of(string const &path)
+{
+  char resolved[PATH_MAX], *real;
+  string name, sys;
+  size_t pos;
+  
+  // Resolve /dev/disk/by-* style links to the kernel name
+  real = realpath(path.c_str(), resolved);
+  name = (real ? resolved : path);
+  pos = name.rfind('/');
+  if (pos != string::npos)
+  {
+    name = name.substr(pos + 1);
+  }
+  
+  // Device node in sysfs
+  real = realpath(("/sys/class/block/" + name).c_str(), resolved);
+  if (real == NULL)
+  {
+    return path;
+  }
+  sys = resolved;
+  
+  // Cut at the SCSI host
+  for (pos = sys.find("/host"); pos != string::npos; pos = sys.find("/host", pos + 1))
+  {
+    size_t end = sys.find('/', pos + 1);
+    if ((pos + 5 < sys.size()) && isdigit(sys[pos + 5]))
+    {
+      return sys.substr(0, end);
+    }
+  }
+  
+  return sys;
+}
@@ -0,0 +1,149 @@
+#ifndef TOPAZ_FLEET_H
+#define TOPAZ_FLEET_H
+
+/**
+ * Topaz - Fleet Executor
+ *
+ * This file implements running one workflow across many drives at once. Work
+ * is spread over a work-stealing thread pool, and the number of drives in
+ * flight behind any one controller (SCSI host) can be capped for links that
+ * can't keep up. The cap is off by default: one SAS HBA commonly fronts a
+ * whole expander of drives, which a per-host cap would run in serial waves. Each drive is opened once, and its
+ * outcome and timing are reported individually.
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace topaz
+{
+  
+  class drive;
+  
+  // Outcome of a workflow on one device
+  typedef struct
+  {
+    std::string path;        // Device path
+    std::string controller;  // Controller key used for concurrency cap
+    bool        ok;          // Workflow completed without exception
+    std::string error;       // Exception text on failure
+    std::string note;        // Free form detail filled in by workflow
+    unsigned    worker;      // Worker thread that ran it
+    bool        stolen;      // Taken from another worker's queue
+    double      queue_ms;    // Wait from start of run until picked up
+    double      open_ms;     // Device open / discovery
+    double      run_ms;      // Workflow body
+  } fleet_result;
+  
+  // Aggregate timing for one run
+  typedef struct
+  {
+    size_t   ok;
+    size_t   failed;
+    double   wall_ms;        // Start of run to last device done
+    double   busy_ms;        // Sum of per-device open + run time
+    double   slowest_ms;     // Longest single device (open + run)
+    std::map<std::string, unsigned> peak; // Most devices in flight per controller
+  } fleet_summary;
+  
+  class fleet
+  {
+    
+  public:
+    
+    // Workflow run against each opened drive
+    typedef std::function<void(drive &target, fleet_result &result)> workflow;
+    
+    // Raw task per device (device not opened by executor)
+    typedef std::function<void(fleet_result &result)> task;
+    
+    /**
+     * \brief Fleet Executor Constructor
+     *
+     * @param threads        Worker threads (0 - one per device, up to 64)
+     * @param per_controller Max devices in flight per controller (0 - no cap)
+     */
+    fleet(unsigned threads = 0, unsigned per_controller = 0);
+    
+    /**
+     * \brief Add device, controller looked up in sysfs
+     *
+     * @param path OS path to drive (eg - '/dev/sdX')
+     */
+    void add(std::string const &path);
+    
+    /**
+     * \brief Add device on given controller
+     *
+     * @param path       OS path to drive
+     * @param controller Controller key (devices with same key share the cap)
+     */
+    void add(std::string const &path, std::string const &controller);
+    
+    /**
+     * \brief Open every device and run workflow on it (blocks until done)
+     *
+     * @param fn Workflow, exceptions are recorded as device failure
+     * @return Per device results, in order added
+     */
+    std::vector<fleet_result> run(workflow const &fn);
+    
+    /**
+     * \brief Run raw task for every device (blocks until done)
+     *
+     * @param fn Task, exceptions are recorded as device failure
+     * @return Per device results, in order added
+     */
+    std::vector<fleet_result> run_tasks(task const &fn);
+    
+    /**
+     * \brief Aggregate timing of last run
+     */
+    fleet_summary const &summary() const;
+    
+    /**
+     * \brief Find controller (SCSI host) of a block device via sysfs
+     *
+     * @param path OS path to drive
+     * @return Controller key, or the device's own sysfs path if unknown
+     */
+    static std::string controller_of(std::string const &path);
+    
+  protected:
+    
+    /* internal data */
+    unsigned threads;
+    unsigned per_controller;
+    std::vector<fleet_result> devices;
+    fleet_summary last;
+    
+  };
+  
+};
+
+#endif
@@ -0,0 +1,258 @@
+/**
+ * Topaz - Latency Histograms
+ *
+ * This file implements always-on, lock-free log-linear latency histograms.
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <topaz/latency.h>
+using namespace std;
+using namespace topaz;
+
+#define SUB_COUNT (1u << latency_histogram::SUB_BITS)
+
+/**
+ * \brief Constructor (empty)
+ */
+latency_histogram::latency_histogram()
+{
+  reset();
+}
+
+/**
+ * \brief Copy Constructor (snapshot of a live histogram)
+ */
+latency_histogram::latency_histogram(latency_histogram const &other)
+{
+  reset();
+  merge(other);
+}
+
+/**
+ * \brief Add one sample
+ */
+void latency_histogram::record(uint64_t value)
+{
+  buckets[bucket_of(value)].fetch_add(1, memory_order_relaxed);
+  samples.fetch_add(1, memory_order_relaxed);
+  total.fetch_add(value, memory_order_relaxed);
+
+  uint64_t seen = lowest.load(memory_order_relaxed);
+  while ((value < seen) &&
+	 !lowest.compare_exchange_weak(seen, value, memory_order_relaxed));
+  seen = highest.load(memory_order_relaxed);
+  while ((value > seen) &&
+	 !highest.compare_exchange_weak(seen, value, memory_order_relaxed));
+}
+
+/**
+ * \brief Drop all samples
+ */
+void latency_histogram::reset()
+{
+  for (unsigned i = 0; i < BUCKETS; i++)
+  {
+    buckets[i].store(0, memory_order_relaxed);
+  }
+  samples.store(0, memory_order_relaxed);
+  total.store(0, memory_order_relaxed);
+  lowest.store(UINT64_MAX, memory_order_relaxed);
+  highest.store(0, memory_order_relaxed);
+}
+
+/**
+ * \brief Fold another histogram's samples into this one
+ */
+void latency_histogram::merge(latency_histogram const &other)
+{
+  for (unsigned i = 0; i < BUCKETS; i++)
+  {
+    uint64_t n = other.buckets[i].load(memory_order_relaxed);
+    if (n)
+    {
+      buckets[i].fetch_add(n, memory_order_relaxed);
+    }
+  }
+  samples.fetch_add(other.samples.load(memory_order_relaxed), memory_order_relaxed);
+  total.fetch_add(other.total.load(memory_order_relaxed), memory_order_relaxed);
+
+  uint64_t value = other.lowest.load(memory_order_relaxed);
+  uint64_t seen = lowest.load(memory_order_relaxed);
+  while ((value < seen) &&
+	 !lowest.compare_exchange_weak(seen, value, memory_order_relaxed));
+  value = other.highest.load(memory_order_relaxed);
+  seen = highest.load(memory_order_relaxed);
+  while ((value > seen) &&
+	 !highest.compare_exchange_weak(seen, value, memory_order_relaxed));
+}
+
+/**
+ * \brief Number of samples
+ */
+uint64_t latency_histogram::count() const
+{
+  return samples.load(memory_order_relaxed);
+}
+
+/**
+ * \brief Sum of samples
+ */
+uint64_t latency_histogram::sum() const
+{
+  return total.load(memory_order_relaxed);
+}
+
+/**
+ * \brief Smallest sample (0 if none)
+ */
+uint64_t latency_histogram::min() const
+{
+  return count() ? lowest.load(memory_order_relaxed) : 0;
+}
+
+/**
+ * \brief Largest sample (0 if none)
+ */
+uint64_t latency_histogram::max() const
+{
+  return highest.load(memory_order_relaxed);
+}
+
+/**
+ * \brief Mean of samples (0 if none)
+ */
+double latency_histogram::mean() const
+{
+  uint64_t n = count();
+  return n ? (double)sum() / n : 0;
+}
+
+/**
+ * \brief Value at or below which pct percent of samples fall
+ */
+uint64_t latency_histogram::percentile(double pct) const
+{
+  uint64_t n = 0, rank, seen = 0;
+  uint64_t counts[BUCKETS];
+
+  // Work from one reading of the buckets, updates may be going on
+  for (unsigned i = 0; i < BUCKETS; i++)
+  {
+    counts[i] = buckets[i].load(memory_order_relaxed);
+    n += counts[i];
+  }
+  if (n == 0)
+  {
+    return 0;
+  }
+
+  rank = (uint64_t)(pct / 100.0 * n + 0.5);
+  rank = (rank ? rank : 1);
+  for (unsigned i = 0; i < BUCKETS; i++)
+  {
+    seen += counts[i];
+    if (seen >= rank)
+    {
+      // Bucket limit, but never beyond what was actually seen
+      uint64_t limit = bucket_limit(i), top = max();
+      return (top && (limit > top)) ? top : limit;
+    }
+  }
+  return max();
+}
+
+/**
+ * \brief Samples in one bucket
+ */
+uint64_t latency_histogram::bucket_count(unsigned index) const
+{
+  return (index < BUCKETS) ? buckets[index].load(memory_order_relaxed) : 0;
+}
+
+/**
+ * \brief Highest value that lands in bucket
+ */
+uint64_t latency_histogram::bucket_limit(unsigned index)
+{
+  // First SUB_COUNT buckets hold one value each
+  if (index < SUB_COUNT)
+  {
+    return index;
+  }
+
+  // Then SUB_COUNT per power of two
+  unsigned group = index >> SUB_BITS, sub = index & (SUB_COUNT - 1);
+  uint64_t width = 1ull << (group - 1);
+  return ((uint64_t)(SUB_COUNT + sub) << (group - 1)) + width - 1;
+}
+
+/**
+ * \brief Bucket for value
+ */
+unsigned latency_histogram::bucket_of(uint64_t value)
+{
+  if (value >= (1ull << MAX_BITS))
+  {
+    value = (1ull << MAX_BITS) - 1;
+  }
+  if (value < SUB_COUNT)
+  {
+    return value;
+  }
+
+  // Top SUB_BITS + 1 bits select the bucket within its power of two
+  unsigned msb = 63 - __builtin_clzll(value);
+  unsigned shift = msb - SUB_BITS;
+  return ((shift + 1) << SUB_BITS) + (unsigned)((value >> shift) - SUB_COUNT);
+}
+
+/**
+ * \brief Reset every histogram in a method table
+ */
+void topaz::reset_latency(method_latency_table &table)
+{
+  vector<uint64_t> keys = table.list();
+  for (size_t i = 0; i < keys.size(); i++)
+  {
+    method_latency *rec = table.get(keys[i]);
+    rec->total.reset();
+    rec->encode.reset();
+    rec->transfer.reset();
+    rec->think.reset();
+    rec->decode.reset();
+  }
+}
+
+/**
+ * \brief Reset every histogram in a command table
+ */
+void topaz::reset_latency(command_latency_table &table)
+{
+  vector<uint64_t> keys = table.list();
+  for (size_t i = 0; i < keys.size(); i++)
+  {
+    table.get(keys[i])->reset();
+  }
+}
@@ -0,0 +1,268 @@
+#ifndef TOPAZ_LATENCY_H
+#define TOPAZ_LATENCY_H
+
+/**
+ * Topaz - Latency Histograms
+ *
+ * This file implements always-on latency histograms for the transport and
+ * drive layers. Buckets are log-linear (HDR style, 16 per power of two, so
+ * within ~6% of the true value), cover 1 ns to ~68 s, and are updated with
+ * relaxed atomics only, so recording never blocks and histograms can be
+ * read from another thread while in use.
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+namespace topaz
+{
+
+  class latency_histogram
+  {
+
+  public:
+
+    // 16 linear buckets per power of two, values clamped to 2^36 - 1 ns
+    static const unsigned SUB_BITS = 4;
+    static const unsigned MAX_BITS = 36;
+    static const unsigned BUCKETS  = (MAX_BITS - SUB_BITS + 1) << SUB_BITS;
+
+    /**
+     * \brief Constructor (empty)
+     */
+    latency_histogram();
+
+    /**
+     * \brief Copy Constructor (snapshot of a live histogram)
+     */
+    latency_histogram(latency_histogram const &other);
+
+    /**
+     * \brief Add one sample
+     *
+     * @param value Sample (nanoseconds, or a count)
+     */
+    void record(uint64_t value);
+
+    /**
+     * \brief Drop all samples
+     */
+    void reset();
+
+    /**
+     * \brief Fold another histogram's samples into this one
+     */
+    void merge(latency_histogram const &other);
+
+    /**
+     * \brief Number of samples
+     */
+    uint64_t count() const;
+
+    /**
+     * \brief Sum of samples
+     */
+    uint64_t sum() const;
+
+    /**
+     * \brief Smallest / largest sample (0 if none)
+     */
+    uint64_t min() const;
+    uint64_t max() const;
+
+    /**
+     * \brief Mean of samples (0 if none)
+     */
+    double mean() const;
+
+    /**
+     * \brief Value at or below which pct percent of samples fall
+     *
+     * @param pct Percentile (0 - 100)
+     * @return Highest value of the bucket holding that sample (0 if none)
+     */
+    uint64_t percentile(double pct) const;
+
+    /**
+     * \brief Samples in one bucket
+     */
+    uint64_t bucket_count(unsigned index) const;
+
+    /**
+     * \brief Highest value that lands in bucket
+     */
+    static uint64_t bucket_limit(unsigned index);
+
+    /**
+     * \brief Bucket for value
+     */
+    static unsigned bucket_of(uint64_t value);
+
+  protected:
+
+    /* internal data */
+    std::atomic<uint64_t> buckets[BUCKETS];
+    std::atomic<uint64_t> samples;
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> lowest;
+    std::atomic<uint64_t> highest;
+
+  };
+
+  // Method call latency, by phase
+  struct method_latency
+  {
+    latency_histogram total;     // Whole call, as seen by caller
+    latency_histogram encode;    // Building call / ComPkt (and other host time)
+    latency_histogram transfer;  // IF-SEND, and IF-RECVs that carried data
+    latency_histogram think;     // Drive busy: "no data yet" polls and waits
+    latency_histogram decode;    // Decoding response and status
+  };
+
+  /**
+   * \brief Fixed size table of latency records, by non-zero key
+   *
+   * Entries are added on first use without locks (a key claims a slot, its
+   * record follows), so lookups from other threads never block.
+   */
+  template <typename T, unsigned N>
+  class latency_table
+  {
+
+  public:
+
+    latency_table()
+    {
+      for (unsigned i = 0; i < N; i++)
+      {
+	keys[i].store(0, std::memory_order_relaxed);
+	vals[i].store(nullptr, std::memory_order_relaxed);
+      }
+    }
+
+    ~latency_table()
+    {
+      for (unsigned i = 0; i < N; i++)
+      {
+	delete vals[i].load(std::memory_order_relaxed);
+      }
+    }
+
+    latency_table(latency_table const &) = delete;
+    latency_table &operator=(latency_table const &) = delete;
+
+    /**
+     * \brief Record for key, added if new
+     *
+     * @param key Non-zero key (eg - method UID)
+     * @return Record, or NULL if table is full
+     */
+    T *get(uint64_t key)
+    {
+      for (unsigned n = 0, i = key % N; n < N; n++, i = (i + 1) % N)
+      {
+	uint64_t found = keys[i].load(std::memory_order_acquire);
+	if (found == 0)
+	{
+	  if (keys[i].compare_exchange_strong(found, key, std::memory_order_acq_rel))
+	  {
+	    vals[i].store(new T(), std::memory_order_release);
+	  }
+	}
+	if (found == 0 || found == key)
+	{
+	  // Slot is ours (or key's), record may still be on its way
+	  T *val;
+	  while ((val = vals[i].load(std::memory_order_acquire)) == nullptr);
+	  return val;
+	}
+      }
+      return nullptr;
+    }
+
+    /**
+     * \brief Record for key, if present
+     */
+    T const *find(uint64_t key) const
+    {
+      for (unsigned n = 0, i = key % N; n < N; n++, i = (i + 1) % N)
+      {
+	uint64_t found = keys[i].load(std::memory_order_acquire);
+	if (found == key)
+	{
+	  return vals[i].load(std::memory_order_acquire);
+	}
+	if (found == 0)
+	{
+	  break;
+	}
+      }
+      return nullptr;
+    }
+
+    /**
+     * \brief Keys with records
+     */
+    std::vector<uint64_t> list() const
+    {
+      std::vector<uint64_t> out;
+      for (unsigned i = 0; i < N; i++)
+      {
+	if (vals[i].load(std::memory_order_acquire))
+	{
+	  out.push_back(keys[i].load(std::memory_order_relaxed));
+	}
+      }
+      return out;
+    }
+
+  protected:
+
+    /* internal data */
+    std::atomic<uint64_t> keys[N];
+    std::atomic<T*>       vals[N];
+
+  };
+
+  // Per method UID, per ATA command opcode
+  typedef latency_table<method_latency, 32>   method_latency_table;
+  typedef latency_table<latency_histogram, 8> command_latency_table;
+
+  /**
+   * \brief Reset every histogram in a method table
+   */
+  void reset_latency(method_latency_table &table);
+
+  /**
+   * \brief Reset every histogram in a command table
+   */
+  void reset_latency(command_latency_table &table);
+
+};
+
+#endif
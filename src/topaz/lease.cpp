@@ -0,0 +1,239 @@
+/**
+ * Topaz - Device Lease
+ *
+ * This file implements the advisory device lease taken while a drive is
+ * open (see lease.h).
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <topaz/debug.h>
+#include <topaz/exceptions.h>
+#include <topaz/lease.h>
+using namespace std;
+using namespace topaz;
+
+// How often a waiting process retries the lease (ms)
+#define LEASE_RETRY_MS 50
+
+// How long to wait for a lease unless told otherwise (ms)
+#define LEASE_WAIT_MS 30000
+
+/**
+ * \brief Lease Settings Constructor (from environment)
+ */
+lease_policy::lease_policy()
+  : mode(LEASE_WAIT), wait_ms(LEASE_WAIT_MS)
+{
+  char const *mode_str = getenv("TOPAZ_LEASE");
+  char const *wait_str = getenv("TOPAZ_LEASE_WAIT_MS");
+
+  if (mode_str && !strcmp(mode_str, "share"))
+  {
+    mode = LEASE_SHARE;
+  }
+  else if (mode_str && !strcmp(mode_str, "takeover"))
+  {
+    mode = LEASE_TAKEOVER;
+  }
+  if (wait_str && *wait_str)
+  {
+    wait_ms = strtoul(wait_str, NULL, 10);
+  }
+}
+
+/**
+ * \brief Device Lease Constructor
+ */
+device_lease::device_lease(string const &device_id, lease_policy const &policy)
+  : fd(-1), lease(NONE), reset_ok(true), holder(0)
+{
+  // Nothing to coordinate with (eg - in process simulator)
+  if (device_id.empty())
+  {
+    return;
+  }
+
+  // One file per device, named so every path to the device finds it
+  char const *dir = getenv("TOPAZ_LEASE_DIR");
+  string path = ((dir && *dir) ? dir : "/run/lock/topaz");
+  mkdir(path.c_str(), 0755);
+  path += '/';
+  for (size_t i = 0; i < device_id.size(); i++)
+  {
+    char c = device_id[i];
+    path += ((isalnum((unsigned char)c) || c == '-' || c == '.') ? c : '_');
+  }
+  path += ".lock";
+
+  // Advisory only, carry on as before if nowhere to keep leases
+  fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd == -1)
+  {
+    TOPAZ_DEBUG(1) printf("No device lease (%s: %s)\n", path.c_str(), strerror(errno));
+    return;
+  }
+
+  // Sharers never reset the ComID, so they can all hold the lease at once
+  // (or go alongside an exclusive holder, which then keeps its session)
+  if (policy.mode == LEASE_SHARE)
+  {
+    reset_ok = false;
+    if (flock(fd, LOCK_SH | LOCK_NB) == 0)
+    {
+      lease = SHARED;
+    }
+    else
+    {
+      holder = read_holder();
+      TOPAZ_DEBUG(1) printf("Sharing device with PID %d\n", (int)holder);
+    }
+    return;
+  }
+
+  // Free?
+  if (flock(fd, LOCK_EX | LOCK_NB) == 0)
+  {
+    lease = EXCLUSIVE;
+    write_holder();
+    return;
+  }
+  holder = read_holder();
+
+  // Taking it over, holder's session ends with our ComID reset
+  if (policy.mode == LEASE_TAKEOVER)
+  {
+    TOPAZ_DEBUG(1) printf("Taking device over from PID %d\n", (int)holder);
+    return;
+  }
+
+  // Wait for holder to finish
+  TOPAZ_DEBUG(1) printf("Device leased by PID %d, waiting ...\n", (int)holder);
+  chrono::steady_clock::time_point deadline =
+    chrono::steady_clock::now() + chrono::milliseconds(policy.wait_ms);
+  while (chrono::steady_clock::now() < deadline)
+  {
+    this_thread::sleep_for(chrono::milliseconds(LEASE_RETRY_MS));
+    if (flock(fd, LOCK_EX | LOCK_NB) == 0)
+    {
+      lease = EXCLUSIVE;
+      write_holder();
+      return;
+    }
+  }
+
+  // Constructor not done, destructor won't be called ...
+  close(fd);
+  char msg[128];
+  if (holder)
+  {
+    snprintf(msg, sizeof(msg), "Device in use by PID %d (lease not released)", (int)holder);
+  }
+  else
+  {
+    snprintf(msg, sizeof(msg), "Device in use by another process (lease not released)");
+  }
+  throw topaz_exception(msg);
+}
+
+/**
+ * \brief Device Lease Destructor
+ */
+device_lease::~device_lease()
+{
+  if (fd == -1)
+  {
+    return;
+  }
+
+  // Don't leave our PID behind for the next one to blame
+  if ((lease == EXCLUSIVE) && (ftruncate(fd, 0) == -1))
+  {
+    TOPAZ_DEBUG(1) printf("Cannot clear device lease holder\n");
+  }
+  close(fd);
+}
+
+/**
+ * \brief Lease obtained
+ */
+device_lease::state device_lease::held() const
+{
+  return lease;
+}
+
+/**
+ * \brief May the ComID be reset?
+ */
+bool device_lease::may_reset() const
+{
+  return reset_ok;
+}
+
+/**
+ * \brief Process holding lease when we arrived
+ */
+pid_t device_lease::previous_holder() const
+{
+  return holder;
+}
+
+/**
+ * \brief PID recorded in lease file
+ */
+pid_t device_lease::read_holder() const
+{
+  char buf[32];
+  ssize_t len = pread(fd, buf, sizeof(buf) - 1, 0);
+  if (len <= 0)
+  {
+    return 0;
+  }
+  buf[len] = 0;
+  return atoi(buf);
+}
+
+/**
+ * \brief Record our PID in lease file
+ */
+void device_lease::write_holder()
+{
+  char buf[32];
+  int len = snprintf(buf, sizeof(buf), "%d\n", (int)getpid());
+  if ((ftruncate(fd, 0) == -1) || (pwrite(fd, buf, len, 0) != len))
+  {
+    TOPAZ_DEBUG(1) printf("Cannot record device lease holder\n");
+  }
+}
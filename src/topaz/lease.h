@@ -0,0 +1,131 @@
+#ifndef TOPAZ_LEASE_H
+#define TOPAZ_LEASE_H
+
+/**
+ * Topaz - Device Lease
+ *
+ * This file implements an advisory lease on a device, shared by every
+ * process using this library. Opening a drive resets its ComID, which
+ * ends any session another process has open on it; holding the lease
+ * while a drive is open lets the next process notice, and wait for it,
+ * share the drive without a reset, or take it over on purpose.
+ *
+ * Leases are flock()s on a file per device (named after its serial, so
+ * every path to the device agrees) in $TOPAZ_LEASE_DIR, default
+ * /run/lock/topaz. The holder's PID is kept in the file for messages.
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string>
+#include <sys/types.h>
+
+namespace topaz
+{
+
+  // What to do about a device already leased by someone else
+  enum lease_mode
+  {
+    LEASE_WAIT,      // Wait for it to be released (up to wait_ms), then reset ComID
+    LEASE_SHARE,     // Use it alongside, never resetting the ComID
+    LEASE_TAKEOVER   // Reset ComID anyway, ending the other holder's session
+  };
+
+  // Lease settings, by default from $TOPAZ_LEASE ("wait", "share" or
+  // "takeover") and $TOPAZ_LEASE_WAIT_MS, else wait up to 30 seconds
+  struct lease_policy
+  {
+    lease_mode mode;
+    unsigned   wait_ms;
+
+    lease_policy();
+  };
+
+  class device_lease
+  {
+
+  public:
+
+    // Lease obtained
+    enum state
+    {
+      NONE,       // Not held (no lease directory, or holder not waited for)
+      SHARED,     // Held with other sharers
+      EXCLUSIVE   // Held alone
+    };
+
+    /**
+     * \brief Device Lease Constructor (acquires lease per policy)
+     *
+     * @param device_id Device identity (see transport::device_id())
+     * @param policy    What to do if already leased
+     */
+    device_lease(std::string const &device_id, lease_policy const &policy);
+
+    /**
+     * \brief Device Lease Destructor (releases lease)
+     */
+    ~device_lease();
+
+    device_lease(device_lease const &) = delete;
+    device_lease &operator=(device_lease const &) = delete;
+
+    /**
+     * \brief Lease obtained
+     */
+    state held() const;
+
+    /**
+     * \brief May the ComID be reset (no other holder, or taken over)?
+     */
+    bool may_reset() const;
+
+    /**
+     * \brief Process holding lease when we arrived (0 - none seen)
+     */
+    pid_t previous_holder() const;
+
+  protected:
+
+    /**
+     * \brief PID recorded in lease file (0 - none)
+     */
+    pid_t read_holder() const;
+
+    /**
+     * \brief Record our PID in lease file
+     */
+    void write_holder();
+
+    /* internal data */
+    int fd;
+    state lease;
+    bool reset_ok;
+    pid_t holder;
+
+  };
+
+};
+
+#endif
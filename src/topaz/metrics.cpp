@@ -0,0 +1,497 @@
+/**
+ * Topaz - Metrics Exporter
+ *
+ * This file implements Prometheus text rendering of drive metrics, and a
+ * minimal HTTP server for scrapes.
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <arpa/inet.h>
+#include <cinttypes>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <topaz/debug.h>
+#include <topaz/drive.h>
+#include <topaz/exceptions.h>
+#include <topaz/metrics.h>
+#include <topaz/uid.h>
+using namespace std;
+using namespace topaz;
+
+namespace
+{
+
+  // How often run() looks for a stop request (ms)
+  const int ACCEPT_POLL_MS = 200;
+
+  // How long a client gets to send its request (ms)
+  const int REQUEST_TIMEOUT_MS = 1000;
+
+  // Invoke latency histogram buckets (seconds)
+  const double INVOKE_BOUNDS[] = {
+    0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025,
+    0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+  };
+
+  // One drive, as read at start of render
+  struct drive_sample
+  {
+    string        device;
+    drive const  *target;
+    drive_health  health;
+    io_counters   traffic;
+    status_counts outcomes;
+  };
+
+  char const *status_name(unsigned status)
+  {
+    switch (status)
+    {
+      case datum::STA_SUCCESS:               return "success";
+      case datum::STA_NOT_AUTHORIZED:        return "not_authorized";
+      case datum::STA_SP_BUSY:               return "sp_busy";
+      case datum::STA_SP_FAILED:             return "sp_failed";
+      case datum::STA_SP_DISABLED:           return "sp_disabled";
+      case datum::STA_SP_FROZEN:             return "sp_frozen";
+      case datum::STA_NO_SESSIONS_AVAILABLE: return "no_sessions_available";
+      case datum::STA_UNIQUENESS_CONFLICT:   return "uniqueness_conflict";
+      case datum::STA_INSUFFICIENT_SPACE:    return "insufficient_space";
+      case datum::STA_INSUFFICIENT_ROWS:     return "insufficient_rows";
+      case datum::STA_INVALID_PARAMETER:     return "invalid_parameter";
+      case datum::STA_TPER_MALFUNCTION:      return "tper_malfunction";
+      case datum::STA_TRANSACTION_FAILURE:   return "transaction_failure";
+      case datum::STA_RESPONSE_OVERFLOW:     return "response_overflow";
+      case datum::STA_AUTHORITY_LOCKED_OUT:  return "authority_locked_out";
+      case 0x3f:                             return "fail";
+      default:                               return NULL;
+    }
+  }
+
+  // Label value, with backslash, quote and newline escaped
+  string escape(string const &val)
+  {
+    string out;
+    for (size_t i = 0; i < val.size(); i++)
+    {
+      switch (val[i])
+      {
+	case '\\': out += "\\\\"; break;
+	case '"':  out += "\\\"";  break;
+	case '\n': out += "\\n";   break;
+	default:   out += val[i];  break;
+      }
+    }
+    return out;
+  }
+
+  void append(string &out, char const *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+  void append(string &out, char const *fmt, ...)
+  {
+    char line[512];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    out += line;
+  }
+
+  void header(string &out, char const *name, char const *type, char const *help)
+  {
+    append(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+  }
+
+  // One sample per drive
+  template <typename F>
+  void family(string &out, vector<drive_sample> const &samples, char const *name,
+	      char const *type, char const *help, F const &value)
+  {
+    header(out, name, type, help);
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+      append(out, "%s{device=\"%s\"} %" PRIu64 "\n", name,
+	     escape(samples[i].device).c_str(), (uint64_t)value(samples[i]));
+    }
+  }
+
+  // Level 0 Locking flag, for drives reporting the feature
+  void lock_family(string &out, vector<drive_sample> const &samples, char const *name,
+		   char const *help, uint8_t flag)
+  {
+    header(out, name, "gauge", help);
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+      if (samples[i].health.has_locking)
+      {
+	append(out, "%s{device=\"%s\"} %d\n", name, escape(samples[i].device).c_str(),
+	       (samples[i].health.locking & flag) ? 1 : 0);
+      }
+    }
+  }
+
+  // Latency histogram in Prometheus buckets (cumulative, seconds)
+  void histogram(string &out, char const *name, string const &labels,
+		 latency_histogram const &hist)
+  {
+    uint64_t seen = 0;
+    unsigned bucket = 0;
+    for (size_t i = 0; i < sizeof(INVOKE_BOUNDS) / sizeof(INVOKE_BOUNDS[0]); i++)
+    {
+      // Whole log-linear buckets at or under bound
+      uint64_t bound_ns = (uint64_t)(INVOKE_BOUNDS[i] * 1e9);
+      while ((bucket < latency_histogram::BUCKETS) &&
+	     (latency_histogram::bucket_limit(bucket) <= bound_ns))
+      {
+	seen += hist.bucket_count(bucket++);
+      }
+      append(out, "%s_bucket{%s,le=\"%g\"} %" PRIu64 "\n", name, labels.c_str(),
+	     INVOKE_BOUNDS[i], seen);
+    }
+    while (bucket < latency_histogram::BUCKETS)
+    {
+      seen += hist.bucket_count(bucket++);
+    }
+    append(out, "%s_bucket{%s,le=\"+Inf\"} %" PRIu64 "\n", name, labels.c_str(), seen);
+    append(out, "%s_sum{%s} %.9f\n", name, labels.c_str(), hist.sum() / 1e9);
+    append(out, "%s_count{%s} %" PRIu64 "\n", name, labels.c_str(), seen);
+  }
+
+  // Write all of buffer, false on hang up or error
+  bool write_all(int fd, char const *data, size_t len)
+  {
+    while (len)
+    {
+      ssize_t put = send(fd, data, len, MSG_NOSIGNAL);
+      if (put <= 0)
+      {
+	return false;
+      }
+      data += put;
+      len -= put;
+    }
+    return true;
+  }
+
+};
+
+/**
+ * \brief Publish drive's metrics
+ */
+void metrics_exporter::add(string const &device, drive const &target)
+{
+  lock_guard<mutex> guard(lock);
+  drives.push_back(make_pair(device, &target));
+}
+
+/**
+ * \brief Stop publishing drive's metrics
+ */
+void metrics_exporter::remove(string const &device)
+{
+  lock_guard<mutex> guard(lock);
+  for (size_t i = 0; i < drives.size(); i++)
+  {
+    if (drives[i].first == device)
+    {
+      drives.erase(drives.begin() + i);
+      return;
+    }
+  }
+}
+
+/**
+ * \brief Current metrics, Prometheus text exposition format
+ */
+string metrics_exporter::render() const
+{
+  vector<drive_sample> samples;
+  string out;
+
+  // Drives stay registered (and alive) until we're done
+  lock_guard<mutex> guard(lock);
+  for (size_t i = 0; i < drives.size(); i++)
+  {
+    drive_sample sample;
+    sample.device   = drives[i].first;
+    sample.target   = drives[i].second;
+    sample.health   = sample.target->health();
+    sample.traffic  = sample.target->counters();
+    sample.outcomes = sample.target->outcomes();
+    samples.push_back(sample);
+  }
+
+  // Discovery
+  lock_family(out, samples, "topaz_locking_supported",
+	      "Level 0 Locking feature: locking supported", LOCK_SUPPORTED);
+  lock_family(out, samples, "topaz_locking_enabled",
+	      "Level 0 Locking feature: locking enabled", LOCK_ENABLED);
+  lock_family(out, samples, "topaz_locked",
+	      "Level 0 Locking feature: some range locked", LOCK_LOCKED);
+  lock_family(out, samples, "topaz_mbr_enabled",
+	      "Level 0 Locking feature: shadow MBR enabled", LOCK_MBR_ENABLED);
+  lock_family(out, samples, "topaz_mbr_done",
+	      "Level 0 Locking feature: shadow MBR done", LOCK_MBR_DONE);
+  family(out, samples, "topaz_max_com_packet_size_bytes", "gauge",
+	 "Negotiated MaxComPacketSize",
+	 [](drive_sample const &s) { return s.health.max_com_pkt_size; });
+  family(out, samples, "topaz_max_methods", "gauge",
+	 "Method calls per ComPkt",
+	 [](drive_sample const &s) { return s.health.max_methods; });
+
+  // Sessions
+  family(out, samples, "topaz_session_open", "gauge",
+	 "Session in progress",
+	 [](drive_sample const &s) { return s.health.session_open ? 1 : 0; });
+  family(out, samples, "topaz_sessions_started_total", "counter",
+	 "Sessions started",
+	 [](drive_sample const &s) { return s.traffic.sessions; });
+
+  // Traffic
+  family(out, samples, "topaz_if_send_total", "counter",
+	 "IF-SEND commands",
+	 [](drive_sample const &s) { return s.traffic.if_sends; });
+  family(out, samples, "topaz_if_recv_total", "counter",
+	 "IF-RECV commands, polls included",
+	 [](drive_sample const &s) { return s.traffic.if_recvs; });
+  family(out, samples, "topaz_poll_retries_total", "counter",
+	 "IF-RECVs retried after \"no data yet\"",
+	 [](drive_sample const &s) { return s.traffic.polls; });
+  family(out, samples, "topaz_sent_bytes_total", "counter",
+	 "IF-SEND bytes",
+	 [](drive_sample const &s) { return s.traffic.bytes_sent; });
+  family(out, samples, "topaz_received_bytes_total", "counter",
+	 "IF-RECV bytes",
+	 [](drive_sample const &s) { return s.traffic.bytes_recv; });
+  family(out, samples, "topaz_method_calls_total", "counter",
+	 "Method calls sent",
+	 [](drive_sample const &s) { return s.traffic.methods; });
+
+  // Outcomes
+  family(out, samples, "topaz_timeouts_total", "counter",
+	 "Responses not in by deadline",
+	 [](drive_sample const &s) { return s.outcomes.timeouts; });
+  header(out, "topaz_method_status_total", "counter", "Method calls answered, by status");
+  for (size_t i = 0; i < samples.size(); i++)
+  {
+    for (unsigned code = 0; code < status_counts::CODES; code++)
+    {
+      uint64_t count = samples[i].outcomes.status[code];
+      if (count || (code == datum::STA_SUCCESS))
+      {
+	char hex[8];
+	char const *name = status_name(code);
+	snprintf(hex, sizeof(hex), "0x%02x", code);
+	append(out, "topaz_method_status_total{device=\"%s\",status=\"%s\"} %" PRIu64 "\n",
+	       escape(samples[i].device).c_str(), name ? name : hex, count);
+      }
+    }
+  }
+
+  // Latency, by method
+  header(out, "topaz_invoke_duration_seconds", "histogram",
+	 "Method call latency (batched calls once per ComPkt)");
+  for (size_t i = 0; i < samples.size(); i++)
+  {
+    method_latency_table const &table = samples[i].target->method_latency();
+    vector<uint64_t> methods = table.list();
+    for (size_t j = 0; j < methods.size(); j++)
+    {
+      method_latency const *rec = table.find(methods[j]);
+      if (rec == NULL)
+      {
+	continue;
+      }
+      char hex[24];
+      char const *name = method_name(methods[j]);
+      snprintf(hex, sizeof(hex), "0x%" PRIx64, methods[j]);
+      string labels = ("device=\"" + escape(samples[i].device) + "\",method=\"" +
+		       (name ? name : hex) + "\"");
+      histogram(out, "topaz_invoke_duration_seconds", labels, rec->total);
+    }
+  }
+
+  return out;
+}
+
+/**
+ * \brief Write metrics to file (replaced atomically)
+ */
+void metrics_exporter::write_textfile(string const &path) const
+{
+  string text = render();
+  string tmp = path + ".tmp";
+
+  // Collector must never see half a file
+  FILE *out = fopen(tmp.c_str(), "w");
+  if (out == NULL)
+  {
+    throw topaz_exception("Cannot create metrics file");
+  }
+  size_t put = fwrite(text.data(), 1, text.size(), out);
+  if ((fclose(out) != 0) || (put != text.size()) ||
+      (rename(tmp.c_str(), path.c_str()) != 0))
+  {
+    unlink(tmp.c_str());
+    throw topaz_exception("Cannot write metrics file");
+  }
+}
+
+/**
+ * \brief Metrics HTTP Server Constructor
+ */
+metrics_server::metrics_server(metrics_exporter const &metrics, uint16_t port,
+			       char const *addr)
+  : metrics(metrics), stopping(false)
+{
+  sockaddr_in sin;
+  socklen_t len = sizeof(sin);
+  int on = 1;
+
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_port = htons(port);
+  if (inet_pton(AF_INET, addr, &sin.sin_addr) != 1)
+  {
+    throw topaz_exception("Invalid metrics listen address");
+  }
+
+  listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_fd == -1)
+  {
+    throw topaz_exception("Cannot create metrics socket");
+  }
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  if ((bind(listen_fd, (sockaddr*)&sin, sizeof(sin)) == -1) ||
+      (listen(listen_fd, 16) == -1) ||
+      (getsockname(listen_fd, (sockaddr*)&sin, &len) == -1))
+  {
+    // Constructor not done, destructor won't be called ...
+    close(listen_fd);
+    throw topaz_exception("Cannot listen on metrics socket");
+  }
+  bound_port = ntohs(sin.sin_port);
+  TOPAZ_DEBUG(1) printf("Serving metrics on %s:%u\n", addr, bound_port);
+}
+
+/**
+ * \brief Metrics HTTP Server Destructor
+ */
+metrics_server::~metrics_server()
+{
+  close(listen_fd);
+}
+
+/**
+ * \brief Serve scrapes until stopped
+ */
+void metrics_server::run()
+{
+  while (!stopping)
+  {
+    pollfd pfd = {listen_fd, POLLIN, 0};
+    if (poll(&pfd, 1, ACCEPT_POLL_MS) <= 0)
+    {
+      continue;
+    }
+    int client = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (client == -1)
+    {
+      continue;
+    }
+
+    // Scrapes are rare and quick, one at a time
+    serve(client);
+    close(client);
+  }
+  stopping = false;
+}
+
+/**
+ * \brief Ask run() to return
+ */
+void metrics_server::stop()
+{
+  stopping = true;
+}
+
+/**
+ * \brief Port listening on
+ */
+uint16_t metrics_server::port() const
+{
+  return bound_port;
+}
+
+/**
+ * \brief Answer one request, then hang up
+ */
+void metrics_server::serve(int client)
+{
+  char buf[4096];
+  size_t len = 0;
+
+  // Request line and headers, body (if any) ignored
+  while (len < sizeof(buf) - 1)
+  {
+    pollfd pfd = {client, POLLIN, 0};
+    if (poll(&pfd, 1, REQUEST_TIMEOUT_MS) <= 0)
+    {
+      return;
+    }
+    ssize_t got = recv(client, buf + len, sizeof(buf) - 1 - len, 0);
+    if (got <= 0)
+    {
+      return;
+    }
+    len += got;
+    buf[len] = 0;
+    if (strstr(buf, "\r\n\r\n") || strstr(buf, "\n\n"))
+    {
+      break;
+    }
+  }
+
+  string status = "404 Not Found", type = "text/plain", body = "Not found\n";
+  if (!strncmp(buf, "GET /metrics ", 13) || !strncmp(buf, "GET /metrics?", 13))
+  {
+    status = "200 OK";
+    type = "text/plain; version=0.0.4; charset=utf-8";
+    body = metrics.render();
+  }
+
+  char head[256];
+  snprintf(head, sizeof(head), "HTTP/1.0 %s\r\nContent-Type: %s\r\n"
+	   "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+	   status.c_str(), type.c_str(), body.size());
+  if (write_all(client, head, strlen(head)))
+  {
+    write_all(client, body.data(), body.size());
+  }
+}
@@ -0,0 +1,146 @@
+#ifndef TOPAZ_METRICS_H
+#define TOPAZ_METRICS_H
+
+/**
+ * Topaz - Metrics Exporter
+ *
+ * This file implements a Prometheus text format exporter for drives held
+ * open by a long running process. Everything published comes from state
+ * the library already keeps (discovery results, traffic and outcome
+ * counters, latency histograms), so a scrape never sends a command to a
+ * drive. Metrics are served over HTTP on localhost, or written to a file
+ * for a node exporter textfile collector.
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace topaz
+{
+
+  class drive;
+
+  class metrics_exporter
+  {
+
+  public:
+
+    /**
+     * \brief Publish drive's metrics
+     *
+     * @param device Value of the "device" label (eg - '/dev/sda')
+     * @param target Drive to publish (must stay registered only while alive)
+     */
+    void add(std::string const &device, drive const &target);
+
+    /**
+     * \brief Stop publishing drive's metrics
+     *
+     * @param device Label given to add()
+     */
+    void remove(std::string const &device);
+
+    /**
+     * \brief Current metrics, Prometheus text exposition format
+     */
+    std::string render() const;
+
+    /**
+     * \brief Write metrics to file (replaced atomically, for textfile collectors)
+     *
+     * @param path Output file (eg - '.../textfile/topaz.prom')
+     */
+    void write_textfile(std::string const &path) const;
+
+  protected:
+
+    /* internal data */
+    mutable std::mutex lock;
+    std::vector<std::pair<std::string, drive const*> > drives;
+
+  };
+
+  class metrics_server
+  {
+
+  public:
+
+    /**
+     * \brief Metrics HTTP Server Constructor
+     *
+     * Socket is bound and listening once constructed. GET /metrics is
+     * answered, anything else gets a 404.
+     *
+     * @param metrics Exporter to render (must outlive server)
+     * @param port    TCP port (0 - any free port, see port())
+     * @param addr    IPv4 address to bind (default loopback only)
+     */
+    metrics_server(metrics_exporter const &metrics, uint16_t port,
+		   char const *addr = "127.0.0.1");
+
+    /**
+     * \brief Metrics HTTP Server Destructor
+     */
+    ~metrics_server();
+
+    /**
+     * \brief Serve scrapes until stopped
+     */
+    void run();
+
+    /**
+     * \brief Ask run() to return (safe from signal handlers and other threads)
+     */
+    void stop();
+
+    /**
+     * \brief Port listening on
+     */
+    uint16_t port() const;
+
+  protected:
+
+    /**
+     * \brief Answer one request, then hang up
+     *
+     * @param client Connected socket
+     */
+    void serve(int client);
+
+    /* internal data */
+    metrics_exporter const &metrics;
+    int listen_fd;
+    uint16_t bound_port;
+    std::atomic<bool> stopping;
+
+  };
+
+};
+
+#endif
@@ -0,0 +1,786 @@
+/**
+ * Topaz - Management Server
+ *
+ * This file implements the management server and client. A request runs
+ * with its drive's lock held, so commands from different clients never
+ * interleave on one ComID, and a session left open by one request is
+ * picked up by the next only when it asks for the same authority and PIN.
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <topaz/debug.h>
+#include <topaz/exceptions.h>
+#include <topaz/mgmt.h>
+#include <topaz/uid.h>
+using namespace std;
+using namespace topaz;
+
+namespace
+{
+
+  // How often run() looks for a stop request and idle sessions (ms)
+  const int ACCEPT_POLL_MS = 200;
+
+  // Longest request line accepted
+  const size_t MAX_REQUEST = 4096;
+
+  // Write exactly len bytes, false on hang up or error
+  bool write_all(int fd, void const *data, size_t len)
+  {
+    char const *ptr = (char const*)data;
+    while (len)
+    {
+      ssize_t put = send(fd, ptr, len, MSG_NOSIGNAL);
+      if (put < 0 && errno == EINTR)
+      {
+	continue;
+      }
+      if (put <= 0)
+      {
+	return false;
+      }
+      ptr += put;
+      len -= put;
+    }
+    return true;
+  }
+
+  // Read up to and excluding newline, false on hang up, error or overlong line
+  bool read_line(int fd, string &pending, string &line)
+  {
+    char buf[512];
+    size_t end;
+    while ((end = pending.find('\n')) == string::npos)
+    {
+      if (pending.size() > MAX_REQUEST)
+      {
+	return false;
+      }
+      ssize_t got = read(fd, buf, sizeof(buf));
+      if (got < 0 && errno == EINTR)
+      {
+	continue;
+      }
+      if (got <= 0)
+      {
+	return false;
+      }
+      pending.append(buf, got);
+    }
+    line = pending.substr(0, end);
+    pending.erase(0, end + 1);
+    return true;
+  }
+
+  // Fill in socket address, checking it fits
+  void make_addr(sockaddr_un &addr, char const *path)
+  {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+      throw topaz_exception("Management socket path too long");
+    }
+    strcpy(addr.sun_path, path);
+  }
+
+  int hex_digit(char c)
+  {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+  }
+
+  // Split request into words, undoing %XX escapes
+  vector<string> split_words(string const &line)
+  {
+    vector<string> words;
+    size_t pos = 0;
+    while (pos < line.size())
+    {
+      if (line[pos] == ' ' || line[pos] == '\t' || line[pos] == '\r')
+      {
+	pos++;
+	continue;
+      }
+      string word;
+      while (pos < line.size() && line[pos] != ' ' && line[pos] != '\t' &&
+	     line[pos] != '\r')
+      {
+	if (line[pos] == '%')
+	{
+	  int hi = (pos + 2 < line.size() ? hex_digit(line[pos + 1]) : -1);
+	  int lo = (hi >= 0 ? hex_digit(line[pos + 2]) : -1);
+	  if (lo < 0)
+	  {
+	    throw topaz_exception("Bad escape in request");
+	  }
+	  word += (char)((hi << 4) | lo);
+	  pos += 3;
+	}
+	else
+	{
+	  word += line[pos++];
+	}
+      }
+      words.push_back(word);
+    }
+    return words;
+  }
+
+  uint64_t parse_uint(string const &word, char const *what)
+  {
+    char *end = NULL;
+    errno = 0;
+    uint64_t val = strtoull(word.c_str(), &end, 0);
+    if (word.empty() || *end || errno || word[0] == '-')
+    {
+      throw topaz_exception(string("Bad ") + what + " '" + word + "'");
+    }
+    return val;
+  }
+
+  // Authority name to SP and authority UID (admin<N>, user<N>, sid)
+  void parse_auth(string const &name, uint64_t &sp_uid, uint64_t &auth_uid)
+  {
+    unsigned num = 0;
+    char tail;
+    if (name == "sid")
+    {
+      sp_uid = ADMIN_SP;
+      auth_uid = SID;
+    }
+    else if (sscanf(name.c_str(), "admin%u%c", &num, &tail) == 1)
+    {
+      sp_uid = LOCKING_SP;
+      auth_uid = ADMIN_BASE + num;
+    }
+    else if (sscanf(name.c_str(), "user%u%c", &num, &tail) == 1)
+    {
+      sp_uid = LOCKING_SP;
+      auth_uid = USER_BASE + num;
+    }
+    else
+    {
+      throw topaz_exception("Unknown authority '" + name + "'");
+    }
+  }
+
+  // Authority UID to its C_PIN row
+  uint64_t pin_row(uint64_t auth_uid)
+  {
+    if (auth_uid == SID)
+    {
+      return C_PIN_SID;
+    }
+    if (auth_uid >= USER_BASE && auth_uid < USER_BASE + 0x10000)
+    {
+      return auth_uid + (C_PIN_USER_BASE - USER_BASE);
+    }
+    return auth_uid + (C_PIN_ADMIN_BASE - ADMIN_BASE);
+  }
+
+  // Locking range number to Locking table row (0 - global range)
+  uint64_t range_uid(string const &word)
+  {
+    uint64_t id = parse_uint(word, "range");
+    return (id ? LBA_RANGE_BASE + id : LBA_RANGE_GLOBAL);
+  }
+
+  // Locking.Set[] of ReadLocked / WriteLocked
+  datum lock_call(uint64_t uid, bool locked)
+  {
+    datum call;
+    call.object_uid() = uid;
+    call.method_uid() = SET;
+    call[0].name() = atom::new_uint(1);
+    call[0].named_value()[0].name()        = atom::new_uint(7);
+    call[0].named_value()[0].named_value() = atom::new_uint(locked);
+    call[0].named_value()[1].name()        = atom::new_uint(8);
+    call[0].named_value()[1].named_value() = atom::new_uint(locked);
+    return call;
+  }
+
+  void need_args(vector<string> const &args, size_t count)
+  {
+    if (args.size() != count)
+    {
+      throw topaz_exception("Wrong number of arguments");
+    }
+  }
+
+};
+
+/**
+ * \brief Management Server Constructor
+ */
+mgmt_server::mgmt_server(string const &path, mgmt_policy const &policy)
+  : policy(policy), path(path), stopping(false)
+{
+  sockaddr_un addr;
+
+  // Listen, replacing any stale socket left by a previous server
+  make_addr(addr, path.c_str());
+  listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_fd == -1)
+  {
+    throw topaz_exception("Cannot create management socket");
+  }
+  unlink(path.c_str());
+  // Requests carry PINs, owner only (no connects until listening)
+  if ((bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) == -1) ||
+      (chmod(path.c_str(), 0600) == -1) ||
+      (listen(listen_fd, 64) == -1))
+  {
+    // Constructor not done, destructor won't be called ...
+    close(listen_fd);
+    throw topaz_exception("Cannot listen on management socket");
+  }
+  TOPAZ_DEBUG(1) printf("Management server on %s\n", path.c_str());
+}
+
+/**
+ * \brief Management Server Destructor
+ */
+mgmt_server::~mgmt_server()
+{
+  close(listen_fd);
+  unlink(path.c_str());
+
+  // Leave no session open behind us
+  for (size_t i = 0; i < drives.size(); i++)
+  {
+    lock_guard<mutex> guard(drives[i]->lock);
+    end_session(*drives[i]);
+    exporter.remove(drives[i]->name);
+  }
+}
+
+/**
+ * \brief Open drive and serve it
+ */
+void mgmt_server::add(string const &name, char const *path)
+{
+  unique_ptr<managed> dev(new managed());
+  dev->name = name;
+  dev->target.reset(new drive(path));
+  dev->warm = false;
+  dev->reused = false;
+  dev->touched = false;
+  for (size_t i = 0; i < drives.size(); i++)
+  {
+    if (drives[i]->name == name)
+    {
+      throw topaz_exception("Drive '" + name + "' already served");
+    }
+  }
+  exporter.add(name, *(dev->target));
+  drives.push_back(std::move(dev));
+}
+
+/**
+ * \brief Serve drive on caller supplied transport
+ */
+void mgmt_server::add(string const &name, transport &io)
+{
+  unique_ptr<managed> dev(new managed());
+  dev->name = name;
+  dev->target.reset(new drive(io));
+  dev->warm = false;
+  dev->reused = false;
+  dev->touched = false;
+  for (size_t i = 0; i < drives.size(); i++)
+  {
+    if (drives[i]->name == name)
+    {
+      throw topaz_exception("Drive '" + name + "' already served");
+    }
+  }
+  exporter.add(name, *(dev->target));
+  drives.push_back(std::move(dev));
+}
+
+/**
+ * \brief Serve clients until stopped
+ */
+void mgmt_server::run()
+{
+  while (!stopping)
+  {
+    expire();
+
+    pollfd pfd = {listen_fd, POLLIN, 0};
+    if (poll(&pfd, 1, ACCEPT_POLL_MS) <= 0)
+    {
+      continue;
+    }
+    int client = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (client == -1)
+    {
+      continue;
+    }
+
+    // One thread per client, it hangs up when done
+    unique_lock<mutex> guard(client_lock);
+    clients.push_back(client);
+    thread(&mgmt_server::serve, this, client).detach();
+  }
+
+  // Hang up on everybody, and wait for their threads to finish
+  unique_lock<mutex> guard(client_lock);
+  for (size_t i = 0; i < clients.size(); i++)
+  {
+    shutdown(clients[i], SHUT_RDWR);
+  }
+  client_done.wait(guard, [this] { return clients.empty(); });
+  stopping = false;
+}
+
+/**
+ * \brief Ask run() to return
+ */
+void mgmt_server::stop()
+{
+  stopping = true;
+}
+
+/**
+ * \brief Answer one request
+ */
+string mgmt_server::handle(string const &request)
+{
+  managed *dev = NULL;
+  string result;
+
+  try
+  {
+    vector<string> words = split_words(request);
+    if (words.empty())
+    {
+      throw topaz_exception("Empty request");
+    }
+    string verb = words[0];
+
+    // Server wide
+    if (verb == "list")
+    {
+      need_args(words, 1);
+      for (size_t i = 0; i < drives.size(); i++)
+      {
+	result += (i ? " " : "") + drives[i]->name;
+      }
+      return "ok " + result;
+    }
+
+    // Everything else names a drive
+    if (words.size() < 2)
+    {
+      throw topaz_exception("No drive given");
+    }
+    for (size_t i = 0; (dev == NULL) && (i < drives.size()); i++)
+    {
+      if (drives[i]->name == words[1])
+      {
+	dev = drives[i].get();
+      }
+    }
+    if (dev == NULL)
+    {
+      throw topaz_exception("No such drive '" + words[1] + "'");
+    }
+
+    lock_guard<mutex> guard(dev->lock);
+    vector<string> args(words.begin() + 2, words.end());
+    for (int attempt = 0; ; attempt++)
+    {
+      try
+      {
+	dev->reused  = false;
+	dev->touched = false;
+	result = run_request(*dev, verb, args);
+	break;
+      }
+      catch (topaz_exception &e)
+      {
+	// Refused before the session was used (eg - someone else's logout)
+	if (!dev->touched)
+	{
+	  throw;
+	}
+
+	// Session state unknown after a failure, start over
+	bool retry = (dev->reused && (attempt == 0));
+	end_session(*dev);
+	if (!retry)
+	{
+	  throw;
+	}
+
+	// Warm session may have been closed by the TPer (eg - power cycle)
+	TOPAZ_DEBUG(1) printf("Warm session on %s failed (%s), logging in again\n",
+			      dev->name.c_str(), e.what());
+      }
+    }
+    dev->last_used = chrono::steady_clock::now();
+    if (policy.idle_ms == 0)
+    {
+      end_session(*dev);
+    }
+  }
+  catch (topaz_exception &e)
+  {
+    // One line answers only
+    string reason = e.what();
+    for (size_t i = 0; i < reason.size(); i++)
+    {
+      if (reason[i] == '\n' || reason[i] == '\r')
+      {
+	reason[i] = ' ';
+      }
+    }
+    TOPAZ_DEBUG(1) printf("Request failed: %s\n", reason.c_str());
+    return "err " + reason;
+  }
+
+  return (result.empty() ? "ok" : "ok " + result);
+}
+
+/**
+ * \brief Log out of sessions idle longer than policy allows
+ */
+void mgmt_server::expire()
+{
+  chrono::steady_clock::time_point now = chrono::steady_clock::now();
+  for (size_t i = 0; i < drives.size(); i++)
+  {
+    // Busy drives aren't idle
+    managed &dev = *drives[i];
+    unique_lock<mutex> guard(dev.lock, try_to_lock);
+    if (guard.owns_lock() && dev.warm &&
+	(now - dev.last_used >= chrono::milliseconds(policy.idle_ms)))
+    {
+      TOPAZ_DEBUG(1) printf("Session on %s idle, logging out\n", dev.name.c_str());
+      end_session(dev);
+    }
+  }
+}
+
+/**
+ * \brief Metrics of every drive served
+ */
+metrics_exporter &mgmt_server::metrics()
+{
+  return exporter;
+}
+
+/**
+ * \brief Answer requests from one client until it hangs up
+ */
+void mgmt_server::serve(int client)
+{
+  string pending, line;
+
+  while (read_line(client, pending, line))
+  {
+    string answer = handle(line) + "\n";
+    if (!write_all(client, answer.data(), answer.size()))
+    {
+      break;
+    }
+  }
+
+  // Gone
+  lock_guard<mutex> guard(client_lock);
+  for (size_t i = 0; i < clients.size(); i++)
+  {
+    if (clients[i] == client)
+    {
+      clients.erase(clients.begin() + i);
+      break;
+    }
+  }
+  close(client);
+  client_done.notify_all();
+}
+
+/**
+ * \brief Run request against a drive
+ */
+string mgmt_server::run_request(managed &dev, string const &verb,
+				vector<string> const &args)
+{
+  drive &target = *(dev.target);
+  char buf[256];
+
+  // Cached state, no commands sent
+  if (verb == "query")
+  {
+    need_args(args, 0);
+    drive_health state = target.health();
+    snprintf(buf, sizeof(buf), "locking=%u enabled=%u locked=%u mbr_enabled=%u "
+	     "mbr_done=%u session=%u max_com_packet=%llu max_methods=%llu",
+	     state.has_locking, !!(state.locking & LOCK_ENABLED),
+	     !!(state.locking & LOCK_LOCKED), !!(state.locking & LOCK_MBR_ENABLED),
+	     !!(state.locking & LOCK_MBR_DONE), dev.warm,
+	     (unsigned long long)state.max_com_pkt_size,
+	     (unsigned long long)state.max_methods);
+    return buf;
+  }
+  else if (verb == "logout")
+  {
+    // Only the session's own authority may end it
+    need_args(args, 2);
+    uint64_t sp_uid, auth_uid;
+    parse_auth(args[0], sp_uid, auth_uid);
+    if (dev.warm && ((dev.sp_uid != sp_uid) || (dev.auth_uid != auth_uid) ||
+		     (dev.pin != args[1])))
+    {
+      throw topaz_exception("Not the session's authority and PIN");
+    }
+    end_session(dev);
+    return "";
+  }
+
+  // Everything else runs in a session
+  if ((verb != "range") && (verb != "setrange") && (verb != "lock") &&
+      (verb != "unlock") && (verb != "setpin"))
+  {
+    throw topaz_exception("Unknown request '" + verb + "'");
+  }
+  if (args.size() < 2)
+  {
+    throw topaz_exception("No authority and PIN given");
+  }
+  session(dev, args[0], args[1]);
+
+  if (verb == "range")
+  {
+    need_args(args, 3);
+    datum row = target.table_get(range_uid(args[2]));
+    snprintf(buf, sizeof(buf), "start=%llu length=%llu read_lock_enabled=%llu "
+	     "write_lock_enabled=%llu read_locked=%llu write_locked=%llu",
+	     (unsigned long long)row.find_by_name(3).value().get_uint(),
+	     (unsigned long long)row.find_by_name(4).value().get_uint(),
+	     (unsigned long long)row.find_by_name(5).value().get_uint(),
+	     (unsigned long long)row.find_by_name(6).value().get_uint(),
+	     (unsigned long long)row.find_by_name(7).value().get_uint(),
+	     (unsigned long long)row.find_by_name(8).value().get_uint());
+    return buf;
+  }
+  else if (verb == "setrange")
+  {
+    need_args(args, 5);
+    uint64_t uid = range_uid(args[2]);
+    target.table_set(uid, 3, parse_uint(args[3], "start"));
+    target.table_set(uid, 4, parse_uint(args[4], "length"));
+    return "";
+  }
+  else if (verb == "lock" || verb == "unlock")
+  {
+    need_args(args, 3);
+
+    // All ranges in as few ComPkts as the TPer allows
+    vector<string> ids;
+    size_t pos = 0, end;
+    do
+    {
+      end = args[2].find(',', pos);
+      ids.push_back(args[2].substr(pos, end == string::npos ? string::npos : end - pos));
+      pos = end + 1;
+    } while (end != string::npos);
+
+    datum_vector calls, results;
+    for (size_t i = 0; i < ids.size(); i++)
+    {
+      calls.push_back(lock_call(range_uid(ids[i]), verb == "lock"));
+    }
+    vector<unsigned> status = target.invoke_batch(std::move(calls), results);
+    for (size_t i = 0; i < status.size(); i++)
+    {
+      if (status[i] != datum::STA_SUCCESS)
+      {
+	snprintf(buf, sizeof(buf), "Range %s: method status %u",
+		 ids[i].c_str(), status[i]);
+	throw topaz_exception(buf);
+      }
+    }
+    return "";
+  }
+  else if (verb == "setpin")
+  {
+    need_args(args, 4);
+    uint64_t sp_uid, auth_uid;
+    parse_auth(args[2], sp_uid, auth_uid);
+    if (sp_uid != dev.sp_uid)
+    {
+      throw topaz_exception("Authority '" + args[2] + "' not in session's SP");
+    }
+    target.table_set(pin_row(auth_uid), 3, atom::new_bin(args[3].c_str()));
+
+    // Changed our own PIN, session stays good for the new one
+    if (auth_uid == dev.auth_uid)
+    {
+      dev.pin = args[3];
+    }
+  }
+  return "";
+}
+
+/**
+ * \brief Make sure a session as auth is open, reusing a warm one
+ */
+void mgmt_server::session(managed &dev, string const &auth, string const &pin)
+{
+  uint64_t sp_uid, auth_uid;
+  parse_auth(auth, sp_uid, auth_uid);
+  dev.touched = true;
+
+  // Same credentials as the open session, nothing to do
+  if (dev.warm && (dev.sp_uid == sp_uid) && (dev.auth_uid == auth_uid) &&
+      (dev.pin == pin))
+  {
+    dev.reused = true;
+    return;
+  }
+
+  end_session(dev);
+  dev.target->login(sp_uid, auth_uid, pin);
+  dev.warm     = true;
+  dev.sp_uid   = sp_uid;
+  dev.auth_uid = auth_uid;
+  dev.pin      = pin;
+}
+
+/**
+ * \brief End session, forgetting its PIN
+ */
+void mgmt_server::end_session(managed &dev)
+{
+  if (dev.warm)
+  {
+    try
+    {
+      dev.target->logout();
+    }
+    catch (topaz_exception &e)
+    {
+      // Drive gone or session already closed by TPer, nothing more to do
+      TOPAZ_DEBUG(1) printf("Logout of %s failed: %s\n", dev.name.c_str(), e.what());
+    }
+  }
+  dev.warm = false;
+  dev.pin.assign(dev.pin.size(), 0);
+  dev.pin.clear();
+}
+
+/**
+ * \brief Management Client Constructor
+ */
+mgmt_client::mgmt_client(char const *path)
+{
+  sockaddr_un addr;
+
+  make_addr(addr, path);
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+  {
+    throw topaz_exception("Cannot create management socket");
+  }
+  if (connect(fd, (sockaddr*)&addr, sizeof(addr)) == -1)
+  {
+    // Constructor not done, destructor won't be called ...
+    close(fd);
+    throw topaz_exception("Cannot connect to management server");
+  }
+}
+
+/**
+ * \brief Management Client Destructor
+ */
+mgmt_client::~mgmt_client()
+{
+  close(fd);
+}
+
+/**
+ * \brief Send request, wait for answer
+ */
+string mgmt_client::call(string const &request)
+{
+  string line = request + "\n", answer;
+  if (!write_all(fd, line.data(), line.size()) || !read_line(fd, pending, answer))
+  {
+    throw topaz_exception("Lost connection to management server");
+  }
+
+  if (answer == "ok")
+  {
+    return "";
+  }
+  else if (answer.compare(0, 3, "ok ") == 0)
+  {
+    return answer.substr(3);
+  }
+  else if (answer.compare(0, 4, "err ") == 0)
+  {
+    throw topaz_exception(answer.substr(4));
+  }
+  throw topaz_exception("Bad answer from management server");
+}
+
+/**
+ * \brief Escape word for use in a request
+ */
+string mgmt_client::escape(string const &word)
+{
+  static char const hex[] = "0123456789ABCDEF";
+  string out;
+  for (size_t i = 0; i < word.size(); i++)
+  {
+    unsigned char c = word[i];
+    if (c <= ' ' || c == '%' || c >= 0x7f)
+    {
+      out += '%';
+      out += hex[c >> 4];
+      out += hex[c & 0xf];
+    }
+    else
+    {
+      out += c;
+    }
+  }
+  return out;
+}
@@ -0,0 +1,239 @@
+#ifndef TOPAZ_MGMT_H
+#define TOPAZ_MGMT_H
+
+/**
+ * Topaz - Management Server
+ *
+ * This file implements a long running owner of TCG Opal drives, answering
+ * requests over a Unix domain socket, and the matching client. Each drive
+ * is opened (discovery, ComID reset, Properties) once, requests to a drive
+ * are serialized, and an authenticated session is kept warm between
+ * requests for the same authority and PIN, for as long as policy allows.
+ * A request that fails on a warm session is retried once on a new one.
+ *
+ * Requests are one line of space separated words, answered by one line:
+ * "ok [result]" or "err <reason>". Words may carry %XX escapes (eg - a
+ * PIN with spaces). Authorities are admin<N>, user<N> (Locking SP) or sid
+ * (Admin SP), ranges are 0 (global) or 1 .. N.
+ *
+ *   list                                   - Drive names
+ *   query <drive>                          - Discovery and session state
+ *   range <drive> <auth> <pin> <range>     - Range start, length and locks
+ *   setrange <drive> <auth> <pin> <range> <start> <length>
+ *   lock <drive> <auth> <pin> <range>[,<range> ...]
+ *   unlock <drive> <auth> <pin> <range>[,<range> ...]
+ *   setpin <drive> <auth> <pin> <target auth> <new pin>
+ *   logout <drive> <auth> <pin>            - End warm session now
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <topaz/drive.h>
+#include <topaz/metrics.h>
+
+namespace topaz
+{
+
+  // What the server may keep between requests
+  struct mgmt_policy
+  {
+    // Keep an authenticated session open this long after a request
+    // (0 - log out after every request, no PINs held in memory)
+    unsigned idle_ms = 30000;
+  };
+
+  class mgmt_server
+  {
+
+  public:
+
+    /**
+     * \brief Management Server Constructor
+     *
+     * Socket is bound and listening once constructed, a stale socket
+     * file at path is replaced. Requests carry PINs, so the socket is
+     * owner only (0600).
+     *
+     * @param path   Unix socket path
+     * @param policy Session policy
+     */
+    mgmt_server(std::string const &path, mgmt_policy const &policy = mgmt_policy());
+
+    /**
+     * \brief Management Server Destructor (logs out, removes socket)
+     */
+    ~mgmt_server();
+
+    /**
+     * \brief Open drive and serve it (before run())
+     *
+     * @param name Name used in requests
+     * @param path OS path to drive (eg - '/dev/sdX', 'sim:/run/tper.sock#3')
+     */
+    void add(std::string const &name, char const *path);
+
+    /**
+     * \brief Serve drive on caller supplied transport (before run())
+     *
+     * @param name Name used in requests
+     * @param io   Transport to TPer, must outlive server
+     */
+    void add(std::string const &name, transport &io);
+
+    /**
+     * \brief Serve clients until stopped
+     */
+    void run();
+
+    /**
+     * \brief Ask run() to return (safe from signal handlers and other threads)
+     */
+    void stop();
+
+    /**
+     * \brief Answer one request (as if received over the socket)
+     *
+     * @param request Request line, without newline
+     * @return Response line, without newline
+     */
+    std::string handle(std::string const &request);
+
+    /**
+     * \brief Log out of sessions idle longer than policy allows
+     */
+    void expire();
+
+    /**
+     * \brief Metrics of every drive served
+     */
+    metrics_exporter &metrics();
+
+  protected:
+
+    // One drive, and its warm session (if any)
+    struct managed
+    {
+      std::string                           name;
+      std::unique_ptr<drive>                target;
+      std::mutex                            lock;
+      bool                                  warm;
+      bool                                  touched;  // Request used the session
+      bool                                  reused;   // ... a warm one
+      uint64_t                              sp_uid;
+      uint64_t                              auth_uid;
+      std::string                           pin;
+      std::chrono::steady_clock::time_point last_used;
+    };
+
+    /**
+     * \brief Answer frames from one client until it hangs up
+     *
+     * @param client Connected socket
+     */
+    void serve(int client);
+
+    /**
+     * \brief Run request against a drive (caller holds drive lock)
+     *
+     * @param dev  Drive
+     * @param args Request words, from the authority on
+     * @param verb Request verb
+     * @return Result text
+     */
+    std::string run_request(managed &dev, std::string const &verb,
+			    std::vector<std::string> const &args);
+
+    /**
+     * \brief Make sure a session as auth is open, reusing a warm one
+     */
+    void session(managed &dev, std::string const &auth, std::string const &pin);
+
+    /**
+     * \brief End session, forgetting its PIN
+     */
+    void end_session(managed &dev);
+
+    /* internal data */
+    std::vector<std::unique_ptr<managed> > drives;
+    metrics_exporter exporter;
+    mgmt_policy policy;
+    std::string path;
+    int listen_fd;
+    std::atomic<bool> stopping;
+
+    // Connected clients, so stop can hang up on them
+    std::mutex client_lock;
+    std::condition_variable client_done;
+    std::vector<int> clients;
+
+  };
+
+  class mgmt_client
+  {
+
+  public:
+
+    /**
+     * \brief Management Client Constructor
+     *
+     * @param path Unix socket path of server
+     */
+    mgmt_client(char const *path);
+
+    /**
+     * \brief Management Client Destructor
+     */
+    ~mgmt_client();
+
+    /**
+     * \brief Send request, wait for answer
+     *
+     * @param request Request line (words escaped, see escape())
+     * @return Result text following "ok"
+     */
+    std::string call(std::string const &request);
+
+    /**
+     * \brief Escape word for use in a request (%XX for space, % and controls)
+     */
+    static std::string escape(std::string const &word);
+
+  protected:
+
+    /* internal data */
+    int fd;
+    std::string pending;
+
+  };
+
+};
+
+#endif
@@ -31,16 +31,22 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <fcntl.h>
+#include <atomic>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <string>
 #include <sys/ioctl.h>
 #include <scsi/sg.h>
 #include <topaz/debug.h>
 #include <topaz/defs.h>
 #include <topaz/exceptions.h>
 #include <topaz/rawdrive.h>
+#include <topaz/record.h>
+#include <topaz/simsock.h>
+#include <topaz/trace.h>
 using namespace topaz;
 
 // Set to nonzero to use ATA12 commands
@@ -80,6 +86,71 @@ rawdrive::rawdrive(char const *path)
   
 }
 
+/**
+ * open_transport
+ *
+ * Open drive by path: device, simulated drive on a socket, or replayed
+ * trace. Recorded into a trace when TOPAZ_RECORD is set.
+ *
+ * @param path OS path to drive (eg - '/dev/sdX', 'sim:/run/tper.sock#3')
+ * @return Transport, owned by caller
+ */
+transport *topaz::open_transport(char const *path)
+{
+  char const *trace = getenv("TOPAZ_RECORD");
+  transport *io;
+  TOPAZ_TRACE_SPAN(span, TRACE_DEVICE_OPEN, 0, 0);
+  
+  if (strncmp(path, "replay:", 7) == 0)
+  {
+    return new replayer(path + 7, false);
+  }
+  if (strncmp(path, "replay-timed:", 13) == 0)
+  {
+    return new replayer(path + 13, true);
+  }
+  
+  if (strncmp(path, "sim:", 4) == 0)
+  {
+    std::string sock(path + 4);
+    unsigned index = 0;
+    
+    // Drive number follows the last '#', first drive if none
+    size_t pos = sock.rfind('#');
+    if (pos != std::string::npos)
+    {
+      char *end;
+      index = strtoul(sock.c_str() + pos + 1, &end, 10);
+      if ((end == sock.c_str() + pos + 1) || (*end != '\0'))
+      {
+	throw topaz_exception("Invalid simulated drive number");
+      }
+      sock.resize(pos);
+    }
+    io = new sockdrive(sock.c_str(), index);
+  }
+  else
+  {
+    io = new rawdrive(path);
+  }
+  
+  // Record everything said to the drive, if asked to (the first transport
+  // of a process to the file named, later ones to "<file>.1", "<file>.2" ...)
+  if (trace && *trace)
+  {
+    static std::atomic<unsigned> recorded(0);
+    std::string name(trace);
+    unsigned n = recorded++;
+    if (n)
+    {
+      name += "." + std::to_string(n);
+    }
+    TOPAZ_DEBUG(1) printf("Recording %s into %s\n", path, name.c_str());
+    return new recorder(std::unique_ptr<transport>(io), name.c_str());
+  }
+  return io;
+}
+
 /**
  * \brief Topaz Raw Hard Drive Destructor
  */
@@ -128,6 +199,7 @@ void rawdrive::if_send(uint8_t proto, uint16_t comid,
     // Off it goes
     ata_exec_16(cmd, SG_DXFER_TO_DEV, data, bcount, 5);
   }
+  traffic.sent(bcount * ATA_BLOCK_SIZE);
 }
 
 /**
@@ -169,6 +241,48 @@ void rawdrive::if_recv(uint8_t proto, uint16_t comid,
     // Off it goes
     ata_exec_16(cmd, SG_DXFER_FROM_DEV, data, bcount, 5);
   }
+  traffic.received(bcount * ATA_BLOCK_SIZE);
+  if (no_data_yet(proto, comid, data, bcount * ATA_BLOCK_SIZE))
+  {
+    traffic.polled();
+  }
+}
+
+/**
+ * \brief SG_IO latency of each ATA command, by opcode (nanoseconds)
+ */
+command_latency_table &rawdrive::command_latency()
+{
+  return ata_latency;
+}
+
+/**
+ * \brief Traffic so far
+ */
+io_counters rawdrive::counters() const
+{
+  return traffic.read();
+}
+
+/**
+ * \brief Start counting traffic from zero
+ */
+void rawdrive::reset_counters()
+{
+  traffic.reset();
+}
+
+/**
+ * \brief Add SG_IO time of ATA command to its histogram
+ */
+void rawdrive::record_command(uint8_t opcode, std::chrono::steady_clock::time_point start)
+{
+  latency_histogram *hist = ata_latency.get(opcode);
+  if (hist)
+  {
+    hist->record(std::chrono::duration_cast<std::chrono::nanoseconds>
+		 (std::chrono::steady_clock::now() - start).count());
+  }
 }
 
 /**
@@ -227,8 +341,43 @@ void rawdrive::check_tpm()
   {
     throw topaz_exception("No TPM Detected in Specified Drive");
   }
+  
+  // Serial number, words 10-19, two characters per word (high byte first)
+  serial.clear();
+  for (size_t i = 0; i < 20; i++)
+  {
+    char c = (i % 2) ? (id_data[10 + i / 2] & 0xff) : (id_data[10 + i / 2] >> 8);
+    if (c != ' ' && c != 0)
+    {
+      serial += c;
+    }
+  }
 }  
 
+/**
+ * device_id
+ *
+ * ATA serial number (device number if the drive reports none)
+ *
+ * @return Identity of drive
+ */
+std::string rawdrive::device_id() const
+{
+  struct stat info;
+  char buf[64];
+  
+  if (!serial.empty())
+  {
+    return "ata-" + serial;
+  }
+  if (fstat(fd, &info) == -1)
+  {
+    return std::string();
+  }
+  snprintf(buf, sizeof(buf), "dev-%u-%u", major(info.st_rdev), minor(info.st_rdev));
+  return buf;
+}
+
 /**
  * ata_identify
  *
@@ -417,8 +566,10 @@ void rawdrive::ata_exec_12(ata12_cmd_t &cmd, int type,
     }
   }
   
-  // System call
+  // System call, timed
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
   rc = ioctl(fd, SG_IO, &sg_io);
+  record_command(cmd.command, start);
   if (rc != 0)
   {
     throw topaz_exception("SGIO ioctl failed");
@@ -550,8 +701,10 @@ void rawdrive::ata_exec_16(ata16_cmd_t &cmd, int type,
     }
   }
   
-  // System call
+  // System call, timed
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
   rc = ioctl(fd, SG_IO, &sg_io);
+  record_command(cmd.command, start);
   if (rc != 0)
   {
     throw topaz_exception("SGIO ioctl failed");
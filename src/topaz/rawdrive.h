@@ -33,6 +33,11 @@
 
 #include <stdint.h>
 #include <stddef.h> /* size_t */
+#include <chrono>
+#include <string>
+#include <topaz/counters.h>
+#include <topaz/latency.h>
+#include <topaz/transport.h>
 
 namespace topaz
 {
@@ -68,7 +73,7 @@ namespace topaz
     uint8_t    command;
   } ata16_cmd_t;
   
-  class rawdrive
+  class rawdrive : public transport
   {
     
   public:
@@ -83,7 +88,7 @@ namespace topaz
     /**
      * \brief Topaz Raw Hard Drive Destructor
      */
-    ~rawdrive();
+    virtual ~rawdrive();
 
     /**
      * if_send (TCG Opal IF-SEND)
@@ -95,8 +100,8 @@ namespace topaz
      * @param data     Data buffer
      * @param bcount   Size of data buffer in 512 byte blocks
      */
-    void if_send(uint8_t proto, uint16_t comid,
-		 void *data, uint8_t bcount);
+    virtual void if_send(uint8_t proto, uint16_t comid,
+			 void *data, uint8_t bcount);
     
     /**
      * if_send (TCG Opal IF-RECV)
@@ -108,8 +113,30 @@ namespace topaz
      * @param data     Data buffer
      * @param bcount   Size of data buffer in 512 byte blocks
      */
-    void if_recv(uint8_t proto, uint16_t comid,
-		 void *data, uint8_t bcount);
+    virtual void if_recv(uint8_t proto, uint16_t comid,
+			 void *data, uint8_t bcount);
+    
+    /**
+     * device_id
+     *
+     * ATA serial number (device number if the drive reports none)
+     */
+    virtual std::string device_id() const;
+    
+    /**
+     * \brief SG_IO latency of each ATA command, by opcode (nanoseconds)
+     */
+    command_latency_table &command_latency();
+    
+    /**
+     * \brief Traffic so far (sessions and methods are counted by drive)
+     */
+    io_counters counters() const;
+    
+    /**
+     * \brief Start counting traffic from zero
+     */
+    void reset_counters();
     
   protected:
     
@@ -177,11 +204,37 @@ namespace topaz
     void ata_exec_16(ata16_cmd_t &cmd, int type,
 		     void *data, uint8_t bcount, int wait);
     
+    /**
+     * \brief Add SG_IO time of ATA command to its histogram
+     *
+     * @param opcode ATA command
+     * @param start  When ioctl was issued
+     */
+    void record_command(uint8_t opcode, std::chrono::steady_clock::time_point start);
+    
     /* internal data */
     int fd;
+    std::string serial;
+    command_latency_table ata_latency;
+    io_counter_set traffic;
     
   };
   
+  /**
+   * open_transport
+   *
+   * Open drive by path. "sim:<socket>[#index]" selects a simulated drive
+   * served over a Unix socket (see tp_simd), "replay:<trace>" and
+   * "replay-timed:<trace>" serve a recorded transport trace, anything else
+   * is a device. If TOPAZ_RECORD names a file, the transport is recorded
+   * into it. Each later transport opened by the same process is recorded
+   * into "<file>.<n>" (n = 1, 2 ...), so multi-drive tools keep every trace.
+   *
+   * @param path OS path to drive (eg - '/dev/sdX', 'sim:/run/tper.sock#3')
+   * @return Transport, owned by caller
+   */
+  transport *open_transport(char const *path);
+  
 };
 
 #endif
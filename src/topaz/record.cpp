@@ -0,0 +1,338 @@
+/**
+ * Topaz - Transport Record and Replay
+ *
+ * This file implements a transport wrapper that records every IF-SEND /
+ * IF-RECV exchange into a compact binary trace, and a transport that serves
+ * a recorded trace back to the host.
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstring>
+#include <thread>
+#include <topaz/debug.h>
+#include <topaz/defs.h>
+#include <topaz/exceptions.h>
+#include <topaz/record.h>
+using namespace std;
+using namespace topaz;
+
+namespace
+{
+
+  // Trace file identification
+  const char     TRACE_MAGIC[8] = { 'T', 'P', 'Z', 'T', 'R', 'A', 'C', 'E' };
+  const uint32_t TRACE_VERSION  = 1;
+
+  // Payload size without trailing zero bytes (mostly block padding)
+  size_t trimmed(void const *data, size_t len)
+  {
+    uint8_t const *ptr = (uint8_t const*)data;
+    while (len && (ptr[len - 1] == 0))
+    {
+      len--;
+    }
+    return len;
+  }
+
+};
+
+/**
+ * \brief Read whole trace file
+ */
+vector<trace_record> topaz::load_trace(char const *path)
+{
+  vector<trace_record> trace;
+  trace_file_header file_hdr;
+  trace_record rec;
+
+  FILE *in = fopen(path, "rb");
+  if (in == NULL)
+  {
+    throw topaz_exception("Cannot open transport trace");
+  }
+  if ((fread(&file_hdr, sizeof(file_hdr), 1, in) != 1) ||
+      memcmp(file_hdr.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) ||
+      (file_hdr.version != TRACE_VERSION))
+  {
+    fclose(in);
+    throw topaz_exception("Not a transport trace (or unsupported version)");
+  }
+
+  // Entries until end of file, a cut off last entry is dropped
+  while (fread(&(rec.hdr), sizeof(rec.hdr), 1, in) == 1)
+  {
+    if (rec.hdr.len > (size_t)rec.hdr.bcount * ATA_BLOCK_SIZE &&
+	!(rec.hdr.flags & TRACE_ERROR))
+    {
+      fclose(in);
+      throw topaz_exception("Corrupt transport trace entry");
+    }
+    rec.data.resize(rec.hdr.len);
+    if (rec.hdr.len && (fread(&(rec.data[0]), rec.hdr.len, 1, in) != 1))
+    {
+      break;
+    }
+    trace.push_back(rec);
+  }
+  fclose(in);
+
+  TOPAZ_DEBUG(1) printf("Loaded %zu exchanges from %s\n", trace.size(), path);
+  return trace;
+}
+
+/**
+ * \brief Recording Transport Constructor
+ */
+recorder::recorder(transport &io, char const *path)
+  : io(io)
+{
+  open(path);
+}
+
+/**
+ * \brief Recording Transport Constructor (takes ownership)
+ */
+recorder::recorder(unique_ptr<transport> io, char const *path)
+  : owned(std::move(io)), io(*owned)
+{
+  open(path);
+}
+
+/**
+ * \brief Recording Transport Destructor
+ */
+recorder::~recorder()
+{
+  fclose(out);
+}
+
+/**
+ * if_send (TCG Opal IF-SEND)
+ */
+void recorder::if_send(uint8_t proto, uint16_t comid, void *data, uint8_t bcount)
+{
+  trace_clock::time_point start = trace_clock::now();
+  try
+  {
+    io.if_send(proto, comid, data, bcount);
+  }
+  catch (topaz_exception &e)
+  {
+    write(TRACE_SEND | TRACE_ERROR, proto, comid, bcount,
+	  e.what(), strlen(e.what()), start, trace_clock::now());
+    throw;
+  }
+  write(TRACE_SEND, proto, comid, bcount,
+	data, bcount * ATA_BLOCK_SIZE, start, trace_clock::now());
+}
+
+/**
+ * if_recv (TCG Opal IF-RECV)
+ */
+void recorder::if_recv(uint8_t proto, uint16_t comid, void *data, uint8_t bcount)
+{
+  trace_clock::time_point start = trace_clock::now();
+  size_t len = bcount * ATA_BLOCK_SIZE;
+  try
+  {
+    io.if_recv(proto, comid, data, bcount);
+  }
+  catch (topaz_exception &e)
+  {
+    write(TRACE_ERROR, proto, comid, bcount,
+	  e.what(), strlen(e.what()), start, trace_clock::now());
+    throw;
+  }
+  write(no_data_yet(proto, comid, data, len) ? TRACE_EMPTY : 0, proto, comid, bcount,
+	data, len, start, trace_clock::now());
+}
+
+/**
+ * device_id
+ */
+string recorder::device_id() const
+{
+  return io.device_id();
+}
+
+/**
+ * \brief Open trace file, write file header
+ */
+void recorder::open(char const *path)
+{
+  trace_file_header file_hdr;
+
+  out = fopen(path, "wb");
+  if (out == NULL)
+  {
+    throw topaz_exception("Cannot create transport trace");
+  }
+  memset(&file_hdr, 0, sizeof(file_hdr));
+  memcpy(file_hdr.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+  file_hdr.version = TRACE_VERSION;
+  if (fwrite(&file_hdr, sizeof(file_hdr), 1, out) != 1)
+  {
+    fclose(out);
+    throw topaz_exception("Cannot write transport trace");
+  }
+  epoch = trace_clock::now();
+  TOPAZ_DEBUG(1) printf("Recording transport to %s\n", path);
+}
+
+/**
+ * \brief Append one exchange to trace
+ */
+void recorder::write(uint8_t flags, uint8_t proto, uint16_t comid, uint8_t bcount,
+		     void const *data, size_t len,
+		     trace_clock::time_point start, trace_clock::time_point end)
+{
+  trace_entry hdr;
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.start_us = chrono::duration_cast<chrono::microseconds>(start - epoch).count();
+  hdr.dur_us   = chrono::duration_cast<chrono::microseconds>(end - start).count();
+  hdr.len      = trimmed(data, len);
+  hdr.flags    = flags;
+  hdr.proto    = proto;
+  hdr.comid    = comid;
+  hdr.bcount   = bcount;
+
+  // Flushed as we go, the trace matters most when something dies
+  if ((fwrite(&hdr, sizeof(hdr), 1, out) != 1) ||
+      (hdr.len && (fwrite(data, hdr.len, 1, out) != 1)) ||
+      (fflush(out) != 0))
+  {
+    throw topaz_exception("Cannot write transport trace");
+  }
+}
+
+/**
+ * \brief Replay Transport Constructor
+ */
+replayer::replayer(char const *path, bool timed)
+  : trace(load_trace(path)), cursor(0), diverged(0), timed(timed)
+{
+}
+
+/**
+ * \brief Replay Transport Destructor
+ */
+replayer::~replayer()
+{
+}
+
+/**
+ * if_send (TCG Opal IF-SEND)
+ */
+void replayer::if_send(uint8_t proto, uint16_t comid, void *data, uint8_t bcount)
+{
+  trace_record const &rec = next(true, proto, comid);
+
+  // Payloads may legitimately differ (eg - codec changes), just count them
+  size_t len = trimmed(data, bcount * ATA_BLOCK_SIZE);
+  if ((len != rec.data.size()) ||
+      (len && memcmp(data, &(rec.data[0]), len)))
+  {
+    diverged++;
+  }
+}
+
+/**
+ * if_recv (TCG Opal IF-RECV)
+ */
+void replayer::if_recv(uint8_t proto, uint16_t comid, void *data, uint8_t bcount)
+{
+  trace_record const &rec = next(false, proto, comid);
+  size_t len = bcount * ATA_BLOCK_SIZE;
+
+  memset(data, 0, len);
+  memcpy(data, rec.data.data(), min(len, rec.data.size()));
+}
+
+/**
+ * \brief Exchanges left in trace
+ */
+size_t replayer::remaining() const
+{
+  return trace.size() - cursor;
+}
+
+/**
+ * \brief IF-SEND payloads that differed from the recorded ones
+ */
+size_t replayer::mismatches() const
+{
+  return diverged;
+}
+
+/**
+ * \brief Find next recorded exchange for host command
+ */
+trace_record const &replayer::next(bool send, uint8_t proto, uint16_t comid)
+{
+  // Host may poll fewer times than the recorded run did. Leftover "no data
+  // yet" answers are dropped, and when not keeping time, all of them are.
+  while ((cursor < trace.size()) && (trace[cursor].hdr.flags & TRACE_EMPTY))
+  {
+    bool more = ((cursor + 1 < trace.size()) &&
+		 !(trace[cursor + 1].hdr.flags & TRACE_SEND) &&
+		 (trace[cursor + 1].hdr.proto == proto) &&
+		 (trace[cursor + 1].hdr.comid == comid));
+    if (!send && (timed || !more))
+    {
+      break;
+    }
+    cursor++;
+  }
+
+  if (cursor >= trace.size())
+  {
+    throw topaz_exception("Replay ran past end of transport trace");
+  }
+  trace_record const &rec = trace[cursor];
+  if (((rec.hdr.flags & TRACE_SEND) != 0) != send ||
+      (rec.hdr.proto != proto) || (rec.hdr.comid != comid))
+  {
+    throw topaz_exception("Replay diverged from transport trace");
+  }
+  cursor++;
+
+  TOPAZ_DEBUG(4)
+  {
+    printf("Replay %s proto %u ComID 0x%x (%u us)\n", send ? "IF-SEND" : "IF-RECV",
+	   proto, comid, rec.hdr.dur_us);
+  }
+
+  // Drive took this long
+  if (timed && rec.hdr.dur_us)
+  {
+    this_thread::sleep_for(chrono::microseconds(rec.hdr.dur_us));
+  }
+  if (rec.hdr.flags & TRACE_ERROR)
+  {
+    throw topaz_exception(string(rec.data.begin(), rec.data.end()));
+  }
+  return rec;
+}
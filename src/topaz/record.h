@@ -0,0 +1,248 @@
+#ifndef TOPAZ_RECORD_H
+#define TOPAZ_RECORD_H
+
+/**
+ * Topaz - Transport Record and Replay
+ *
+ * This file implements a transport wrapper that records every IF-SEND /
+ * IF-RECV exchange (protocol, ComID, payload, timing) into a compact binary
+ * trace, and a transport that serves a recorded trace back to the host,
+ * either at recorded timing or as fast as possible.
+ *
+ * Trace layout (host byte order): a trace_file_header, then one
+ * trace_entry per exchange, each followed by its payload with trailing
+ * zero bytes trimmed, or by error text if the exchange threw.
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include <topaz/transport.h>
+
+namespace topaz
+{
+
+  // Trace entry flags
+  enum trace_flags
+  {
+    TRACE_SEND  = 0x01,   // IF-SEND (else IF-RECV)
+    TRACE_EMPTY = 0x02,   // IF-RECV answered "no data yet"
+    TRACE_ERROR = 0x04    // Exchange threw, payload is error text
+  };
+
+  typedef struct
+  {
+    char     magic[8];    // "TPZTRACE"
+    uint32_t version;     // Format version (1)
+    uint32_t reserved;
+  } trace_file_header;
+
+  typedef struct
+  {
+    uint64_t start_us;    // Start of exchange, from start of trace
+    uint32_t dur_us;      // Time spent in the transport
+    uint32_t len;         // Payload bytes stored (trailing zeros trimmed)
+    uint8_t  flags;       // trace_flags
+    uint8_t  proto;       // Security Protocol
+    uint16_t comid;       // Protocol ComId
+    uint8_t  bcount;      // Transfer size in 512 byte blocks
+    uint8_t  reserved[3];
+  } trace_entry;
+
+  // One exchange read back from a trace
+  typedef struct
+  {
+    trace_entry          hdr;
+    std::vector<uint8_t> data;
+  } trace_record;
+
+  /**
+   * \brief Read whole trace file
+   *
+   * @param path Trace file
+   * @return Exchanges, in recorded order
+   */
+  std::vector<trace_record> load_trace(char const *path);
+
+  class recorder : public transport
+  {
+
+  public:
+
+    /**
+     * \brief Recording Transport Constructor
+     *
+     * @param io   Transport to record (must outlive recorder)
+     * @param path Trace file to create
+     */
+    recorder(transport &io, char const *path);
+
+    /**
+     * \brief Recording Transport Constructor (takes ownership)
+     *
+     * @param io   Transport to record, deleted with recorder
+     * @param path Trace file to create
+     */
+    recorder(std::unique_ptr<transport> io, char const *path);
+
+    /**
+     * \brief Recording Transport Destructor (flushes trace)
+     */
+    virtual ~recorder();
+
+    /**
+     * if_send (TCG Opal IF-SEND)
+     *
+     * @param protocol Security Protocol
+     * @param comid    Protocol ComId
+     * @param data     Data buffer
+     * @param bcount   Size of data buffer in 512 byte blocks
+     */
+    virtual void if_send(uint8_t proto, uint16_t comid,
+			 void *data, uint8_t bcount);
+
+    /**
+     * if_recv (TCG Opal IF-RECV)
+     *
+     * @param protocol Security Protocol
+     * @param comid    Protocol ComId
+     * @param data     Data buffer
+     * @param bcount   Size of data buffer in 512 byte blocks
+     */
+    virtual void if_recv(uint8_t proto, uint16_t comid,
+			 void *data, uint8_t bcount);
+
+    /**
+     * device_id
+     *
+     * Identity of the recorded transport's device
+     */
+    virtual std::string device_id() const;
+
+  protected:
+
+    typedef std::chrono::steady_clock trace_clock;
+
+    /**
+     * \brief Open trace file, write file header
+     */
+    void open(char const *path);
+
+    /**
+     * \brief Append one exchange to trace
+     */
+    void write(uint8_t flags, uint8_t proto, uint16_t comid, uint8_t bcount,
+	       void const *data, size_t len,
+	       trace_clock::time_point start, trace_clock::time_point end);
+
+    /* internal data */
+    std::unique_ptr<transport> owned;
+    transport &io;
+    FILE *out;
+    trace_clock::time_point epoch;
+
+  };
+
+  class replayer : public transport
+  {
+
+  public:
+
+    /**
+     * \brief Replay Transport Constructor
+     *
+     * @param path  Trace file to serve
+     * @param timed Take as long as the recorded drive did (else no waits,
+     *              and recorded "no data yet" polls are skipped)
+     */
+    replayer(char const *path, bool timed = false);
+
+    /**
+     * \brief Replay Transport Destructor
+     */
+    virtual ~replayer();
+
+    /**
+     * if_send (TCG Opal IF-SEND)
+     *
+     * Next exchange in trace must be an IF-SEND to same protocol / ComID.
+     *
+     * @param protocol Security Protocol
+     * @param comid    Protocol ComId
+     * @param data     Data buffer
+     * @param bcount   Size of data buffer in 512 byte blocks
+     */
+    virtual void if_send(uint8_t proto, uint16_t comid,
+			 void *data, uint8_t bcount);
+
+    /**
+     * if_recv (TCG Opal IF-RECV)
+     *
+     * Next exchange in trace must be an IF-RECV from same protocol / ComID.
+     *
+     * @param protocol Security Protocol
+     * @param comid    Protocol ComId
+     * @param data     Data buffer
+     * @param bcount   Size of data buffer in 512 byte blocks
+     */
+    virtual void if_recv(uint8_t proto, uint16_t comid,
+			 void *data, uint8_t bcount);
+
+    /**
+     * \brief Exchanges left in trace
+     */
+    size_t remaining() const;
+
+    /**
+     * \brief IF-SEND payloads that differed from the recorded ones
+     */
+    size_t mismatches() const;
+
+  protected:
+
+    /**
+     * \brief Find next recorded exchange for host command
+     *
+     * @param send  Host is sending?
+     * @param proto Security Protocol
+     * @param comid Protocol ComId
+     * @return Recorded exchange (errors are rethrown)
+     */
+    trace_record const &next(bool send, uint8_t proto, uint16_t comid);
+
+    /* internal data */
+    std::vector<trace_record> trace;
+    size_t cursor;
+    size_t diverged;
+    bool timed;
+
+  };
+
+};
+
+#endif
@@ -0,0 +1,1035 @@
+/**
+ * Topaz - Simulated Drive
+ *
+ * This file implements an in-process software TPer behind the transport
+ * interface, so session, batching and codec paths can be exercised (and
+ * timed) without a self-encrypting drive.
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstring>
+#include <endian.h>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <topaz/alloc.h>
+#include <topaz/debug.h>
+#include <topaz/defs.h>
+#include <topaz/exceptions.h>
+#include <topaz/simdrive.h>
+#include <topaz/uid.h>
+using namespace std;
+using namespace topaz;
+
+#define PAD_TO_MULTIPLE(val, mult) (((val + (mult - 1)) / mult) * mult)
+
+namespace
+{
+
+  // Objects the library doesn't otherwise name
+  const uint64_t THIS_SP         = _UID_MAKE(  0x0,     0x1);
+  const uint64_t C_PIN_PSID      = _UID_MAKE(  0xb, 0x1ff01);
+  const uint64_t K_AES_256_BASE  = _UID_MAKE(0x806, 0x30000);
+  const uint64_t K_AES_256_GLOBAL = _UID_MAKE(0x806,    0x1);
+
+  // SP life cycle states (SP table, column 6)
+  const uint64_t SP_INACTIVE = 8; // Manufactured-Inactive
+  const uint64_t SP_ACTIVE   = 9; // Manufactured
+
+  // Key mode reported for media keys (XTS)
+  const uint64_t KEY_MODE_XTS = 23;
+
+  // Host properties assumed until host offers its own
+  const char *host_prop_names[] = {
+    "MaxComPacketSize", "MaxPacketSize", "MaxIndTokenSize",
+    "MaxPackets", "MaxSubpackets", "MaxMethods"
+  };
+  const uint64_t host_prop_defaults[] = { 2048, 2028, 1992, 1, 1, 1 };
+
+  // Named parameter of a method call (not a plain list, so no try_find_by_name)
+  datum const *find_param(datum const &call, uint64_t name)
+  {
+    datum_vector const &params = call.list();
+    for (size_t i = 0; i < params.size(); i++)
+    {
+      if (params[i].get_type() == datum::NAMED)
+      {
+	optional<uint64_t> id = params[i].name().try_get_uint();
+	if (id && (*id == name))
+	{
+	  return &params[i].named_value();
+	}
+      }
+    }
+    return NULL;
+  }
+
+  // Unsigned value of optional cellblock entry
+  uint64_t cell_uint(datum const *cells, uint64_t name, uint64_t def)
+  {
+    datum const *cell = (cells ? cells->try_find_by_name(name) : NULL);
+    if (cell && (cell->get_type() == datum::ATOM))
+    {
+      return cell->value().try_get_uint().value_or(def);
+    }
+    return def;
+  }
+
+  // Authority number relative to base (0 if not one of count)
+  uint64_t auth_index(uint64_t auth, uint64_t base, unsigned count)
+  {
+    return (((auth > base) && (auth - base <= count)) ? auth - base : 0);
+  }
+
+};
+
+/**
+ * \brief Constructor (all service times zero)
+ */
+sim_latency::sim_latency()
+{
+}
+
+/**
+ * \brief Load profile
+ *
+ * @param path Profile file
+ */
+void sim_latency::load(char const *path)
+{
+  ifstream in(path);
+  string line, op;
+  unsigned usec;
+
+  if (!in)
+  {
+    throw topaz_exception("Cannot open latency profile");
+  }
+
+  while (getline(in, line))
+  {
+    // Strip comments
+    size_t hash = line.find('#');
+    if (hash != string::npos)
+    {
+      line.resize(hash);
+    }
+
+    // Operation, then samples
+    istringstream fields(line);
+    if (!(fields >> op))
+    {
+      continue;
+    }
+    samples[op].clear();
+    cursor[op] = 0;
+    while (fields >> usec)
+    {
+      samples[op].push_back(usec);
+    }
+    if (samples[op].empty())
+    {
+      throw topaz_exception("Latency profile operation without samples");
+    }
+  }
+}
+
+/**
+ * \brief Set fixed service time for operation
+ */
+void sim_latency::set(string const &op, unsigned usec)
+{
+  samples[op].assign(1, usec);
+  cursor[op] = 0;
+}
+
+/**
+ * \brief Append measured sample for operation
+ */
+void sim_latency::add_sample(string const &op, unsigned usec)
+{
+  samples[op].push_back(usec);
+}
+
+/**
+ * \brief Next service time for operation
+ */
+unsigned sim_latency::next(string const &op)
+{
+  map<string, vector<unsigned> >::iterator it = samples.find(op);
+  if (it == samples.end())
+  {
+    it = samples.find("default");
+  }
+  if ((it == samples.end()) || it->second.empty())
+  {
+    return 0;
+  }
+
+  // Replay in order, wrapping around
+  size_t &pos = cursor[it->first];
+  unsigned usec = it->second[pos % it->second.size()];
+  pos = (pos + 1) % it->second.size();
+  return usec;
+}
+
+/**
+ * \brief Simulated Drive Constructor (factory fresh)
+ *
+ * @param cfg Shape of the drive
+ * @param lat Service time model
+ */
+simdrive::simdrive(sim_config const &cfg, sim_latency const &lat)
+  : cfg(cfg), lat(lat)
+{
+  reset_stats();
+  factory_reset();
+}
+
+/**
+ * \brief Simulated Drive Destructor
+ */
+simdrive::~simdrive()
+{
+}
+
+/**
+ * \brief Return to factory state (as if by PSID revert)
+ */
+void simdrive::factory_reset()
+{
+  // Any session is gone
+  session_sp = 0;
+  session_auth = 0;
+  tper_session_id = 0;
+  host_session_id = 0;
+  next_session_id = 0x1001;
+  response.clear();
+  comid_reset = false;
+
+  // Admin SP - SID starts out as MSID
+  admin_sp.clear();
+  admin_sp[C_PIN_MSID][3] = atom::new_bin(cfg.msid.c_str());
+  admin_sp[C_PIN_SID][3]  = atom::new_bin(cfg.msid.c_str());
+  admin_sp[C_PIN_PSID][3] = atom::new_bin(cfg.psid.c_str());
+  admin_sp[ADMIN_SP][6]   = atom::new_uint(SP_ACTIVE);
+  admin_sp[LOCKING_SP][6] = atom::new_uint(SP_INACTIVE);
+
+  // Locking SP and whatever it protected
+  reset_locking_sp();
+}
+
+/**
+ * \brief Build Locking SP tables (inactive until activated)
+ */
+void simdrive::reset_locking_sp()
+{
+  unsigned i;
+
+  locking_sp.clear();
+
+  // Authorities and their PINs (only Admin1 enabled, on activation)
+  for (i = 1; i <= cfg.admins; i++)
+  {
+    locking_sp[ADMIN_BASE + i][2] = atom::new_bin("");
+    locking_sp[ADMIN_BASE + i][5] = atom::new_uint(i == 1);
+    locking_sp[C_PIN_ADMIN_BASE + i][3] = atom::new_bin("");
+  }
+  for (i = 1; i <= cfg.users; i++)
+  {
+    locking_sp[USER_BASE + i][2] = atom::new_bin("");
+    locking_sp[USER_BASE + i][5] = atom::new_uint(0);
+    locking_sp[C_PIN_USER_BASE + i][3] = atom::new_bin("");
+  }
+
+  // Locking info, MBR control
+  locking_sp[LOCKINGINFO][4] = atom::new_uint(cfg.ranges);
+  locking_sp[MBR_CONTROL][1] = atom::new_uint(0);
+  locking_sp[MBR_CONTROL][2] = atom::new_uint(0);
+
+  // Ranges, each with its own media key (fresh keys, old data is gone)
+  for (i = 0; i <= cfg.ranges; i++)
+  {
+    uint64_t range_uid = (i ? LBA_RANGE_BASE + i : LBA_RANGE_GLOBAL);
+    uint64_t key_uid   = (i ? K_AES_256_BASE + i : K_AES_256_GLOBAL);
+    row_t &range = locking_sp[range_uid];
+    for (uint64_t col = 3; col <= 8; col++)
+    {
+      range[col] = atom::new_uint(0);
+    }
+    range[10] = atom::new_uid(key_uid);
+    locking_sp[key_uid][4] = atom::new_uint(KEY_MODE_XTS);
+    keys[key_uid]++;
+  }
+
+  // Shadow MBR cleared
+  mbr.assign(cfg.mbr_size, 0);
+}
+
+/**
+ * device_id
+ */
+string simdrive::device_id() const
+{
+  return (cfg.serial.empty() ? string() : "sim-" + cfg.serial);
+}
+
+/**
+ * \brief Simulate power cycle
+ */
+void simdrive::power_cycle()
+{
+  // Sessions don't survive
+  session_sp = 0;
+  session_auth = 0;
+  tper_session_id = 0;
+  host_session_id = 0;
+  response.clear();
+
+  // LockOnReset - lock enabled ranges, show MBR again
+  for (unsigned i = 0; i <= cfg.ranges; i++)
+  {
+    row_t &range = locking_sp[i ? LBA_RANGE_BASE + i : LBA_RANGE_GLOBAL];
+    range[7] = atom::new_uint(range[5].get_uint());
+    range[8] = atom::new_uint(range[6].get_uint());
+  }
+  locking_sp[MBR_CONTROL][2] = atom::new_uint(0);
+}
+
+/**
+ * \brief Query traffic counters
+ */
+sim_stats const &simdrive::stats() const
+{
+  return counters;
+}
+
+/**
+ * \brief Clear traffic counters
+ */
+void simdrive::reset_stats()
+{
+  memset(&counters, 0, sizeof(counters));
+}
+
+/**
+ * \brief Service time model in use
+ */
+sim_latency &simdrive::latency()
+{
+  return lat;
+}
+
+/**
+ * \brief Query how many times a media key was regenerated
+ */
+uint64_t simdrive::key_generation(uint64_t key_uid) const
+{
+  map<uint64_t, uint64_t>::const_iterator it = keys.find(key_uid);
+  return (it == keys.end() ? 0 : it->second);
+}
+
+/**
+ * \brief Query Shadow MBR contents
+ */
+vector<uint8_t> const &simdrive::mbr_data() const
+{
+  return mbr;
+}
+
+/**
+ * if_send (TCG Opal IF-SEND)
+ */
+void simdrive::if_send(uint8_t proto, uint16_t comid, void *data, uint8_t bcount)
+{
+  TOPAZ_ALLOC_SITE(site, ALLOC_SIMULATED);
+  counters.sends++;
+  service(lat.next("send"));
+
+  if (proto == 2)
+  {
+    // ComID management - only STACK_RESET
+    opal_comid_req_t *cmd = (opal_comid_req_t*)data;
+    if ((comid != cfg.com_id) || (be32toh(cmd->req_code) != 0x02))
+    {
+      throw topaz_exception("Simulated TPer: unsupported ComID request");
+    }
+    session_sp = 0;
+    session_auth = 0;
+    tper_session_id = 0;
+    host_session_id = 0;
+    response.clear();
+    comid_reset = true;
+  }
+  else if ((proto == 1) && (comid == cfg.com_id))
+  {
+    process((uint8_t const*)data, bcount * ATA_BLOCK_SIZE);
+  }
+  else
+  {
+    throw topaz_exception("Simulated TPer: IF-SEND to unknown protocol / ComID");
+  }
+}
+
+/**
+ * if_recv (TCG Opal IF-RECV)
+ */
+void simdrive::if_recv(uint8_t proto, uint16_t comid, void *data, uint8_t bcount)
+{
+  TOPAZ_ALLOC_SITE(site, ALLOC_SIMULATED);
+  size_t len = bcount * ATA_BLOCK_SIZE;
+
+  counters.recvs++;
+  service(lat.next("recv"));
+  memset(data, 0, len);
+
+  if ((proto == 0) && (comid == 0))
+  {
+    // Supported security protocols
+    tpm_protos_t *protos = (tpm_protos_t*)data;
+    protos->list_len = htobe16(3);
+    protos->list[0] = 0x00;
+    protos->list[1] = 0x01;
+    protos->list[2] = 0x02;
+  }
+  else if ((proto == 1) && (comid == 1))
+  {
+    level0((uint8_t*)data, len);
+  }
+  else if ((proto == 2) && (comid == cfg.com_id))
+  {
+    // Result of STACK_RESET
+    opal_comid_resp_t *resp = (opal_comid_resp_t*)data;
+    resp->com_id   = htobe16(cfg.com_id);
+    resp->req_code = htobe32(comid_reset ? 0x02 : 0);
+    resp->avail_data = htobe32(comid_reset ? 4 : 0);
+    comid_reset = false;
+  }
+  else if ((proto == 1) && (comid == cfg.com_id))
+  {
+    opal_header_t *header = (opal_header_t*)data;
+    header->com_hdr.com_id = htobe16(cfg.com_id);
+
+    // Nothing yet (or still busy)
+    if (response.empty() || (sim_clock::now() < ready))
+    {
+      counters.polls++;
+      return;
+    }
+
+    // Too big for host buffer, say how much is needed
+    if (response.size() > len)
+    {
+      header->com_hdr.tper_left = htobe32(response.size());
+      header->com_hdr.min_xfer  = htobe32(response.size());
+      return;
+    }
+
+    memcpy(data, &(response[0]), response.size());
+    response.clear();
+  }
+  else
+  {
+    throw topaz_exception("Simulated TPer: IF-RECV from unknown protocol / ComID");
+  }
+}
+
+/**
+ * \brief Fill Level 0 discovery response
+ */
+void simdrive::level0(uint8_t *data, size_t len)
+{
+  level0_header_t *header = (level0_header_t*)data;
+  uint8_t *pos = data + sizeof(level0_header_t);
+  level0_feat_t *feat;
+
+  // TPer - Sync, ComID management
+  feat = (level0_feat_t*)pos;
+  feat->code = htobe16(FEAT_TPER);
+  feat->version = 0x10;
+  feat->length = 12;
+  pos += sizeof(level0_feat_t);
+  pos[0] = 0x41;
+  pos += feat->length;
+
+  // Locking - Supported, Enabled, Locked, Media Encryption, MBR Enabled/Done
+  bool active = (admin_sp[LOCKING_SP][6].get_uint() == SP_ACTIVE);
+  bool locked = false;
+  for (unsigned i = 0; i <= cfg.ranges; i++)
+  {
+    row_t &range = locking_sp[i ? LBA_RANGE_BASE + i : LBA_RANGE_GLOBAL];
+    locked = locked || (range[5].get_uint() && range[7].get_uint());
+    locked = locked || (range[6].get_uint() && range[8].get_uint());
+  }
+  feat = (level0_feat_t*)pos;
+  feat->code = htobe16(FEAT_LOCK);
+  feat->version = 0x10;
+  feat->length = 12;
+  pos += sizeof(level0_feat_t);
+  pos[0] = (0x01 | (active ? 0x02 : 0) | (locked ? 0x04 : 0) | 0x08 |
+	    (locking_sp[MBR_CONTROL][1].get_uint() ? 0x10 : 0) |
+	    (locking_sp[MBR_CONTROL][2].get_uint() ? 0x20 : 0));
+  pos += feat->length;
+
+  // Geometry - 512 byte sectors, no alignment
+  feat = (level0_feat_t*)pos;
+  feat->code = htobe16(FEAT_GEO);
+  feat->version = 0x10;
+  feat->length = sizeof(feat_geo_t);
+  pos += sizeof(level0_feat_t);
+  feat_geo_t *geo = (feat_geo_t*)pos;
+  geo->lba_size   = htobe32(ATA_BLOCK_SIZE);
+  geo->align_gran = htobe64(1);
+  pos += feat->length;
+
+  // Opal 2.0 SSC
+  feat = (level0_feat_t*)pos;
+  feat->code = htobe16(FEAT_OPAL2);
+  feat->version = 0x10;
+  feat->length = 16;
+  pos += sizeof(level0_feat_t);
+  feat_opal2_t *opal2 = (feat_opal2_t*)pos;
+  opal2->comid_base  = htobe16(cfg.com_id);
+  opal2->comid_count = htobe16(1);
+  opal2->admin_count = htobe16(cfg.admins);
+  opal2->user_count  = htobe16(cfg.users);
+  pos += feat->length;
+
+  // Length excludes itself
+  header->length    = htobe32((pos - data) - 4);
+  header->major_ver = htobe16(0);
+  header->minor_ver = htobe16(1);
+  strncpy(header->vendor, "topaz simulated TPer", sizeof(header->vendor));
+}
+
+/**
+ * \brief Run every call in an inbound ComPkt, queue response
+ */
+void simdrive::process(uint8_t const *data, size_t len)
+{
+  opal_header_t const *header = (opal_header_t const*)data;
+  uint8_t const *payload = data + sizeof(opal_header_t);
+  size_t sub_len = be32toh(header->sub_hdr.length), offset = 0;
+  vector<uint8_t> out;
+  unsigned usec = 0;
+
+  if (sub_len > len - sizeof(opal_header_t))
+  {
+    throw topaz_exception("Simulated TPer: SubPacket overruns ComPkt");
+  }
+
+  // Calls only reach the open session with matching IDs
+  bool in_session = (session_sp &&
+		     (be32toh(header->pkt_hdr.tper_session_id) == tper_session_id) &&
+		     (be32toh(header->pkt_hdr.host_session_id) == host_session_id));
+
+  while (offset < sub_len)
+  {
+    // End of session is a single token, answered in kind
+    if (payload[offset] == datum::TOK_END_SESSION)
+    {
+      if (in_session)
+      {
+	session_sp = 0;
+	session_auth = 0;
+	tper_session_id = 0;
+	host_session_id = 0;
+      }
+      out.push_back(datum::TOK_END_SESSION);
+      usec += lat.next("EndSession");
+      break;
+    }
+
+    // Method call, then its status list
+    datum call;
+    offset += call.decode_bytes(payload + offset, sub_len - offset);
+    if ((call.get_type() != datum::METHOD) || (sub_len - offset < 6) ||
+	(payload[offset] != datum::TOK_END_OF_DATA))
+    {
+      throw topaz_exception("Simulated TPer: malformed method call");
+    }
+    offset += 6;
+    counters.methods++;
+    char const *name = method_name(call.method_uid());
+    name = (name ? name : "other");
+    usec += lat.next(name);
+
+    // Run it
+    datum result(datum::LIST);
+    unsigned status = execute(call, result, in_session);
+    TOPAZ_DEBUG(4)
+    {
+      printf("Simulated TPer: %s <STATUS=%u>\n", name, status);
+    }
+
+    // Result, then status list
+    size_t at = out.size();
+    out.resize(at + result.size());
+    result.encode_bytes(&(out[at]));
+    uint8_t tail[] = { datum::TOK_END_OF_DATA, datum::TOK_START_LIST,
+		       (uint8_t)status, 0, 0, datum::TOK_END_LIST };
+    out.insert(out.end(), tail, tail + sizeof(tail));
+
+    // TPer stops at first failure, rest of ComPkt goes unanswered
+    if (status)
+    {
+      break;
+    }
+
+    // Revert ends the session on the spot
+    if (!session_sp)
+    {
+      in_session = false;
+    }
+  }
+  counters.packets++;
+
+  // Wrap response in ComPkt headers
+  size_t pkt_size = PAD_TO_MULTIPLE(out.size() + sizeof(opal_sub_packet_header_t), 4);
+  size_t com_size = pkt_size + sizeof(opal_packet_header_t);
+  response.assign(PAD_TO_MULTIPLE(com_size + sizeof(opal_com_packet_header_t),
+				  ATA_BLOCK_SIZE), 0);
+  opal_header_t *resp = (opal_header_t*)&(response[0]);
+  resp->com_hdr.com_id = htobe16(cfg.com_id);
+  resp->com_hdr.length = htobe32(com_size);
+  resp->pkt_hdr.tper_session_id = header->pkt_hdr.tper_session_id;
+  resp->pkt_hdr.host_session_id = header->pkt_hdr.host_session_id;
+  resp->pkt_hdr.length = htobe32(pkt_size);
+  resp->sub_hdr.length = htobe32(out.size());
+  if (out.size())
+  {
+    memcpy(&(response[0]) + sizeof(opal_header_t), &(out[0]), out.size());
+  }
+
+  // Busy until all of the methods' service time has passed
+  ready = sim_clock::now() + chrono::microseconds(usec);
+}
+
+/**
+ * \brief Execute single method call
+ */
+unsigned simdrive::execute(datum const &call, datum &result, bool in_session)
+{
+  uint64_t obj = call.object_uid(), method = call.method_uid();
+
+  // Session manager is stateless
+  if (obj == SESSION_MGR)
+  {
+    return session_mgr(call, result);
+  }
+  if (!in_session)
+  {
+    return datum::STA_NOT_AUTHORIZED;
+  }
+
+  sp_tables_t &tables = (session_sp == ADMIN_SP ? admin_sp : locking_sp);
+  sp_tables_t::iterator row = tables.find(obj);
+
+  if (method == GET)
+  {
+    if ((row == tables.end()) && !((session_sp == LOCKING_SP) && (obj == MBR)))
+    {
+      return datum::STA_INVALID_PARAMETER;
+    }
+    return method_get(row == tables.end() ? NULL : &(row->second), call, result);
+  }
+  else if (method == SET)
+  {
+    if ((row == tables.end()) && !((session_sp == LOCKING_SP) && (obj == MBR)))
+    {
+      return datum::STA_INVALID_PARAMETER;
+    }
+    return method_set(row == tables.end() ? NULL : &(row->second), call);
+  }
+  else if (method == GENKEY)
+  {
+    // Locking SP admins only, on media keys
+    if (keys.find(obj) == keys.end())
+    {
+      return datum::STA_INVALID_PARAMETER;
+    }
+    if ((session_sp != LOCKING_SP) || !may_write(obj, 0))
+    {
+      return datum::STA_NOT_AUTHORIZED;
+    }
+    keys[obj]++;
+    return datum::STA_SUCCESS;
+  }
+  else if (method == ACTIVATE)
+  {
+    if ((session_sp != ADMIN_SP) || (obj != LOCKING_SP))
+    {
+      return datum::STA_INVALID_PARAMETER;
+    }
+    if (session_auth != SID)
+    {
+      return datum::STA_NOT_AUTHORIZED;
+    }
+
+    // Admin1 takes over SID's PIN
+    if (admin_sp[LOCKING_SP][6].get_uint() == SP_INACTIVE)
+    {
+      reset_locking_sp();
+      admin_sp[LOCKING_SP][6] = atom::new_uint(SP_ACTIVE);
+      locking_sp[C_PIN_ADMIN_BASE + 1][3] = admin_sp[C_PIN_SID][3];
+    }
+    return datum::STA_SUCCESS;
+  }
+  else if (method == REVERT)
+  {
+    if ((session_sp != ADMIN_SP) || (obj != ADMIN_SP))
+    {
+      return datum::STA_INVALID_PARAMETER;
+    }
+    if ((session_auth != SID) && (session_auth != PSID))
+    {
+      return datum::STA_NOT_AUTHORIZED;
+    }
+
+    // Back to factory, session ends with it
+    factory_reset();
+    return datum::STA_SUCCESS;
+  }
+  else if (method == REVERT_SP)
+  {
+    if ((session_sp != LOCKING_SP) || (obj != THIS_SP))
+    {
+      return datum::STA_INVALID_PARAMETER;
+    }
+    if (!may_write(obj, 0))
+    {
+      return datum::STA_NOT_AUTHORIZED;
+    }
+
+    // Locking SP back to inactive, data gone, session ends with it
+    reset_locking_sp();
+    admin_sp[LOCKING_SP][6] = atom::new_uint(SP_INACTIVE);
+    session_sp = 0;
+    session_auth = 0;
+    tper_session_id = 0;
+    host_session_id = 0;
+    return datum::STA_SUCCESS;
+  }
+
+  return datum::STA_INVALID_PARAMETER;
+}
+
+/**
+ * \brief Session Manager calls (Properties, StartSession)
+ */
+unsigned simdrive::session_mgr(datum const &call, datum &result)
+{
+  if (call.method_uid() == PROPERTIES)
+  {
+    datum tper(datum::LIST), host(datum::LIST);
+    char const *tper_names[] = {
+      "MaxComPacketSize", "MaxResponseComPacketSize", "MaxPacketSize",
+      "MaxIndTokenSize", "MaxPackets", "MaxSubpackets", "MaxMethods",
+      "MaxSessions", "MaxAuthentications", "MaxTransactionLimit", "DefSessionTimeout"
+    };
+    uint64_t tper_vals[] = {
+      cfg.max_com_pkt, cfg.max_com_pkt, cfg.max_com_pkt - 20,
+      cfg.max_com_pkt - 56, 1, 1, cfg.max_methods,
+      1, 2, 1, 0
+    };
+    size_t i, j;
+
+    // Our own communication properties
+    for (i = 0; i < sizeof(tper_vals) / sizeof(tper_vals[0]); i++)
+    {
+      tper[i].name()        = atom::new_bin(tper_names[i]);
+      tper[i].named_value() = atom::new_uint(tper_vals[i]);
+    }
+
+    // Host's, as offered (MaxMethods capped to ours) or defaulted
+    datum const *offered = find_param(call, 0);
+    for (i = 0; i < sizeof(host_prop_defaults) / sizeof(host_prop_defaults[0]); i++)
+    {
+      uint64_t val = host_prop_defaults[i];
+      for (j = 0; offered && (offered->get_type() == datum::LIST) &&
+	     (j < offered->list().size()); j++)
+      {
+	datum const &prop = offered->list()[j];
+	if ((prop.get_type() == datum::NAMED) &&
+	    (prop.name().get_type() == atom::BYTES) &&
+	    (prop.name().get_string() == host_prop_names[i]) &&
+	    (prop.named_value().get_type() == datum::ATOM))
+	{
+	  val = prop.named_value().value().try_get_uint().value_or(val);
+	}
+      }
+      if ((strcmp(host_prop_names[i], "MaxMethods") == 0) && (val > cfg.max_methods))
+      {
+	val = cfg.max_methods;
+      }
+      host[i].name()        = atom::new_bin(host_prop_names[i]);
+      host[i].named_value() = atom::new_uint(val);
+    }
+
+    // Answered as Properties[TPerProperties, HostProperties = ...]
+    result = datum();
+    result.object_uid() = SESSION_MGR;
+    result.method_uid() = PROPERTIES;
+    result[0] = std::move(tper);
+    result[1].name() = atom::new_uint(0);
+    result[1].named_value() = std::move(host);
+    return datum::STA_SUCCESS;
+  }
+  else if (call.method_uid() == START_SESSION)
+  {
+    datum_vector const &params = call.list();
+    if ((params.size() < 3) || (params[0].get_type() != datum::ATOM) ||
+	(params[1].get_type() != datum::ATOM))
+    {
+      return datum::STA_INVALID_PARAMETER;
+    }
+    optional<uint64_t> host_id = params[0].value().try_get_uint();
+    optional<uint64_t> sp = params[1].value().try_get_uid();
+    if (!host_id || !sp || ((*sp != ADMIN_SP) && (*sp != LOCKING_SP)))
+    {
+      return datum::STA_INVALID_PARAMETER;
+    }
+    if ((*sp == LOCKING_SP) && (admin_sp[LOCKING_SP][6].get_uint() != SP_ACTIVE))
+    {
+      return datum::STA_INVALID_PARAMETER;
+    }
+    if (session_sp)
+    {
+      return datum::STA_NO_SESSIONS_AVAILABLE;
+    }
+
+    // Authority and challenge, if any
+    uint64_t auth = 0;
+    datum const *signer = find_param(call, 3);
+    datum const *challenge = find_param(call, 0);
+    if (signer)
+    {
+      optional<uint64_t> uid = signer->value().try_get_uid();
+      uint64_t pin_uid = 0;
+      if (!uid)
+      {
+	return datum::STA_INVALID_PARAMETER;
+      }
+      auth = *uid;
+
+      // Which PIN goes with authority
+      if (*sp == ADMIN_SP)
+      {
+	pin_uid = (auth == SID ? C_PIN_SID : (auth == PSID ? C_PIN_PSID : 0));
+      }
+      else if (auth_index(auth, ADMIN_BASE, cfg.admins) && locking_sp[auth][5].get_uint())
+      {
+	pin_uid = C_PIN_ADMIN_BASE + auth_index(auth, ADMIN_BASE, cfg.admins);
+      }
+      else if (auth_index(auth, USER_BASE, cfg.users) && locking_sp[auth][5].get_uint())
+      {
+	pin_uid = C_PIN_USER_BASE + auth_index(auth, USER_BASE, cfg.users);
+      }
+      if (pin_uid == 0)
+      {
+	return datum::STA_NOT_AUTHORIZED;
+      }
+
+      // Challenge must match stored PIN
+      atom const &pin = (*sp == ADMIN_SP ? admin_sp : locking_sp)[pin_uid][3];
+      if (!challenge || (challenge->get_type() != datum::ATOM) ||
+	  (challenge->value().get_type() != atom::BYTES) ||
+	  (challenge->value().get_bin_size() != pin.get_bin_size()) ||
+	  memcmp(challenge->value().get_bin_data(), pin.get_bin_data(), pin.get_bin_size()))
+      {
+	return datum::STA_NOT_AUTHORIZED;
+      }
+    }
+
+    // Open it
+    session_sp = *sp;
+    session_auth = auth;
+    host_session_id = *host_id;
+    tper_session_id = next_session_id++;
+
+    // Answered as SyncSession[HostSessionID, SPSessionID]
+    result = datum();
+    result.object_uid() = SESSION_MGR;
+    result.method_uid() = SYNC_SESSION;
+    result[0] = atom::new_uint(host_session_id);
+    result[1] = atom::new_uint(tper_session_id);
+    return datum::STA_SUCCESS;
+  }
+
+  return datum::STA_INVALID_PARAMETER;
+}
+
+/**
+ * \brief Get[] on object or byte table
+ */
+unsigned simdrive::method_get(row_t *row, datum const &call, datum &result)
+{
+  datum const *cells = NULL;
+  if ((call.list().size() > 0) && (call.list()[0].get_type() == datum::LIST))
+  {
+    cells = &(call.list()[0]);
+  }
+
+  // Anonymous sessions may only read the MSID and SP life cycles
+  if ((session_auth == 0) && (call.object_uid() != C_PIN_MSID) &&
+      (call.object_uid() != ADMIN_SP) && (call.object_uid() != LOCKING_SP))
+  {
+    return datum::STA_NOT_AUTHORIZED;
+  }
+
+  // Byte table - startRow(1) / endRow(2) inclusive
+  if (row == NULL)
+  {
+    uint64_t first = cell_uint(cells, 1, 0);
+    uint64_t last  = cell_uint(cells, 2, first);
+    if ((first > last) || (last >= mbr.size()) || (last - first + 1 > cfg.max_com_pkt / 2))
+    {
+      return datum::STA_INVALID_PARAMETER;
+    }
+    result[0] = atom::new_bin(&(mbr[first]), last - first + 1);
+    return datum::STA_SUCCESS;
+  }
+
+  // Object - startColumn(3) / endColumn(4) inclusive
+  uint64_t first = cell_uint(cells, 3, 0);
+  uint64_t last  = cell_uint(cells, 4, UINT64_MAX);
+  bool is_pin = (_UID_HIGH(call.object_uid()) == 0xb) && (call.object_uid() != C_PIN_MSID);
+  datum cols(datum::LIST);
+  size_t n = 0;
+  for (row_t::const_iterator it = row->begin(); it != row->end(); it++)
+  {
+    // PINs are never readable (except MSID)
+    if ((it->first < first) || (it->first > last) || (is_pin && (it->first == 3)))
+    {
+      continue;
+    }
+    cols[n].name()        = atom::new_uint(it->first);
+    cols[n].named_value() = it->second;
+    n++;
+  }
+  result[0] = std::move(cols);
+  return datum::STA_SUCCESS;
+}
+
+/**
+ * \brief Set[] on object or byte table
+ */
+unsigned simdrive::method_set(row_t *row, datum const &call)
+{
+  datum const *where  = find_param(call, 0);
+  datum const *values = find_param(call, 1);
+
+  if (values == NULL)
+  {
+    return datum::STA_INVALID_PARAMETER;
+  }
+
+  // Byte table - Where(0) = offset, Values(1) = bytes
+  if (row == NULL)
+  {
+    uint64_t offset = 0;
+    if (!may_write(call.object_uid(), 0))
+    {
+      return datum::STA_NOT_AUTHORIZED;
+    }
+    if (where && (where->get_type() == datum::ATOM))
+    {
+      offset = where->value().try_get_uint().value_or(UINT64_MAX);
+    }
+    if ((values->get_type() != datum::ATOM) || (values->value().get_type() != atom::BYTES) ||
+	(offset > mbr.size()) || (values->value().get_bin_size() > mbr.size() - offset))
+    {
+      return datum::STA_INVALID_PARAMETER;
+    }
+    if (values->value().get_bin_size())
+    {
+      memcpy(&(mbr[offset]), values->value().get_bin_data(), values->value().get_bin_size());
+    }
+    return datum::STA_SUCCESS;
+  }
+
+  // Object - Values(1) = [col = val ...], checked before any is applied
+  if (values->get_type() != datum::LIST)
+  {
+    return datum::STA_INVALID_PARAMETER;
+  }
+  datum_vector const &cols = values->list();
+  size_t i;
+  for (i = 0; i < cols.size(); i++)
+  {
+    optional<uint64_t> col;
+    if ((cols[i].get_type() == datum::NAMED) && (cols[i].named_value().get_type() == datum::ATOM))
+    {
+      col = cols[i].name().try_get_uint();
+    }
+    if (!col || (row->find(*col) == row->end()))
+    {
+      return datum::STA_INVALID_PARAMETER;
+    }
+    if (!may_write(call.object_uid(), *col))
+    {
+      return datum::STA_NOT_AUTHORIZED;
+    }
+  }
+  for (i = 0; i < cols.size(); i++)
+  {
+    (*row)[cols[i].name().get_uint()] = cols[i].named_value().value();
+  }
+  return datum::STA_SUCCESS;
+}
+
+/**
+ * \brief May current session authority write to object?
+ */
+bool simdrive::may_write(uint64_t obj_uid, uint64_t col) const
+{
+  if (session_sp == ADMIN_SP)
+  {
+    // SID owns the Admin SP, PSID may only revert
+    return (session_auth == SID);
+  }
+  if (session_sp == LOCKING_SP)
+  {
+    // Admins own the Locking SP, users may change their own PIN
+    if (auth_index(session_auth, ADMIN_BASE, cfg.admins))
+    {
+      return true;
+    }
+    uint64_t user = auth_index(session_auth, USER_BASE, cfg.users);
+    return (user && (obj_uid == C_PIN_USER_BASE + user) && (col == 3));
+  }
+  return false;
+}
+
+/**
+ * \brief Apply service time, in microseconds
+ */
+void simdrive::service(unsigned usec)
+{
+  if (usec)
+  {
+    this_thread::sleep_for(chrono::microseconds(usec));
+  }
+}
@@ -0,0 +1,315 @@
+#ifndef TOPAZ_SIMDRIVE_H
+#define TOPAZ_SIMDRIVE_H
+
+/**
+ * Topaz - Simulated Drive
+ *
+ * This file implements an in-process software TPer behind the transport
+ * interface, so session, batching and codec paths can be exercised (and
+ * timed) without a self-encrypting drive. It covers Level 0 discovery,
+ * Properties, Start/End Session, Get/Set on Admin SP and Locking SP tables,
+ * GenKey, Activate, Revert / RevertSP and the MBR byte table, with service
+ * times drawn from a configurable (or replayed) latency profile.
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+#include <topaz/atom.h>
+#include <topaz/datum.h>
+#include <topaz/transport.h>
+
+namespace topaz
+{
+
+  // Shape of the simulated drive
+  struct sim_config
+  {
+    uint16_t    com_id      = 0x1000;   // Base ComID in discovery
+    unsigned    max_methods = 8;        // MaxMethods per ComPkt
+    uint32_t    max_com_pkt = 65536;    // MaxComPacketSize
+    unsigned    admins      = 4;        // Locking SP admins
+    unsigned    users       = 8;        // Locking SP users
+    unsigned    ranges      = 8;        // Locking ranges besides global
+    size_t      mbr_size    = 1 << 20;  // Shadow MBR table size in bytes
+    std::string msid        = "SIMULATED-MSID";
+    std::string psid        = "SIMULATED-PSID";
+    std::string serial;                 // Keys device lease (none if empty)
+  };
+
+  // Traffic seen by the simulated drive
+  typedef struct
+  {
+    uint64_t sends;    // IF-SEND commands
+    uint64_t recvs;    // IF-RECV commands
+    uint64_t polls;    // IF-RECV answered "no data yet"
+    uint64_t packets;  // ComPkts carrying method calls
+    uint64_t methods;  // Method calls executed
+  } sim_stats;
+
+  /**
+   * \brief Service Time Model
+   *
+   * Each operation ("send", "recv", or a method name such as "Get",
+   * "GenKey", "StartSession") has one or more samples in microseconds.
+   * Samples are handed out round robin, so a profile measured on a real
+   * drive replays in order. Operations without samples fall back to
+   * "default", then zero.
+   */
+  class sim_latency
+  {
+
+  public:
+
+    /**
+     * \brief Constructor (all service times zero)
+     */
+    sim_latency();
+
+    /**
+     * \brief Load profile
+     *
+     * One operation per line, "<op> <usec> [usec ...]", '#' starts a comment.
+     *
+     * @param path Profile file
+     */
+    void load(char const *path);
+
+    /**
+     * \brief Set fixed service time for operation
+     *
+     * @param op Operation name
+     * @param usec Service time in microseconds
+     */
+    void set(std::string const &op, unsigned usec);
+
+    /**
+     * \brief Append measured sample for operation
+     *
+     * @param op Operation name
+     * @param usec Service time in microseconds
+     */
+    void add_sample(std::string const &op, unsigned usec);
+
+    /**
+     * \brief Next service time for operation
+     *
+     * @param op Operation name
+     * @return Service time in microseconds
+     */
+    unsigned next(std::string const &op);
+
+  protected:
+
+    // Samples and replay position per operation
+    std::map<std::string, std::vector<unsigned> > samples;
+    std::map<std::string, size_t> cursor;
+
+  };
+
+  class simdrive : public transport
+  {
+
+  public:
+
+    /**
+     * \brief Simulated Drive Constructor (factory fresh)
+     *
+     * @param cfg Shape of the drive
+     * @param lat Service time model
+     */
+    simdrive(sim_config const &cfg = sim_config(),
+	     sim_latency const &lat = sim_latency());
+
+    /**
+     * \brief Simulated Drive Destructor
+     */
+    virtual ~simdrive();
+
+    /**
+     * if_send (TCG Opal IF-SEND)
+     *
+     * @param protocol Security Protocol
+     * @param comid    Protocol ComId
+     * @param data     Data buffer
+     * @param bcount   Size of data buffer in 512 byte blocks
+     */
+    virtual void if_send(uint8_t proto, uint16_t comid,
+			 void *data, uint8_t bcount);
+
+    /**
+     * if_recv (TCG Opal IF-RECV)
+     *
+     * @param protocol Security Protocol
+     * @param comid    Protocol ComId
+     * @param data     Data buffer
+     * @param bcount   Size of data buffer in 512 byte blocks
+     */
+    virtual void if_recv(uint8_t proto, uint16_t comid,
+			 void *data, uint8_t bcount);
+
+    /**
+     * device_id
+     *
+     * "sim-<serial>", none unless configured with a serial
+     */
+    virtual std::string device_id() const;
+
+    /**
+     * \brief Simulate power cycle
+     *
+     * Sessions are dropped, LockOnReset ranges lock and MBR Done clears.
+     */
+    void power_cycle();
+
+    /**
+     * \brief Return to factory state (as if by PSID revert)
+     */
+    void factory_reset();
+
+    /**
+     * \brief Query traffic counters
+     */
+    sim_stats const &stats() const;
+
+    /**
+     * \brief Clear traffic counters
+     */
+    void reset_stats();
+
+    /**
+     * \brief Service time model in use
+     */
+    sim_latency &latency();
+
+    /**
+     * \brief Query how many times a media key was regenerated
+     *
+     * @param key_uid Key object (K_AES_256 row)
+     */
+    uint64_t key_generation(uint64_t key_uid) const;
+
+    /**
+     * \brief Query Shadow MBR contents
+     */
+    std::vector<uint8_t> const &mbr_data() const;
+
+  protected:
+
+    // Columns of one table row
+    typedef std::map<uint64_t, atom> row_t;
+
+    // Rows of one SP, keyed by object UID
+    typedef std::map<uint64_t, row_t> sp_tables_t;
+
+    typedef std::chrono::steady_clock sim_clock;
+
+    /**
+     * \brief Build Locking SP tables (inactive until activated)
+     */
+    void reset_locking_sp();
+
+    /**
+     * \brief Fill Level 0 discovery response
+     *
+     * @param data Data buffer
+     * @param len  Size of data buffer
+     */
+    void level0(uint8_t *data, size_t len);
+
+    /**
+     * \brief Run every call in an inbound ComPkt, queue response
+     *
+     * @param data ComPkt
+     * @param len  Size of ComPkt
+     */
+    void process(uint8_t const *data, size_t len);
+
+    /**
+     * \brief Execute single method call
+     *
+     * @param call Method call
+     * @param result Returned data
+     * @param in_session Call arrived with current session IDs
+     * @return Method status
+     */
+    unsigned execute(datum const &call, datum &result, bool in_session);
+
+    /**
+     * \brief Session Manager calls (Properties, StartSession)
+     */
+    unsigned session_mgr(datum const &call, datum &result);
+
+    /**
+     * \brief Get[] on object or byte table
+     */
+    unsigned method_get(row_t *row, datum const &call, datum &result);
+
+    /**
+     * \brief Set[] on object or byte table
+     */
+    unsigned method_set(row_t *row, datum const &call);
+
+    /**
+     * \brief May current session authority write to object?
+     */
+    bool may_write(uint64_t obj_uid, uint64_t col) const;
+
+    /**
+     * \brief Apply service time, in microseconds
+     */
+    void service(unsigned usec);
+
+    // Configuration
+    sim_config  cfg;
+    sim_latency lat;
+
+    // Persistent state
+    sp_tables_t admin_sp;
+    sp_tables_t locking_sp;
+    std::map<uint64_t, uint64_t> keys;
+    std::vector<uint8_t> mbr;
+
+    // Session state
+    uint64_t session_sp;
+    uint64_t session_auth;
+    uint32_t tper_session_id;
+    uint32_t host_session_id;
+    uint32_t next_session_id;
+
+    // Pending response, and when the TPer is done with it
+    std::vector<uint8_t> response;
+    sim_clock::time_point ready;
+    bool comid_reset;
+
+    sim_stats counters;
+
+  };
+
+};
+
+#endif
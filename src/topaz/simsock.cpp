@@ -0,0 +1,428 @@
+/**
+ * Topaz - Simulated Drives over Unix Socket
+ *
+ * This file implements a server that owns a set of simulated drives and
+ * answers IF-SEND / IF-RECV frames over a Unix domain socket, and the
+ * matching client transport.
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <topaz/debug.h>
+#include <topaz/defs.h>
+#include <topaz/exceptions.h>
+#include <topaz/simsock.h>
+using namespace std;
+using namespace topaz;
+
+namespace
+{
+
+  // Largest IF-SEND / IF-RECV payload (8 bit block count)
+  const size_t MAX_FRAME = 255 * ATA_BLOCK_SIZE;
+
+  // How often run() looks for a stop request (ms)
+  const int ACCEPT_POLL_MS = 200;
+
+  // Read exactly len bytes, false on hang up or error
+  bool read_all(int fd, void *data, size_t len)
+  {
+    uint8_t *ptr = (uint8_t*)data;
+    while (len)
+    {
+      ssize_t got = read(fd, ptr, len);
+      if (got < 0 && errno == EINTR)
+      {
+	continue;
+      }
+      if (got <= 0)
+      {
+	return false;
+      }
+      ptr += got;
+      len -= got;
+    }
+    return true;
+  }
+
+  // Write exactly len bytes, false on hang up or error
+  bool write_all(int fd, void const *data, size_t len)
+  {
+    uint8_t const *ptr = (uint8_t const*)data;
+    while (len)
+    {
+      ssize_t put = send(fd, ptr, len, MSG_NOSIGNAL);
+      if (put < 0 && errno == EINTR)
+      {
+	continue;
+      }
+      if (put <= 0)
+      {
+	return false;
+      }
+      ptr += put;
+      len -= put;
+    }
+    return true;
+  }
+
+  // Fill in socket address, checking it fits
+  void make_addr(sockaddr_un &addr, char const *path)
+  {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+      throw topaz_exception("Simulated drive socket path too long");
+    }
+    strcpy(addr.sun_path, path);
+  }
+
+};
+
+/**
+ * \brief Simulated Drive Server Constructor
+ */
+sim_server::sim_server(string const &path, unsigned count,
+		       sim_config const &cfg, sim_latency const &lat)
+  : path(path), stopping(false)
+{
+  sockaddr_un addr;
+
+  // Drives, each independent
+  for (unsigned i = 0; i < count; i++)
+  {
+    drives.push_back(unique_ptr<simdrive>(new simdrive(cfg, lat)));
+    locks.push_back(unique_ptr<mutex>(new mutex()));
+  }
+
+  // Listen, replacing any stale socket left by a previous server
+  make_addr(addr, path.c_str());
+  listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_fd == -1)
+  {
+    throw topaz_exception("Cannot create simulated drive socket");
+  }
+  unlink(path.c_str());
+  if ((bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) == -1) ||
+      (listen(listen_fd, 64) == -1))
+  {
+    // Constructor not done, destructor won't be called ...
+    close(listen_fd);
+    throw topaz_exception("Cannot listen on simulated drive socket");
+  }
+  TOPAZ_DEBUG(1) printf("Serving %u simulated drives on %s\n", count, path.c_str());
+}
+
+/**
+ * \brief Simulated Drive Server Destructor
+ */
+sim_server::~sim_server()
+{
+  close(listen_fd);
+  unlink(path.c_str());
+}
+
+/**
+ * \brief Serve clients until stopped
+ */
+void sim_server::run()
+{
+  while (!stopping)
+  {
+    pollfd pfd = {listen_fd, POLLIN, 0};
+    if (poll(&pfd, 1, ACCEPT_POLL_MS) <= 0)
+    {
+      continue;
+    }
+    int client = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (client == -1)
+    {
+      continue;
+    }
+
+    // One thread per client, it hangs up when done
+    unique_lock<mutex> guard(client_lock);
+    clients.push_back(client);
+    thread(&sim_server::serve, this, client).detach();
+  }
+
+  // Hang up on everybody, and wait for their threads to finish
+  unique_lock<mutex> guard(client_lock);
+  for (size_t i = 0; i < clients.size(); i++)
+  {
+    shutdown(clients[i], SHUT_RDWR);
+  }
+  client_done.wait(guard, [this] { return clients.empty(); });
+  stopping = false;
+}
+
+/**
+ * \brief Ask run() to return
+ */
+void sim_server::stop()
+{
+  stopping = true;
+}
+
+/**
+ * \brief Number of drives served
+ */
+size_t sim_server::size() const
+{
+  return drives.size();
+}
+
+/**
+ * \brief Access simulated drive
+ */
+simdrive &sim_server::at(size_t index)
+{
+  return *(drives.at(index));
+}
+
+/**
+ * \brief Answer frames from one client until it hangs up
+ */
+void sim_server::serve(int client)
+{
+  vector<uint8_t> buf;
+  sim_frame_req req;
+
+  while (read_all(client, &req, sizeof(req)))
+  {
+    sim_frame_resp resp = {0, 0};
+    string error;
+
+    // IF-SEND / IF-RECV payloads are whole blocks
+    if ((req.len > MAX_FRAME) ||
+	((req.op != SIM_OP_COUNT) && (req.len % ATA_BLOCK_SIZE)))
+    {
+      break;
+    }
+    buf.assign(req.len, 0);
+    if ((req.op == SIM_OP_SEND) && !read_all(client, buf.data(), req.len))
+    {
+      break;
+    }
+
+    // Run it against the drive, exceptions go back as error text
+    try
+    {
+      if (req.op == SIM_OP_COUNT)
+      {
+	uint32_t count = drives.size();
+	buf.assign((uint8_t*)&count, (uint8_t*)&count + sizeof(count));
+      }
+      else if (req.index >= drives.size())
+      {
+	throw topaz_exception("Simulated TPer: no such drive");
+      }
+      else
+      {
+	lock_guard<mutex> guard(*(locks[req.index]));
+	uint8_t bcount = req.len / ATA_BLOCK_SIZE;
+	if (req.op == SIM_OP_SEND)
+	{
+	  drives[req.index]->if_send(req.proto, req.comid, buf.data(), bcount);
+	  buf.clear();
+	}
+	else if (req.op == SIM_OP_RECV)
+	{
+	  drives[req.index]->if_recv(req.proto, req.comid, buf.data(), bcount);
+	}
+	else
+	{
+	  throw topaz_exception("Simulated TPer: unknown frame");
+	}
+      }
+    }
+    catch (topaz_exception &e)
+    {
+      error = e.what();
+      buf.assign(error.begin(), error.end());
+      resp.status = -1;
+    }
+
+    resp.len = buf.size();
+    if (!write_all(client, &resp, sizeof(resp)) ||
+	(buf.size() && !write_all(client, buf.data(), buf.size())))
+    {
+      break;
+    }
+  }
+
+  // Gone
+  lock_guard<mutex> guard(client_lock);
+  for (size_t i = 0; i < clients.size(); i++)
+  {
+    if (clients[i] == client)
+    {
+      clients.erase(clients.begin() + i);
+      break;
+    }
+  }
+  close(client);
+  client_done.notify_all();
+}
+
+/**
+ * \brief Socket Drive Constructor
+ */
+sockdrive::sockdrive(char const *path, unsigned index)
+  : index(index), id("sim-" + string(path) + "#" + to_string(index))
+{
+  sockaddr_un addr;
+
+  TOPAZ_DEBUG(1) printf("Opening simulated drive %u on %s ...\n", index, path);
+  make_addr(addr, path);
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+  {
+    throw topaz_exception("Cannot create simulated drive socket");
+  }
+  if (connect(fd, (sockaddr*)&addr, sizeof(addr)) == -1)
+  {
+    // Constructor not done, destructor won't be called ...
+    close(fd);
+    throw topaz_exception("Cannot connect to simulated drive server");
+  }
+
+  // Make sure the drive exists
+  try
+  {
+    if (index >= count())
+    {
+      throw topaz_exception("No such simulated drive on server");
+    }
+  }
+  catch (topaz_exception &e)
+  {
+    close(fd);
+    throw;
+  }
+}
+
+/**
+ * \brief Socket Drive Destructor
+ */
+sockdrive::~sockdrive()
+{
+  close(fd);
+}
+
+/**
+ * if_send (TCG Opal IF-SEND)
+ */
+void sockdrive::if_send(uint8_t proto, uint16_t comid, void *data, uint8_t bcount)
+{
+  exchange(SIM_OP_SEND, proto, comid, data, bcount * ATA_BLOCK_SIZE);
+}
+
+/**
+ * if_recv (TCG Opal IF-RECV)
+ */
+void sockdrive::if_recv(uint8_t proto, uint16_t comid, void *data, uint8_t bcount)
+{
+  size_t len = bcount * ATA_BLOCK_SIZE;
+  if (exchange(SIM_OP_RECV, proto, comid, data, len) != len)
+  {
+    throw topaz_exception("Short IF-RECV from simulated drive server");
+  }
+}
+
+/**
+ * device_id
+ */
+string sockdrive::device_id() const
+{
+  return id;
+}
+
+/**
+ * \brief Query number of drives on server
+ */
+unsigned sockdrive::count()
+{
+  uint32_t count = 0;
+  if (exchange(SIM_OP_COUNT, 0, 0, &count, sizeof(count)) != sizeof(count))
+  {
+    throw topaz_exception("Bad drive count from simulated drive server");
+  }
+  return count;
+}
+
+/**
+ * \brief One request / response exchange with server
+ */
+size_t sockdrive::exchange(uint8_t op, uint8_t proto, uint16_t comid,
+			   void *data, size_t len)
+{
+  sim_frame_req req;
+  sim_frame_resp resp;
+
+  // Request (payload only goes out with IF-SEND)
+  req.op    = op;
+  req.proto = proto;
+  req.comid = comid;
+  req.index = index;
+  req.len   = len;
+  if (!write_all(fd, &req, sizeof(req)) ||
+      ((op == SIM_OP_SEND) && !write_all(fd, data, len)))
+  {
+    throw topaz_exception("Lost connection to simulated drive server");
+  }
+
+  // Response, error text or data
+  if (!read_all(fd, &resp, sizeof(resp)))
+  {
+    throw topaz_exception("Lost connection to simulated drive server");
+  }
+  if (resp.status != 0)
+  {
+    string error(resp.len, '\0');
+    if (resp.len && !read_all(fd, &(error[0]), resp.len))
+    {
+      throw topaz_exception("Lost connection to simulated drive server");
+    }
+    throw topaz_exception(error);
+  }
+  if (resp.len > len)
+  {
+    throw topaz_exception("Oversized response from simulated drive server");
+  }
+  if (resp.len && !read_all(fd, data, resp.len))
+  {
+    throw topaz_exception("Lost connection to simulated drive server");
+  }
+  return resp.len;
+}
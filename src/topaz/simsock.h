@@ -0,0 +1,223 @@
+#ifndef TOPAZ_SIMSOCK_H
+#define TOPAZ_SIMSOCK_H
+
+/**
+ * Topaz - Simulated Drives over Unix Socket
+ *
+ * This file implements a server that owns a set of simulated drives and
+ * answers IF-SEND / IF-RECV frames over a Unix domain socket, and the
+ * matching client transport. Several processes may then share the same
+ * simulated drive, much as several tools share one real drive, so ComID
+ * resets and session collisions between processes can be exercised.
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <topaz/simdrive.h>
+
+namespace topaz
+{
+
+  // Frame operations
+  enum sim_op
+  {
+    SIM_OP_SEND  = 1,   // IF-SEND, payload follows
+    SIM_OP_RECV  = 2,   // IF-RECV, payload returned
+    SIM_OP_COUNT = 3    // Number of drives served
+  };
+
+  // Client -> server frame header (host byte order, same machine only)
+  typedef struct
+  {
+    uint8_t  op;        // sim_op
+    uint8_t  proto;     // Security Protocol
+    uint16_t comid;     // Protocol ComId
+    uint32_t index;     // Drive served by this server
+    uint32_t len;       // Payload size in bytes
+  } sim_frame_req;
+
+  // Server -> client frame header, followed by data or error text
+  typedef struct
+  {
+    int32_t  status;    // 0 - ok, else payload is error text
+    uint32_t len;       // Payload size in bytes
+  } sim_frame_resp;
+
+  class sim_server
+  {
+
+  public:
+
+    /**
+     * \brief Simulated Drive Server Constructor
+     *
+     * Socket is bound and listening once constructed, a stale socket
+     * file at path is replaced.
+     *
+     * @param path  Unix socket path
+     * @param count Number of drives to serve
+     * @param cfg   Shape of each drive
+     * @param lat   Service time model (each drive replays its own copy)
+     */
+    sim_server(std::string const &path, unsigned count,
+	       sim_config const &cfg = sim_config(),
+	       sim_latency const &lat = sim_latency());
+
+    /**
+     * \brief Simulated Drive Server Destructor (stops, removes socket)
+     */
+    ~sim_server();
+
+    /**
+     * \brief Serve clients until stopped
+     */
+    void run();
+
+    /**
+     * \brief Ask run() to return (safe from signal handlers and other threads)
+     */
+    void stop();
+
+    /**
+     * \brief Number of drives served
+     */
+    size_t size() const;
+
+    /**
+     * \brief Access simulated drive
+     *
+     * Not synchronized with clients, inspect while no client is active.
+     *
+     * @param index Drive number (as in "sim:path#index")
+     */
+    simdrive &at(size_t index);
+
+  protected:
+
+    /**
+     * \brief Answer frames from one client until it hangs up
+     *
+     * @param client Connected socket
+     */
+    void serve(int client);
+
+    // Drives, each behind its own lock (one command at a time, like hardware)
+    std::vector<std::unique_ptr<simdrive> > drives;
+    std::vector<std::unique_ptr<std::mutex> > locks;
+
+    // Listening socket
+    std::string path;
+    int listen_fd;
+    std::atomic<bool> stopping;
+
+    // Client connections, each answered by its own (detached) thread
+    std::mutex client_lock;
+    std::condition_variable client_done;
+    std::vector<int> clients;
+
+  };
+
+  class sockdrive : public transport
+  {
+
+  public:
+
+    /**
+     * \brief Socket Drive Constructor
+     *
+     * @param path  Unix socket of simulated drive server
+     * @param index Drive number on that server
+     */
+    sockdrive(char const *path, unsigned index);
+
+    /**
+     * \brief Socket Drive Destructor
+     */
+    virtual ~sockdrive();
+
+    /**
+     * if_send (TCG Opal IF-SEND)
+     *
+     * @param protocol Security Protocol
+     * @param comid    Protocol ComId
+     * @param data     Data buffer
+     * @param bcount   Size of data buffer in 512 byte blocks
+     */
+    virtual void if_send(uint8_t proto, uint16_t comid,
+			 void *data, uint8_t bcount);
+
+    /**
+     * if_recv (TCG Opal IF-RECV)
+     *
+     * @param protocol Security Protocol
+     * @param comid    Protocol ComId
+     * @param data     Data buffer
+     * @param bcount   Size of data buffer in 512 byte blocks
+     */
+    virtual void if_recv(uint8_t proto, uint16_t comid,
+			 void *data, uint8_t bcount);
+
+    /**
+     * device_id
+     *
+     * Server socket and drive number ("sim-<socket>#<num>")
+     */
+    virtual std::string device_id() const;
+
+    /**
+     * \brief Query number of drives on server
+     */
+    unsigned count();
+
+  protected:
+
+    /**
+     * \brief One request / response exchange with server
+     *
+     * @param op    Frame operation
+     * @param proto Security Protocol
+     * @param comid Protocol ComId
+     * @param data  Payload out (SEND) or in (RECV)
+     * @param len   Size of payload in bytes
+     * @return Size of payload returned
+     */
+    size_t exchange(uint8_t op, uint8_t proto, uint16_t comid,
+		    void *data, size_t len);
+
+    /* internal data */
+    int fd;
+    unsigned index;
+    std::string id;
+
+  };
+
+};
+
+#endif
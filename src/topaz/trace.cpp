@@ -0,0 +1,357 @@
+/**
+ * Topaz - Event Tracing
+ *
+ * This file implements the per-thread event rings behind the TOPAZ_TRACE_*
+ * macros, and their export as Chrome / Perfetto trace JSON.
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <topaz/alloc.h>
+#include <topaz/debug.h>
+#include <topaz/exceptions.h>
+#include <topaz/trace.h>
+#include <topaz/uid.h>
+using namespace std;
+using namespace topaz;
+
+// Events kept per thread (newest win)
+#define TRACE_RING_SIZE 16384
+
+std::atomic<bool> topaz::trace_on(false);
+
+namespace
+{
+
+  typedef chrono::steady_clock trace_clock;
+
+  // One thread's events. Only the owning thread writes; head is published
+  // after each event so readers know which slots are complete. Clearing
+  // just moves the readers' floor, so never races the writer.
+  struct trace_ring
+  {
+    uint32_t         tid;
+    atomic<uint64_t> head;
+    atomic<uint64_t> floor;
+    trace_event      events[TRACE_RING_SIZE];
+  };
+
+  // Every ring ever attached (rings outlive their threads)
+  struct trace_registry
+  {
+    mutex                          lock;
+    vector<shared_ptr<trace_ring>> rings;
+    trace_clock::time_point        epoch = trace_clock::now();
+  };
+
+  trace_registry &registry()
+  {
+    static trace_registry reg;
+    return reg;
+  }
+
+  thread_local trace_ring *local_ring = NULL;
+
+  // First event on a thread (only time the registry lock is taken)
+  trace_ring *attach_ring()
+  {
+    shared_ptr<trace_ring> ring(new trace_ring());
+    ring->tid = syscall(SYS_gettid);
+    ring->head.store(0, memory_order_relaxed);
+    ring->floor.store(0, memory_order_relaxed);
+
+    trace_registry &reg = registry();
+    lock_guard<mutex> guard(reg.lock);
+    reg.rings.push_back(ring);
+    local_ring = ring.get();
+    return local_ring;
+  }
+
+  char const *type_name(uint32_t type)
+  {
+    switch (type)
+    {
+      case TRACE_DEVICE_OPEN:   return "open";
+      case TRACE_PROBE:         return "probe";
+      case TRACE_SESSION_START: return "session_start";
+      case TRACE_SESSION_END:   return "session_end";
+      case TRACE_INVOKE:        return "invoke";
+      case TRACE_IF_SEND:       return "if_send";
+      case TRACE_IF_RECV:       return "if_recv";
+      case TRACE_POLL:          return "poll";
+      case TRACE_DECODE:        return "decode";
+      case TRACE_ALLOC:         return "alloc";
+      default:                  return "unknown";
+    }
+  }
+
+  char const *probe_name(uint64_t stage)
+  {
+    switch (stage)
+    {
+      case TRACE_PROBE_TPM:         return "probe_tpm";
+      case TRACE_PROBE_LEVEL0:      return "probe_level0";
+      case TRACE_PROBE_RESET_COMID: return "reset_comid";
+      case TRACE_PROBE_LEVEL1:      return "probe_level1";
+      default:                      return "probe";
+    }
+  }
+
+  // Event name and args as JSON members
+  void write_event(FILE *out, trace_event const &ev, pid_t pid)
+  {
+    char const *name = type_name(ev.type);
+    if (ev.type == TRACE_PROBE)
+    {
+      name = probe_name(ev.a);
+    }
+    else if (ev.type == TRACE_INVOKE)
+    {
+      name = method_name(ev.b);
+      if (name == NULL)
+      {
+	name = "invoke";
+      }
+    }
+    else if (ev.type == TRACE_ALLOC)
+    {
+      name = alloc_site_name(ev.a >> 32);
+    }
+
+    fprintf(out, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%s\",\"ts\":%.3f,",
+	    name, type_name(ev.type), ev.dur_ns ? "X" : "i", ev.start_ns / 1000.0);
+    if (ev.dur_ns)
+    {
+      fprintf(out, "\"dur\":%.3f,", ev.dur_ns / 1000.0);
+    }
+    else
+    {
+      fprintf(out, "\"s\":\"t\",");
+    }
+    fprintf(out, "\"pid\":%d,\"tid\":%u,\"args\":{", (int)pid, ev.tid);
+
+    switch (ev.type)
+    {
+      case TRACE_SESSION_START:
+	fprintf(out, "\"sp\":\"0x%" PRIx64 "\",\"authority\":\"0x%" PRIx64 "\"", ev.a, ev.b);
+	break;
+      case TRACE_SESSION_END:
+	fprintf(out, "\"tper_session\":%" PRIu64, ev.a);
+	break;
+      case TRACE_INVOKE:
+	fprintf(out, "\"object\":\"0x%" PRIx64 "\",\"method\":\"0x%" PRIx64 "\"", ev.a, ev.b);
+	break;
+      case TRACE_IF_SEND:
+      case TRACE_IF_RECV:
+	fprintf(out, "\"proto\":%" PRIu64 ",\"comid\":\"0x%" PRIx64 "\",\"bytes\":%" PRIu64,
+		ev.a >> 16, ev.a & 0xffff, ev.b);
+	break;
+      case TRACE_POLL:
+	fprintf(out, "\"iteration\":%" PRIu64, ev.a);
+	break;
+      case TRACE_DECODE:
+	fprintf(out, "\"values\":%" PRIu64 ",\"bytes\":%" PRIu64, ev.a, ev.b);
+	break;
+      case TRACE_ALLOC:
+	fprintf(out, "\"allocs\":%" PRIu64 ",\"bytes\":%" PRIu64,
+		ev.a & 0xffffffff, ev.b);
+	break;
+      default:
+	break;
+    }
+    fprintf(out, "}}");
+  }
+
+  // TOPAZ_TRACE=<file> - trace whole run, written at exit
+  char const *exit_path = NULL;
+
+  void export_at_exit()
+  {
+    try
+    {
+      trace_export(exit_path);
+    }
+    catch (topaz_exception &e)
+    {
+      fprintf(stderr, "%s: %s\n", exit_path, e.what());
+    }
+  }
+
+  struct trace_from_env
+  {
+    trace_from_env()
+    {
+      exit_path = getenv("TOPAZ_TRACE");
+      if (exit_path && *exit_path && trace_available())
+      {
+	registry();
+	trace_enable(true);
+	atexit(export_at_exit);
+      }
+    }
+  } env_init;
+
+};
+
+/**
+ * \brief Was the library built with instrumentation (TOPAZ_TRACE)?
+ */
+bool topaz::trace_available()
+{
+#ifdef TOPAZ_TRACE
+  return true;
+#else
+  return false;
+#endif
+}
+
+/**
+ * \brief Start / stop recording events
+ */
+void topaz::trace_enable(bool on)
+{
+  trace_on.store(on, memory_order_relaxed);
+}
+
+/**
+ * \brief Drop recorded events (of every thread)
+ */
+void topaz::trace_clear()
+{
+  trace_registry &reg = registry();
+  lock_guard<mutex> guard(reg.lock);
+  for (size_t i = 0; i < reg.rings.size(); i++)
+  {
+    reg.rings[i]->floor.store(reg.rings[i]->head.load(memory_order_acquire),
+			      memory_order_relaxed);
+  }
+}
+
+/**
+ * \brief Append event to calling thread's ring
+ */
+void topaz::trace_emit(trace_type type, trace_clock::time_point start,
+			 uint64_t dur_ns, uint64_t a, uint64_t b)
+{
+  trace_ring *ring = (local_ring ? local_ring : attach_ring());
+  uint64_t slot = ring->head.load(memory_order_relaxed);
+  trace_event &ev = ring->events[slot % TRACE_RING_SIZE];
+
+  int64_t since = chrono::duration_cast<chrono::nanoseconds>(start - registry().epoch).count();
+  ev.start_ns = (since > 0 ? since : 0);
+  ev.dur_ns   = dur_ns;
+  ev.a        = a;
+  ev.b        = b;
+  ev.type     = type;
+  ev.tid      = ring->tid;
+  ring->head.store(slot + 1, memory_order_release);
+}
+
+/**
+ * \brief Copy out recorded events of every thread, oldest first
+ */
+void topaz::trace_snapshot(vector<trace_event> &out)
+{
+  trace_registry &reg = registry();
+  lock_guard<mutex> guard(reg.lock);
+
+  out.clear();
+  for (size_t i = 0; i < reg.rings.size(); i++)
+  {
+    trace_ring &ring = *(reg.rings[i]);
+    uint64_t head = ring.head.load(memory_order_acquire);
+    uint64_t first = (head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0);
+    first = max(first, ring.floor.load(memory_order_relaxed));
+    size_t base = out.size();
+    for (uint64_t slot = first; slot < head; slot++)
+    {
+      out.push_back(ring.events[slot % TRACE_RING_SIZE]);
+    }
+
+    // Writer may have lapped us while copying, drop what it overwrote
+    // (and the slot it may be writing now)
+    uint64_t now = ring.head.load(memory_order_acquire);
+    if ((now > head) && (now >= first + TRACE_RING_SIZE))
+    {
+      size_t lost = min(now - TRACE_RING_SIZE + 1 - first, head - first);
+      out.erase(out.begin() + base, out.begin() + base + lost);
+    }
+  }
+
+  stable_sort(out.begin(), out.end(), [](trace_event const &x, trace_event const &y)
+	      {
+		return x.start_ns < y.start_ns;
+	      });
+}
+
+/**
+ * \brief Write recorded events as Chrome / Perfetto trace JSON
+ */
+void topaz::trace_export(char const *path)
+{
+  vector<trace_event> events;
+  vector<uint32_t> tids;
+  pid_t pid = getpid();
+
+  trace_snapshot(events);
+  FILE *out = fopen(path, "w");
+  if (out == NULL)
+  {
+    throw topaz_exception("Cannot create trace export");
+  }
+
+  fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  for (size_t i = 0; i < events.size(); i++)
+  {
+    if (find(tids.begin(), tids.end(), events[i].tid) == tids.end())
+    {
+      tids.push_back(events[i].tid);
+    }
+    write_event(out, events[i], pid);
+    fprintf(out, ",\n");
+  }
+
+  // Threads are labeled by OS thread ID
+  for (size_t i = 0; i < tids.size(); i++)
+  {
+    fprintf(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,"
+	    "\"args\":{\"name\":\"topaz %u\"}},\n", (int)pid, tids[i], tids[i]);
+  }
+  fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+	  "\"args\":{\"name\":\"topaz\"}}\n]}\n", (int)pid);
+
+  if (fclose(out) != 0)
+  {
+    throw topaz_exception("Cannot write trace export");
+  }
+  TOPAZ_DEBUG(1) printf("Wrote %zu trace events to %s\n", events.size(), path);
+}
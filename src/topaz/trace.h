@@ -0,0 +1,198 @@
+#ifndef TOPAZ_TRACE_H
+#define TOPAZ_TRACE_H
+
+/**
+ * Topaz - Event Tracing
+ *
+ * This file implements a low overhead tracer. Typed events (device open,
+ * probe stages, sessions, method calls, IF-SEND / IF-RECV, polls, decode)
+ * go into a per-thread ring buffer without locks, and can be exported as
+ * Chrome / Perfetto trace JSON to see where time goes across threads.
+ *
+ * Instrumentation points are the TOPAZ_TRACE_* macros, which compile to
+ * nothing unless the library is built with TOPAZ_TRACE defined (cmake
+ * -DTOPAZ_TRACE=ON). When compiled in, tracing is still off until enabled,
+ * either by trace_enable() or by setting TOPAZ_TRACE=<file> in the
+ * environment, in which case the trace is written to <file> at exit.
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+namespace topaz
+{
+
+  // Event types
+  enum trace_type
+  {
+    TRACE_DEVICE_OPEN,    // a: -, b: -
+    TRACE_PROBE,          // a: trace_probe stage
+    TRACE_SESSION_START,  // a: SP UID, b: authority UID (0 - anonymous)
+    TRACE_SESSION_END,    // a: TPer session ID
+    TRACE_INVOKE,         // a: object UID, b: method UID (first call of batch)
+    TRACE_IF_SEND,        // a: protocol << 16 | ComID, b: bytes
+    TRACE_IF_RECV,        // a: protocol << 16 | ComID, b: bytes
+    TRACE_POLL,           // a: poll iteration ("no data yet" so far)
+    TRACE_DECODE,         // a: values decoded, b: bytes
+    TRACE_ALLOC,          // a: alloc_site << 32 | allocations, b: bytes
+    TRACE_TYPES
+  };
+
+  // Probe stages (TRACE_PROBE)
+  enum trace_probe
+  {
+    TRACE_PROBE_TPM,
+    TRACE_PROBE_LEVEL0,
+    TRACE_PROBE_RESET_COMID,
+    TRACE_PROBE_LEVEL1
+  };
+
+  typedef struct
+  {
+    uint64_t start_ns;    // From start of trace
+    uint64_t dur_ns;      // Zero for instant events
+    uint64_t a;           // Type specific
+    uint64_t b;
+    uint32_t type;        // trace_type
+    uint32_t tid;         // OS thread ID
+  } trace_event;
+
+  // Runtime switch, only consulted by compiled in instrumentation
+  extern std::atomic<bool> trace_on;
+
+  /**
+   * \brief Was the library built with instrumentation (TOPAZ_TRACE)?
+   */
+  bool trace_available();
+
+  /**
+   * \brief Start / stop recording events
+   */
+  void trace_enable(bool on);
+
+  /**
+   * \brief Drop recorded events (of every thread)
+   */
+  void trace_clear();
+
+  /**
+   * \brief Append event to calling thread's ring (oldest dropped when full)
+   *
+   * @param type  trace_type
+   * @param start Start time
+   * @param dur_ns Duration (0 - instant)
+   * @param a, b  Type specific arguments
+   */
+  void trace_emit(trace_type type, std::chrono::steady_clock::time_point start,
+		    uint64_t dur_ns, uint64_t a, uint64_t b);
+
+  /**
+   * \brief Copy out recorded events of every thread, oldest first
+   *
+   * May run while other threads record; events overwritten mid-copy are
+   * left out.
+   *
+   * @param out Events, ordered by start time
+   */
+  void trace_snapshot(std::vector<trace_event> &out);
+
+  /**
+   * \brief Write recorded events as Chrome / Perfetto trace JSON
+   *
+   * @param path Output file
+   */
+  void trace_export(char const *path);
+
+  /**
+   * \brief Event lasting until end of scope (use TOPAZ_TRACE_SPAN)
+   */
+  class trace_span
+  {
+
+  public:
+
+    trace_span(trace_type type, uint64_t a = 0, uint64_t b = 0)
+      : type(type), a(a), b(b), live(trace_on.load(std::memory_order_relaxed))
+    {
+      if (live)
+      {
+	start = std::chrono::steady_clock::now();
+      }
+    }
+
+    ~trace_span()
+    {
+      if (live)
+      {
+	uint64_t dur = std::chrono::duration_cast<std::chrono::nanoseconds>
+	  (std::chrono::steady_clock::now() - start).count();
+	trace_emit(type, start, dur ? dur : 1, a, b);
+      }
+    }
+
+    // Argument only known part way through (eg - bytes received)
+    void set_args(uint64_t new_a, uint64_t new_b)
+    {
+      a = new_a;
+      b = new_b;
+    }
+
+  protected:
+
+    trace_type type;
+    uint64_t a, b;
+    bool live;
+    std::chrono::steady_clock::time_point start;
+
+  };
+
+};
+
+#ifdef TOPAZ_TRACE
+
+/* Event lasting until end of enclosing scope, named so args can be set later */
+#define TOPAZ_TRACE_SPAN(var, type, a, b) topaz::trace_span var((type), (a), (b))
+#define TOPAZ_TRACE_ARGS(var, a, b) var.set_args((a), (b))
+
+/* Instant event */
+#define TOPAZ_TRACE_EVENT(type, a, b)					\
+  do {									\
+    if (topaz::trace_on.load(std::memory_order_relaxed))		\
+      topaz::trace_emit((type), std::chrono::steady_clock::now(), 0, (a), (b)); \
+  } while (0)
+
+#else
+
+#define TOPAZ_TRACE_SPAN(var, type, a, b)
+#define TOPAZ_TRACE_ARGS(var, a, b)
+#define TOPAZ_TRACE_EVENT(type, a, b) do { } while (0)
+
+#endif
+
+#endif
@@ -0,0 +1,126 @@
+/**
+ * Topaz - Transport
+ *
+ * This file implements the pieces shared by all IF-SEND / IF-RECV transports.
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <unistd.h>
+#include <topaz/defs.h>
+#include <topaz/exceptions.h>
+#include <topaz/transport.h>
+using namespace topaz;
+
+namespace
+{
+  
+  // Unlock core hooks (no exceptions may cross into the core)
+  int core_if_send(void *ctx, uint8_t proto, uint16_t comid,
+		   void const *data, size_t bcount)
+  {
+    try
+    {
+      ((transport*)ctx)->if_send(proto, comid, (void*)data, bcount);
+    }
+    catch (topaz_exception &e)
+    {
+      return -1;
+    }
+    return 0;
+  }
+  
+  int core_if_recv(void *ctx, uint8_t proto, uint16_t comid,
+		   void *data, size_t bcount)
+  {
+    try
+    {
+      ((transport*)ctx)->if_recv(proto, comid, data, bcount);
+    }
+    catch (topaz_exception &e)
+    {
+      return -1;
+    }
+    return 0;
+  }
+  
+  void core_delay_ms(void *ctx, unsigned ms)
+  {
+    usleep(ms * 1000);
+  }
+  
+};
+
+/**
+ * \brief Transport Destructor
+ */
+transport::~transport()
+{
+}
+
+/**
+ * device_id
+ *
+ * Identity of the device behind this transport (none by default)
+ *
+ * @return Identity, empty if there is nothing to coordinate with
+ */
+std::string transport::device_id() const
+{
+  return std::string();
+}
+
+/**
+ * get_core_io
+ *
+ * Transport hooks for the freestanding unlock core
+ *
+ * @return Hooks, valid for the lifetime of this object
+ */
+core_io_t transport::get_core_io()
+{
+  core_io_t io;
+  io.ctx      = this;
+  io.if_send  = core_if_send;
+  io.if_recv  = core_if_recv;
+  io.delay_ms = core_delay_ms;
+  return io;
+}
+
+/**
+ * no_data_yet
+ *
+ * Is this IF-RECV result a ComPkt saying the response isn't ready?
+ *
+ * @return True if host has to poll again
+ */
+bool transport::no_data_yet(uint8_t proto, uint16_t comid,
+			    void const *data, size_t len)
+{
+  opal_com_packet_header_t const *hdr = (opal_com_packet_header_t const*)data;
+  
+  // Level 0 discovery (ComID 1) is always answered
+  return ((proto == 1) && (comid != 1) && (len >= sizeof(*hdr)) &&
+	  (hdr->length == 0) && (hdr->min_xfer == 0) && (hdr->tper_left == 0));
+}
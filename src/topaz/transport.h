@@ -0,0 +1,116 @@
+#ifndef TOPAZ_TRANSPORT_H
+#define TOPAZ_TRANSPORT_H
+
+/**
+ * Topaz - Transport
+ *
+ * This file defines the IF-SEND / IF-RECV interface used by the higher level
+ * drive APIs, so the TPer behind it may be a real drive or a simulated one.
+ *
+ * Copyright (c) 2014, T Parys
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <string>
+#include <topaz/core.h>
+
+namespace topaz
+{
+  
+  class transport
+  {
+    
+  public:
+    
+    /**
+     * \brief Transport Destructor
+     */
+    virtual ~transport();
+    
+    /**
+     * if_send (TCG Opal IF-SEND)
+     *
+     * Low level interface to send data to Drive TPM
+     *
+     * @param protocol Security Protocol
+     * @param comid    Protocol ComId
+     * @param data     Data buffer
+     * @param bcount   Size of data buffer in 512 byte blocks
+     */
+    virtual void if_send(uint8_t proto, uint16_t comid,
+			 void *data, uint8_t bcount) = 0;
+    
+    /**
+     * if_recv (TCG Opal IF-RECV)
+     *
+     * Low level interface to receive data from Drive TPM
+     *
+     * @param protocol Security Protocol
+     * @param comid    Protocol ComId
+     * @param data     Data buffer
+     * @param bcount   Size of data buffer in 512 byte blocks
+     */
+    virtual void if_recv(uint8_t proto, uint16_t comid,
+			 void *data, uint8_t bcount) = 0;
+    
+    /**
+     * device_id
+     *
+     * Identity of the device behind this transport, the same from every
+     * process and every path naming it (eg - its serial number). Used to
+     * key the cross-process device lease.
+     *
+     * @return Identity, empty if there is nothing to coordinate with
+     */
+    virtual std::string device_id() const;
+    
+    /**
+     * get_core_io
+     *
+     * Transport hooks for the freestanding unlock core, routed through
+     * this transport (exceptions are reported as hook failures).
+     *
+     * @return Hooks, valid for the lifetime of this object
+     */
+    core_io_t get_core_io();
+    
+    /**
+     * no_data_yet
+     *
+     * Is this IF-RECV result a ComPkt saying the response isn't ready?
+     *
+     * @param protocol Security Protocol
+     * @param comid    Protocol ComId
+     * @param data     Data buffer as received
+     * @param len      Size of data buffer in bytes
+     * @return True if host has to poll again
+     */
+    static bool no_data_yet(uint8_t proto, uint16_t comid,
+			    void const *data, size_t len);
+    
+  };
+  
+};
+
+#endif
@@ -1,3 +1,6 @@
+#ifndef TOPAZ_UID_H
+#define TOPAZ_UID_H
+
 /**
  * Topaz - Unique ID's
  *
@@ -28,6 +31,8 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <stdint.h>
+
 #define _UID_MAKE(high, low) (((high) * 0x100000000ULL) + (low))
 #define _UID_HIGH(uid)       ((uid) / 0x100000000ULL)
 #define _UID_LOW(uid)        ((uid) & 0x0ffffffffULL)
@@ -120,6 +125,11 @@ namespace topaz
     ACTIVATE      = _UID_MAKE(6,  0x203)  // Activate
   };
   
+  /**
+   * \brief Name of a method UID (eg - "Get"), NULL if not known
+   */
+  char const *method_name(uint64_t method_uid);
+  
   ////
   // Table Column Definitions
   //
@@ -134,3 +144,5 @@ namespace topaz
   };
   
 };
+
+#endif